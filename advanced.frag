@@ -1,12 +1,98 @@
 #version 330 core
 in vec2 TexCoord;
+#ifdef LIT_TERRAIN
+in vec3 WorldPos;
+#endif
 
 out vec4 color;
 
 uniform sampler2D ourTexture1;
+#ifdef TWO_TEXTURE_BLEND
 uniform sampler2D ourTexture2;
+#endif
+#if defined(LIT_TERRAIN) || defined(HORIZON_SHADING)
+uniform vec3 sunDirection;
+#endif
+#ifdef VIRTUAL_TEXTURE
+// Per virtual page and level: the cache slot holding the page, or its closest resident ancestor,
+// and the level of the page found
+uniform sampler2D pageTable;
+// Pages along each side of level 0, the number of levels, and the part of the virtual texture
+// the image covers
+uniform float virtualPages;
+uniform int pageLevels;
+uniform vec2 imageArea;
+// Page content, border and size, and the size of the cache, in texels
+uniform vec4 pageLayout;
+
+vec4 sampleVirtual(vec2 uv)
+{
+    vec2 virtualUv = uv * imageArea;
+    vec2 texels = virtualUv * virtualPages * pageLayout.x;
+    float lod = 0.5 * log2(max(dot(dFdx(texels), dFdx(texels)), dot(dFdy(texels), dFdy(texels))));
+    int level = clamp(int(floor(lod)), 0, pageLevels - 1);
+    int pages = int(virtualPages) >> level;
+    ivec2 page = min(ivec2(virtualUv * float(pages)), ivec2(pages - 1));
+    vec3 entry = floor(texelFetch(pageTable, page, level).rgb * 255.0 + 0.5);
+    // Position inside the page that was found, which may be coarser than the one asked for
+    vec2 inPage = fract(virtualUv * (virtualPages / exp2(entry.b)));
+    vec2 texel = entry.rg * pageLayout.z + pageLayout.y + inPage * pageLayout.x;
+    return texture(ourTexture1, texel / pageLayout.w);
+}
+#endif
+#ifdef VIEWSHED_OVERLAY
+// 1 where the observer can see the terrain, one texel per heightmap sample
+uniform sampler2D viewshedMask;
+#endif
+#ifdef HORIZON_SHADING
+// Sines of the horizon in eight azimuths 45 degrees apart from +x towards +z, four to a layer,
+// one texel per heightmap sample
+uniform sampler2DArray horizonMap;
+#endif
 
 void main()
 {
+#ifdef VIRTUAL_TEXTURE
+    color = sampleVirtual(TexCoord);
+#elif defined(TWO_TEXTURE_BLEND)
     color = mix(texture(ourTexture1, TexCoord), texture(ourTexture2, TexCoord), 0.2);
+#else
+    color = texture(ourTexture1, TexCoord);
+#endif
+    // Share of the sky and of the sun the terrain sees
+    float ambient = 1.0, sunlight = 1.0;
+#ifdef HORIZON_SHADING
+    {
+        vec2 size = vec2(textureSize(horizonMap, 0).xy);
+        vec2 uv = (vec2(TexCoord.x, 1.0 - TexCoord.y) * (size - 1.0) + 0.5) / size;
+        vec4 layer0 = texture(horizonMap, vec3(uv, 0.0)), layer1 = texture(horizonMap, vec3(uv, 1.0));
+        float horizons[8] = float[8](layer0.x, layer0.y, layer0.z, layer0.w, layer1.x, layer1.y, layer1.z, layer1.w);
+        // Every azimuth hides the sky below its horizon
+        ambient = 1.0 - dot(layer0 + layer1, vec4(0.125));
+        // The horizon towards the sun, between the two azimuths around it
+        vec3 sun = normalize(sunDirection);
+        float sector = mod(atan(sun.z, sun.x) / 0.785398163, 8.0);
+        int first = int(sector);
+        float horizon = mix(horizons[first], horizons[(first + 1) % 8], fract(sector));
+        sunlight = smoothstep(horizon - 0.02, horizon + 0.02, sun.y);
+    }
+#endif
+#ifdef LIT_TERRAIN
+    // Face normal from screen space derivatives, so the mesh needs no normal attribute
+    vec3 normal = normalize(cross(dFdx(WorldPos), dFdy(WorldPos)));
+    if (normal.y < 0.0)
+        normal = -normal;
+    float diffuse = max(dot(normal, normalize(sunDirection)), 0.0);
+    color.rgb *= 0.35 * ambient + 0.65 * diffuse * sunlight;
+#elif defined(HORIZON_SHADING)
+    color.rgb *= ambient * (0.6 + 0.4 * sunlight);
+#endif
+#ifdef VIEWSHED_OVERLAY
+    // TexCoord runs up the image, the mask's rows run down the heightmap. Texel centres sit
+    // on the samples.
+    vec2 size = vec2(textureSize(viewshedMask, 0));
+    vec2 grid = vec2(TexCoord.x, 1.0 - TexCoord.y) * (size - 1.0);
+    float seen = texture(viewshedMask, (grid + 0.5) / size).r;
+    color.rgb = mix(color.rgb * vec3(0.5, 0.35, 0.35), mix(color.rgb, vec3(0.2, 1.0, 0.3), 0.3), seen);
+#endif
 }
@@ -1,15 +1,43 @@
 #version 330 core
+#ifdef MULTI_VIEW
+#extension GL_ARB_shader_viewport_layer_array : require
+#endif
 layout (location = 0) in vec3 position;
 layout (location = 2) in vec2 texCoord;
 
 out vec2 TexCoord;
+#ifdef LIT_TERRAIN
+out vec3 WorldPos;
+#endif
 
 uniform mat4 model;
+#ifdef MULTI_VIEW
+// One draw covers every view, instance i goes through view i into viewport i.  Views outside
+//  viewMask see nothing: their vertices land behind the near plane.
+uniform mat4 views[4];
+uniform mat4 projections[4];
+uniform int viewMask;
+#else
 uniform mat4 view;
 uniform mat4 projection;
+#endif
+
+// The depth pre-pass links this stage with another fragment shader, its depth must match exactly
+invariant gl_Position;
 
 void main()
 {
+#ifdef MULTI_VIEW
+    gl_ViewportIndex = gl_InstanceID;
+    if ((viewMask & (1 << gl_InstanceID)) != 0)
+        gl_Position = projections[gl_InstanceID] * views[gl_InstanceID] * model * vec4(position, 1.0f);
+    else
+        gl_Position = vec4(0.0, 0.0, -2.0, 1.0);
+#else
     gl_Position = projection * view * model * vec4(position, 1.0f);
+#endif
     TexCoord = vec2(texCoord.x, 1.0 - texCoord.y);
+#ifdef LIT_TERRAIN
+    WorldPos = vec3(model * vec4(position, 1.0f));
+#endif
 }
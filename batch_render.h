@@ -0,0 +1,253 @@
+#pragma once
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <cstring>
+#include <cctype>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// Other Libs
+#include <SOIL.h>
+
+#include "thread_pool.h"
+#include "resource_registry.h"
+
+// Frames being read back at once; the oldest is only mapped once the GPU is well past it
+const int BATCH_READBACK_FRAMES = 3;
+
+
+// One image of a batch job: where the camera is and which file receives the frame
+struct RenderPose
+{
+    glm::vec3 Position;
+    GLfloat Yaw, Pitch, Zoom;
+    std::string Output;
+};
+
+// Reads a job file with one pose per line: x y z yaw pitch zoom output. Blank lines and lines
+// starting with # are skipped.
+inline bool LoadPoses(const char* path, std::vector<RenderPose>& poses)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::cout << "ERROR::BATCH::JOB_FILE_NOT_READ " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    for (int number = 1; std::getline(file, line); number++)
+    {
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#')
+            continue;
+        std::istringstream fields(line);
+        RenderPose pose;
+        if (!(fields >> pose.Position.x >> pose.Position.y >> pose.Position.z >> pose.Yaw >> pose.Pitch >> pose.Zoom >> pose.Output))
+        {
+            std::cout << "ERROR::BATCH::BAD_POSE " << path << ":" << number << std::endl;
+            return false;
+        }
+        poses.push_back(pose);
+    }
+    return true;
+}
+
+
+// Offscreen target of a batch job. Frames are rendered into a framebuffer object and copied into
+// a ring of pixel pack buffers, so glReadPixels returns at once. A frame is only mapped a few
+// frames later, when the GPU has finished it, and its pixels go to a pool of encoder threads.
+// The GPU keeps rendering while earlier frames are read back and written out.
+class BatchOutput
+{
+public:
+    // Frames handed to the encoders and frames written
+    size_t Submitted;
+    std::atomic<size_t> Written;
+
+    BatchOutput() : Submitted(0), Written(0), Width(0), Height(0), FBO(0), ColorBuffer(0), DepthBuffer(0), Next(0), Encoding(0)
+    {
+        for (int i = 0; i < BATCH_READBACK_FRAMES; i++)
+        {
+            this->PixelBuffers[i] = 0;
+            this->Fences[i] = 0;
+        }
+    }
+
+    // Creates the framebuffer and the readback buffers, needs a current GL 3.2+ context
+    bool Create(int width, int height, unsigned encoderThreads = 0)
+    {
+        this->Width = width;
+        this->Height = height;
+        glGenFramebuffers(1, &this->FBO);
+        glGenRenderbuffers(1, &this->ColorBuffer);
+        glGenRenderbuffers(1, &this->DepthBuffer);
+        Resources().Created(RESOURCE_FRAMEBUFFER, this->FBO, "batch framebuffer");
+        Resources().Created(RESOURCE_RENDERBUFFER, this->ColorBuffer, "batch color", size_t(width) * height * 4);
+        Resources().Created(RESOURCE_RENDERBUFFER, this->DepthBuffer, "batch depth", size_t(width) * height * 4);
+        glBindRenderbuffer(GL_RENDERBUFFER, this->ColorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGB8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, this->DepthBuffer);
+        // Float depth, so reversed-Z keeps its precision far away
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, this->FBO);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, this->ColorBuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, this->DepthBuffer);
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (!complete)
+        {
+            std::cout << "ERROR::BATCH::FRAMEBUFFER_INCOMPLETE" << std::endl;
+            return false;
+        }
+
+        glGenBuffers(BATCH_READBACK_FRAMES, this->PixelBuffers);
+        Resources().Created(RESOURCE_BUFFER, BATCH_READBACK_FRAMES, this->PixelBuffers, "batch readback", size_t(width) * height * 3);
+        for (int i = 0; i < BATCH_READBACK_FRAMES; i++)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, this->PixelBuffers[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, size_t(width) * height * 3, NULL, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        this->Encoders.reset(new ThreadPool(encoderThreads));
+        return true;
+    }
+
+    // Deletes the GL objects, must run while the context is still current
+    void Release()
+    {
+        if (this->FBO == 0)
+            return;
+        for (int i = 0; i < BATCH_READBACK_FRAMES; i++)
+            if (this->Fences[i])
+                glDeleteSync(this->Fences[i]);
+        Resources().Deleted(RESOURCE_BUFFER, BATCH_READBACK_FRAMES, this->PixelBuffers);
+        Resources().Deleted(RESOURCE_RENDERBUFFER, this->ColorBuffer);
+        Resources().Deleted(RESOURCE_RENDERBUFFER, this->DepthBuffer);
+        Resources().Deleted(RESOURCE_FRAMEBUFFER, this->FBO);
+        glDeleteBuffers(BATCH_READBACK_FRAMES, this->PixelBuffers);
+        glDeleteRenderbuffers(1, &this->ColorBuffer);
+        glDeleteRenderbuffers(1, &this->DepthBuffer);
+        glDeleteFramebuffers(1, &this->FBO);
+        this->FBO = 0;
+    }
+
+    // Makes the offscreen framebuffer the render target
+    void Bind()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, this->FBO);
+        glViewport(0, 0, this->Width, this->Height);
+    }
+
+    // Starts reading back the frame just rendered, to be saved as path
+    void Capture(const std::string& path)
+    {
+        int slot = this->Next;
+        // The slot is reused: hand its previous frame to the encoders first
+        if (this->Fences[slot])
+            this->collect(slot);
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, this->FBO);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, this->PixelBuffers[slot]);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, this->Width, this->Height, GL_RGB, GL_UNSIGNED_BYTE, (GLvoid*)0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        this->Fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        this->Paths[slot] = path;
+        this->Next = (slot + 1) % BATCH_READBACK_FRAMES;
+    }
+
+    // Collects the frames still in flight and waits until every image is written
+    void Finish()
+    {
+        for (int i = 0; i < BATCH_READBACK_FRAMES; i++)
+        {
+            int slot = (this->Next + i) % BATCH_READBACK_FRAMES;
+            if (this->Fences[slot])
+                this->collect(slot);
+        }
+        while (this->Encoding.load() > 0)
+            std::this_thread::yield();
+    }
+
+private:
+    int Width, Height;
+    GLuint FBO, ColorBuffer, DepthBuffer;
+    GLuint PixelBuffers[BATCH_READBACK_FRAMES];
+    GLsync Fences[BATCH_READBACK_FRAMES];
+    std::string Paths[BATCH_READBACK_FRAMES];
+    int Next;
+    // Frames queued or being written. Declared before the pool, whose workers touch it until they exit.
+    std::atomic<int> Encoding;
+    std::unique_ptr<ThreadPool> Encoders;
+
+    void collect(int slot)
+    {
+        // Keep the number of frames waiting for an encoder bounded, the encoders set the pace
+        int limit = 2 * int(this->Encoders->Size()) + 2;
+        while (this->Encoding.load() >= limit)
+            std::this_thread::yield();
+
+        glClientWaitSync(this->Fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+        glDeleteSync(this->Fences[slot]);
+        this->Fences[slot] = 0;
+
+        // GL rows start at the bottom, SOIL wants the top row first
+        size_t rowBytes = size_t(this->Width) * 3;
+        auto pixels = std::make_shared<std::vector<unsigned char>>(rowBytes * this->Height);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, this->PixelBuffers[slot]);
+        const unsigned char* mapped = static_cast<const unsigned char*>(
+            glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, rowBytes * this->Height, GL_MAP_READ_BIT));
+        if (mapped)
+        {
+            for (int y = 0; y < this->Height; y++)
+                memcpy(&(*pixels)[rowBytes * y], mapped + rowBytes * (this->Height - 1 - y), rowBytes);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        if (!mapped)
+        {
+            std::cout << "ERROR::BATCH::READBACK_FAILED " << this->Paths[slot] << std::endl;
+            return;
+        }
+
+        std::string path = this->Paths[slot];
+        int width = this->Width, height = this->Height;
+        this->Encoding++;
+        this->Submitted++;
+        this->Encoders->Submit([this, path, pixels, width, height]
+        {
+            saveImage(path, width, height, *pixels);
+            this->Written++;
+            this->Encoding--;
+        });
+    }
+
+    // SOIL writes BMP, TGA and DDS. Other extensions, such as png or jpg, are written as BMP.
+    static void saveImage(std::string path, int width, int height, const std::vector<unsigned char>& pixels)
+    {
+        size_t dot = path.find_last_of('.');
+        std::string extension = dot == std::string::npos ? "" : path.substr(dot + 1);
+        for (char& c : extension)
+            c = char(tolower(c));
+        int type = SOIL_SAVE_TYPE_BMP;
+        if (extension == "tga")
+            type = SOIL_SAVE_TYPE_TGA;
+        else if (extension == "dds")
+            type = SOIL_SAVE_TYPE_DDS;
+        else if (extension != "bmp")
+            path = (dot == std::string::npos ? path : path.substr(0, dot)) + ".bmp";
+        if (!SOIL_save_image(path.c_str(), type, width, height, 3, pixels.data()))
+            std::cout << "ERROR::BATCH::SAVE_FAILED " << path << std::endl;
+    }
+};
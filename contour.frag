@@ -0,0 +1,12 @@
+#version 330 core
+
+// Contour lines over the terrain, all in one colour
+
+out vec4 color;
+
+uniform vec3 lineColor;
+
+void main()
+{
+    color = vec4(lineColor, 1.0);
+}
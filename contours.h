@@ -0,0 +1,503 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <utility>
+#include <cmath>
+#include <cstdint>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "heightmap.h"
+#include "thread_pool.h"
+#include "resource_registry.h"
+
+// Cells along the side of a tile extracted as one job
+const int CONTOUR_TILE = 64;
+// Lines are lifted this far in model space, so the triangles between their points do not hide them
+const GLfloat CONTOUR_LIFT = 0.002f;
+// Closest spacing of the lines, in normalised height
+const GLfloat CONTOUR_MIN_INTERVAL = 1.0f / 4096.0f;
+// Shortest time between two extractions in the viewer while the heights keep changing
+const GLfloat CONTOUR_REFRESH_SECONDS = 0.25f;
+
+
+// Contour lines of a heightmap: the lines where the height crosses every multiple of Interval.
+//
+// Marching squares runs over CONTOUR_TILE square tiles of cells in parallel. In a cell, a line
+// crosses every edge whose two samples lie on different sides of a level, at the interpolated
+// point, and joins the crossings in pairs; where all four edges are crossed the centre of the
+// cell decides which pairs. A crossing is named by its grid edge and level, which is how the
+// two cells sharing it find each other. Each tile joins its segments into chains that end on the
+// tile's border, and the chains of all tiles are then joined across the borders into polylines.
+//
+// The heights are a copy, changed with Update. Only the tiles that touch changed samples are
+// extracted again, the joining across tiles is redone every time. The polylines are one vertex
+// buffer drawn with a single multi draw.
+class Contours
+{
+public:
+    int Width, Height;
+    // Height between neighbouring lines, 0 until SetInterval
+    GLfloat Interval;
+    // Polylines of the last Extract, in the model space of the mesh: their points back to back,
+    // and the first point and the point count of each. Closed lines repeat their first point.
+    std::vector<glm::vec3> Vertices;
+    std::vector<GLint> First;
+    std::vector<GLsizei> Count;
+    // Time taken by the last Extract, and the tiles it marched
+    double Milliseconds;
+    int TilesExtracted;
+
+    Contours() : Width(0), Height(0), Interval(0.0f), Milliseconds(0.0), TilesExtracted(0), TilesX(0), TilesY(0), VAO(0), VBO(0) {}
+
+    bool Loaded() const
+    {
+        return this->Width > 0;
+    }
+
+    void Load(const Heightmap& heightmap)
+    {
+        this->Width = heightmap.Width;
+        this->Height = heightmap.Height;
+        heightmap.Decode(this->Heights);
+        // Tiles of cells, a cell lying between four samples
+        this->TilesX = (this->Width - 2) / CONTOUR_TILE + 1;
+        this->TilesY = (this->Height - 2) / CONTOUR_TILE + 1;
+        this->Tiles.assign(size_t(this->TilesX) * this->TilesY, Tile());
+        this->Dirty.assign(this->Tiles.size(), 1);
+        Resources().CpuAllocation(this, "contour heights", this->Heights.size() * sizeof(float));
+    }
+
+    // Frees the heights, lines and buffers
+    void Clear()
+    {
+        std::vector<float>().swap(this->Heights);
+        std::vector<Tile>().swap(this->Tiles);
+        std::vector<uint8_t>().swap(this->Dirty);
+        std::vector<glm::vec3>().swap(this->Vertices);
+        this->First.clear();
+        this->Count.clear();
+        this->Width = this->Height = this->TilesX = this->TilesY = 0;
+        Resources().CpuAllocation(this, "contour heights", 0);
+        this->Release();
+    }
+
+    // A new spacing of the lines, every tile is extracted again
+    void SetInterval(GLfloat interval)
+    {
+        interval = std::max(interval, CONTOUR_MIN_INTERVAL);
+        if (interval == this->Interval)
+            return;
+        this->Interval = interval;
+        std::fill(this->Dirty.begin(), this->Dirty.end(), 1);
+    }
+
+    // Copies the samples of rows [row0,row1) and columns [col0,col1) from heightAt(row, col)
+    // and marks the tiles whose cells use them
+    template <typename HeightAt>
+    void Update(int row0, int col0, int row1, int col1, HeightAt heightAt)
+    {
+        for (int row = row0; row < row1; row++)
+            for (int col = col0; col < col1; col++)
+                this->Heights[size_t(row) * this->Width + col] = heightAt(row, col);
+        // A sample is a corner of the cells above and to the left of it too
+        int ty0 = std::max(row0 - 1, 0) / CONTOUR_TILE, ty1 = std::min(row1 - 1, this->Height - 2) / CONTOUR_TILE;
+        int tx0 = std::max(col0 - 1, 0) / CONTOUR_TILE, tx1 = std::min(col1 - 1, this->Width - 2) / CONTOUR_TILE;
+        for (int ty = ty0; ty <= ty1; ty++)
+            for (int tx = tx0; tx <= tx1; tx++)
+                this->Dirty[ty * this->TilesX + tx] = 1;
+    }
+
+    // Marches the changed tiles on the pool and joins the lines again. False when nothing had
+    // changed, the lines are then as they were.
+    bool Extract(ThreadPool& pool)
+    {
+        if (this->Interval <= 0.0f)
+            return false;
+        std::vector<int> dirty;
+        for (int t = 0; t < int(this->Dirty.size()); t++)
+            if (this->Dirty[t])
+                dirty.push_back(t);
+        if (dirty.empty())
+            return false;
+        auto start = std::chrono::steady_clock::now();
+        pool.ParallelFor(int(dirty.size()), [&](int i) { this->extractTile(dirty[i]); });
+        for (int t : dirty)
+            this->Dirty[t] = 0;
+        this->join();
+        std::chrono::duration<double, std::milli> milliseconds = std::chrono::steady_clock::now() - start;
+        this->Milliseconds = milliseconds.count();
+        this->TilesExtracted = int(dirty.size());
+        return true;
+    }
+
+    // Uploads the polylines into the vertex buffer
+    void Upload()
+    {
+        if (!this->VAO)
+        {
+            glGenVertexArrays(1, &this->VAO);
+            glGenBuffers(1, &this->VBO);
+            Resources().Created(RESOURCE_VERTEX_ARRAY, this->VAO, "contours");
+            Resources().Created(RESOURCE_BUFFER, this->VBO, "contour lines");
+            glBindVertexArray(this->VAO);
+            glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (GLvoid*)0);
+            glEnableVertexAttribArray(0);
+            glBindVertexArray(0);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+        glBufferData(GL_ARRAY_BUFFER, this->Vertices.size() * sizeof(glm::vec3), this->Vertices.data(), GL_DYNAMIC_DRAW);
+        Resources().Resized(RESOURCE_BUFFER, this->VBO, this->Vertices.size() * sizeof(glm::vec3));
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Draws the polylines as line strips, with the program and its matrices already set. They
+    // must have been uploaded since the last Extract.
+    void Draw() const
+    {
+        if (!this->VAO || this->First.empty())
+            return;
+        glBindVertexArray(this->VAO);
+        glMultiDrawArrays(GL_LINE_STRIP, this->First.data(), this->Count.data(), GLsizei(this->First.size()));
+        glBindVertexArray(0);
+    }
+
+    // Deletes the buffers, must run while the context is still current
+    void Release()
+    {
+        if (this->VAO)
+        {
+            Resources().Deleted(RESOURCE_VERTEX_ARRAY, this->VAO);
+            Resources().Deleted(RESOURCE_BUFFER, this->VBO);
+            glDeleteVertexArrays(1, &this->VAO);
+            glDeleteBuffers(1, &this->VBO);
+        }
+        this->VAO = this->VBO = 0;
+    }
+
+private:
+    // A run of joined segments inside a tile. Open chains end on the tile's border, at the
+    // crossings named Start and End.
+    struct Chain
+    {
+        uint32_t FirstPoint, Points;
+        uint64_t Start, End;
+        bool Closed;
+    };
+
+    struct Tile
+    {
+        std::vector<glm::vec3> Points;
+        std::vector<Chain> Chains;
+        // Crossings the open chains end on, sorted, with chain * 2 + 1 for an End
+        std::vector<std::pair<uint64_t, uint32_t>> Ends;
+    };
+
+    // One piece of line in a cell, between crossings of two of its sides: 0 top, 1 right,
+    // 2 bottom, 3 left
+    struct Segment
+    {
+        uint64_t Key[2];
+        glm::vec3 Point[2];
+        uint8_t Side[2];
+        uint16_t Row, Col;
+    };
+
+    std::vector<float> Heights;
+    int TilesX, TilesY;
+    std::vector<Tile> Tiles;
+    std::vector<uint8_t> Dirty;
+    GLuint VAO, VBO;
+
+    // A crossing: the grid edge, 2 (row * Width + col) for the one going right from a sample
+    // and one more for the one going down, and the level
+    uint64_t key(int row, int col, int down, int level) const
+    {
+        return ((uint64_t(row) * this->Width + col) * 2 + down) << 16 | uint64_t(level);
+    }
+
+    // Highest level at or below a height, the product rounds by at most one level either way.
+    // Levels are compared as float(n) * Interval everywhere, so neighbouring tiles agree on which
+    // side of a level a shared sample lies.
+    int levelOf(float height, float inverse) const
+    {
+        int n = int(height * inverse);
+        if (float(n + 1) * this->Interval <= height)
+            n++;
+        else if (n > 0 && float(n) * this->Interval > height)
+            n--;
+        return n;
+    }
+
+    void extractTile(int t)
+    {
+        int ty = t / this->TilesX, tx = t % this->TilesX;
+        int row0 = ty * CONTOUR_TILE, row1 = std::min(row0 + CONTOUR_TILE, this->Height - 1);
+        int col0 = tx * CONTOUR_TILE, col1 = std::min(col0 + CONTOUR_TILE, this->Width - 1);
+        int rows = row1 - row0, cols = col1 - col0;
+        float inverse = 1.0f / this->Interval;
+        float stepX = 2.0f / float(this->Width - 1), stepZ = 2.0f / float(this->Height - 1);
+
+        // Level of every sample of the tile's cells: a cell has lines for the levels above its
+        // lowest corner's up to its highest corner's, and most cells have none
+        int samples = cols + 1;
+        std::vector<int> levels(size_t(rows + 1) * samples);
+        for (int r = 0; r <= rows; r++)
+        {
+            const float* row = &this->Heights[size_t(row0 + r) * this->Width + col0];
+            for (int c = 0; c <= cols; c++)
+                levels[r * samples + c] = this->levelOf(row[c], inverse);
+        }
+
+        // March the cells, their segments in cell order
+        std::vector<Segment> segments;
+        std::vector<uint32_t> cellStart(size_t(rows) * cols + 1);
+        for (int r = row0; r < row1; r++)
+        {
+            const float* top = &this->Heights[size_t(r) * this->Width];
+            const float* bottom = top + this->Width;
+            const int* levelsTop = &levels[(r - row0) * samples - col0];
+            const int* levelsBottom = levelsTop + samples;
+            for (int c = col0; c < col1; c++)
+            {
+                cellStart[size_t(r - row0) * cols + c - col0] = uint32_t(segments.size());
+                // Corners clockwise from the top left
+                int l[4] = { levelsTop[c], levelsTop[c + 1], levelsBottom[c + 1], levelsBottom[c] };
+                if (l[0] == l[1] && l[0] == l[2] && l[0] == l[3])
+                    continue;
+                int first = std::min(std::min(l[0], l[1]), std::min(l[2], l[3])) + 1;
+                int last = std::max(std::max(l[0], l[1]), std::max(l[2], l[3]));
+                float h[4] = { top[c], top[c + 1], bottom[c + 1], bottom[c] };
+                for (int n = first; n <= last; n++)
+                {
+                    float level = float(n) * this->Interval;
+                    int above = (l[0] >= n) | (l[1] >= n) << 1 | (l[2] >= n) << 2 | (l[3] >= n) << 3;
+                    // Crossing of a side, interpolated from its top or left sample
+                    glm::vec3 point[4];
+                    uint64_t keys[4];
+                    auto cross = [&](int side, int a, int b, int row, int col, int down)
+                    {
+                        float along = (level - h[a]) / (h[b] - h[a]);
+                        float x = float(col) + (down ? 0.0f : along), z = float(row) + (down ? along : 0.0f);
+                        point[side] = glm::vec3(x * stepX - 1.0f, -level / 2.0f - 0.5f + CONTOUR_LIFT, z * stepZ - 1.0f);
+                        keys[side] = this->key(row, col, down, n);
+                    };
+                    int sides[4], crossed = 0;
+                    if ((above ^ above >> 1) & 1)
+                    {
+                        cross(0, 0, 1, r, c, 0);
+                        sides[crossed++] = 0;
+                    }
+                    if ((above >> 1 ^ above >> 2) & 1)
+                    {
+                        cross(1, 1, 2, r, c + 1, 1);
+                        sides[crossed++] = 1;
+                    }
+                    if ((above >> 3 ^ above >> 2) & 1)
+                    {
+                        cross(2, 3, 2, r + 1, c, 0);
+                        sides[crossed++] = 2;
+                    }
+                    if ((above ^ above >> 3) & 1)
+                    {
+                        cross(3, 0, 3, r, c, 1);
+                        sides[crossed++] = 3;
+                    }
+                    auto add = [&](int a, int b)
+                    {
+                        Segment segment = { { keys[a], keys[b] }, { point[a], point[b] }, { uint8_t(a), uint8_t(b) },
+                            uint16_t(r - row0), uint16_t(c - col0) };
+                        segments.push_back(segment);
+                    };
+                    if (crossed == 2)
+                        add(sides[0], sides[1]);
+                    else
+                    {
+                        // Saddle: the line keeps the corners on the centre's side joined
+                        bool centreAbove = (h[0] + h[1] + h[2] + h[3]) * 0.25f >= level;
+                        if ((above == 5) == centreAbove)
+                        {
+                            add(0, 1);
+                            add(2, 3);
+                        }
+                        else
+                        {
+                            add(0, 3);
+                            add(1, 2);
+                        }
+                    }
+                }
+            }
+        }
+        cellStart.back() = uint32_t(segments.size());
+
+        // The segment in the cell across a side that shares the crossing, false on the border
+        auto partner = [&](const Segment& segment, int end, int& next, int& nextEnd)
+        {
+            static const int dr[4] = { -1, 0, 1, 0 }, dc[4] = { 0, 1, 0, -1 };
+            int row = segment.Row + dr[segment.Side[end]], col = segment.Col + dc[segment.Side[end]];
+            if (row < 0 || row >= rows || col < 0 || col >= cols)
+                return false;
+            size_t cell = size_t(row) * cols + col;
+            for (uint32_t s = cellStart[cell]; s < cellStart[cell + 1]; s++)
+            {
+                for (int e = 0; e < 2; e++)
+                {
+                    if (segments[s].Key[e] == segment.Key[end])
+                    {
+                        next = int(s);
+                        nextEnd = e;
+                        return true;
+                    }
+                }
+            }
+            return false;
+        };
+
+        // Chains from one border crossing to another, then the loops left over
+        Tile& tile = this->Tiles[t];
+        tile.Points.clear();
+        tile.Chains.clear();
+        tile.Ends.clear();
+        std::vector<uint8_t> used(segments.size(), 0);
+        auto walk = [&](int s, int end, bool closed)
+        {
+            Chain chain;
+            chain.FirstPoint = uint32_t(tile.Points.size());
+            chain.Start = segments[s].Key[end];
+            chain.Closed = closed;
+            tile.Points.push_back(segments[s].Point[end]);
+            for (;;)
+            {
+                used[s] = 1;
+                int exit = 1 - end;
+                tile.Points.push_back(segments[s].Point[exit]);
+                chain.End = segments[s].Key[exit];
+                int next, nextEnd;
+                if (!partner(segments[s], exit, next, nextEnd) || used[next])
+                    break;
+                s = next;
+                end = nextEnd;
+            }
+            chain.Points = uint32_t(tile.Points.size()) - chain.FirstPoint;
+            if (!closed)
+            {
+                uint32_t index = uint32_t(tile.Chains.size());
+                tile.Ends.push_back(std::make_pair(chain.Start, index * 2));
+                tile.Ends.push_back(std::make_pair(chain.End, index * 2 + 1));
+            }
+            tile.Chains.push_back(chain);
+        };
+        for (int s = 0; s < int(segments.size()); s++)
+        {
+            int next, nextEnd;
+            for (int end = 0; end < 2 && !used[s]; end++)
+                if (!partner(segments[s], end, next, nextEnd))
+                    walk(s, end, false);
+        }
+        for (int s = 0; s < int(segments.size()); s++)
+            if (!used[s])
+                walk(s, 0, true);
+        std::sort(tile.Ends.begin(), tile.Ends.end());
+    }
+
+    // The chain end of the tile across a tile border that shares a crossing, false on the map's border
+    bool across(int t, uint64_t crossing, int& other, uint32_t& chainEnd) const
+    {
+        uint64_t edge = crossing >> 16;
+        int down = int(edge & 1);
+        int row = int((edge >> 1) / this->Width), col = int((edge >> 1) % this->Width);
+        int ty = t / this->TilesX, tx = t % this->TilesX;
+        if (down)
+        {
+            // Between the cells left and right of the edge
+            if (col == 0 || col == this->Width - 1)
+                return false;
+            int left = (col - 1) / CONTOUR_TILE, right = col / CONTOUR_TILE;
+            other = ty * this->TilesX + (tx == left ? right : left);
+        }
+        else
+        {
+            if (row == 0 || row == this->Height - 1)
+                return false;
+            int up = (row - 1) / CONTOUR_TILE, below = row / CONTOUR_TILE;
+            other = (ty == up ? below : up) * this->TilesX + tx;
+        }
+        const std::vector<std::pair<uint64_t, uint32_t>>& ends = this->Tiles[other].Ends;
+        auto found = std::lower_bound(ends.begin(), ends.end(), std::make_pair(crossing, uint32_t(0)));
+        if (found == ends.end() || found->first != crossing)
+            return false;
+        chainEnd = found->second;
+        return true;
+    }
+
+    // Joins the chains of all tiles into polylines
+    void join()
+    {
+        this->Vertices.clear();
+        this->First.clear();
+        this->Count.clear();
+        std::vector<size_t> base(this->Tiles.size() + 1, 0);
+        for (size_t t = 0; t < this->Tiles.size(); t++)
+            base[t + 1] = base[t] + this->Tiles[t].Chains.size();
+        std::vector<uint8_t> used(base.back(), 0);
+
+        // Follows chains from one end of chain c of tile t until a line ends or comes back round
+        auto follow = [&](int t, uint32_t c, int end)
+        {
+            this->First.push_back(GLint(this->Vertices.size()));
+            bool joined = false;
+            for (;;)
+            {
+                used[base[t] + c] = 1;
+                const Tile& tile = this->Tiles[t];
+                const Chain& chain = tile.Chains[c];
+                const glm::vec3* points = &tile.Points[chain.FirstPoint];
+                // The first point of a joined chain is the last one of the chain before
+                if (end == 0)
+                    this->Vertices.insert(this->Vertices.end(), points + (joined ? 1 : 0), points + chain.Points);
+                else
+                    for (int p = int(chain.Points) - (joined ? 2 : 1); p >= 0; p--)
+                        this->Vertices.push_back(points[p]);
+                int other;
+                uint32_t chainEnd;
+                if (chain.Closed || !this->across(t, end == 0 ? chain.End : chain.Start, other, chainEnd) || used[base[other] + chainEnd / 2])
+                    break;
+                t = other;
+                c = chainEnd / 2;
+                end = chainEnd & 1;
+                joined = true;
+            }
+            this->Count.push_back(GLsizei(this->Vertices.size()) - this->First.back());
+        };
+
+        // Loops inside a tile and lines with an end on the map's border first, then the loops
+        // through several tiles
+        for (int t = 0; t < int(this->Tiles.size()); t++)
+        {
+            const Tile& tile = this->Tiles[t];
+            for (uint32_t c = 0; c < tile.Chains.size(); c++)
+            {
+                const Chain& chain = tile.Chains[c];
+                int other;
+                uint32_t chainEnd;
+                if (used[base[t] + c])
+                    continue;
+                if (chain.Closed || !this->across(t, chain.Start, other, chainEnd))
+                    follow(t, c, 0);
+                else if (!this->across(t, chain.End, other, chainEnd))
+                    follow(t, c, 1);
+            }
+        }
+        for (int t = 0; t < int(this->Tiles.size()); t++)
+            for (uint32_t c = 0; c < this->Tiles[t].Chains.size(); c++)
+                if (!used[base[t] + c])
+                    follow(t, c, 0);
+    }
+};
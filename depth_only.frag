@@ -0,0 +1,7 @@
+#version 330 core
+
+// Depth pre-pass: advanced.vs places the vertices, only the depth buffer is written
+
+void main()
+{
+}
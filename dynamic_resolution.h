@@ -0,0 +1,228 @@
+#pragma once
+
+// Std. Includes
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+// GL Includes
+#include <GL/glew.h>
+
+#include "shader_cache.h"
+#include "resource_registry.h"
+
+// Render scale limits, as a fraction of the window size on each axis
+const GLfloat DYNAMIC_RESOLUTION_MIN_SCALE = 0.5f;
+const GLfloat DYNAMIC_RESOLUTION_MAX_SCALE = 1.0f;
+// Sharpening applied at the lowest scale, fading out towards full resolution
+const GLfloat DYNAMIC_RESOLUTION_SHARPNESS = 0.6f;
+// GPU timings in flight, results are read a few frames late so the CPU never waits for them
+const int DYNAMIC_RESOLUTION_QUERIES = 4;
+
+
+// Renders the scene into an offscreen framebuffer sized to a fraction of the window, then scales
+// it up to the window with a bilinear pass that sharpens a little. The fraction follows the GPU
+// time of the scene, measured with timer queries: it drops quickly when frames go over the target
+// and climbs back slowly once they fit again.
+//
+// The framebuffer is allocated at the full window size and only a part of it is drawn, so
+// changing the scale never reallocates anything. Only a window resize does.
+class DynamicResolution
+{
+public:
+    // GPU time the scene should fit in, in milliseconds
+    GLfloat TargetMilliseconds;
+    // Current scale, and the size of the part of the framebuffer drawn this frame
+    GLfloat Scale;
+    int RenderWidth, RenderHeight;
+
+    DynamicResolution() : TargetMilliseconds(1000.0f / 60.0f), Scale(DYNAMIC_RESOLUTION_MAX_SCALE), RenderWidth(0), RenderHeight(0),
+                          FBO(0), ColorTexture(0), DepthBuffer(0), VAO(0), Width(0), Height(0), Next(0),
+                          Shaders(NULL), ShaderGeneration(0), Program(0), Measured(0), Hits(0), ScaleSum(0.0f)
+    {
+        for (int i = 0; i < DYNAMIC_RESOLUTION_QUERIES; i++)
+        {
+            this->Queries[i] = 0;
+            this->QueryScales[i] = 0.0f;
+        }
+    }
+
+    // Creates the queries and the upscale program, needs a current GL 3.3 context
+    void Create(ShaderCache& shaderCache, GLfloat targetMilliseconds)
+    {
+        this->TargetMilliseconds = targetMilliseconds;
+        this->Shaders = &shaderCache;
+        this->ShaderGeneration = shaderCache.Generation;
+        this->Program = shaderCache.Program("shaders/upscale.vs", "shaders/upscale.frag");
+        glGenQueries(DYNAMIC_RESOLUTION_QUERIES, this->Queries);
+        // The full-screen triangle comes from gl_VertexID, but core contexts still need a VAO
+        glGenVertexArrays(1, &this->VAO);
+        Resources().Created(RESOURCE_QUERY, DYNAMIC_RESOLUTION_QUERIES, this->Queries, "dynamic resolution timers");
+        Resources().Created(RESOURCE_VERTEX_ARRAY, this->VAO, "upscale");
+    }
+
+    // Deletes the GL objects, must run while the context is still current
+    void Release()
+    {
+        if (this->VAO == 0)
+            return;
+        this->releaseTarget();
+        Resources().Deleted(RESOURCE_QUERY, DYNAMIC_RESOLUTION_QUERIES, this->Queries);
+        Resources().Deleted(RESOURCE_VERTEX_ARRAY, this->VAO);
+        glDeleteQueries(DYNAMIC_RESOLUTION_QUERIES, this->Queries);
+        glDeleteVertexArrays(1, &this->VAO);
+        this->VAO = 0;
+    }
+
+    // Starts a frame for a window of the given framebuffer size: binds the offscreen framebuffer,
+    // sets the viewport to the scaled size and starts timing the scene
+    void Begin(int windowWidth, int windowHeight)
+    {
+        this->collect();
+        if (windowWidth != this->Width || windowHeight != this->Height)
+            this->resize(windowWidth, windowHeight);
+
+        this->RenderWidth = std::max(1, int(std::lround(windowWidth * this->Scale)));
+        this->RenderHeight = std::max(1, int(std::lround(windowHeight * this->Scale)));
+        glBindFramebuffer(GL_FRAMEBUFFER, this->FBO);
+        glViewport(0, 0, this->RenderWidth, this->RenderHeight);
+
+        int slot = this->Next;
+        this->QueryScales[slot] = this->Scale;
+        glBeginQuery(GL_TIME_ELAPSED, this->Queries[slot]);
+    }
+
+    // Stops timing and draws the scene scaled up into the default framebuffer
+    void Present()
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        this->Next = (this->Next + 1) % DYNAMIC_RESOLUTION_QUERIES;
+
+        // Pick up a program rebuilt by a shader reload
+        if (this->Shaders->Generation != this->ShaderGeneration)
+        {
+            this->ShaderGeneration = this->Shaders->Generation;
+            this->Program = this->Shaders->Program("shaders/upscale.vs", "shaders/upscale.frag");
+        }
+
+        GLfloat range = DYNAMIC_RESOLUTION_MAX_SCALE - DYNAMIC_RESOLUTION_MIN_SCALE;
+        GLfloat sharpness = DYNAMIC_RESOLUTION_SHARPNESS * (DYNAMIC_RESOLUTION_MAX_SCALE - this->Scale) / range;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, this->Width, this->Height);
+        glDisable(GL_DEPTH_TEST);
+        glUseProgram(this->Program);
+        glUniform1i(glGetUniformLocation(this->Program, "scene"), 0);
+        glUniform2f(glGetUniformLocation(this->Program, "renderedArea"),
+                    GLfloat(this->RenderWidth) / this->Width, GLfloat(this->RenderHeight) / this->Height);
+        glUniform1f(glGetUniformLocation(this->Program, "sharpness"), sharpness);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, this->ColorTexture);
+        glBindVertexArray(this->VAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    // Statistics since the last reset: the average scale and the share of frames within the target
+    GLfloat AverageScale() const
+    {
+        return this->Measured ? this->ScaleSum / this->Measured : this->Scale;
+    }
+
+    GLfloat BudgetHitRate() const
+    {
+        return this->Measured ? GLfloat(this->Hits) / this->Measured : 1.0f;
+    }
+
+    void ResetStatistics()
+    {
+        this->Measured = 0;
+        this->Hits = 0;
+        this->ScaleSum = 0.0f;
+    }
+
+private:
+    GLuint FBO, ColorTexture, DepthBuffer, VAO;
+    int Width, Height;
+    GLuint Queries[DYNAMIC_RESOLUTION_QUERIES];
+    // Scale each query was measured at
+    GLfloat QueryScales[DYNAMIC_RESOLUTION_QUERIES];
+    int Next;
+    ShaderCache* Shaders;
+    GLuint ShaderGeneration;
+    GLuint Program;
+    GLuint Measured, Hits;
+    GLfloat ScaleSum;
+
+    void releaseTarget()
+    {
+        if (this->FBO == 0)
+            return;
+        Resources().Deleted(RESOURCE_FRAMEBUFFER, this->FBO);
+        Resources().Deleted(RESOURCE_TEXTURE, this->ColorTexture);
+        Resources().Deleted(RESOURCE_RENDERBUFFER, this->DepthBuffer);
+        glDeleteFramebuffers(1, &this->FBO);
+        glDeleteTextures(1, &this->ColorTexture);
+        glDeleteRenderbuffers(1, &this->DepthBuffer);
+        this->FBO = 0;
+    }
+
+    void resize(int width, int height)
+    {
+        this->releaseTarget();
+        this->Width = width;
+        this->Height = height;
+        glGenFramebuffers(1, &this->FBO);
+        glGenTextures(1, &this->ColorTexture);
+        glGenRenderbuffers(1, &this->DepthBuffer);
+        Resources().Created(RESOURCE_FRAMEBUFFER, this->FBO, "scaled scene");
+        Resources().Created(RESOURCE_TEXTURE, this->ColorTexture, "scaled scene color", TextureBytes(width, height, 4));
+        Resources().Created(RESOURCE_RENDERBUFFER, this->DepthBuffer, "scaled scene depth", size_t(width) * height * 4);
+        glBindTexture(GL_TEXTURE_2D, this->ColorTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindRenderbuffer(GL_RENDERBUFFER, this->DepthBuffer);
+        // Float depth, so reversed-Z keeps its precision far away
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, this->FBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->ColorTexture, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, this->DepthBuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::DYNAMIC_RESOLUTION::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Reads the timing of the frame about to reuse its query, if the GPU has finished it, and
+    // steers the scale towards the target
+    void collect()
+    {
+        int slot = this->Next;
+        if (this->QueryScales[slot] == 0.0f)
+            return;
+        GLint available = 0;
+        glGetQueryObjectiv(this->Queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+        GLfloat measuredScale = this->QueryScales[slot];
+        this->QueryScales[slot] = 0.0f;
+        if (!available)
+            return;
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(this->Queries[slot], GL_QUERY_RESULT, &nanoseconds);
+        GLfloat milliseconds = GLfloat(nanoseconds) * 1e-6f;
+
+        this->Measured++;
+        if (milliseconds <= this->TargetMilliseconds)
+            this->Hits++;
+        this->ScaleSum += measuredScale;
+
+        // Fill cost follows the pixel count, the square of the scale. Aim a little below the
+        // target so small spikes still fit.
+        GLfloat desired = measuredScale * std::sqrt(0.9f * this->TargetMilliseconds / std::max(milliseconds, 0.01f));
+        desired = std::min(std::max(desired, DYNAMIC_RESOLUTION_MIN_SCALE), DYNAMIC_RESOLUTION_MAX_SCALE);
+        this->Scale += (desired - this->Scale) * (desired < this->Scale ? 0.5f : 0.05f);
+    }
+};
@@ -0,0 +1,531 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define EROSION_SSE 1
+#endif
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "heightmap.h"
+#include "terrain.h"
+#include "thread_pool.h"
+#include "resource_registry.h"
+
+// Cells along the side of a tile handed to one worker, the same as a terrain chunk so the tiles
+// that changed map straight onto the chunks whose bounds need widening
+const int EROSION_TILE = TERRAIN_CHUNK_SIZE;
+// Iterations the viewer runs every frame while eroding
+const int EROSION_ITERATIONS_PER_FRAME = 2;
+// Change of a normalised height a tile has to gather before its vertices are uploaded again
+const GLfloat EROSION_UPLOAD_THRESHOLD = 1.0f / 4096.0f;
+
+// Rates of the simulation, per unit of time. Heights, water and sediment are in cells.
+struct ErosionParameters
+{
+    GLfloat TimeStep;
+    GLfloat Gravity;
+    GLfloat Rain;           // water added to every cell
+    GLfloat Evaporation;    // fraction of the water lost
+    GLfloat Capacity;       // sediment a unit of flow over a unit of slope can carry
+    GLfloat MinSlope;       // slope used for the capacity of flat ground
+    GLfloat StreamDepth;    // water depth below which the capacity falls off
+    GLfloat Dissolve;       // fraction of the missing capacity taken from the ground
+    GLfloat Deposit;        // fraction of the excess sediment dropped
+    GLfloat Talus;          // height difference to a neighbour above which material slides
+    GLfloat Slumping;       // fraction of the excess that slides
+
+    ErosionParameters() : TimeStep(0.05f), Gravity(9.81f), Rain(0.02f), Evaporation(0.015f), Capacity(1.0f),
+        MinSlope(0.05f), StreamDepth(0.05f), Dissolve(0.5f), Deposit(1.0f), Talus(1.2f), Slumping(0.5f) {}
+};
+
+
+// Hydraulic and thermal erosion of a heightmap. Water moves between cells through virtual pipes
+// (the shallow water model of Mei et al., "Fast Hydraulic Erosion Simulation and Visualization
+// on GPU"), dissolving ground where it flows faster than its load allows and dropping sediment
+// where it slows down; the sediment is carried along with the flow. Thermal erosion then lets
+// material slide down wherever a slope is steeper than the talus.
+//
+// Every quantity is a separate float field (structure of arrays), so the passes walk rows of
+// contiguous floats four at a time, in SSE2 registers when the compiler has them. A field has a
+// one cell halo around the map that copies the edge, so neighbours are read without bounds
+// checks; water flowing into the halo leaves the map. Each pass runs over EROSION_TILE square tiles on the thread pool and only
+// writes its own tile, reading the neighbours' cells that the previous pass finished. The pool
+// hands tiles out one at a time, so cores that finish early take the remaining ones.
+//
+// Heights are elevations in cells: brighter samples are lower, and the terrain is a quarter as
+// tall as it is wide, as the mesh draws it. 40 bytes per cell.
+class Erosion
+{
+public:
+    ErosionParameters Parameters;
+    int Width, Height;
+    // Iterations run since loading
+    size_t Iterations;
+
+    Erosion() : Width(0), Height(0), Iterations(0), Seconds(0.0) {}
+
+    bool Loaded() const
+    {
+        return this->Width > 0;
+    }
+
+    // Starts over from the heights of a heightmap with dry, clean ground
+    void Load(const Heightmap& heightmap)
+    {
+        this->Width = heightmap.Width;
+        this->Height = heightmap.Height;
+        this->Stride = this->Width + 2;
+        this->Scale = (this->Width - 1) / 4.0f;
+        this->TilesX = (this->Width + EROSION_TILE - 1) / EROSION_TILE;
+        this->TilesY = (this->Height + EROSION_TILE - 1) / EROSION_TILE;
+        this->Iterations = 0;
+        this->Seconds = 0.0;
+
+        size_t cells = size_t(this->Stride) * (this->Height + 2);
+        for (std::vector<float>* field : { &this->Terrain, &this->Water, &this->Sediment, &this->Scratch, &this->FluxL,
+            &this->FluxR, &this->FluxT, &this->FluxB, &this->Carry, &this->Slope })
+            field->assign(cells, 0.0f);
+        this->Changed.assign(size_t(this->TilesX) * this->TilesY, 0.0f);
+        Resources().CpuAllocation(this, "erosion fields", cells * 10 * sizeof(float));
+
+        std::vector<GLfloat> samples;
+        heightmap.Decode(samples);
+        for (int row = 0; row < this->Height; row++)
+            for (int col = 0; col < this->Width; col++)
+                this->Terrain[this->index(row, col)] = (1.0f - samples[size_t(row) * this->Width + col]) * this->Scale;
+        this->refreshHalo(this->Terrain);
+    }
+
+    // Frees the fields
+    void Clear()
+    {
+        for (std::vector<float>* field : { &this->Terrain, &this->Water, &this->Sediment, &this->Scratch, &this->FluxL,
+            &this->FluxR, &this->FluxT, &this->FluxB, &this->Carry, &this->Slope })
+            std::vector<float>().swap(*field);
+        this->Changed.clear();
+        this->Width = this->Height = 0;
+        this->Iterations = 0;
+        Resources().CpuAllocation(this, "erosion fields", 0);
+    }
+
+    void Step(ThreadPool& pool, int iterations)
+    {
+        auto start = std::chrono::steady_clock::now();
+        int tiles = this->TilesX * this->TilesY;
+        for (int n = 0; n < iterations; n++)
+        {
+            pool.ParallelFor(tiles, [this](int t) { this->tilePass(t, &Erosion::flow); });
+            pool.ParallelFor(tiles, [this](int t) { this->tilePass(t, &Erosion::erode); });
+            this->refreshHalo(this->Terrain);
+            pool.ParallelFor(tiles, [this](int t) { this->tilePass(t, &Erosion::transport); });
+            this->Sediment.swap(this->Scratch);
+            pool.ParallelFor(tiles, [this](int t) { this->tilePass(t, &Erosion::slumpOut); });
+            pool.ParallelFor(tiles, [this](int t) { this->tilePass(t, &Erosion::slumpIn); });
+            this->Terrain.swap(this->Scratch);
+            this->refreshHalo(this->Terrain);
+        }
+        this->Iterations += iterations;
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+        this->Seconds += seconds.count();
+    }
+
+    double IterationsPerSecond() const
+    {
+        return this->Seconds > 0.0 ? this->Iterations / this->Seconds : 0.0;
+    }
+
+    // Normalised height of a cell, brighter is lower like the heightmap
+    GLfloat At(int row, int col) const
+    {
+        return 1.0f - this->Terrain[this->index(row, col)] / this->Scale;
+    }
+
+    // Rewrites the vertices of the tiles that changed by more than EROSION_UPLOAD_THRESHOLD in a
+    // vertex buffer laid out by BuildTerrainMesh from the heightmap that was loaded, and widens
+    // the bounds of their chunks. Each band of tiles goes up as one range of rows; the rows and
+    // columns [row0,row1) x [col0,col1) of every band are added to regions when it is given.
+    void UploadChanged(GLuint vbo, const Heightmap& heightmap, std::vector<TerrainChunk>& chunks, std::vector<glm::ivec4>* regions = NULL)
+    {
+        int chunksX = (this->Width - 2) / TERRAIN_CHUNK_SIZE + 1, chunksY = (this->Height - 2) / TERRAIN_CHUNK_SIZE + 1;
+        float threshold = EROSION_UPLOAD_THRESHOLD * this->Scale;
+        std::vector<GLfloat> vertices;
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        for (int ty = 0; ty < this->TilesY; ty++)
+        {
+            int first = this->TilesX, last = -1;
+            for (int tx = 0; tx < this->TilesX; tx++)
+            {
+                if (this->Changed[ty * this->TilesX + tx] > threshold)
+                {
+                    first = std::min(first, tx);
+                    last = tx;
+                }
+            }
+            if (last < 0)
+                continue;
+
+            int row0 = ty * EROSION_TILE, row1 = std::min(row0 + EROSION_TILE, this->Height);
+            int col0 = first * EROSION_TILE, col1 = std::min((last + 1) * EROSION_TILE, this->Width);
+            int columns = col1 - col0;
+            if (regions)
+                regions->push_back(glm::ivec4(row0, col0, row1, col1));
+            vertices.resize(size_t(row1 - row0) * columns * 5);
+            for (int row = row0; row < row1; row++)
+            {
+                for (int col = col0; col < col1; col++)
+                {
+                    glm::vec3 position = heightmap.Position(row, col, this->At(row, col));
+                    glm::vec2 coords = heightmap.TexCoord(row, col);
+                    GLfloat* vertex = &vertices[(size_t(row - row0) * columns + col - col0) * 5];
+                    vertex[0] = position.x;
+                    vertex[1] = position.y;
+                    vertex[2] = position.z;
+                    vertex[3] = coords.x;
+                    vertex[4] = coords.y;
+                }
+            }
+            // Whole rows are contiguous in the buffer, part rows go up one at a time
+            GLsizeiptr rowBytes = GLsizeiptr(columns) * 5 * sizeof(GLfloat);
+            if (columns == this->Width)
+                glBufferSubData(GL_ARRAY_BUFFER, GLintptr(row0) * rowBytes, rowBytes * (row1 - row0), vertices.data());
+            else
+                for (int row = row0; row < row1; row++)
+                    glBufferSubData(GL_ARRAY_BUFFER, (GLintptr(row) * this->Width + col0) * 5 * sizeof(GLfloat), rowBytes,
+                        &vertices[size_t(row - row0) * columns * 5]);
+
+            for (int tx = first; tx <= last; tx++)
+            {
+                float& changed = this->Changed[ty * this->TilesX + tx];
+                if (changed <= threshold)
+                    continue;
+                changed = 0.0f;
+                // Chunk (cx, cy) spans samples [64 cx, 64 cx + 64], so the tile's first row and
+                // column also belong to the chunks before it
+                GLfloat lowest = std::numeric_limits<GLfloat>::max(), highest = -lowest;
+                for (int row = row0; row < row1; row++)
+                {
+                    for (int col = tx * EROSION_TILE; col < std::min((tx + 1) * EROSION_TILE, this->Width); col++)
+                    {
+                        GLfloat y = vertices[(size_t(row - row0) * columns + col - col0) * 5 + 1];
+                        lowest = std::min(lowest, y);
+                        highest = std::max(highest, y);
+                    }
+                }
+                for (int cy = std::max(ty - 1, 0); cy <= std::min(ty, chunksY - 1); cy++)
+                {
+                    for (int cx = std::max(tx - 1, 0); cx <= std::min(tx, chunksX - 1); cx++)
+                    {
+                        TerrainChunk& chunk = chunks[cy * chunksX + cx];
+                        chunk.BoundsMin.y = std::min(chunk.BoundsMin.y, lowest);
+                        chunk.BoundsMax.y = std::max(chunk.BoundsMax.y, highest);
+                    }
+                }
+            }
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Writes the heights as a 16 bit binary PGM, which the preprocessor reads
+    bool SavePGM(const char* path) const
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file << "P5\n" << this->Width << " " << this->Height << "\n65535\n";
+        std::vector<uint8_t> row(size_t(this->Width) * 2);
+        for (int i = 0; i < this->Height; i++)
+        {
+            for (int j = 0; j < this->Width; j++)
+            {
+                uint16_t code = uint16_t(std::min(std::max(this->At(i, j), 0.0f), 1.0f) * 65535.0f + 0.5f);
+                row[j * 2] = uint8_t(code >> 8);
+                row[j * 2 + 1] = uint8_t(code & 0xff);
+            }
+            file.write(reinterpret_cast<const char*>(row.data()), row.size());
+        }
+        if (!file)
+        {
+            std::cout << "ERROR::EROSION::NOT_WRITTEN " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    int Stride;
+    float Scale;
+    int TilesX, TilesY;
+    // Fields, Stride x (Height + 2) with the halo. Scratch is the next sediment during transport
+    // and the next terrain during slumping. Carry is the share of a cell's water that a unit of
+    // flux moves. Slope holds the sine of the slope for erosion, then the share of each excess
+    // height that slides during slumping.
+    std::vector<float> Terrain, Water, Sediment, Scratch;
+    std::vector<float> FluxL, FluxR, FluxT, FluxB;
+    std::vector<float> Carry, Slope;
+    // Largest terrain change of each tile since its last upload, written by its own task only
+    std::vector<float> Changed;
+    double Seconds;
+
+#ifdef EROSION_SSE
+    struct Float4
+    {
+        __m128 V;
+        friend Float4 operator+(Float4 a, Float4 b) { return Float4{ _mm_add_ps(a.V, b.V) }; }
+        friend Float4 operator-(Float4 a, Float4 b) { return Float4{ _mm_sub_ps(a.V, b.V) }; }
+        friend Float4 operator*(Float4 a, Float4 b) { return Float4{ _mm_mul_ps(a.V, b.V) }; }
+        friend Float4 operator/(Float4 a, Float4 b) { return Float4{ _mm_div_ps(a.V, b.V) }; }
+    };
+
+    static Float4 set(float v) { return Float4{ _mm_set1_ps(v) }; }
+    static Float4 vmin(Float4 a, Float4 b) { return Float4{ _mm_min_ps(a.V, b.V) }; }
+    static Float4 vmax(Float4 a, Float4 b) { return Float4{ _mm_max_ps(a.V, b.V) }; }
+    static Float4 vsqrt(Float4 a) { return Float4{ _mm_sqrt_ps(a.V) }; }
+
+    // a > b ? x : y, lane by lane
+    static Float4 whereGreater(Float4 a, Float4 b, Float4 x, Float4 y)
+    {
+        __m128 mask = _mm_cmpgt_ps(a.V, b.V);
+        return Float4{ _mm_or_ps(_mm_and_ps(mask, x.V), _mm_andnot_ps(mask, y.V)) };
+    }
+
+    // The first n floats, the other lanes 0
+    static Float4 load(const float* v, int n)
+    {
+        if (n == 4)
+            return Float4{ _mm_loadu_ps(v) };
+        float lanes[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        memcpy(lanes, v, n * sizeof(float));
+        return Float4{ _mm_loadu_ps(lanes) };
+    }
+
+    static void store(float* v, Float4 a, int n)
+    {
+        if (n == 4)
+        {
+            _mm_storeu_ps(v, a.V);
+            return;
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, a.V);
+        memcpy(v, lanes, n * sizeof(float));
+    }
+#else
+    struct Float4
+    {
+        float V[4];
+#define EROSION_LANES(expression) Float4 r; for (int k = 0; k < 4; k++) r.V[k] = expression; return r
+        friend Float4 operator+(Float4 a, Float4 b) { EROSION_LANES(a.V[k] + b.V[k]); }
+        friend Float4 operator-(Float4 a, Float4 b) { EROSION_LANES(a.V[k] - b.V[k]); }
+        friend Float4 operator*(Float4 a, Float4 b) { EROSION_LANES(a.V[k] * b.V[k]); }
+        friend Float4 operator/(Float4 a, Float4 b) { EROSION_LANES(a.V[k] / b.V[k]); }
+    };
+
+    static Float4 set(float v) { EROSION_LANES(v); }
+    static Float4 vmin(Float4 a, Float4 b) { EROSION_LANES(std::min(a.V[k], b.V[k])); }
+    static Float4 vmax(Float4 a, Float4 b) { EROSION_LANES(std::max(a.V[k], b.V[k])); }
+    static Float4 vsqrt(Float4 a) { EROSION_LANES(std::sqrt(a.V[k])); }
+    static Float4 whereGreater(Float4 a, Float4 b, Float4 x, Float4 y) { EROSION_LANES(a.V[k] > b.V[k] ? x.V[k] : y.V[k]); }
+    static Float4 load(const float* v, int n) { EROSION_LANES(k < n ? v[k] : 0.0f); }
+#undef EROSION_LANES
+    static void store(float* v, Float4 a, int n)
+    {
+        memcpy(v, a.V, n * sizeof(float));
+    }
+#endif
+
+    static float horizontalMax(Float4 a)
+    {
+        float lanes[4];
+        store(lanes, a, 4);
+        return std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    }
+
+    size_t index(int row, int col) const
+    {
+        return size_t(row + 1) * this->Stride + col + 1;
+    }
+
+    // Runs one pass over the rows of a tile, a row of count cells starting at index i0 at a time
+    void tilePass(int tile, float (Erosion::*pass)(size_t, int))
+    {
+        int tx = tile % this->TilesX, ty = tile / this->TilesX;
+        int col0 = tx * EROSION_TILE, col1 = std::min(col0 + EROSION_TILE, this->Width);
+        int row1 = std::min((ty + 1) * EROSION_TILE, this->Height);
+        float changed = 0.0f;
+        for (int row = ty * EROSION_TILE; row < row1; row++)
+            changed = std::max(changed, (this->*pass)(this->index(row, col0), col1 - col0));
+        this->Changed[tile] += changed;
+    }
+
+    // Copies the edge cells of a field into its halo
+    void refreshHalo(std::vector<float>& field)
+    {
+        float* f = field.data();
+        for (int row = 0; row < this->Height; row++)
+        {
+            f[this->index(row, -1)] = f[this->index(row, 0)];
+            f[this->index(row, this->Width)] = f[this->index(row, this->Width - 1)];
+        }
+        std::copy(f + this->index(0, -1), f + this->index(0, this->Width + 1), f + this->index(-1, -1));
+        std::copy(f + this->index(this->Height - 1, -1), f + this->index(this->Height - 1, this->Width + 1), f + this->index(this->Height, -1));
+    }
+
+    // Rain, then the flow through the pipes to the four neighbours, scaled down so a cell never
+    // sends more water than it has. Also the slope for erosion.
+    float flow(size_t i0, int count)
+    {
+        const ErosionParameters& p = this->Parameters;
+        const ptrdiff_t s = this->Stride;
+        const Float4 zero = set(0.0f), one = set(1.0f), pressure = set(p.TimeStep * p.Gravity);
+        for (int k = 0; k < count; k += 4)
+        {
+            int n = std::min(4, count - k);
+            size_t i = i0 + k;
+            Float4 t = load(&this->Terrain[i], n), w = load(&this->Water[i], n);
+            // Rain falls evenly, so it changes no level difference; erode adds it for good
+            Float4 water = w + set(p.Rain * p.TimeStep);
+            Float4 level = t + w;
+            Float4 left = vmax(zero, load(&this->FluxL[i], n) + pressure * (level - load(&this->Terrain[i - 1], n) - load(&this->Water[i - 1], n)));
+            Float4 right = vmax(zero, load(&this->FluxR[i], n) + pressure * (level - load(&this->Terrain[i + 1], n) - load(&this->Water[i + 1], n)));
+            Float4 top = vmax(zero, load(&this->FluxT[i], n) + pressure * (level - load(&this->Terrain[i - s], n) - load(&this->Water[i - s], n)));
+            Float4 bottom = vmax(zero, load(&this->FluxB[i], n) + pressure * (level - load(&this->Terrain[i + s], n) - load(&this->Water[i + s], n)));
+            Float4 scale = vmin(one, water / vmax((left + right + top + bottom) * set(p.TimeStep), set(1e-6f)));
+            store(&this->FluxL[i], left * scale, n);
+            store(&this->FluxR[i], right * scale, n);
+            store(&this->FluxT[i], top * scale, n);
+            store(&this->FluxB[i], bottom * scale, n);
+
+            Float4 dx = set(0.5f) * (load(&this->Terrain[i + 1], n) - load(&this->Terrain[i - 1], n));
+            Float4 dy = set(0.5f) * (load(&this->Terrain[i + s], n) - load(&this->Terrain[i - s], n));
+            Float4 gradient = dx * dx + dy * dy;
+            store(&this->Slope[i], vsqrt(gradient / (one + gradient)), n);
+        }
+        return 0.0f;
+    }
+
+    // Moves the water, derives its velocity from the flow through the cell, then dissolves or
+    // deposits sediment towards what that flow can carry. Returns the largest terrain change.
+    float erode(size_t i0, int count)
+    {
+        const ErosionParameters& p = this->Parameters;
+        const ptrdiff_t s = this->Stride;
+        const Float4 zero = set(0.0f), half = set(0.5f), timeStep = set(p.TimeStep);
+        Float4 changed = zero;
+        for (int k = 0; k < count; k += 4)
+        {
+            int n = std::min(4, count - k);
+            size_t i = i0 + k;
+            Float4 fl = load(&this->FluxL[i], n), fr = load(&this->FluxR[i], n);
+            Float4 ft = load(&this->FluxT[i], n), fb = load(&this->FluxB[i], n);
+            Float4 fromLeft = load(&this->FluxR[i - 1], n), fromRight = load(&this->FluxL[i + 1], n);
+            Float4 fromTop = load(&this->FluxB[i - s], n), fromBottom = load(&this->FluxT[i + s], n);
+            Float4 before = load(&this->Water[i], n) + set(p.Rain * p.TimeStep);
+            Float4 after = vmax(zero, before + timeStep * (fromLeft + fromRight + fromTop + fromBottom - fl - fr - ft - fb));
+            store(&this->Water[i], after, n);
+            store(&this->Carry[i], timeStep / vmax(before, set(1e-6f)), n);
+            Float4 depth = vmax(half * (before + after), set(1e-4f));
+            Float4 u = half * (fromLeft - fl + fr - fromRight) / depth;
+            Float4 v = half * (fromTop - ft + fb - fromBottom) / depth;
+
+            // A film of water carries less than a stream, however fast it runs
+            Float4 capacity = set(p.Capacity) * vmax(load(&this->Slope[i], n), set(p.MinSlope)) * vsqrt(u * u + v * v) *
+                vmin(depth * set(1.0f / p.StreamDepth), set(1.0f));
+            Float4 sediment = load(&this->Sediment[i], n);
+            Float4 missing = capacity - sediment;
+            Float4 amount = missing * whereGreater(missing, zero, set(p.Dissolve), set(p.Deposit)) * timeStep;
+            store(&this->Terrain[i], load(&this->Terrain[i], n) - amount, n);
+            store(&this->Sediment[i], sediment + amount, n);
+            changed = vmax(changed, vmax(amount, zero - amount));
+        }
+        return horizontalMax(changed);
+    }
+
+    // Moves the sediment through the pipes along with the water, each pipe taking the share of
+    // the cell's sediment that it took of its water, so none is lost but what flows off the map.
+    // Then evaporates some water. Writes the sediment to Scratch.
+    float transport(size_t i0, int count)
+    {
+        const ErosionParameters& p = this->Parameters;
+        const ptrdiff_t s = this->Stride;
+        const Float4 dry = set(1.0f - p.Evaporation * p.TimeStep);
+        for (int k = 0; k < count; k += 4)
+        {
+            int n = std::min(4, count - k);
+            size_t i = i0 + k;
+            Float4 sediment = load(&this->Sediment[i], n);
+            Float4 out = sediment * load(&this->Carry[i], n) *
+                (load(&this->FluxL[i], n) + load(&this->FluxR[i], n) + load(&this->FluxT[i], n) + load(&this->FluxB[i], n));
+            Float4 in = load(&this->Sediment[i - 1], n) * load(&this->Carry[i - 1], n) * load(&this->FluxR[i - 1], n) +
+                load(&this->Sediment[i + 1], n) * load(&this->Carry[i + 1], n) * load(&this->FluxL[i + 1], n) +
+                load(&this->Sediment[i - s], n) * load(&this->Carry[i - s], n) * load(&this->FluxB[i - s], n) +
+                load(&this->Sediment[i + s], n) * load(&this->Carry[i + s], n) * load(&this->FluxT[i + s], n);
+            store(&this->Scratch[i], sediment + in - out, n);
+            store(&this->Water[i], load(&this->Water[i], n) * dry, n);
+        }
+        return 0.0f;
+    }
+
+    // Excess height of a cell over a neighbour beyond the talus
+    static Float4 excess(Float4 from, Float4 to, Float4 talus)
+    {
+        return vmax(set(0.0f), from - to - talus);
+    }
+
+    // Thermal erosion, first half: how much of each cell slides, as a share of its total excess
+    // over the talus, which every lower neighbour receives in proportion to its own excess
+    float slumpOut(size_t i0, int count)
+    {
+        const ErosionParameters& p = this->Parameters;
+        const ptrdiff_t s = this->Stride;
+        const Float4 talus = set(p.Talus);
+        for (int k = 0; k < count; k += 4)
+        {
+            int n = std::min(4, count - k);
+            size_t i = i0 + k;
+            Float4 t = load(&this->Terrain[i], n);
+            Float4 l = excess(t, load(&this->Terrain[i - 1], n), talus), r = excess(t, load(&this->Terrain[i + 1], n), talus);
+            Float4 u = excess(t, load(&this->Terrain[i - s], n), talus), d = excess(t, load(&this->Terrain[i + s], n), talus);
+            // Half the largest excess levels that pair, more would overshoot; nothing slides
+            // when there is no excess, whatever the total is divided by
+            Float4 amount = set(p.Slumping * p.TimeStep * 0.5f) * vmax(vmax(l, r), vmax(u, d));
+            store(&this->Slope[i], amount / vmax(l + r + u + d, set(1e-20f)), n);
+        }
+        return 0.0f;
+    }
+
+    // Thermal erosion, second half: each cell loses what slides off it and gains its share of
+    // what slides off its neighbours. Writes the terrain to Scratch.
+    float slumpIn(size_t i0, int count)
+    {
+        const ErosionParameters& p = this->Parameters;
+        const ptrdiff_t s = this->Stride;
+        const Float4 talus = set(p.Talus);
+        Float4 changed = set(0.0f);
+        for (int k = 0; k < count; k += 4)
+        {
+            int n = std::min(4, count - k);
+            size_t i = i0 + k;
+            Float4 t = load(&this->Terrain[i], n);
+            Float4 tl = load(&this->Terrain[i - 1], n), tr = load(&this->Terrain[i + 1], n);
+            Float4 tu = load(&this->Terrain[i - s], n), td = load(&this->Terrain[i + s], n);
+            Float4 out = load(&this->Slope[i], n) * (excess(t, tl, talus) + excess(t, tr, talus) + excess(t, tu, talus) + excess(t, td, talus));
+            Float4 in = load(&this->Slope[i - 1], n) * excess(tl, t, talus) + load(&this->Slope[i + 1], n) * excess(tr, t, talus) +
+                load(&this->Slope[i - s], n) * excess(tu, t, talus) + load(&this->Slope[i + s], n) * excess(td, t, talus);
+            store(&this->Scratch[i], t + in - out, n);
+            changed = vmax(changed, vmax(in - out, out - in));
+        }
+        return horizontalMax(changed);
+    }
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <chrono>
+#include <filesystem>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+
+// Reports changes to a set of files without blocking. On Linux the directories holding them are
+// watched with inotify; elsewhere the modification times are polled twice per second.
+class FileWatcher
+{
+public:
+    FileWatcher()
+    {
+#ifdef __linux__
+        this->Inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+        this->LastScan = std::chrono::steady_clock::now();
+    }
+
+    ~FileWatcher()
+    {
+#ifdef __linux__
+        if (this->Inotify >= 0)
+            close(this->Inotify);
+#endif
+    }
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    // Starts watching a file, given relative to the working directory like every asset path
+    void Watch(const std::string& path)
+    {
+        std::filesystem::path file(path);
+        std::string directory = file.has_parent_path() ? file.parent_path().string() : ".";
+        this->Files.insert(path);
+        std::error_code error;
+        this->Times[path] = std::filesystem::last_write_time(file, error);
+#ifdef __linux__
+        if (this->Inotify >= 0 && this->DirectoryOf.find(directory) == this->DirectoryOf.end())
+        {
+            // Editors often save by writing a temporary file and renaming it over the original
+            int wd = inotify_add_watch(this->Inotify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+            if (wd >= 0)
+            {
+                this->Directories[wd] = directory;
+                this->DirectoryOf[directory] = wd;
+            }
+        }
+#endif
+    }
+
+    // Appends the watched files that changed since the last call
+    void Poll(std::vector<std::string>& changed)
+    {
+#ifdef __linux__
+        if (this->Inotify >= 0)
+        {
+            alignas(inotify_event) char buffer[4096];
+            for (;;)
+            {
+                ssize_t length = read(this->Inotify, buffer, sizeof(buffer));
+                if (length <= 0)
+                    break;
+                for (char* p = buffer; p < buffer + length; )
+                {
+                    inotify_event* event = reinterpret_cast<inotify_event*>(p);
+                    if (event->len > 0)
+                    {
+                        std::string directory = this->Directories[event->wd];
+                        std::string path = directory == "." ? std::string(event->name) : directory + "/" + event->name;
+                        if (this->Files.count(path))
+                            changed.push_back(path);
+                    }
+                    p += sizeof(inotify_event) + event->len;
+                }
+            }
+            return;
+        }
+#endif
+        // Fallback: compare modification times
+        auto now = std::chrono::steady_clock::now();
+        if (now - this->LastScan < std::chrono::milliseconds(500))
+            return;
+        this->LastScan = now;
+        for (const std::string& path : this->Files)
+        {
+            std::error_code error;
+            auto time = std::filesystem::last_write_time(path, error);
+            if (!error && time != this->Times[path])
+            {
+                this->Times[path] = time;
+                changed.push_back(path);
+            }
+        }
+    }
+
+private:
+    std::set<std::string> Files;
+    std::map<std::string, std::filesystem::file_time_type> Times;
+    std::chrono::steady_clock::time_point LastScan;
+#ifdef __linux__
+    int Inotify;
+    std::map<int, std::string> Directories;
+    std::map<std::string, int> DirectoryOf;
+#endif
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+// Std. Includes
+#include <cmath>
+#include <algorithm>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+
+// The six planes of a view frustum, extracted from a view-projection matrix (Gribb/Hartmann).
+// Plane normals point inwards, so a point p is inside when dot(n, p) + d >= 0 for every plane.
+// reversedZ is for projections made by ReversedPerspective, whose depth runs from 1 to 0.
+struct Frustum
+{
+    glm::vec4 Planes[6];
+
+    Frustum() {}
+
+    explicit Frustum(const glm::mat4& viewProjection, bool reversedZ = false)
+    {
+        // Rows of the matrix; glm stores columns
+        glm::vec4 rows[4];
+        for (int r = 0; r < 4; r++)
+            rows[r] = glm::vec4(viewProjection[0][r], viewProjection[1][r], viewProjection[2][r], viewProjection[3][r]);
+        this->Planes[0] = rows[3] + rows[0];   // left
+        this->Planes[1] = rows[3] - rows[0];   // right
+        this->Planes[2] = rows[3] + rows[1];   // bottom
+        this->Planes[3] = rows[3] - rows[1];   // top
+        if (reversedZ)
+        {
+            this->Planes[4] = rows[3] - rows[2];   // near, depth <= 1
+            this->Planes[5] = rows[2];             // far, depth >= 0
+        }
+        else
+        {
+            this->Planes[4] = rows[3] + rows[2];   // near
+            this->Planes[5] = rows[3] - rows[2];   // far
+        }
+        for (int p = 0; p < 6; p++)
+            this->Planes[p] /= glm::length(glm::vec3(this->Planes[p]));
+    }
+
+    // Conservative box test: false only when the box lies completely outside one plane
+    bool IntersectsBox(const glm::vec3& boxMin, const glm::vec3& boxMax) const
+    {
+        for (int p = 0; p < 6; p++)
+        {
+            // Corner of the box furthest along the plane normal
+            glm::vec3 corner(this->Planes[p].x >= 0.0f ? boxMax.x : boxMin.x,
+                             this->Planes[p].y >= 0.0f ? boxMax.y : boxMin.y,
+                             this->Planes[p].z >= 0.0f ? boxMax.z : boxMin.z);
+            if (glm::dot(glm::vec3(this->Planes[p]), corner) + this->Planes[p].w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+};
+
+// World space bounds of a model space box under an affine transform
+inline void TransformBounds(const glm::mat4& model, const glm::vec3& boxMin, const glm::vec3& boxMax,
+                            glm::vec3& outMin, glm::vec3& outMax)
+{
+    glm::vec3 center = glm::vec3(model * glm::vec4((boxMin + boxMax) * 0.5f, 1.0f));
+    glm::vec3 extent = (boxMax - boxMin) * 0.5f;
+    glm::vec3 worldExtent = glm::abs(glm::vec3(model[0])) * extent.x +
+                            glm::abs(glm::vec3(model[1])) * extent.y +
+                            glm::abs(glm::vec3(model[2])) * extent.z;
+    outMin = center - worldExtent;
+    outMax = center + worldExtent;
+}
+
+// Distance from a point to the closest point of a box, 0 inside it
+inline GLfloat DistanceToBox(const glm::vec3& point, const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+    glm::vec3 outside = glm::max(glm::max(boxMin - point, point - boxMax), glm::vec3(0.0f));
+    return glm::length(outside);
+}
+
+// Perspective projection for reversed-Z, with glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE): the near
+// plane maps to depth 1 and the far plane to 0. Float depth is densest near 0, which balances the
+// perspective divide, so precision stays nearly even over the whole range. Field of view in degrees,
+// like the glm::perspective calls of the viewer.
+inline glm::mat4 ReversedPerspective(GLfloat fovy, GLfloat aspect, GLfloat zNear, GLfloat zFar)
+{
+    GLfloat f = 1.0f / std::tan(fovy * 3.14159265f / 360.0f);
+    glm::mat4 projection(0.0f);
+    projection[0][0] = f / aspect;
+    projection[1][1] = f;
+    projection[2][2] = zNear / (zFar - zNear);
+    projection[2][3] = -1.0f;
+    projection[3][2] = zFar * zNear / (zFar - zNear);
+    return projection;
+}
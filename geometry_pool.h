@@ -0,0 +1,223 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <algorithm>
+
+// GL Includes
+#include <GL/glew.h>
+
+#include "range_allocator.h"
+#include "resource_registry.h"
+
+// Vertices and indices a pool starts with, each doubles when it runs out
+const size_t GEOMETRY_POOL_VERTICES = 1 << 14;
+const size_t GEOMETRY_POOL_INDICES = 1 << 14;
+// Compact once this share of the free space lies outside the largest free range
+const float GEOMETRY_POOL_FRAGMENTATION = 0.5f;
+// Bytes of an x y z s t vertex
+const size_t GEOMETRY_POOL_STRIDE = 5 * sizeof(GLfloat);
+
+// Where a mesh lives in a GeometryPool: handles of its vertex and index ranges, -1 for none
+struct PoolMesh
+{
+    int Vertices, Indices;
+    PoolMesh() : Vertices(-1), Indices(-1) {}
+};
+
+
+// Meshes of x y z s t vertices packed into one vertex buffer and one index buffer behind a
+// single VAO, so drawing another mesh only changes the base vertex and index offset. Ranges of
+// the buffers are handed out by a RangeAllocator each, in vertices and in indices, so a mesh's
+// indices stay relative to the mesh and are drawn with glDrawElementsBaseVertex.
+//
+// A buffer that runs out is replaced by one twice the size on the GPU, and Defragment packs the
+// meshes together again once freeing has scattered the free space. Both copy between buffers
+// with glCopyBufferSubData and point the VAO at the new one; a mesh's base vertex and first
+// index must be read again after either.
+class GeometryPool
+{
+public:
+    GLuint VAO;
+    // Times a buffer grew or was compacted
+    GLuint Grows, Compactions;
+
+    GeometryPool() : VAO(0), Grows(0), Compactions(0), VertexBuffer(0), IndexBuffer(0) {}
+
+    void Create(size_t vertices = GEOMETRY_POOL_VERTICES, size_t indices = GEOMETRY_POOL_INDICES)
+    {
+        this->VertexSpace.Reset(vertices);
+        this->IndexSpace.Reset(indices);
+        glGenVertexArrays(1, &this->VAO);
+        Resources().Created(RESOURCE_VERTEX_ARRAY, this->VAO, "geometry pool");
+        this->VertexBuffer = createBuffer(vertices * GEOMETRY_POOL_STRIDE, "geometry pool vertices");
+        this->IndexBuffer = createBuffer(indices * sizeof(GLuint), "geometry pool indices");
+        this->bindBuffers();
+    }
+
+    // Deletes the buffers and the VAO, must run while the context is still current
+    void Release()
+    {
+        if (this->VAO == 0)
+            return;
+        GLuint buffers[] = { this->VertexBuffer, this->IndexBuffer };
+        Resources().Deleted(RESOURCE_VERTEX_ARRAY, this->VAO);
+        Resources().Deleted(RESOURCE_BUFFER, 2, buffers);
+        glDeleteVertexArrays(1, &this->VAO);
+        glDeleteBuffers(2, buffers);
+        this->VAO = this->VertexBuffer = this->IndexBuffer = 0;
+    }
+
+    // Copies a mesh into the pool. Indices are relative to the mesh; either part may be empty,
+    // such as the indices of a triangle list or the vertices of indices shared by other meshes.
+    PoolMesh AddMesh(const GLfloat* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount)
+    {
+        PoolMesh mesh;
+        if (vertexCount > 0)
+            mesh.Vertices = this->add(this->VertexSpace, this->VertexBuffer, "geometry pool vertices", vertices, vertexCount, GEOMETRY_POOL_STRIDE);
+        if (indexCount > 0)
+            mesh.Indices = this->add(this->IndexSpace, this->IndexBuffer, "geometry pool indices", indices, indexCount, sizeof(GLuint));
+        return mesh;
+    }
+
+    // A non-indexed triangle list, drawn with glDrawArrays from BaseVertex
+    PoolMesh AddTriangles(const GLfloat* vertices, size_t vertexCount)
+    {
+        return this->AddMesh(vertices, vertexCount, NULL, 0);
+    }
+
+    // Frees the ranges of a mesh, they are reused by the next meshes added
+    void Remove(PoolMesh& mesh)
+    {
+        if (mesh.Vertices >= 0)
+            this->VertexSpace.Free(mesh.Vertices);
+        if (mesh.Indices >= 0)
+            this->IndexSpace.Free(mesh.Indices);
+        mesh = PoolMesh();
+    }
+
+    GLint BaseVertex(const PoolMesh& mesh) const
+    {
+        return GLint(this->VertexSpace.Offset(mesh.Vertices));
+    }
+
+    GLuint FirstIndex(const PoolMesh& mesh) const
+    {
+        return GLuint(this->IndexSpace.Offset(mesh.Indices));
+    }
+
+    // Packs the meshes of a buffer whose free space has scattered, returns whether any moved.
+    // Meant for between frames.
+    bool Defragment()
+    {
+        bool moved = false;
+        if (this->VertexSpace.Fragmentation() > GEOMETRY_POOL_FRAGMENTATION)
+            moved = this->compact(this->VertexSpace, this->VertexBuffer, "geometry pool vertices", GEOMETRY_POOL_STRIDE) || moved;
+        if (this->IndexSpace.Fragmentation() > GEOMETRY_POOL_FRAGMENTATION)
+            moved = this->compact(this->IndexSpace, this->IndexBuffer, "geometry pool indices", sizeof(GLuint)) || moved;
+        if (moved)
+            this->bindBuffers();
+        return moved;
+    }
+
+    size_t Meshes() const
+    {
+        return std::max(this->VertexSpace.Count(), this->IndexSpace.Count());
+    }
+
+    // Bytes of the two buffers, and of the meshes in them
+    size_t Bytes() const
+    {
+        return this->VertexSpace.Capacity() * GEOMETRY_POOL_STRIDE + this->IndexSpace.Capacity() * sizeof(GLuint);
+    }
+
+    size_t UsedBytes() const
+    {
+        return this->VertexSpace.Used() * GEOMETRY_POOL_STRIDE + this->IndexSpace.Used() * sizeof(GLuint);
+    }
+
+private:
+    RangeAllocator VertexSpace, IndexSpace;
+    GLuint VertexBuffer, IndexBuffer;
+
+    static GLuint createBuffer(size_t bytes, const char* label)
+    {
+        GLuint buffer;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, bytes, NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        Resources().Created(RESOURCE_BUFFER, buffer, label, bytes);
+        return buffer;
+    }
+
+    // Points the VAO at the current buffers: position at 0, texture coordinate at 2
+    void bindBuffers()
+    {
+        glBindVertexArray(this->VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, this->VertexBuffer);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, GEOMETRY_POOL_STRIDE, (GLvoid*)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, GEOMETRY_POOL_STRIDE, (GLvoid*)(3 * sizeof(GLfloat)));
+        glEnableVertexAttribArray(2);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->IndexBuffer);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Allocates count units, growing the buffer when no free range fits, and uploads the data
+    int add(RangeAllocator& space, GLuint& buffer, const char* label, const void* data, size_t count, size_t unitBytes)
+    {
+        int handle = space.Allocate(count);
+        if (handle < 0)
+        {
+            size_t capacity = std::max(space.Capacity() * 2, space.Capacity() + count);
+            GLuint grown = createBuffer(capacity * unitBytes, label);
+            this->copy(buffer, grown, 0, 0, space.Capacity() * unitBytes);
+            this->replace(buffer, grown);
+            space.Grow(capacity);
+            this->bindBuffers();
+            this->Grows++;
+            handle = space.Allocate(count);
+        }
+        // Through the copy target, which leaves the bindings of any VAO untouched
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, space.Offset(handle) * unitBytes, count * unitBytes, data);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return handle;
+    }
+
+    // Copies the ranges into a new buffer at their packed offsets. Ranges that did not move are
+    // the ones before the first move, copied in one go.
+    bool compact(RangeAllocator& space, GLuint& buffer, const char* label, size_t unitBytes)
+    {
+        std::vector<RangeAllocator::Move> moves = space.Compact();
+        if (moves.empty())
+            return false;
+        GLuint packed = createBuffer(space.Capacity() * unitBytes, label);
+        this->copy(buffer, packed, 0, 0, moves[0].To * unitBytes);
+        for (const RangeAllocator::Move& move : moves)
+            this->copy(buffer, packed, move.From * unitBytes, move.To * unitBytes, move.Size * unitBytes);
+        this->replace(buffer, packed);
+        this->Compactions++;
+        return true;
+    }
+
+    static void copy(GLuint from, GLuint to, size_t fromOffset, size_t toOffset, size_t bytes)
+    {
+        if (bytes == 0)
+            return;
+        glBindBuffer(GL_COPY_READ_BUFFER, from);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, to);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, fromOffset, toOffset, bytes);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    static void replace(GLuint& buffer, GLuint with)
+    {
+        Resources().Deleted(RESOURCE_BUFFER, buffer);
+        glDeleteBuffers(1, &buffer);
+        buffer = with;
+    }
+};
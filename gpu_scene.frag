@@ -0,0 +1,32 @@
+#version 430 core
+in vec2 TexCoord;
+in vec3 WorldPos;
+flat in uint LayerA;
+flat in uint LayerB;
+flat in uint Flags;
+flat in float Blend;
+
+out vec4 color;
+
+uniform sampler2DArray sceneTextures;
+uniform bool litTerrain;
+uniform vec3 sunDirection;
+
+void main()
+{
+    // Derivatives are taken before any branching on per object data
+    vec3 normal = normalize(cross(dFdx(WorldPos), dFdy(WorldPos)));
+
+    color = texture(sceneTextures, vec3(TexCoord, LayerA));
+    // Only objects with two different layers pay for a second fetch
+    if (LayerA != LayerB)
+        color = mix(color, texture(sceneTextures, vec3(TexCoord, LayerB)), Blend);
+
+    if (litTerrain && (Flags & 1u) != 0u)
+    {
+        if (normal.y < 0.0)
+            normal = -normal;
+        float diffuse = max(dot(normal, normalize(sunDirection)), 0.0);
+        color.rgb *= 0.35 + 0.65 * diffuse;
+    }
+}
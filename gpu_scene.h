@@ -0,0 +1,293 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "frustum.h"
+#include "shader_cache.h"
+#include "staged_buffer.h"
+#include "resource_registry.h"
+
+
+// Command layout read by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+    GLuint Count;
+    GLuint InstanceCount;
+    GLuint FirstIndex;
+    GLint BaseVertex;
+    GLuint BaseInstance;
+};
+
+// Object flags
+const GLuint GPU_OBJECT_TERRAIN = 1;   // receives sun lighting when lit terrain is enabled
+
+// Per object record shared with cull.comp and gpu_scene.vs (std430 layout, 128 bytes)
+struct GpuObject
+{
+    glm::mat4 Model;
+    glm::vec4 BoundsMin;   // model space bounds, w unused
+    glm::vec4 BoundsMax;
+    GLuint FirstIndex;
+    GLuint IndexCount;
+    GLint BaseVertex;
+    GLuint LayerA;         // texture array layers, blended when they differ
+    GLuint LayerB;
+    GLuint Flags;
+    GLfloat Blend;
+    GLuint Padding;
+};
+
+// A range of the shared index buffer together with its model space bounds
+struct GpuMesh
+{
+    GLint BaseVertex;
+    GLuint FirstIndex;
+    GLuint IndexCount;
+    glm::vec3 BoundsMin;
+    glm::vec3 BoundsMax;
+};
+
+
+// GPU driven renderer for the static scene. All meshes live in one vertex/index buffer pair with a
+// single VAO, all textures in one 2D texture array, and every object is a slot in an indirect
+// command buffer. Each frame a compute shader frustum culls the objects and writes the commands,
+// and the whole scene is submitted with one glMultiDrawElementsIndirect, so the CPU cost of a
+// frame no longer grows with the number of objects. Needs GL 4.3.
+class GpuScene
+{
+public:
+    GpuScene() : VAO(0), VBO(0), EBO(0), ObjectIds(0), ObjectBuffer(0), CommandBuffer(0),
+                 DrawProgram(0), CullProgram(0), Shaders(NULL), ShaderGeneration(0), DirtyBegin(0), DirtyEnd(0) {}
+
+    // Deletes the GL objects, must run while the context is still current
+    void Release()
+    {
+        if (this->VAO == 0)
+            return;
+        GLuint buffers[] = { this->VBO, this->EBO, this->ObjectIds, this->ObjectBuffer, this->CommandBuffer };
+        Resources().Deleted(RESOURCE_VERTEX_ARRAY, this->VAO);
+        Resources().Deleted(RESOURCE_BUFFER, 5, buffers);
+        glDeleteVertexArrays(1, &this->VAO);
+        glDeleteBuffers(5, buffers);
+        this->VAO = 0;
+    }
+
+    // Appends a mesh of x y z s t vertices to the shared buffers. Indices are relative to the mesh.
+    GpuMesh AddMesh(const GLfloat* vertices, GLuint vertexCount, const GLuint* indices, GLuint indexCount)
+    {
+        GpuMesh mesh;
+        mesh.BaseVertex = GLint(this->Vertices.size() / 5);
+        mesh.FirstIndex = GLuint(this->Indices.size());
+        mesh.IndexCount = indexCount;
+        mesh.BoundsMin = mesh.BoundsMax = glm::vec3(vertices[0], vertices[1], vertices[2]);
+        for (GLuint v = 0; v < vertexCount; v++)
+        {
+            glm::vec3 position(vertices[v * 5], vertices[v * 5 + 1], vertices[v * 5 + 2]);
+            mesh.BoundsMin = glm::min(mesh.BoundsMin, position);
+            mesh.BoundsMax = glm::max(mesh.BoundsMax, position);
+        }
+        this->Vertices.insert(this->Vertices.end(), vertices, vertices + vertexCount * 5);
+        this->Indices.insert(this->Indices.end(), indices, indices + indexCount);
+        return mesh;
+    }
+
+    // Appends a non-indexed triangle list, as used by the skybox sides and the boxes
+    GpuMesh AddTriangles(const GLfloat* vertices, GLuint vertexCount)
+    {
+        std::vector<GLuint> indices(vertexCount);
+        for (GLuint i = 0; i < vertexCount; i++)
+            indices[i] = i;
+        return this->AddMesh(vertices, vertexCount, indices.data(), vertexCount);
+    }
+
+    // Adds an object drawing a mesh with the given transform and texture array layers
+    GLuint AddObject(const GpuMesh& mesh, const glm::mat4& model, GLuint layerA, GLuint layerB, GLuint flags = 0, GLfloat blend = 0.2f)
+    {
+        GpuObject object;
+        object.Model = model;
+        object.BoundsMin = glm::vec4(mesh.BoundsMin, 1.0f);
+        object.BoundsMax = glm::vec4(mesh.BoundsMax, 1.0f);
+        object.FirstIndex = mesh.FirstIndex;
+        object.IndexCount = mesh.IndexCount;
+        object.BaseVertex = mesh.BaseVertex;
+        object.LayerA = layerA;
+        object.LayerB = layerB;
+        object.Flags = flags;
+        object.Blend = blend;
+        object.Padding = 0;
+        this->Objects.push_back(object);
+        return GLuint(this->Objects.size() - 1);
+    }
+
+    // Moves an object. The changed range is uploaded once by the next Draw.
+    void SetModel(GLuint object, const glm::mat4& model)
+    {
+        this->Objects[object].Model = model;
+        if (this->DirtyBegin == this->DirtyEnd)
+        {
+            this->DirtyBegin = object;
+            this->DirtyEnd = object + 1;
+        }
+        else
+        {
+            this->DirtyBegin = std::min(this->DirtyBegin, object);
+            this->DirtyEnd = std::max(this->DirtyEnd, object + 1);
+        }
+    }
+
+    GLuint ObjectCount() const
+    {
+        return GLuint(this->Objects.size());
+    }
+
+    // Creates the GL buffers and programs once every mesh and object has been added
+    void Upload(ShaderCache& shaderCache)
+    {
+        this->BeginUpload(shaderCache);
+        size_t budget = SIZE_MAX;
+        this->UploadStep(budget);
+    }
+
+    // Creates the GL objects; the geometry then streams in with UploadStep over several frames
+    void BeginUpload(ShaderCache& shaderCache)
+    {
+        this->Shaders = &shaderCache;
+        this->ShaderGeneration = shaderCache.Generation;
+        this->DrawProgram = shaderCache.Program("shaders/gpu_scene.vs", "shaders/gpu_scene.frag");
+        this->CullProgram = shaderCache.Program({ { GL_COMPUTE_SHADER, "shaders/cull.comp" } });
+
+        // Object ids feed an instanced attribute; every command's base instance is its object,
+        // so the vertex shader finds its object without ARB_shader_draw_parameters
+        std::vector<GLuint> ids(this->Objects.size());
+        for (GLuint i = 0; i < ids.size(); i++)
+            ids[i] = i;
+
+        this->VertexUpload.Begin(this->Vertices.data(), sizeof(GLfloat) * this->Vertices.size(), GL_STATIC_DRAW, "scene vertices");
+        this->IndexUpload.Begin(this->Indices.data(), sizeof(GLuint) * this->Indices.size(), GL_STATIC_DRAW, "scene indices");
+        this->VBO = this->VertexUpload.Buffer;
+        this->EBO = this->IndexUpload.Buffer;
+        Resources().CpuAllocation(this, "scene upload staging", sizeof(GLfloat) * this->Vertices.size() + sizeof(GLuint) * this->Indices.size());
+        glGenVertexArrays(1, &this->VAO);
+        glGenBuffers(1, &this->ObjectIds);
+        Resources().Created(RESOURCE_VERTEX_ARRAY, this->VAO, "scene");
+        Resources().Created(RESOURCE_BUFFER, this->ObjectIds, "scene object ids", sizeof(GLuint) * ids.size());
+        glBindVertexArray(this->VAO);
+
+        glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+        // Position attribute
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)0);
+        glEnableVertexAttribArray(0);
+        // TexCoord attribute
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
+        glEnableVertexAttribArray(2);
+
+        // Object id attribute, advanced once per instance
+        glBindBuffer(GL_ARRAY_BUFFER, this->ObjectIds);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * ids.size(), ids.data(), GL_STATIC_DRAW);
+        glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, sizeof(GLuint), (GLvoid*)0);
+        glVertexAttribDivisor(3, 1);
+        glEnableVertexAttribArray(3);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glGenBuffers(1, &this->ObjectBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->ObjectBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GpuObject) * this->Objects.size(), this->Objects.data(), GL_DYNAMIC_DRAW);
+        Resources().Created(RESOURCE_BUFFER, this->ObjectBuffer, "scene objects", sizeof(GpuObject) * this->Objects.size());
+        glGenBuffers(1, &this->CommandBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->CommandBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(DrawElementsIndirectCommand) * this->Objects.size(), NULL, GL_DYNAMIC_COPY);
+        Resources().Created(RESOURCE_BUFFER, this->CommandBuffer, "scene draw commands", sizeof(DrawElementsIndirectCommand) * this->Objects.size());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        this->DirtyBegin = this->DirtyEnd = 0;
+    }
+
+    // Uploads up to budget bytes of geometry, returns true once the scene can be drawn
+    bool UploadStep(size_t& budget)
+    {
+        bool done = this->VertexUpload.Step(budget);
+        done = this->IndexUpload.Step(budget) && done;
+        if (done && !this->Vertices.empty())
+        {
+            // The geometry now lives on the GPU
+            std::vector<GLfloat>().swap(this->Vertices);
+            std::vector<GLuint>().swap(this->Indices);
+            Resources().CpuAllocation(this, "scene upload staging", 0);
+        }
+        return done;
+    }
+
+    // Culls and draws the whole scene: one dispatch and one multi draw, whatever the object count.
+    // reversedZ tells that projection comes from ReversedPerspective.
+    void Draw(const glm::mat4& view, const glm::mat4& projection, GLuint textureArray, bool litTerrain, bool reversedZ = false)
+    {
+        GLuint count = this->ObjectCount();
+        if (this->VAO == 0 || count == 0 || !this->VertexUpload.Done() || !this->IndexUpload.Done())
+            return;
+        // Pick up programs rebuilt by a shader reload
+        if (this->Shaders->Generation != this->ShaderGeneration)
+        {
+            this->ShaderGeneration = this->Shaders->Generation;
+            this->DrawProgram = this->Shaders->Program("shaders/gpu_scene.vs", "shaders/gpu_scene.frag");
+            this->CullProgram = this->Shaders->Program({ { GL_COMPUTE_SHADER, "shaders/cull.comp" } });
+        }
+        if (this->DrawProgram == 0 || this->CullProgram == 0)
+            return;
+
+        // Upload the objects that moved since the last frame
+        if (this->DirtyBegin != this->DirtyEnd)
+        {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->ObjectBuffer);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(GpuObject) * this->DirtyBegin,
+                            sizeof(GpuObject) * (this->DirtyEnd - this->DirtyBegin), &this->Objects[this->DirtyBegin]);
+            this->DirtyBegin = this->DirtyEnd = 0;
+        }
+
+        // 1. Frustum cull on the GPU, writing one command per object
+        Frustum frustum(projection * view, reversedZ);
+        glUseProgram(this->CullProgram);
+        glUniform4fv(glGetUniformLocation(this->CullProgram, "frustumPlanes"), 6, glm::value_ptr(frustum.Planes[0]));
+        glUniform1ui(glGetUniformLocation(this->CullProgram, "objectCount"), count);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, this->ObjectBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, this->CommandBuffer);
+        glDispatchCompute((count + 63) / 64, 1, 1);
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+        // 2. Submit every command at once
+        glUseProgram(this->DrawProgram);
+        glUniformMatrix4fv(glGetUniformLocation(this->DrawProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(this->DrawProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        glUniform1i(glGetUniformLocation(this->DrawProgram, "sceneTextures"), 0);
+        glUniform1i(glGetUniformLocation(this->DrawProgram, "litTerrain"), litTerrain);
+        glUniform3f(glGetUniformLocation(this->DrawProgram, "sunDirection"), 0.4f, 1.0f, 0.3f);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textureArray);
+        glBindVertexArray(this->VAO);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->CommandBuffer);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (GLvoid*)0, count, 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        glBindVertexArray(0);
+    }
+
+private:
+    GLuint VAO, VBO, EBO, ObjectIds, ObjectBuffer, CommandBuffer;
+    GLuint DrawProgram, CullProgram;
+    ShaderCache* Shaders;
+    GLuint ShaderGeneration;
+    StagedBuffer VertexUpload, IndexUpload;
+    // CPU copies, the geometry is released after Upload
+    std::vector<GLfloat> Vertices;
+    std::vector<GLuint> Indices;
+    std::vector<GpuObject> Objects;
+    GLuint DirtyBegin, DirtyEnd;
+};
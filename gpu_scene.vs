@@ -0,0 +1,44 @@
+#version 430 core
+layout (location = 0) in vec3 position;
+layout (location = 2) in vec2 texCoord;
+layout (location = 3) in uint objectId;   // instanced, equals the command's base instance
+
+struct Object
+{
+    mat4 model;
+    vec4 boundsMin;
+    vec4 boundsMax;
+    uint firstIndex;
+    uint indexCount;
+    int baseVertex;
+    uint layerA;
+    uint layerB;
+    uint flags;
+    float blend;
+    uint padding;
+};
+
+layout (std430, binding = 0) readonly buffer Objects { Object objects[]; };
+
+out vec2 TexCoord;
+out vec3 WorldPos;
+flat out uint LayerA;
+flat out uint LayerB;
+flat out uint Flags;
+flat out float Blend;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+void main()
+{
+    Object object = objects[objectId];
+    vec4 world = object.model * vec4(position, 1.0f);
+    gl_Position = projection * view * world;
+    TexCoord = vec2(texCoord.x, 1.0 - texCoord.y);
+    WorldPos = world.xyz;
+    LayerA = object.layerA;
+    LayerB = object.layerB;
+    Flags = object.flags;
+    Blend = object.blend;
+}
@@ -0,0 +1,292 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// GL Includes
+#include <GL/glew.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define HEIGHT_TILES_SSE 1
+#endif
+
+// Samples along each side of a compressed tile
+const int HEIGHT_TILE_SIZE = 64;
+// Decoded tiles kept for height queries, 16 KB each
+const int HEIGHT_TILE_CACHE = 64;
+// Residuals sharing one bit width
+const int HEIGHT_TILE_GROUP = 16;
+
+
+// A height raster kept compressed in memory. The integer samples of the source, 8 or 16 bit, are
+// cut into tiles that are coded on their own: each sample is predicted from the plane through its
+// left, upper and upper left neighbours, and the residuals are zigzag coded and bit packed in
+// groups of HEIGHT_TILE_GROUP, each group as wide as its largest residual. Smooth terrain needs
+// a few bits per sample instead of the 32 of a float.
+//
+// Decoding undoes the predictor a row at a time: the upper row's part is added to the residuals,
+// then a prefix sum along the row restores the samples, eight at a time with SSE2. Point and range
+// queries go through a small cache of decoded tiles, least recently used first out; bulk readers
+// decode tiles straight into their own buffers. The compressed data never changes once built, so
+// any thread may read it, and the cache is locked.
+class HeightTiles
+{
+public:
+    int Width, Height;
+    int TilesX, TilesY;
+
+    HeightTiles() : Width(0), Height(0), TilesX(0), TilesY(0), Scale(0.0f), Clock(0)
+    {
+        for (int i = 0; i < HEIGHT_TILE_CACHE; i++)
+        {
+            this->CacheTile[i] = -1;
+            this->CacheUse[i] = 0;
+        }
+    }
+
+    // Compresses width x height row major codes in [0,maxCode]; samples read back as code / maxCode
+    template <typename Code>
+    void Compress(const Code* codes, int width, int height, GLuint maxCode)
+    {
+        this->Width = width;
+        this->Height = height;
+        this->TilesX = (width + HEIGHT_TILE_SIZE - 1) / HEIGHT_TILE_SIZE;
+        this->TilesY = (height + HEIGHT_TILE_SIZE - 1) / HEIGHT_TILE_SIZE;
+        this->Scale = 1.0f / GLfloat(maxCode);
+        this->Data.clear();
+        this->Offsets.assign(1, 0);
+        this->SlotOfTile.assign(size_t(this->TilesX) * this->TilesY, -1);
+
+        uint16_t up[HEIGHT_TILE_SIZE], residuals[HEIGHT_TILE_SIZE];
+        for (int ty = 0; ty < this->TilesY; ty++)
+        {
+            for (int tx = 0; tx < this->TilesX; tx++)
+            {
+                int tileWidth, tileHeight;
+                this->TileSize(tx, ty, tileWidth, tileHeight);
+                memset(up, 0, sizeof(up));
+                for (int i = 0; i < tileHeight; i++)
+                {
+                    const Code* row = codes + size_t(ty * HEIGHT_TILE_SIZE + i) * width + tx * HEIGHT_TILE_SIZE;
+                    uint16_t left = 0, upLeft = 0;
+                    memset(residuals, 0, sizeof(residuals));
+                    for (int j = 0; j < tileWidth; j++)
+                    {
+                        uint16_t value = uint16_t(row[j]);
+                        int16_t residual = int16_t(uint16_t(value - (left + up[j] - upLeft)));
+                        residuals[j] = uint16_t((uint16_t(residual) << 1) ^ (residual >> 15));
+                        upLeft = up[j];
+                        left = up[j] = value;
+                    }
+                    this->packRow(residuals, tileWidth);
+                }
+                this->Offsets.push_back(this->Data.size());
+            }
+        }
+        // unpackRow reads whole 64 bit words
+        this->Data.resize(this->Data.size() + 8, 0);
+        this->Data.shrink_to_fit();
+    }
+
+    // Memory held by the compressed samples
+    size_t CompressedBytes() const
+    {
+        return this->Data.size() + this->Offsets.size() * sizeof(size_t);
+    }
+
+    // Samples of a tile, the last ones in each row and column may be smaller
+    void TileSize(int tx, int ty, int& width, int& height) const
+    {
+        width = std::min(HEIGHT_TILE_SIZE, this->Width - tx * HEIGHT_TILE_SIZE);
+        height = std::min(HEIGHT_TILE_SIZE, this->Height - ty * HEIGHT_TILE_SIZE);
+    }
+
+    // Decodes one tile into out, HEIGHT_TILE_SIZE samples per row whatever the tile's width
+    void DecodeTile(int tx, int ty, GLfloat* out) const
+    {
+        int tileWidth, tileHeight;
+        this->TileSize(tx, ty, tileWidth, tileHeight);
+        // Rows start one vector in, so the sample left of the first reads as zero
+        alignas(16) uint16_t rows[2][8 + HEIGHT_TILE_SIZE];
+        memset(rows, 0, sizeof(rows));
+        const uint8_t* data = &this->Data[this->Offsets[size_t(ty) * this->TilesX + tx]];
+        for (int i = 0; i < tileHeight; i++)
+        {
+            uint16_t* row = rows[i & 1] + 8;
+            data = unpackRow(data, row, tileWidth);
+            restoreRow(row, rows[(i + 1) & 1] + 8, tileWidth);
+            GLfloat* target = out + i * HEIGHT_TILE_SIZE;
+            for (int j = 0; j < tileWidth; j++)
+                target[j] = GLfloat(row[j]) * this->Scale;
+        }
+    }
+
+    // Decodes the whole raster, row major
+    void Decode(std::vector<GLfloat>& samples) const
+    {
+        samples.resize(size_t(this->Width) * this->Height);
+        std::vector<GLfloat> tile(HEIGHT_TILE_SIZE * HEIGHT_TILE_SIZE);
+        for (int ty = 0; ty < this->TilesY; ty++)
+        {
+            for (int tx = 0; tx < this->TilesX; tx++)
+            {
+                int tileWidth, tileHeight;
+                this->TileSize(tx, ty, tileWidth, tileHeight);
+                this->DecodeTile(tx, ty, tile.data());
+                for (int i = 0; i < tileHeight; i++)
+                    memcpy(&samples[size_t(ty * HEIGHT_TILE_SIZE + i) * this->Width + tx * HEIGHT_TILE_SIZE],
+                           &tile[i * HEIGHT_TILE_SIZE], tileWidth * sizeof(GLfloat));
+            }
+        }
+    }
+
+    GLfloat At(int row, int col) const
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        const GLfloat* tile = this->cached(col / HEIGHT_TILE_SIZE, row / HEIGHT_TILE_SIZE);
+        return tile[(row % HEIGHT_TILE_SIZE) * HEIGHT_TILE_SIZE + col % HEIGHT_TILE_SIZE];
+    }
+
+    // Lowest and highest sample of the rows and columns [row0,row1] x [col0,col1]
+    void Range(int row0, int col0, int row1, int col1, GLfloat& lowest, GLfloat& highest) const
+    {
+        lowest = 1.0f;
+        highest = 0.0f;
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        for (int ty = row0 / HEIGHT_TILE_SIZE; ty <= row1 / HEIGHT_TILE_SIZE; ty++)
+        {
+            for (int tx = col0 / HEIGHT_TILE_SIZE; tx <= col1 / HEIGHT_TILE_SIZE; tx++)
+            {
+                const GLfloat* tile = this->cached(tx, ty);
+                int i0 = std::max(row0 - ty * HEIGHT_TILE_SIZE, 0), i1 = std::min(row1 - ty * HEIGHT_TILE_SIZE, HEIGHT_TILE_SIZE - 1);
+                int j0 = std::max(col0 - tx * HEIGHT_TILE_SIZE, 0), j1 = std::min(col1 - tx * HEIGHT_TILE_SIZE, HEIGHT_TILE_SIZE - 1);
+                for (int i = i0; i <= i1; i++)
+                {
+                    for (int j = j0; j <= j1; j++)
+                    {
+                        lowest = std::min(lowest, tile[i * HEIGHT_TILE_SIZE + j]);
+                        highest = std::max(highest, tile[i * HEIGHT_TILE_SIZE + j]);
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    GLfloat Scale;
+    std::vector<uint8_t> Data;
+    // Start of every tile in Data, and the end of the last
+    std::vector<size_t> Offsets;
+
+    // Decoded tiles: the tile in each slot, when it was last used, and the slot of each tile
+    mutable std::mutex Mutex;
+    mutable std::vector<GLfloat> Cache;
+    mutable int CacheTile[HEIGHT_TILE_CACHE];
+    mutable uint64_t CacheUse[HEIGHT_TILE_CACHE];
+    mutable std::vector<int> SlotOfTile;
+    mutable uint64_t Clock;
+
+    // A decoded tile, decoding it over the least recently used one if needed. Mutex must be held.
+    const GLfloat* cached(int tx, int ty) const
+    {
+        const size_t tileSamples = HEIGHT_TILE_SIZE * HEIGHT_TILE_SIZE;
+        if (this->Cache.empty())
+            this->Cache.resize(HEIGHT_TILE_CACHE * tileSamples);
+        int tile = ty * this->TilesX + tx;
+        int slot = this->SlotOfTile[tile];
+        if (slot < 0)
+        {
+            slot = int(std::min_element(this->CacheUse, this->CacheUse + HEIGHT_TILE_CACHE) - this->CacheUse);
+            if (this->CacheTile[slot] >= 0)
+                this->SlotOfTile[this->CacheTile[slot]] = -1;
+            this->CacheTile[slot] = tile;
+            this->SlotOfTile[tile] = slot;
+            this->DecodeTile(tx, ty, &this->Cache[slot * tileSamples]);
+        }
+        this->CacheUse[slot] = ++this->Clock;
+        return &this->Cache[slot * tileSamples];
+    }
+
+    // Appends the zigzag residuals of a row, padded with zeros to whole groups
+    void packRow(const uint16_t* residuals, int count)
+    {
+        for (int g = 0; g < count; g += HEIGHT_TILE_GROUP)
+        {
+            uint16_t widest = 0;
+            for (int k = 0; k < HEIGHT_TILE_GROUP; k++)
+                widest |= residuals[g + k];
+            int bits = 0;
+            while (widest >> bits)
+                bits++;
+            this->Data.push_back(uint8_t(bits));
+            uint64_t accumulator = 0;
+            int pending = 0;
+            for (int k = 0; k < HEIGHT_TILE_GROUP; k++)
+            {
+                accumulator |= uint64_t(residuals[g + k]) << pending;
+                pending += bits;
+                while (pending >= 8)
+                {
+                    this->Data.push_back(uint8_t(accumulator));
+                    accumulator >>= 8;
+                    pending -= 8;
+                }
+            }
+        }
+    }
+
+    // Reads a row packed by packRow into signed residuals, returns the start of the next row
+    static const uint8_t* unpackRow(const uint8_t* data, uint16_t* residuals, int count)
+    {
+        for (int g = 0; g < count; g += HEIGHT_TILE_GROUP)
+        {
+            int bits = *data++;
+            if (bits == 0)
+            {
+                memset(residuals + g, 0, HEIGHT_TILE_GROUP * sizeof(uint16_t));
+                continue;
+            }
+            // A group is 2 * bits bytes, every value lies within one unaligned 64 bit word
+            uint32_t mask = (1u << bits) - 1;
+            for (int k = 0; k < HEIGHT_TILE_GROUP; k++)
+            {
+                int bit = k * bits;
+                uint64_t word;
+                memcpy(&word, data + (bit >> 3), sizeof(word));
+                uint16_t zigzag = uint16_t((word >> (bit & 7)) & mask);
+                residuals[g + k] = uint16_t((zigzag >> 1) ^ -(zigzag & 1));
+            }
+            data += 2 * bits;
+        }
+        return data;
+    }
+
+    // Turns a row of residuals into samples given the row above: adds up - upLeft to each, then
+    // sums along the row, modulo 2^16 like the predictor. row[-1] and up[-1] are zero.
+    static void restoreRow(uint16_t* row, const uint16_t* up, int count)
+    {
+#ifdef HEIGHT_TILES_SSE
+        __m128i carry = _mm_setzero_si128();
+        for (int j = 0; j < count; j += 8)
+        {
+            __m128i v = _mm_load_si128(reinterpret_cast<const __m128i*>(row + j));
+            v = _mm_add_epi16(v, _mm_load_si128(reinterpret_cast<const __m128i*>(up + j)));
+            v = _mm_sub_epi16(v, _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + j - 1)));
+            v = _mm_add_epi16(v, _mm_slli_si128(v, 2));
+            v = _mm_add_epi16(v, _mm_slli_si128(v, 4));
+            v = _mm_add_epi16(v, _mm_slli_si128(v, 8));
+            v = _mm_add_epi16(v, carry);
+            _mm_store_si128(reinterpret_cast<__m128i*>(row + j), v);
+            carry = _mm_set1_epi16(short(_mm_extract_epi16(v, 7)));
+        }
+#else
+        for (int j = 0; j < count; j++)
+            row[j] = uint16_t(row[j] + up[j] - up[j - 1] + row[j - 1]);
+#endif
+    }
+};
@@ -0,0 +1,129 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <string>
+#include <memory>
+#include <iostream>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// Other Libs
+#include <SOIL.h>
+
+#include "tile_archive.h"
+#include "height_tiles.h"
+
+// Largest side of a heightmap taken from a tile archive, the viewer meshes the whole map at once
+const uint32_t HEIGHTMAP_ARCHIVE_MAX_SIDE = 2049;
+
+
+// Height samples of a terrain, normalised to [0,1]. They are held compressed; single samples
+// and ranges go through the decoded tile cache, builders that read everything decode whole
+// tiles or the whole map. Copies share the samples, which never change after loading.
+struct Heightmap
+{
+    int Width;
+    int Height;
+    std::shared_ptr<HeightTiles> Tiles;
+
+    Heightmap() : Width(0), Height(0) {}
+
+    // Compresses width x height row major codes, maxCode being the brightest
+    template <typename Code>
+    void Assign(const Code* codes, int width, int height, GLuint maxCode)
+    {
+        this->Tiles = std::make_shared<HeightTiles>();
+        this->Tiles->Compress(codes, width, height, maxCode);
+        this->Width = width;
+        this->Height = height;
+    }
+
+    GLfloat At(int row, int col) const
+    {
+        return this->Tiles->At(row, col);
+    }
+
+    // Lowest and highest sample of the rows and columns [row0,row1] x [col0,col1]
+    void Range(int row0, int col0, int row1, int col1, GLfloat& lowest, GLfloat& highest) const
+    {
+        this->Tiles->Range(row0, col0, row1, col1, lowest, highest);
+    }
+
+    // Every sample decoded, row major, for uploads that need the whole map
+    void Decode(std::vector<GLfloat>& samples) const
+    {
+        this->Tiles->Decode(samples);
+    }
+
+    // Position of a sample in the model space of the height map mesh. x and z span [-1,1] and
+    // brighter samples sit lower, so y ranges over [-1,-0.5].
+    glm::vec3 Vertex(int row, int col) const
+    {
+        return this->Position(row, col, this->At(row, col));
+    }
+
+    // Position of a sample of the given height, for readers that decoded it themselves
+    glm::vec3 Position(int row, int col, GLfloat height) const
+    {
+        GLfloat fScaleC = GLfloat(col) / GLfloat(this->Width - 1);
+        GLfloat fScaleR = GLfloat(row) / GLfloat(this->Height - 1);
+        return glm::vec3(fScaleC * 2.0f - 1.0f, -height / 2.0f - 0.5f, fScaleR * 2.0f - 1.0f);
+    }
+
+    // Texture coordinate of a sample, the whole map is covered by one image
+    glm::vec2 TexCoord(int row, int col) const
+    {
+        return glm::vec2(GLfloat(col) / GLfloat(this->Width - 1), GLfloat(row) / GLfloat(this->Height - 1));
+    }
+};
+
+// Loads the finest level of a tile archive written by the preprocessor that still fits
+// HEIGHTMAP_ARCHIVE_MAX_SIDE, rescaled to [0,1] over the range of the source and kept at the
+// archive's 16 bit precision
+inline bool LoadHeightmapArchive(const char* path, Heightmap& heightmap)
+{
+    TileArchive archive;
+    if (!archive.Open(path))
+        return false;
+    int level = 0;
+    while (level + 1 < int(archive.Header.Levels) &&
+           std::max(archive.LevelWidth(level), archive.LevelHeight(level)) > HEIGHTMAP_ARCHIVE_MAX_SIDE)
+        level++;
+    std::vector<float> samples;
+    int width, height;
+    if (!archive.ReadLevel(level, samples, width, height))
+    {
+        std::cout << "ERROR::HEIGHTMAP::LOAD_FAILED " << path << std::endl;
+        heightmap.Width = heightmap.Height = 0;
+        return false;
+    }
+    std::vector<uint16_t> codes(samples.size());
+    for (size_t i = 0; i < samples.size(); i++)
+        codes[i] = uint16_t(std::min(std::max(samples[i], 0.0f), 1.0f) * 65535.0f + 0.5f);
+    heightmap.Assign(codes.data(), width, height, 65535);
+    return true;
+}
+
+// Loads an 8 bit intensity map. 1 channel is forced so RGB images can be used as well, and the
+// values in [0,255] are rescaled to [0,1]. Tile archives (.hta) are read by LoadHeightmapArchive.
+inline bool LoadHeightmap(const char* path, Heightmap& heightmap)
+{
+    std::string name(path);
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".hta") == 0)
+        return LoadHeightmapArchive(path, heightmap);
+    int width, height, channels;
+    unsigned char* ht_map = SOIL_load_image(path, &width, &height, &channels, SOIL_LOAD_L);
+    if (!ht_map)
+    {
+        std::cout << "ERROR::HEIGHTMAP::LOAD_FAILED " << path << std::endl;
+        heightmap.Width = heightmap.Height = 0;
+        return false;
+    }
+    // The bytes are compressed as they are, nothing else of the image stays resident
+    heightmap.Assign(ht_map, width, height, 255);
+    SOIL_free_image_data(ht_map);
+    return true;
+}
@@ -0,0 +1,268 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define HORIZON_SSE 1
+#endif
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "heightmap.h"
+#include "thread_pool.h"
+#include "resource_registry.h"
+
+// Azimuths a horizon is found in, 45 degrees apart, the first along +x and the third along +z
+const int HORIZON_DIRECTIONS = 8;
+// Samples along the side of a tile baked as one job
+const int HORIZON_TILE = 64;
+// Taps along a direction: every sample up to HORIZON_NEAR_TAPS away, then eight taps per
+// doubling of the distance out to HORIZON_REACH samples
+const int HORIZON_NEAR_TAPS = 16;
+const int HORIZON_REACH = 256;
+// Shortest time between two bakes in the viewer while the heights keep changing
+const GLfloat HORIZON_REFRESH_SECONDS = 0.5f;
+
+
+// Horizons of a heightmap: for every sample and each of eight azimuths, the sine of the
+// elevation angle of the highest terrain seen in that direction. The terrain shader derives
+// ambient occlusion from the mean of the eight and sun shadowing from the two around the sun's
+// azimuth, so lighting costs two texture fetches instead of rays.
+//
+// A direction steps a whole number of rows and columns at a time, so the taps of a row of
+// samples are a row of the heightmap too: the rise to each tap is taken for four samples at a
+// time with SSE2 when the compiler has it, and the steepest kept. Taps are dense nearby and
+// sparse further out. Tiles of HORIZON_TILE samples are baked in parallel; Update marks the
+// tiles within HORIZON_REACH of changed samples and Bake redoes only those.
+//
+// The sines are bytes, four azimuths to a texel, in the two layers of an RGBA8 texture array.
+class HorizonMap
+{
+public:
+    int Width, Height;
+    // Layer l holds azimuths 4l to 4l + 3, each row major with four bytes a sample
+    std::vector<uint8_t> Sines;
+    // Time taken by the last Bake, the tiles it baked, and the rows and columns it covered
+    double Milliseconds;
+    int TilesBaked;
+    glm::ivec4 Baked;
+    // Texture array of the sines, 0 until uploaded
+    GLuint Texture;
+
+    HorizonMap() : Width(0), Height(0), Milliseconds(0.0), TilesBaked(0), Texture(0), TilesX(0), TilesY(0), Uploaded(true)
+    {
+        for (int k = 1; k <= HORIZON_NEAR_TAPS; k++)
+            this->Taps.push_back(k);
+        for (int step = 2; this->Taps.back() < HORIZON_REACH; step *= 2)
+            for (int k = 0; k < 8 && this->Taps.back() < HORIZON_REACH; k++)
+                this->Taps.push_back(this->Taps.back() + step);
+    }
+
+    bool Loaded() const
+    {
+        return this->Width > 0;
+    }
+
+    // Copies the heights, every tile waits for the first Bake
+    void Load(const Heightmap& heightmap)
+    {
+        this->Width = heightmap.Width;
+        this->Height = heightmap.Height;
+        heightmap.Decode(this->Elevations);
+        for (float& sample : this->Elevations)
+            sample = -0.5f * sample;
+        this->Sines.assign(size_t(this->Width) * this->Height * HORIZON_DIRECTIONS, 0);
+        this->TilesX = (this->Width + HORIZON_TILE - 1) / HORIZON_TILE;
+        this->TilesY = (this->Height + HORIZON_TILE - 1) / HORIZON_TILE;
+        this->Dirty.assign(size_t(this->TilesX) * this->TilesY, 1);
+        Resources().CpuAllocation(this, "horizon map", this->Elevations.size() * sizeof(float) + this->Sines.size());
+    }
+
+    // Frees the heights, the sines and the texture
+    void Clear()
+    {
+        std::vector<float>().swap(this->Elevations);
+        std::vector<uint8_t>().swap(this->Sines);
+        std::vector<uint8_t>().swap(this->Dirty);
+        this->Width = this->Height = this->TilesX = this->TilesY = 0;
+        Resources().CpuAllocation(this, "horizon map", 0);
+        this->Release();
+    }
+
+    // Copies the samples of rows [row0,row1) and columns [col0,col1) from heightAt(row, col)
+    // and marks the tiles close enough to see them
+    template <typename HeightAt>
+    void Update(int row0, int col0, int row1, int col1, HeightAt heightAt)
+    {
+        for (int row = row0; row < row1; row++)
+            for (int col = col0; col < col1; col++)
+                this->Elevations[size_t(row) * this->Width + col] = -0.5f * heightAt(row, col);
+        int ty0 = std::max(row0 - HORIZON_REACH, 0) / HORIZON_TILE, ty1 = std::min(row1 - 1 + HORIZON_REACH, this->Height - 1) / HORIZON_TILE;
+        int tx0 = std::max(col0 - HORIZON_REACH, 0) / HORIZON_TILE, tx1 = std::min(col1 - 1 + HORIZON_REACH, this->Width - 1) / HORIZON_TILE;
+        for (int ty = ty0; ty <= ty1; ty++)
+            for (int tx = tx0; tx <= tx1; tx++)
+                this->Dirty[ty * this->TilesX + tx] = 1;
+    }
+
+    // Bakes the marked tiles on the pool. False when nothing had changed.
+    bool Bake(ThreadPool& pool)
+    {
+        std::vector<int> dirty;
+        for (int t = 0; t < int(this->Dirty.size()); t++)
+            if (this->Dirty[t])
+                dirty.push_back(t);
+        if (dirty.empty())
+            return false;
+        auto start = std::chrono::steady_clock::now();
+        pool.ParallelFor(int(dirty.size()), [&](int i) { this->bakeTile(dirty[i]); });
+        // Rows and columns the baked tiles span, for the upload
+        glm::ivec4 baked(this->Height, this->Width, 0, 0);
+        for (int t : dirty)
+        {
+            int ty = t / this->TilesX, tx = t % this->TilesX;
+            baked = glm::ivec4(std::min(baked.x, ty * HORIZON_TILE), std::min(baked.y, tx * HORIZON_TILE),
+                std::max(baked.z, std::min((ty + 1) * HORIZON_TILE, this->Height)), std::max(baked.w, std::min((tx + 1) * HORIZON_TILE, this->Width)));
+            this->Dirty[t] = 0;
+        }
+        // Rows and columns still waiting for an upload stay in it
+        this->Baked = this->Uploaded ? baked : glm::ivec4(std::min(baked.x, this->Baked.x), std::min(baked.y, this->Baked.y),
+            std::max(baked.z, this->Baked.z), std::max(baked.w, this->Baked.w));
+        this->Uploaded = false;
+        std::chrono::duration<double, std::milli> milliseconds = std::chrono::steady_clock::now() - start;
+        this->Milliseconds = milliseconds.count();
+        this->TilesBaked = int(dirty.size());
+        return true;
+    }
+
+    // Uploads what the bakes since the last upload changed, the whole map the first time
+    void Upload()
+    {
+        if (!this->Texture)
+        {
+            glGenTextures(1, &this->Texture);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, this->Texture);
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, this->Width, this->Height, HORIZON_DIRECTIONS / 4, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            Resources().Created(RESOURCE_TEXTURE, this->Texture, "horizon map", TextureBytes(this->Width, this->Height, 4, false, HORIZON_DIRECTIONS / 4));
+            this->Baked = glm::ivec4(0, 0, this->Height, this->Width);
+        }
+        else
+            glBindTexture(GL_TEXTURE_2D_ARRAY, this->Texture);
+        if (this->Baked.z > this->Baked.x && this->Baked.w > this->Baked.y)
+        {
+            // A window of rows of the layers as they lie in Sines
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, this->Width);
+            glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, this->Height);
+            glPixelStorei(GL_UNPACK_SKIP_ROWS, this->Baked.x);
+            glPixelStorei(GL_UNPACK_SKIP_PIXELS, this->Baked.y);
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, this->Baked.y, this->Baked.x, 0, this->Baked.w - this->Baked.y, this->Baked.z - this->Baked.x,
+                HORIZON_DIRECTIONS / 4, GL_RGBA, GL_UNSIGNED_BYTE, this->Sines.data());
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+            glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, 0);
+            glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+            glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        this->Uploaded = true;
+    }
+
+    // Binds the texture to unit 4 of a program built with HORIZON_SHADING
+    void SetUniforms(GLuint program) const
+    {
+        glUniform1i(glGetUniformLocation(program, "horizonMap"), 4);
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, this->Texture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // Sine of the horizon of a sample in one of the azimuths, 0 when the sky is open down to level
+    GLfloat Sine(int row, int col, int direction) const
+    {
+        size_t layer = size_t(direction / 4) * this->Width * this->Height;
+        return this->Sines[(layer + size_t(row) * this->Width + col) * 4 + direction % 4] / 255.0f;
+    }
+
+    // Deletes the texture, must run while the context is still current
+    void Release()
+    {
+        if (this->Texture)
+        {
+            Resources().Deleted(RESOURCE_TEXTURE, this->Texture);
+            glDeleteTextures(1, &this->Texture);
+        }
+        this->Texture = 0;
+    }
+
+private:
+    // Heights turned into elevations in the model space of the mesh, up being up
+    std::vector<float> Elevations;
+    std::vector<int> Taps;
+    int TilesX, TilesY;
+    std::vector<uint8_t> Dirty;
+    // Whether Baked was uploaded since the last Bake
+    bool Uploaded;
+
+    void bakeTile(int t)
+    {
+        static const int steps[HORIZON_DIRECTIONS][2] = { { 1, 0 }, { 1, 1 }, { 0, 1 }, { -1, 1 }, { -1, 0 }, { -1, -1 }, { 0, -1 }, { 1, -1 } };
+        int ty = t / this->TilesX, tx = t % this->TilesX;
+        int row0 = ty * HORIZON_TILE, row1 = std::min(row0 + HORIZON_TILE, this->Height);
+        int col0 = tx * HORIZON_TILE, col1 = std::min(col0 + HORIZON_TILE, this->Width);
+        // Samples are 2 / (side - 1) apart in model space
+        float spacingX = 2.0f / float(this->Width - 1), spacingZ = 2.0f / float(this->Height - 1);
+        float steepest[HORIZON_TILE];
+        for (int d = 0; d < HORIZON_DIRECTIONS; d++)
+        {
+            int dc = steps[d][0], dr = steps[d][1];
+            float stepLength = std::sqrt(float(dc * dc) * spacingX * spacingX + float(dr * dr) * spacingZ * spacingZ);
+            for (int row = row0; row < row1; row++)
+            {
+                std::fill(steepest, steepest + (col1 - col0), 0.0f);
+                const float* here = &this->Elevations[size_t(row) * this->Width];
+                for (int k : this->Taps)
+                {
+                    int tapRow = row + k * dr;
+                    if (tapRow < 0 || tapRow >= this->Height)
+                        break;
+                    // Columns whose tap is still on the map
+                    int first = std::max(col0, -k * dc), last = std::min(col1, this->Width - k * dc);
+                    if (first >= last)
+                        break;
+                    const float* there = &this->Elevations[size_t(tapRow) * this->Width] + k * dc;
+                    float inverse = 1.0f / (float(k) * stepLength);
+                    float* best = steepest - col0;
+                    int col = first;
+#ifdef HORIZON_SSE
+                    __m128 scale = _mm_set1_ps(inverse);
+                    for (; col + 4 <= last; col += 4)
+                    {
+                        __m128 rise = _mm_sub_ps(_mm_loadu_ps(there + col), _mm_loadu_ps(here + col));
+                        _mm_storeu_ps(best + col, _mm_max_ps(_mm_loadu_ps(best + col), _mm_mul_ps(rise, scale)));
+                    }
+#endif
+                    for (; col < last; col++)
+                        best[col] = std::max(best[col], (there[col] - here[col]) * inverse);
+                }
+                // The steepest slope as the sine of its angle, in a byte
+                size_t layer = size_t(d / 4) * this->Width * this->Height;
+                uint8_t* out = &this->Sines[(layer + size_t(row) * this->Width + col0) * 4 + d % 4];
+                for (int i = 0; i < col1 - col0; i++)
+                {
+                    float slope = steepest[i];
+                    out[i * 4] = uint8_t(255.0f * slope / std::sqrt(1.0f + slope * slope) + 0.5f);
+                }
+            }
+        }
+    }
+};
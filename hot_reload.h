@@ -0,0 +1,161 @@
+#pragma once
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+
+#include "file_watcher.h"
+#include "thread_pool.h"
+
+
+// Runs on the main thread at frame boundaries to swap a rebuilt resource in. It receives the
+// upload budget left for the frame, takes what it uses off it, and returns true once the new
+// resource has replaced the old one. Until then the old resource keeps being drawn.
+typedef std::function<bool(size_t& budget)> ReloadApply;
+// Rebuilds a resource from its file. Returns an empty function when the rebuild failed, in which
+// case the old resource simply stays in place.
+typedef std::function<ReloadApply()> ReloadPrepare;
+
+
+// Rebuilds resources in the background when their files change. Decoding and mesh generation run
+// on the thread pool, and the finished GPU resources are uploaded within a per frame byte budget
+// and swapped in between two frames, so a reload never makes a frame spike.
+class HotReloader
+{
+public:
+    // Bytes uploaded to the GPU per frame by all reloads together
+    size_t FrameBudget;
+
+    HotReloader(ThreadPool& pool, size_t frameBudget = 8 << 20) : FrameBudget(frameBudget), Pool(pool), Running(0) {}
+
+    // Waits for the rebuilds still running on the workers
+    ~HotReloader()
+    {
+        while (this->Running.load() > 0)
+            std::this_thread::yield();
+    }
+
+    // Rebuilds the resource with prepare on a worker thread whenever the file changes
+    void Watch(const std::string& path, ReloadPrepare prepare)
+    {
+        this->Watcher.Watch(path);
+        this->Prepare[path] = prepare;
+        this->MainThread.erase(path);
+    }
+
+    // For resources that need the GL context from the very start (shaders): prepare runs on the
+    // main thread and should only kick the work off, its apply step then polls for completion
+    void WatchOnMainThread(const std::string& path, ReloadPrepare prepare)
+    {
+        this->Watch(path, prepare);
+        this->MainThread.insert(path);
+    }
+
+    // Call once per frame before rendering
+    void Update()
+    {
+        auto now = std::chrono::steady_clock::now();
+
+        // 1. Collect changes. Saves often arrive as several events, so a file must stay quiet
+        //    for a moment before it is rebuilt.
+        std::vector<std::string> changed;
+        this->Watcher.Poll(changed);
+        for (const std::string& path : changed)
+            this->Changed[path] = now;
+        for (auto it = this->Changed.begin(); it != this->Changed.end(); )
+        {
+            if (now - it->second < std::chrono::milliseconds(250) || this->Busy.count(it->first))
+            {
+                ++it;
+                continue;
+            }
+            this->start(it->first);
+            it = this->Changed.erase(it);
+        }
+
+        // 2. Take over the rebuilds that finished on the workers
+        {
+            std::lock_guard<std::mutex> lock(this->Mutex);
+            for (auto& ready : this->Ready)
+            {
+                if (ready.second)
+                    this->Applying.push_back(ready);
+                else
+                    this->Busy.erase(ready.first);
+            }
+            this->Ready.clear();
+        }
+
+        // 3. Advance the swaps within this frame's budget
+        size_t budget = this->FrameBudget;
+        for (auto it = this->Applying.begin(); it != this->Applying.end(); )
+        {
+            if (it->second(budget))
+            {
+                std::cout << "Reloaded " << it->first << std::endl;
+                this->Busy.erase(it->first);
+                it = this->Applying.erase(it);
+            }
+            else
+                ++it;
+        }
+    }
+
+private:
+    ThreadPool& Pool;
+    FileWatcher Watcher;
+    std::map<std::string, ReloadPrepare> Prepare;
+    std::set<std::string> MainThread;
+    std::map<std::string, std::chrono::steady_clock::time_point> Changed;
+    // Files with a rebuild running or waiting to be swapped in
+    std::set<std::string> Busy;
+    std::vector<std::pair<std::string, ReloadApply>> Applying;
+    // Rebuilds handed back by the workers
+    std::mutex Mutex;
+    std::vector<std::pair<std::string, ReloadApply>> Ready;
+    std::atomic<int> Running;
+
+    void start(const std::string& path)
+    {
+        ReloadPrepare prepare = this->Prepare[path];
+        this->Busy.insert(path);
+        if (this->MainThread.count(path))
+        {
+            this->finishPrepare(path, prepare());
+            return;
+        }
+        this->Running++;
+        this->Pool.Submit([this, path, prepare]
+        {
+            ReloadApply apply;
+            try
+            {
+                apply = prepare();
+            }
+            catch (const std::exception& e)
+            {
+                std::cout << "ERROR::RELOAD " << path << ": " << e.what() << std::endl;
+            }
+            this->finishPrepare(path, apply);
+            this->Running--;
+        });
+    }
+
+    void finishPrepare(const std::string& path, ReloadApply apply)
+    {
+        if (!apply)
+            std::cout << "Reload of " << path << " failed, keeping the current version" << std::endl;
+        // A failed rebuild is handed back empty, which only marks the file as idle again
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        this->Ready.push_back(std::make_pair(path, apply));
+    }
+};
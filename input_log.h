@@ -0,0 +1,226 @@
+#pragma once
+
+// Std. Includes
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+// GL Includes
+#include <GL/glew.h>
+
+// GLFW
+#include <GLFW/glfw3.h>
+
+
+// Handlers the recorded input is replayed into, the same functions GLFW calls
+typedef void (*KeyHandler)(GLFWwindow*, int, int, int, int);
+typedef void (*PositionHandler)(GLFWwindow*, double, double);
+
+enum Input_Event
+{
+    INPUT_FRAME = 1,	// start of a frame: its time on the clock of the recording
+    INPUT_KEY,
+    INPUT_CURSOR,
+    INPUT_SCROLL
+};
+
+
+// Records the input of a session to a compact binary file, or plays one back. A recording is a
+// list of frames, each with its time and the events polled during it. On replay the clock is
+// virtual: every frame gets the recorded time whatever the real frame rate, and the events are
+// fed to the handlers on the frame they arrived. Two replays of one file take the same path.
+//
+// File: "HMIN", version, then records of one type byte and a little endian payload
+//   frame   f32 time
+//   key     i16 key, i16 scancode, u8 action, u8 mods
+//   cursor  f32 x, f32 y
+//   scroll  f32 x, f32 y
+class InputLog
+{
+public:
+    InputLog() : Ended(false), Frames(0), File(NULL), Mode(IDLE), Pending(0), LastTime(0.0f) {}
+
+    ~InputLog()
+    {
+        if (this->File)
+            fclose(this->File);
+    }
+
+    bool Recording() const { return this->Mode == RECORDING; }
+    bool Replaying() const { return this->Mode == REPLAYING; }
+    // Set once a replay has used up its last frame
+    bool Ended;
+    // Frames recorded or replayed so far
+    size_t Frames;
+
+    bool StartRecording(const char* path)
+    {
+        this->File = fopen(path, "wb");
+        if (!this->File)
+        {
+            std::cout << "ERROR::INPUT::RECORD_FAILED " << path << std::endl;
+            return false;
+        }
+        uint32_t version = VERSION;
+        fwrite(MAGIC, 1, 4, this->File);
+        fwrite(&version, sizeof(version), 1, this->File);
+        this->Mode = RECORDING;
+        return true;
+    }
+
+    bool StartReplay(const char* path)
+    {
+        FILE* file = fopen(path, "rb");
+        char magic[4];
+        uint32_t version = 0;
+        if (!file || fread(magic, 1, 4, file) != 4 || memcmp(magic, MAGIC, 4) != 0 ||
+            fread(&version, sizeof(version), 1, file) != 1 || version != VERSION)
+        {
+            std::cout << "ERROR::INPUT::NOT_A_RECORDING " << path << std::endl;
+            if (file)
+                fclose(file);
+            return false;
+        }
+        this->File = file;
+        this->Mode = REPLAYING;
+        // The first record is always a frame
+        this->Pending = this->readRecord();
+        return true;
+    }
+
+    // Recording: starts a frame at the given time
+    void BeginFrame(GLfloat time)
+    {
+        this->writeByte(INPUT_FRAME);
+        this->writeFloat(time);
+        this->Frames++;
+    }
+
+    // Replay: returns the time of the next frame and feeds its events to the handlers
+    GLfloat ReplayFrame(GLFWwindow* window, KeyHandler key, PositionHandler cursor, PositionHandler scroll)
+    {
+        if (this->Pending != INPUT_FRAME)
+        {
+            this->Ended = true;
+            return this->LastTime;
+        }
+        this->LastTime = this->readFloat();
+        this->Frames++;
+        for (this->Pending = this->readRecord(); this->Pending != 0 && this->Pending != INPUT_FRAME; this->Pending = this->readRecord())
+        {
+            if (this->Pending == INPUT_KEY)
+            {
+                int16_t code[2];
+                uint8_t state[2];
+                this->read(code, sizeof(code));
+                this->read(state, sizeof(state));
+                key(window, code[0], code[1], state[0], state[1]);
+            }
+            else
+            {
+                GLfloat x = this->readFloat(), y = this->readFloat();
+                (this->Pending == INPUT_CURSOR ? cursor : scroll)(window, x, y);
+            }
+        }
+        return this->LastTime;
+    }
+
+    void Key(int key, int scancode, int action, int mods)
+    {
+        int16_t code[2] = { int16_t(key), int16_t(scancode) };
+        uint8_t state[2] = { uint8_t(action), uint8_t(mods) };
+        this->writeByte(INPUT_KEY);
+        fwrite(code, sizeof(code), 1, this->File);
+        fwrite(state, sizeof(state), 1, this->File);
+    }
+
+    void Cursor(GLfloat x, GLfloat y)
+    {
+        this->writeByte(INPUT_CURSOR);
+        this->writeFloat(x);
+        this->writeFloat(y);
+    }
+
+    void Scroll(GLfloat x, GLfloat y)
+    {
+        this->writeByte(INPUT_SCROLL);
+        this->writeFloat(x);
+        this->writeFloat(y);
+    }
+
+private:
+    enum LogMode { IDLE, RECORDING, REPLAYING };
+    static constexpr const char* MAGIC = "HMIN";
+    static const uint32_t VERSION = 1;
+
+    FILE* File;
+    LogMode Mode;
+    // Type of the record read ahead, 0 at the end of the file
+    int Pending;
+    GLfloat LastTime;
+
+    void writeByte(uint8_t value)
+    {
+        fwrite(&value, 1, 1, this->File);
+    }
+
+    void writeFloat(GLfloat value)
+    {
+        fwrite(&value, sizeof(value), 1, this->File);
+    }
+
+    bool read(void* data, size_t size)
+    {
+        return fread(data, 1, size, this->File) == size;
+    }
+
+    int readRecord()
+    {
+        uint8_t type;
+        return this->read(&type, 1) ? type : 0;
+    }
+
+    GLfloat readFloat()
+    {
+        GLfloat value = 0.0f;
+        this->read(&value, sizeof(value));
+        return value;
+    }
+};
+
+
+// Writes one CSV row per frame: frame number, clock time and real frame time in milliseconds
+class FrameTimeLog
+{
+public:
+    FrameTimeLog() : File(NULL), Frame(0) {}
+
+    ~FrameTimeLog()
+    {
+        if (this->File)
+            fclose(this->File);
+    }
+
+    bool Open(const char* path)
+    {
+        this->File = fopen(path, "w");
+        if (!this->File)
+        {
+            std::cout << "ERROR::FRAMELOG::OPEN_FAILED " << path << std::endl;
+            return false;
+        }
+        fprintf(this->File, "frame,time,frame_ms\n");
+        return true;
+    }
+
+    void Add(GLfloat time, GLfloat frameSeconds)
+    {
+        if (this->File)
+            fprintf(this->File, "%zu,%.6f,%.3f\n", this->Frame++, time, frameSeconds * 1000.0f);
+    }
+
+private:
+    FILE* File;
+    size_t Frame;
+};
@@ -4,6 +4,10 @@
 #include <cmath>
 #include <vector>
 #include <algorithm>    // std::max
+#include <memory>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
 using namespace std;
 
 // GLEW
@@ -22,7 +26,34 @@ using namespace std;
 
 // Other includes
 #include "Camera.h"
-#include "Shader.h"
+#include "shader_cache.h"
+#include "heightmap.h"
+#include "terrain.h"
+#include "texture.h"
+#include "frustum.h"
+#include "gpu_scene.h"
+#include "thread_pool.h"
+#include "occlusion.h"
+#include "hot_reload.h"
+#include "tessellated_terrain.h"
+#include "raymarched_terrain.h"
+#include "scene_geometry.h"
+#include "soft_raster.h"
+#include "batch_render.h"
+#include "input_log.h"
+#include "dynamic_resolution.h"
+#include "query_ring.h"
+#include "virtual_texture.h"
+#include "procedural_terrain.h"
+#include "erosion.h"
+#include "viewshed.h"
+#include "contours.h"
+#include "mesh_export.h"
+#include "resource_registry.h"
+#include "geometry_pool.h"
+#include "scene_store.h"
+#include "horizon.h"
+#include "multi_view.h"
 
 //for convience
 #define FOR(q,n) for(int q=0;q<n;q++)
@@ -31,10 +62,19 @@ using namespace std;
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mode);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
+void live_key_callback(GLFWwindow* window, int key, int scancode, int action, int mode);
+void live_mouse_callback(GLFWwindow* window, double xpos, double ypos);
+void live_scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void do_movement();
+glm::mat4 boxModel(const glm::vec3& position, GLfloat time);
+int renderSoftware(const char* outputPath);
+int erodeHeightmap(const char* inputPath, int iterations, const char* outputPath);
+int exportMesh(const char* inputPath, const char* outputPath, int level, float error);
 
-// Window dimensions
+// Window dimensions at startup, the window can be resized
 const GLuint WIDTH = 1200, HEIGHT = 600;
+// Current size of the default framebuffer
+int framebufferWidth = WIDTH, framebufferHeight = HEIGHT;
 
 // Camera Intialization
 Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
@@ -56,29 +96,176 @@ GLfloat lastY  =  HEIGHT / 2.0;
 GLfloat fov =  45.0f;
 bool keys[1024];
 
+// Shade the terrain with a directional sun, then also with ambient occlusion and shadows from
+//  baked horizons on the mesh terrain (cycled with F)
+bool litTerrain = false;
+bool horizonShading = false;
+// Cull on the GPU and submit the scene with one indirect multi draw (toggled with G)
+bool gpuDriven = false;
+bool gpuDrivenSupported = false;
+// Skip chunks and boxes hidden behind the terrain (toggled with C)
+bool occlusionCulling = true;
+// How the terrain is drawn by the classic path (cycled with T)
+enum TerrainMode
+{
+	TERRAIN_MESH,			// chunked triangle mesh
+	TERRAIN_TESSELLATED,	// patches refined by the tessellation stages, needs GL 4.0
+	TERRAIN_RAYMARCHED,		// one full-screen triangle ray marching the height texture
+	TERRAIN_MODE_COUNT
+};
+const char* TERRAIN_MODE_NAMES[] = { "mesh", "tessellated", "ray marched" };
+TerrainMode terrainMode = TERRAIN_MESH;
+bool terrainModeSupported[TERRAIN_MODE_COUNT] = { true, false, true };
+// Render at a scale of the window that holds the GPU frame time target (toggled with V)
+bool dynamicResolution = true;
+// Reversed-Z: glClipControl's 0..1 depth with near at 1, into a float depth buffer (toggled with Z)
+bool reversedZ = false;
+bool reversedZSupported = false;
+// Lay down the depth of the terrain and boxes before shading them (toggled with X)
+bool depthPrePass = false;
+// Draw the terrain chunks and boxes nearest first (toggled with B)
+bool frontToBack = true;
+// Erode the mesh terrain a few iterations every frame (toggled with H)
+bool eroding = false;
+// Tint the mesh terrain by what can be seen from where the camera was (N computes it, N again hides it)
+bool viewshedShown = false;
+bool viewshedRequested = false;
+// Contour lines over the heightmap, index into CONTOUR_INTERVALS with 0 for none (cycled with M)
+const GLfloat CONTOUR_INTERVALS[] = { 0.0f, 1.0f / 16.0f, 1.0f / 64.0f, 1.0f / 256.0f };
+int contourSpacing = 0;
+// Where the GL objects and CPU allocations are listed as JSON (written with Y, and at exit with --resource-log)
+const char* resourceLogPath = "resources.json";
+bool resourceLogRequested = false;
+// The box picked under the crosshair (Space) or nearest the camera (Tab), moved with the arrow
+//  keys and Page Up/Down and removed with Delete.  Enter places a new box in front of the camera.
+Entity selectedBox = NO_ENTITY;
+bool pickRequested = false, nearestRequested = false, placeRequested = false, removeRequested = false;
+// Materials of the scene store's boxes: the two blended box textures, or the second alone
+const GLuint BOX_MATERIAL = 0, PLACED_MATERIAL = 1;
+// Views drawn each frame: the camera alone, with a minimap, or a stereo pair with it (picked with 1, 2 and 3)
+ViewLayout viewLayout = VIEWS_SINGLE;
+
+// A chunk of the mesh terrain or a box, queued for drawing in order of distance
+struct OrderedDraw
+{
+	GLfloat Distance;
+	GLint Chunk, Box;	// one of them is -1, Box indexes the scene store
+	GLint Tile;			// procedural tile of the chunk, -1 for the heightmap
+	GLuint Views;		// bit per view that sees it
+};
+
 // Deltatime
 GLfloat deltaTime = 0.0f;	// Time between current frame and last frame
 GLfloat lastFrame = 0.0f;  	// Time of last frame
 
+// Input recorded to a file, or played back from one on the recorded clock
+InputLog inputLog;
+
+// Image or tile archive the terrain is built from
+const char* heightmapPath = "textures/hflab4.jpg";
+
 // The MAIN function, from here we start the application and run the game loop
-int main()
+//  --software [image.bmp]  renders one frame on the CPU instead, no GPU or window needed
+//  --batch jobs.txt        renders every camera pose of a job file offscreen and exits
+//  --record input.bin      records the keyboard and mouse input of the session
+//  --replay input.bin      flies the recorded session again, frame for frame, and exits
+//  --frame-log times.csv   writes the time of every frame
+//  --target-ms 16.7        GPU time per frame the dynamic resolution aims for
+//  --bake-pages image.jpg imagery.vtp   cuts terrain imagery into a page file and exits
+//  --pages imagery.vtp     textures the mesh terrain from a page file
+//  --heightmap map.hta     builds the terrain from another image or a preprocessed tile archive
+//  --procedural 1234       generates endless terrain around the camera from a seed instead
+//  --erode map.png 500 eroded.pgm   erodes a heightmap on the CPU, saves it and exits
+//  --export map.hta terrain.glb [--lod 2 | --error 0.001]   writes the terrain as a .glb or .ply mesh and exits
+//  --resource-log resources.json   lists the GL objects and CPU allocations still alive at exit
+//  --instances 100000      scatters that many more boxes over the terrain
+int main(int argc, char** argv)
 {
+	if (argc > 1 && strcmp(argv[1], "--software") == 0)
+		return renderSoftware(argc > 2 ? argv[2] : "software.bmp");
+	if (argc > 3 && strcmp(argv[1], "--bake-pages") == 0)
+		return VirtualTexture::Bake(argv[2], argv[3]) ? 0 : 1;
+	if (argc > 4 && strcmp(argv[1], "--erode") == 0)
+		return erodeHeightmap(argv[2], atoi(argv[3]), argv[4]);
+	if (argc > 3 && strcmp(argv[1], "--export") == 0)
+	{
+		int level = 0;
+		float error = -1.0f;
+		for (int a = 4; a + 1 < argc; a++)
+		{
+			if (strcmp(argv[a], "--lod") == 0)
+				level = atoi(argv[++a]);
+			else if (strcmp(argv[a], "--error") == 0)
+				error = float(atof(argv[++a]));
+		}
+		return exportMesh(argv[2], argv[3], level, error);
+	}
+	vector<RenderPose> poses;
+	bool batch = argc > 2 && strcmp(argv[1], "--batch") == 0;
+	if (batch && !LoadPoses(argv[2], poses))
+		return 1;
+	FrameTimeLog frameTimeLog;
+	GLfloat targetMilliseconds = 0.0f;
+	const char* pagesPath = NULL;
+	long proceduralSeed = -1;
+	bool resourceLogAtExit = false;
+	int instances = 0;
+	for (int a = 1; a + 1 < argc; a++)
+	{
+		bool started = true;
+		if (strcmp(argv[a], "--record") == 0)
+			started = inputLog.StartRecording(argv[++a]);
+		else if (strcmp(argv[a], "--replay") == 0)
+			started = inputLog.StartReplay(argv[++a]);
+		else if (strcmp(argv[a], "--frame-log") == 0)
+			started = frameTimeLog.Open(argv[++a]);
+		else if (strcmp(argv[a], "--target-ms") == 0)
+		{
+			targetMilliseconds = GLfloat(atof(argv[++a]));
+			started = targetMilliseconds > 0.0f;
+		}
+		else if (strcmp(argv[a], "--pages") == 0)
+			pagesPath = argv[++a];
+		else if (strcmp(argv[a], "--heightmap") == 0)
+			heightmapPath = argv[++a];
+		else if (strcmp(argv[a], "--procedural") == 0)
+			proceduralSeed = atol(argv[++a]);
+		else if (strcmp(argv[a], "--resource-log") == 0)
+		{
+			resourceLogPath = argv[++a];
+			resourceLogAtExit = true;
+		}
+		else if (strcmp(argv[a], "--instances") == 0)
+			instances = atoi(argv[++a]);
+		if (!started)
+			return 1;
+	}
+
 	// Init GLFW
 	glfwInit();
-	// Set all the required options for GLFW
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	// Set all the required options for GLFW.  Ask for 4.5 so the GPU driven path is
+	//  available, and fall back to 3.3 on drivers that do not have it.
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-	glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+	// A batch job renders offscreen at a fixed size, its window is never shown
+	glfwWindowHint(GLFW_RESIZABLE, batch ? GL_FALSE : GL_TRUE);
+	glfwWindowHint(GLFW_VISIBLE, batch ? GL_FALSE : GL_TRUE);
 
 	// Create a GLFWwindow object that we can use for GLFW's functions
 	GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, "LearnOpenGL", nullptr, nullptr);
+	if (!window)
+	{
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		window = glfwCreateWindow(WIDTH, HEIGHT, "LearnOpenGL", nullptr, nullptr);
+	}
 	glfwMakeContextCurrent(window);
 
 	// Set the required callback functions
-	glfwSetKeyCallback(window, key_callback);
-	glfwSetCursorPosCallback(window, mouse_callback);
-	glfwSetScrollCallback(window, scroll_callback);
+	glfwSetKeyCallback(window, live_key_callback);
+	glfwSetCursorPosCallback(window, live_mouse_callback);
+	glfwSetScrollCallback(window, live_scroll_callback);
 
 	// GLFW Options
 	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
@@ -93,113 +280,76 @@ int main()
 
 	glEnable(GL_DEPTH_TEST);
 
+	// Several views are drawn in one pass where the vertex stage can pick the viewport
+	MultiView multiView;
+	multiView.Init();
 
-	// Build and compile our shader program
-	Shader ourShader("shaders/advanced.vs", "shaders/advanced.frag");
-
-
-	//Load the Height Map and force 1 channel (so you can use RGB images as well)
-	//  The values can be recast as integers and then used for the y values of the 
-	//  heightmap.  The values range from [0,255].
-	int ht_width, ht_height, ht_channels;
-	unsigned char *ht_map = SOIL_load_image
-		(
-		"textures/hflab4.jpg",
-		&ht_width, &ht_height, &ht_channels,
-		SOIL_LOAD_L
-		);
 
-	// Set to 1 since 8bit intensity map
-	unsigned int ptr_inc = 1;
-	unsigned int row_step = ptr_inc * ht_width;
+	// Build and compile our shader programs.  The permutations of advanced.vs/advanced.frag
+	//  are built the first time a draw picks one, so only the variants the settings reach are
+	//  ever compiled; linked programs are cached on disk, so a warm start skips compilation
+	//  entirely.  shaderVariants holds the ids fetched so far, 0 until then.
+	ShaderCache shaderCache;
+	GLuint shaderVariants[1 << PERMUTATION_COUNT] = {};
+	auto shaderVariant = [&](GLuint permutation) -> GLuint
+	{
+		if (shaderVariants[permutation] == 0)
+			shaderVariants[permutation] = shaderCache.Program("shaders/advanced.vs", "shaders/advanced.frag", permutation);
+		return shaderVariants[permutation];
+	};
+	// Warm up the variants of the first frame: the flat terrain and sky, and the blended boxes
+	shaderVariant(SINGLE_TEXTURE);
+	shaderVariant(TWO_TEXTURE_BLEND);
+	// Program of the depth pre-pass, the vertex stage of the shaded draws with no fragment work
+	GLuint depthProgram = shaderCache.Program("shaders/advanced.vs", "shaders/depth_only.frag");
+	// Program of the contour lines, a flat colour
+	GLuint contourProgram = shaderCache.Program("shaders/contour.vs", "shaders/contour.frag");
+	cout << "Shader programs: " << shaderCache.LoadedFromCache << " loaded from cache, "
+		<< shaderCache.Compiled << " compiled" << endl;
 
-	vector<vector<glm::vec3>> vVertexData(ht_height, vector<glm::vec3>(ht_width));
-	vector<vector<glm::vec2>> vCoordsData(ht_height, vector<glm::vec2>(ht_width));
-	vector<GLfloat> htData;
-	vector<GLfloat> htTriangles;
 
-	
-	FOR(i, ht_height)
+	//Load the Height Map and force 1 channel (so you can use RGB images as well)
+	//  The values range from [0,255] and are rescaled to [0,1] for the y values of the 
+	//  heightmap.  Only the compressed tiles stay in memory.  Without one there is no terrain
+	//  to build, LoadHeightmap has said why.  Procedural terrain needs no heightmap, it stays
+	//  empty along with the mesh and everything built from them.
+	Heightmap heightmap;
+	if (proceduralSeed < 0)
 	{
-		FOR(j, ht_width)
+		if (!LoadHeightmap(heightmapPath, heightmap))
 		{
-			GLfloat fScaleC = GLfloat(j)/GLfloat(ht_width-1);
-			GLfloat fScaleR = GLfloat(i)/GLfloat(ht_height-1);
-			GLfloat fVertexHeight = GLfloat(*(ht_map + row_step * i + j * ptr_inc))/255.0f;
-			htData.push_back((fScaleC - 0.5f)*2);
-			htData.push_back(fVertexHeight);
-			htData.push_back((fScaleR - 0.5f)*2);
-			htData.push_back(fScaleC);
-			htData.push_back(fScaleR);
-			//cout << (fScaleC -0.5f)*2 << " " << fVertexHeight << " " << (fScaleR -0.5f)*2 << " " << fScaleC << " " << fScaleR << endl;
-			vVertexData[i][j] = glm::vec3((fScaleC*2.0f - 1.0f), -fVertexHeight/2-.5, (fScaleR*2.0f - 1.0f));
-			vCoordsData[i][j] = glm::vec2(fScaleC, fScaleR);
-			/*htData.push_back(vVertexData[i][j].x);
-			htData.push_back(vVertexData[i][j].y);
-			htData.push_back(vVertexData[i][j].z);
-			htData.push_back(vCoordsData[i][j].x);
-			htData.push_back(vCoordsData[i][j].y);*/
-			//cout << htData.back() << endl;
-			//cout << vVertexData[i][j].x << " " << vVertexData[i][j].y << " " << vVertexData[i][j].z << endl;
-			//cout << vCoordsData[i][j].x << " " << vCoordsData[i][j].y << endl;
+			shaderCache.Release();
+			glfwTerminate();
+			return 1;
 		}
+		cout << "Heightmap: " << heightmap.Width << "x" << heightmap.Height << ", "
+			<< heightmap.Tiles->CompressedBytes() / 1024 << " KB compressed, "
+			<< 4.0 * heightmap.Width * heightmap.Height / heightmap.Tiles->CompressedBytes() << ":1 against floats" << endl;
+		Resources().CpuAllocation(&heightmap, "heightmap tiles", heightmap.Tiles->CompressedBytes());
 	}
 
-	// Generate the triangles
-	FOR(i, ht_height-1)
-	{
-		FOR(j, ht_width-1)
-		{
-			// Triangle1 Part1
-			htTriangles.push_back(vVertexData[i][j].x);
-			htTriangles.push_back(vVertexData[i][j].y);
-			htTriangles.push_back(vVertexData[i][j].z);
-			htTriangles.push_back(vCoordsData[i][j].x);
-			htTriangles.push_back(vCoordsData[i][j].y);
-			// Part2
-			htTriangles.push_back(vVertexData[i+1][j].x);
-			htTriangles.push_back(vVertexData[i+1][j].y);
-			htTriangles.push_back(vVertexData[i+1][j].z);
-			htTriangles.push_back(vCoordsData[i+1][j].x);
-			htTriangles.push_back(vCoordsData[i+1][j].y);
-			// Part3
-			htTriangles.push_back(vVertexData[i+1][j+1].x);
-			htTriangles.push_back(vVertexData[i+1][j+1].y);
-			htTriangles.push_back(vVertexData[i+1][j+1].z);
-			htTriangles.push_back(vCoordsData[i+1][j+1].x);
-			htTriangles.push_back(vCoordsData[i+1][j+1].y);
-
-			// Triangle2 Part1
-			htTriangles.push_back(vVertexData[i+1][j+1].x);
-			htTriangles.push_back(vVertexData[i+1][j+1].y);
-			htTriangles.push_back(vVertexData[i+1][j+1].z);
-			htTriangles.push_back(vCoordsData[i+1][j+1].x);
-			htTriangles.push_back(vCoordsData[i+1][j+1].y);
-			// Part2
-			htTriangles.push_back(vVertexData[i][j+1].x);
-			htTriangles.push_back(vVertexData[i][j+1].y);
-			htTriangles.push_back(vVertexData[i][j+1].z);
-			htTriangles.push_back(vCoordsData[i][j+1].x);
-			htTriangles.push_back(vCoordsData[i][j+1].y);
-			// Part3
-			htTriangles.push_back(vVertexData[i][j].x);
-			htTriangles.push_back(vVertexData[i][j].y);
-			htTriangles.push_back(vVertexData[i][j].z);
-			htTriangles.push_back(vCoordsData[i][j].x);
-			htTriangles.push_back(vCoordsData[i][j].y);
-		}
-	}
+	// Generate the triangles.  Every sample is stored once and the index buffer is split
+	//  into square chunks, so chunks outside the view are never submitted.
+	TerrainMesh terrain;
+	if (proceduralSeed < 0)
+		terrain = BuildTerrainMesh(heightmap);
 
-	GLuint VBOht, VAOht;
+	GLuint VBOht, EBOht, VAOht;
 	glGenVertexArrays(1, &VAOht);
 	glGenBuffers(1, &VBOht);
+	glGenBuffers(1, &EBOht);
 	// 2. Bind Vertex Array Object
 	glBindVertexArray(VAOht);
 	//  Bind the Vertex Buffer
 	glBindBuffer(GL_ARRAY_BUFFER, VBOht);
 
-	// 3. Copy our vertices array in a vertex buffer for OpenGL to use
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*htTriangles.size(), &htTriangles[0], GL_STATIC_DRAW);
+	// 3. Copy our vertices and indices in buffers for OpenGL to use
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*terrain.Vertices.size(), terrain.Vertices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBOht);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)*terrain.Indices.size(), terrain.Indices.data(), GL_STATIC_DRAW);
+	Resources().Created(RESOURCE_VERTEX_ARRAY, VAOht, "terrain");
+	Resources().Created(RESOURCE_BUFFER, VBOht, "terrain vertices", sizeof(GLfloat)*terrain.Vertices.size());
+	Resources().Created(RESOURCE_BUFFER, EBOht, "terrain indices", sizeof(GLuint)*terrain.Indices.size());
 
 	// 4.  Position attribute for the 3D Position Coordinates and link to position 0
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)0);
@@ -210,750 +360,1179 @@ int main()
 	// 6.  Unbind Vertex Array Object
 	glBindVertexArray(0);
 
-	// Vertices for front side of skycube
-	//      3D Coordinates      Texture Coordinates
-	//    x       y      z     s     t  
-	GLfloat front_vertices[] = {
-		-1.0f, -1.0f, -1.0f,  1.0f, 0.0f,
-		1.0f, -1.0f, -1.0f,  0.0f, 0.0f,
-		1.0f,  1.0f, -1.0f,  0.0f, 1.0f,
-		1.0f,  1.0f, -1.0f,  0.0f, 1.0f,
-		-1.0f,  1.0f, -1.0f,  1.0f, 1.0f,
-		-1.0f, -1.0f, -1.0f,  1.0f, 0.0f
-	};	// finished
-
-	// Vertices for back side of skycube
-	//      3D Coordinates      Texture Coordinates
-	//    x       y      z     s     t  
-	GLfloat back_vertices[] = {
-		-1.0f, -1.0f, 1.0f,  0.0f, 0.0f,
-		1.0f, -1.0f, 1.0f,  1.0f, 0.0f,
-		1.0f,  1.0f, 1.0f,  1.0f, 1.0f,
-		-1.0f,  -1.0f, 1.0f,  0.0f, 0.0f,
-		-1.0f,  1.0f, 1.0f,  0.0f, 1.0f,
-		1.0f, 1.0f, 1.0f,  1.0f, 1.0f
-	};	// finished
-
-	// Vertices for right side of skycube
-	//      3D Coordinates      Texture Coordinates
-	//    x       y      z     s     t  
-	GLfloat right_vertices[] = {
-		1.0f, 1.0f, -1.0f,  1.0f, 1.0f,
-		1.0f, -1.0f, -1.0f,  1.0f, 0.0f,
-		1.0f,  1.0f, 1.0f,  0.0f, 1.0f,
-		1.0f,  -1.0f, -1.0f,  1.0f, 0.0f,
-		1.0f,  -1.0f, 1.0f,  0.0f, 0.0f,
-		1.0f, 1.0f, 1.0f,  0.0f, 1.0f
-	};	// finished
-
-	// Vertices for left side of skycube
-	//      3D Coordinates      Texture Coordinates
-	//    x       y      z     s     t  
-	GLfloat left_vertices[] = {
-		-1.0f, 1.0f, -1.0f,  0.0f, 1.0f,
-		-1.0f, -1.0f, -1.0f,  0.0f, 0.0f,
-		-1.0f,  -1.0f, 1.0f,  1.0f, 0.0f,
-		-1.0f,  1.0f, -1.0f,  0.0f, 1.0f,
-		-1.0f,  1.0f, 1.0f,  1.0f, 1.0f,
-		-1.0f, -1.0f, 1.0f,  1.0f, 0.0f
-	};	// finished
-
-	// Vertices for bottom side of skycube
-	//      3D Coordinates      Texture Coordinates
-	//    x       y      z     s     t  
-	GLfloat bottom_vertices[] = {
-		-1.0f, -1.0f, -1.0f,  1.0f, 0.0f,	// left bot back
-		1.0f, -1.0f, -1.0f,  1.0f, 1.0f,	// right bot back
-		-1.0f,  -1.0f, 1.0f,  0.0f, 0.0f,	// left bot front
-		-1.0f,  -1.0f, 1.0f,  0.0f, 0.0f,	// left bot front
-		1.0f,  -1.0f, 1.0f,  0.0f, 1.0f,	// right bot front
-		1.0f, -1.0f, -1.0f,  1.0f, 1.0f		// right bot back
-	};	// not finished
-
-	// Vertices for top side of skycube
-	//      3D Coordinates      Texture Coordinates
-	//    x       y      z     s     t  
-	GLfloat top_vertices[] = {
-		-1.0f, 1.0f, -1.0f,  1.0f, 1.0f,
-		-1.0f, 1.0f, 1.0f,  0.0f, 1.0f,
-		1.0f,  1.0f, -1.0f,  1.0f, 0.0f,
-		1.0f,  1.0f, -1.0f,  1.0f, 0.0f,
-		1.0f,  1.0f, 1.0f,  0.0f, 0.0f,
-		-1.0f, 1.0f, 1.0f,  0.0f, 1.0f
-	};	// finished
-
-
-	// Set up vertex data for boxes in the center
-	GLfloat vertices[] = {
-		-0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
-		0.5f, -0.5f, -0.5f,  1.0f, 0.0f,
-		0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-		0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-		-0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
-		-0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
-
-		-0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-		0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
-		0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
-		0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
-		-0.5f,  0.5f,  0.5f,  0.0f, 1.0f,
-		-0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-
-		-0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-		-0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-		-0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-		-0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-		-0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-		-0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-
-		0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-		0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-		0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-		0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-		0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-		0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-
-		-0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-		0.5f, -0.5f, -0.5f,  1.0f, 1.0f,
-		0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
-		0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
-		-0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-		-0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-
-		-0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
-		0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-		0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-		0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-		-0.5f,  0.5f,  0.5f,  0.0f, 0.0f,
-		-0.5f,  0.5f, -0.5f,  0.0f, 1.0f
-	};
-
-	// Initial Translation Coordinates for each of the Boxes
-	glm::vec3 cubePositions[] = {
-		glm::vec3( 0.0f,  0.0f,  0.0f),
-		glm::vec3( 2.0f,  5.0f, -15.0f),
-		glm::vec3(-1.5f, -2.2f, -2.5f),
-		glm::vec3(-3.8f, -2.0f, -12.3f),
-		glm::vec3( 2.4f, -0.4f, -3.5f),
-		glm::vec3(-1.7f,  3.0f, -7.5f),
-		glm::vec3( 1.3f, -2.0f, -2.5f),
-		glm::vec3( 1.5f,  2.0f, -2.5f),
-		glm::vec3( 1.5f,  0.2f, -1.5f),
-		glm::vec3(-1.3f,  1.0f, -1.5f)
-	};
-
-	//  1.  Create ID / Generate Buffers and for Vertex Buffer Object (VBO) and 
-	//      Vertex Array Buffer (VAO)
-	GLuint VBO, VAO;
-	glGenVertexArrays(1, &VAO);
-	glGenBuffers(1, &VBO);
-	// 2. Bind Vertex Array Object
-	glBindVertexArray(VAO);
-	//  Bind the Vertex Buffer
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
-	// 3. Copy our vertices array in a vertex buffer for OpenGL to use
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-	// 4.  Position attribute for the 3D Position Coordinates and link to position 0
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)0);
-	glEnableVertexAttribArray(0);
-	// 5.  TexCoord attribute for the 2d Texture Coordinates and link to position 2
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
-	glEnableVertexAttribArray(2);
-
-	// 6.  Unbind Vertex Array Object
-	glBindVertexArray(0);
-
-
-	// Create VBO and VAO for the front side of the skycube
-	GLuint VBO_Front, VAO_Front;
-	glGenVertexArrays(1, &VAO_Front);
-	glGenBuffers(1, &VBO_Front);
-
-	glBindVertexArray(VAO_Front);
-
-	glBindBuffer(GL_ARRAY_BUFFER, VBO_Front);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(front_vertices), front_vertices, GL_STATIC_DRAW);
-
-	// Position attribute
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)0);
-	glEnableVertexAttribArray(0);
-	// TexCoord attribute
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
-	glEnableVertexAttribArray(2);
-
-	glBindVertexArray(0); // Unbind VAO
-
-
-	// Create VBO and VAO for the back side of the skycube
-	GLuint VBO_Back, VAO_Back;
-	glGenVertexArrays(1, &VAO_Back);
-	glGenBuffers(1, &VBO_Back);
-
-	glBindVertexArray(VAO_Back);
 
-	glBindBuffer(GL_ARRAY_BUFFER, VBO_Back);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(back_vertices), back_vertices, GL_STATIC_DRAW);
-
-	// Position attribute
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)0);
-	glEnableVertexAttribArray(0);
-	// TexCoord attribute
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
-	glEnableVertexAttribArray(2);
-
-	glBindVertexArray(0); // Unbind VAO
-
-
-	// Create VBO and VAO for the left side of the skycube
-	GLuint VBO_Left, VAO_Left;
-	glGenVertexArrays(1, &VAO_Left);
-	glGenBuffers(1, &VBO_Left);
-
-	glBindVertexArray(VAO_Left);
-
-	glBindBuffer(GL_ARRAY_BUFFER, VBO_Left);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(left_vertices), left_vertices, GL_STATIC_DRAW);
-
-	// Position attribute
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)0);
-	glEnableVertexAttribArray(0);
-	// TexCoord attribute
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
-	glEnableVertexAttribArray(2);
-
-	glBindVertexArray(0); // Unbind VAO
-
-
-	// Create VBO and VAO for the top side of the skycube
-	GLuint VBO_Top, VAO_Top;
-	glGenVertexArrays(1, &VAO_Top);
-	glGenBuffers(1, &VBO_Top);
-
-	glBindVertexArray(VAO_Top);
-
-	glBindBuffer(GL_ARRAY_BUFFER, VBO_Top);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(top_vertices), top_vertices, GL_STATIC_DRAW);
-
-	// Position attribute
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)0);
-	glEnableVertexAttribArray(0);
-	// TexCoord attribute
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
-	glEnableVertexAttribArray(2);
-
-	glBindVertexArray(0); // Unbind VAO
-
-
-	
-	GLuint VBO_Bottom, VAO_Bottom;
-	glGenVertexArrays(1, &VAO_Bottom);
-	glGenBuffers(1, &VBO_Bottom);
-
-	glBindVertexArray(VAO_Bottom);
-
-	glBindBuffer(GL_ARRAY_BUFFER, VBO_Bottom);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(bottom_vertices), bottom_vertices, GL_STATIC_DRAW);
-
-	// Position attribute
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)0);
-	glEnableVertexAttribArray(0);
-	// TexCoord attribute
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
-	glEnableVertexAttribArray(2);
-
-	glBindVertexArray(0); // Unbind VAO
-
-
-	// Create VBO and VAO for the front side of the skycube
-	GLuint VBO_Right, VAO_Right;
-	glGenVertexArrays(1, &VAO_Right);
-	glGenBuffers(1, &VBO_Right);
-
-	glBindVertexArray(VAO_Right);
-
-	glBindBuffer(GL_ARRAY_BUFFER, VBO_Right);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(right_vertices), right_vertices, GL_STATIC_DRAW);
-
-	// Position attribute
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)0);
-	glEnableVertexAttribArray(0);
-	// TexCoord attribute
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
-	glEnableVertexAttribArray(2);
+	// The boxes and the sides of the skybox are ranges of one geometry pool, drawn from their
+	//  base vertex with the pool's vertex array.  The procedural terrain adds its tiles to it.
+	GeometryPool geometry;
+	geometry.Create();
+	PoolMesh boxMesh = geometry.AddTriangles(vertices, 36);
+	const GLfloat* skySides[] = { front_vertices, back_vertices, left_vertices, right_vertices, top_vertices };
+	PoolMesh skyMeshes[5];
+	FOR(side, 5)
+		skyMeshes[side] = geometry.AddTriangles(skySides[side], 6);
+
+	// Every box is an object of the scene store, which culls and picks them through its BVH.
+	//  The ten animated ones start at cubePositions, the instances stand on the heightmap.
+	SceneStore sceneStore;
+	Entity boxEntities[10];
+	FOR(i, 10)
+		boxEntities[i] = sceneStore.Add(cubePositions[i], glm::vec3(-0.5f), glm::vec3(0.5f), BOX_MATERIAL);
+	if (instances > 0 && heightmap.Tiles)
+	{
+		srand(1);
+		FOR(i, instances)
+		{
+			int row = rand() % heightmap.Height, col = rand() % heightmap.Width;
+			glm::vec3 ground = 50.0f * heightmap.Position(row, col, heightmap.At(row, col));
+			sceneStore.Add(ground + glm::vec3(0.0f, 0.5f, 0.0f), glm::vec3(-0.5f), glm::vec3(0.5f), PLACED_MATERIAL);
+		}
+		sceneStore.Refit();
+		cout << "Scene: " << sceneStore.Size() << " boxes, BVH built in " << sceneStore.BuildMilliseconds << " ms" << endl;
+	}
+	Resources().CpuAllocation(&sceneStore, "scene store", sceneStore.Bytes());
 
-	glBindVertexArray(0); // Unbind VAO
 
+	// Load the images once.  They feed both the individual textures and the texture array
+	//  of the GPU driven path.
+	vector<Image> images(IMAGE_COUNT);
+	FOR(i, IMAGE_COUNT)
+		LoadImageFile(imagePaths[i], images[i]);
 
 	// Load and create a texture 
-	GLuint texture1, texture2, // boxes
-		texture3,	// front
-		texture4,	// back
-		texture5,	// left
-		texture6,	// right
-		texture7,	// top
-		texture8,	// bottom
-		texture9;	// heightmap
-	// ====================
-	// Texture 1
-	// ====================
-	glGenTextures(1, &texture1);
-	glBindTexture(GL_TEXTURE_2D, texture1); // All upcoming GL_TEXTURE_2D operations now have effect on our texture object
-	// Set our texture parameters
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);	// Set texture wrapping to GL_CLAMP_TO_EDGE
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	// Set texture filtering
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	// Load, create texture and generate mipmaps
-	int width, height;
-	unsigned char* image = SOIL_load_image("textures/container.jpg", &width, &height, 0, SOIL_LOAD_RGB);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	SOIL_free_image_data(image);
-	glBindTexture(GL_TEXTURE_2D, 0); // Unbind texture when done, so we won't accidentily mess up our texture.
-	// ===================
-	// Texture 2
-	// ===================
-	glGenTextures(1, &texture2);
-	glBindTexture(GL_TEXTURE_2D, texture2);
-	// Set our texture parameters
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	// Set texture filtering
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	// Load, create texture and generate mipmaps
-	image = SOIL_load_image("textures/psulogo.png", &width, &height, 0, SOIL_LOAD_RGB);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	SOIL_free_image_data(image);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	GLuint texture1 = CreateTexture2D(images[0]), // boxes
+		texture2 = CreateTexture2D(images[1]),
+		texture3 = CreateTexture2D(images[2]),	// front
+		texture4 = CreateTexture2D(images[3]),	// back
+		texture5 = CreateTexture2D(images[4]),	// left
+		texture6 = CreateTexture2D(images[5]),	// right
+		texture7 = CreateTexture2D(images[6]),	// top
+		texture8 = CreateTexture2D(images[7]);	// bottom
 
 	// ===================
-	// Box Textures Front
+	// GPU driven scene
 	// ===================
-	glGenTextures(1, &texture3);
-	glBindTexture(GL_TEXTURE_2D, texture3);
-	// Set our texture parameters
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	// Set texture filtering
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	// Load, create texture and generate mipmaps
-	image = SOIL_load_image("skybox/front.jpg", &width, &height, 0, SOIL_LOAD_RGB);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	SOIL_free_image_data(image);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	// All static geometry is packed into one vertex/index buffer and every texture into a
+	//  layer of one texture array.  A compute pass frustum culls the objects and the frame
+	//  is submitted with a single glMultiDrawElementsIndirect (needs GL 4.3, toggled with G).
+	gpuDrivenSupported = GLEW_VERSION_4_3 != 0 && proceduralSeed < 0;
+	GpuScene gpuScene;
+	GLuint textureArray = 0;
+	GLint layerWidth = 0, layerHeight = 0;
+	GLuint gpuBoxObjects[10];
+	// Fills a scene with the sky, the terrain chunks and the boxes.  Only touches the CPU side of
+	//  the scene, so a heightmap reload can build its new scene on a worker thread.
+	glm::mat4 terrainModel = glm::scale(glm::mat4(), glm::vec3(50.0f, 50.0f, 50.0f));
+	auto buildGpuScene = [&](GpuScene& scene, const TerrainMesh& mesh, GLuint* boxObjects)
+	{
+		const GLfloat* skyVertices[] = { front_vertices, back_vertices, left_vertices, right_vertices, top_vertices };
+		FOR(side, 5)
+		{
+			GpuMesh skyMesh = scene.AddTriangles(skyVertices[side], 6);
+			scene.AddObject(skyMesh, terrainModel, 2 + side, 2 + side);
+		}
 
-	// ===================
-	// Box Textures Back
-	// ===================
-	glGenTextures(1, &texture4);
-	glBindTexture(GL_TEXTURE_2D, texture4);
-	// Set our texture parameters
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	// Set texture filtering
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	// Load, create texture and generate mipmaps
-	image = SOIL_load_image("skybox/back.jpg", &width, &height, 0, SOIL_LOAD_RGB);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	SOIL_free_image_data(image);
-	glBindTexture(GL_TEXTURE_2D, 0);
+		// A heightmap one sample wide or high has no triangles to add
+		if (!mesh.Indices.empty())
+		{
+			GpuMesh terrainMesh = scene.AddMesh(mesh.Vertices.data(), mesh.VertexCount(), mesh.Indices.data(), GLuint(mesh.Indices.size()));
+			for (const TerrainChunk& chunk : mesh.Chunks)
+			{
+				GpuMesh chunkMesh = terrainMesh;
+				chunkMesh.FirstIndex += chunk.FirstIndex;
+				chunkMesh.IndexCount = chunk.IndexCount;
+				chunkMesh.BoundsMin = chunk.BoundsMin;
+				chunkMesh.BoundsMax = chunk.BoundsMax;
+				scene.AddObject(chunkMesh, terrainModel, 7, 7, GPU_OBJECT_TERRAIN);
+			}
+		}
 
-	// ===================
-	// Box Textures Left
-	// ===================
-	glGenTextures(1, &texture5);
-	glBindTexture(GL_TEXTURE_2D, texture5);
-	// Set our texture parameters
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	// Set texture filtering
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	// Load, create texture and generate mipmaps
-	image = SOIL_load_image("skybox/left.jpg", &width, &height, 0, SOIL_LOAD_RGB);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	SOIL_free_image_data(image);
-	glBindTexture(GL_TEXTURE_2D, 0);
+		GpuMesh boxMesh = scene.AddTriangles(vertices, 36);
+		FOR(i, 10)
+			boxObjects[i] = scene.AddObject(boxMesh, glm::mat4(), 0, 1);
+	};
+	if (gpuDrivenSupported)
+	{
+		vector<const Image*> layers;
+		FOR(i, IMAGE_COUNT)
+			layers.push_back(&images[i]);
+		textureArray = CreateTextureArray(layers);
+		// Reloaded images are resampled to the layer size on the worker
+		glBindTexture(GL_TEXTURE_2D_ARRAY, textureArray);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D_ARRAY, 0, GL_TEXTURE_WIDTH, &layerWidth);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D_ARRAY, 0, GL_TEXTURE_HEIGHT, &layerHeight);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+		buildGpuScene(gpuScene, terrain, gpuBoxObjects);
+		gpuScene.Upload(shaderCache);
+	}
+	// The pixels and the terrain geometry are on the GPU now, only the chunk ranges are kept
+	vector<Image>().swap(images);
+	vector<GLfloat>().swap(terrain.Vertices);
+	vector<GLuint>().swap(terrain.Indices);
+
+	// Worker threads shared by the CPU side systems
+	ThreadPool threadPool;
+	// Procedural terrain streamed in tiles around the camera.  It replaces the mesh terrain;
+	//  the GPU driven scene, the other terrain modes and the occluder only know the heightmap,
+	//  so they are not built for it.
+	ProceduralTerrain procedural;
+	terrainModeSupported[TERRAIN_TESSELLATED] = GLEW_VERSION_4_0 != 0 && proceduralSeed < 0;
+	terrainModeSupported[TERRAIN_RAYMARCHED] = proceduralSeed < 0;
+	if (proceduralSeed >= 0)
+	{
+		procedural.Create(threadPool, geometry, uint32_t(proceduralSeed));
+		cout << "Procedural terrain, seed " << proceduralSeed << endl;
+	}
 
-	// ===================
-	// Box Textures Right
-	// ===================
-	glGenTextures(1, &texture6);
-	glBindTexture(GL_TEXTURE_2D, texture6);
-	// Set our texture parameters
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	// Set texture filtering
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	// Load, create texture and generate mipmaps
-	image = SOIL_load_image("skybox/right.jpg", &width, &height, 0, SOIL_LOAD_RGB);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	SOIL_free_image_data(image);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	// Occlusion culling against a coarse, conservative copy of the terrain rasterised on the CPU
+	OcclusionCuller occlusion(threadPool);
+	if (proceduralSeed < 0)
+		occlusion.SetOccluder(heightmap, terrainModel);
+
+	// Tessellated terrain, an alternative to the chunked mesh drawn from a coarse patch grid
+	TessellatedTerrain tessellatedTerrain;
+	if (terrainModeSupported[TERRAIN_TESSELLATED])
+		tessellatedTerrain.Upload(TessellatedTerrain::Build(heightmap), shaderCache);
+	// Ray marched terrain, no geometry at all
+	RaymarchedTerrain raymarchedTerrain;
+	if (terrainModeSupported[TERRAIN_RAYMARCHED])
+		raymarchedTerrain.Upload(RaymarchedTerrain::Build(heightmap), shaderCache);
+
+	// Hydraulic and thermal erosion of the mesh terrain, loaded when it is first switched on
+	Erosion erosion;
+	// What can be seen from a point of the heightmap, loaded with the first request
+	Viewshed viewshed;
+	// Contour lines of the heightmap, loaded when they are first shown and following the erosion
+	Contours contours;
+	GLfloat contoursExtracted = 0.0f;
+	// Horizons of the heightmap for its ambient occlusion and sun shadows, baked when first shown
+	HorizonMap horizon;
+	GLfloat horizonBaked = 0.0f;
 
 	// ===================
-	// Box Textures Top
+	// Hot reload
 	// ===================
-	glGenTextures(1, &texture7);
-	glBindTexture(GL_TEXTURE_2D, texture7);
-	// Set our texture parameters
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	// Set texture filtering
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	// Load, create texture and generate mipmaps
-	image = SOIL_load_image("skybox/top.jpg", &width, &height, 0, SOIL_LOAD_RGB);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	SOIL_free_image_data(image);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	// Edited files are rebuilt on the workers and swapped in between two frames.  Uploads
+	//  are spread over frames, and a file that fails to load leaves the old version in place.
+	HotReloader hotReloader(threadPool);
 
-	// ===================
-	// Box Textures Bottom
-	// ===================
-	glGenTextures(1, &texture8);
-	glBindTexture(GL_TEXTURE_2D, texture8);
-	// Set our texture parameters
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	// Set texture filtering
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	// Load, create texture and generate mipmaps
-	image = SOIL_load_image("skybox/bottom.jpg", &width, &height, 0, SOIL_LOAD_RGB);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	SOIL_free_image_data(image);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	// The heightmap: new mesh, occluder and GPU scene are built in the background, then the
+	//  buffers stream in and everything is swapped at once.  Procedural terrain has none.
+	if (proceduralSeed < 0)
+	{
+		hotReloader.Watch(heightmapPath, [&]() -> ReloadApply
+		{
+			auto next = make_shared<Heightmap>();
+			if (!LoadHeightmap(heightmapPath, *next))
+				return ReloadApply();
+			auto mesh = make_shared<TerrainMesh>(BuildTerrainMesh(*next));
+			auto occluder = make_shared<OccluderMesh>(OcclusionCuller::BuildOccluder(*next, terrainModel));
+			auto scene = make_shared<GpuScene>();
+			auto boxObjects = make_shared<vector<GLuint>>(10);
+			if (gpuDrivenSupported)
+				buildGpuScene(*scene, *mesh, boxObjects->data());
+			auto tessellation = make_shared<TessellationData>();
+			if (terrainModeSupported[TERRAIN_TESSELLATED])
+				*tessellation = TessellatedTerrain::Build(*next);
+			auto raymarch = make_shared<RaymarchData>(RaymarchedTerrain::Build(*next));
+			auto vertexUpload = make_shared<StagedBuffer>(), indexUpload = make_shared<StagedBuffer>();
+			auto started = make_shared<bool>(false);
+
+			return [&, next, mesh, occluder, scene, boxObjects, tessellation, raymarch, vertexUpload, indexUpload, started](size_t& budget) -> bool
+			{
+				if (!*started)
+				{
+					vertexUpload->Begin(mesh->Vertices.data(), sizeof(GLfloat) * mesh->Vertices.size(), GL_STATIC_DRAW, "terrain vertices");
+					indexUpload->Begin(mesh->Indices.data(), sizeof(GLuint) * mesh->Indices.size(), GL_STATIC_DRAW, "terrain indices");
+					Resources().CpuAllocation(mesh.get(), "terrain reload staging",
+						sizeof(GLfloat) * mesh->Vertices.size() + sizeof(GLuint) * mesh->Indices.size());
+					if (gpuDrivenSupported)
+						scene->BeginUpload(shaderCache);
+					*started = true;
+				}
+				bool done = vertexUpload->Step(budget);
+				done = indexUpload->Step(budget) && done;
+				done = scene->UploadStep(budget) && done;
+				if (!done)
+					return false;
+
+				// Point the terrain VAO at the new buffers
+				glBindVertexArray(VAOht);
+				glBindBuffer(GL_ARRAY_BUFFER, vertexUpload->Buffer);
+				glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)0);
+				glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexUpload->Buffer);
+				glBindVertexArray(0);
+				glBindBuffer(GL_ARRAY_BUFFER, 0);
+				Resources().Deleted(RESOURCE_BUFFER, VBOht);
+				Resources().Deleted(RESOURCE_BUFFER, EBOht);
+				glDeleteBuffers(1, &VBOht);
+				glDeleteBuffers(1, &EBOht);
+				Resources().CpuAllocation(mesh.get(), "terrain reload staging", 0);
+				VBOht = vertexUpload->Buffer;
+				EBOht = indexUpload->Buffer;
+
+				terrain.Chunks.swap(mesh->Chunks);
+				occlusion.SetOccluderMesh(std::move(*occluder));
+				swap(heightmap, *next);
+				Resources().CpuAllocation(&heightmap, "heightmap tiles", heightmap.Tiles->CompressedBytes());
+				erosion.Clear();
+				viewshed.Clear();
+				viewshedShown = false;
+				contours.Clear();
+				horizon.Clear();
+				if (terrainModeSupported[TERRAIN_TESSELLATED])
+					tessellatedTerrain.Upload(*tessellation, shaderCache);
+				raymarchedTerrain.Upload(*raymarch, shaderCache);
+				if (gpuDrivenSupported)
+				{
+					swap(gpuScene, *scene);
+					scene->Release();
+					copy(boxObjects->begin(), boxObjects->end(), gpuBoxObjects);
+				}
+				return true;
+			};
+		});
+	}
 
-	// ===================
-	// Heightmap Texture
-	// ===================
-	
+	// The textures: decoded and resampled in the background, created in one go
+	GLuint* textureSlots[] = { &texture1, &texture2, &texture3, &texture4, &texture5, &texture6, &texture7, &texture8 };
+	FOR(i, IMAGE_COUNT)
+	{
+		hotReloader.Watch(imagePaths[i], [&, i]() -> ReloadApply
+		{
+			auto image = make_shared<Image>(), layer = make_shared<Image>();
+			if (!LoadImageFile(imagePaths[i], *image))
+				return ReloadApply();
+			if (textureArray != 0)
+				*layer = ResampleImage(*image, layerWidth, layerHeight);
+
+			return [&, i, image, layer](size_t& budget) -> bool
+			{
+				// A texture is not split, so wait for a frame with room for it unless it is larger
+				//  than a whole frame's budget anyway
+				size_t bytes = image->Pixels.size() + layer->Pixels.size();
+				if (bytes > budget && budget < hotReloader.FrameBudget)
+					return false;
+				budget -= min(budget, bytes);
+
+				GLuint texture = CreateTexture2D(*image);
+				Resources().Deleted(RESOURCE_TEXTURE, *textureSlots[i]);
+				glDeleteTextures(1, textureSlots[i]);
+				*textureSlots[i] = texture;
+				if (textureArray != 0)
+					UpdateTextureArrayLayer(textureArray, i, *layer);
+				return true;
+			};
+		});
+	}
 
-	// Game loop
-	while (!glfwWindowShouldClose(window))
+	// The shaders: compiled by the driver, in parallel when it supports
+	//  ARB_parallel_shader_compile, and swapped in once linked.  Programs that fail to
+	//  build keep their previous version.
+	const char* shaderPaths[] = {
+		"shaders/advanced.vs",
+		"shaders/advanced.frag",
+		"shaders/gpu_scene.vs",
+		"shaders/gpu_scene.frag",
+		"shaders/cull.comp",
+		"shaders/terrain.vs",
+		"shaders/terrain.tcs",
+		"shaders/terrain.tes",
+		"shaders/raymarch.vs",
+		"shaders/raymarch.frag",
+		"shaders/upscale.vs",
+		"shaders/upscale.frag",
+		"shaders/depth_only.frag",
+		"shaders/vt_feedback.frag",
+		"shaders/contour.vs",
+		"shaders/contour.frag"
+	};
+	for (const char* path : shaderPaths)
 	{
-		// Calculate deltatime of current frame
-		GLfloat currentFrame = glfwGetTime();
-		deltaTime = currentFrame - lastFrame;
-		lastFrame = currentFrame;
+		hotReloader.WatchOnMainThread(path, [&shaderCache, path]() -> ReloadApply
+		{
+			auto pending = make_shared<vector<PendingProgram>>(shaderCache.BeginReload(path));
+			return [&shaderCache, pending](size_t&) -> bool
+			{
+				for (auto it = pending->begin(); it != pending->end(); )
+				{
+					if (shaderCache.FinishReload(*it))
+						it = pending->erase(it);
+					else
+						++it;
+				}
+				return pending->empty();
+			};
+		});
+	}
+	GLuint shaderGeneration = shaderCache.Generation;
+
+	// Batch jobs render into an offscreen framebuffer; finished frames are read back
+	//  asynchronously and written by encoder threads while the next poses render
+	BatchOutput batchOutput;
+	if (batch && !batchOutput.Create(WIDTH, HEIGHT))
+	{
+		glfwTerminate();
+		return 1;
+	}
+	size_t poseIndex = 0;
+	GLfloat batchStart = glfwGetTime();
+
+	// A replay measures how fast the frames render, so do not wait for the display
+	if (inputLog.Replaying())
+		glfwSwapInterval(0);
+
+	// Interactive frames render offscreen at a scale of the window and are scaled up.  The
+	//  scale depends on timings, so a replay keeps full resolution unless given a target.
+	DynamicResolution dynamicTarget;
+	dynamicTarget.Create(shaderCache, targetMilliseconds > 0.0f ? targetMilliseconds : 1000.0f / 60.0f);
+	if (inputLog.Replaying() && targetMilliseconds == 0.0f)
+		dynamicResolution = false;
+	GLfloat replayStart = glfwGetTime();
+
+	// Reversed-Z needs glClipControl.  Fragment shader invocations are counted when the driver
+	//  has pipeline statistics queries, samples passing the depth test otherwise.
+	reversedZSupported = GLEW_VERSION_4_5 || GLEW_ARB_clip_control;
+	reversedZ = reversedZSupported;
+	bool invocationsCounted = GLEW_ARB_pipeline_statistics_query != 0;
+	QueryRing fragmentQueries;
+	fragmentQueries.Create(invocationsCounted ? GL_FRAGMENT_SHADER_INVOCATIONS_ARB : GL_SAMPLES_PASSED);
+	vector<OrderedDraw> orderedDraws;
+	vector<int> visibleBoxes;
+	vector<uint32_t> visibleViews;
+
+	// Terrain imagery streamed in pages through a fixed cache, instead of the skybox bottom
+	VirtualTexture virtualTexture;
+	if (pagesPath && !procedural.Enabled() && virtualTexture.Open(pagesPath, threadPool, shaderCache))
+		cout << "Virtual texture: " << pagesPath << endl;
+
+	// Statistics, reported once per second
+	GLfloat lastReport = glfwGetTime();
+	GLuint reportFrames = 0;
+	GLfloat occludedSum = 0.0f;
+	GLfloat sceneQueryMilliseconds = 0.0f;
+	GLuint sceneQueries = 0;
+
+
+	// Game loop, or one frame per pose in a batch job
+	while (batch ? poseIndex < poses.size() : !glfwWindowShouldClose(window))
+	{
+		// Calculate deltatime of current frame. A replay runs on the recorded clock instead, so
+		//  movement and animation do not depend on how fast the frames render.
+		GLfloat frameStart = glfwGetTime();
+		GLfloat currentFrame = frameStart;
+		if (inputLog.Recording())
+			inputLog.BeginFrame(currentFrame);
 		// Check if any events have been activiated (key pressed, mouse moved etc.) and call corresponding response functions
 		glfwPollEvents();
+		if (inputLog.Replaying())
+		{
+			currentFrame = inputLog.ReplayFrame(window, key_callback, mouse_callback, scroll_callback);
+			if (inputLog.Ended)
+				break;
+		}
+		deltaTime = currentFrame - lastFrame;
+		lastFrame = currentFrame;
 		do_movement();
 
+		// Swap in the files that changed on disk, then pick up rebuilt shader variants
+		hotReloader.Update();
+		virtualTexture.Update();
+		procedural.Update(camera.Position, camera.Front);
+		// Dropped tiles leave holes in the geometry pool, packed once they scatter the free space
+		geometry.Defragment();
+		// Erode the mesh terrain in place, only the tiles that changed go up again
+		if (eroding && !procedural.Enabled())
+		{
+			if (!erosion.Loaded())
+				erosion.Load(heightmap);
+			erosion.Step(threadPool, EROSION_ITERATIONS_PER_FRAME);
+			vector<glm::ivec4> eroded;
+			erosion.UploadChanged(VBOht, heightmap, terrain.Chunks, &eroded);
+			if (contours.Loaded())
+				for (const glm::ivec4& region : eroded)
+					contours.Update(region.x, region.y, region.z, region.w, [&](int row, int col) { return erosion.At(row, col); });
+			if (horizon.Loaded())
+				for (const glm::ivec4& region : eroded)
+					horizon.Update(region.x, region.y, region.z, region.w, [&](int row, int col) { return erosion.At(row, col); });
+		}
+		// Contour lines of the mesh terrain.  Tiles the erosion changed are marched again, but at
+		//  most every CONTOUR_REFRESH_SECONDS so the lines do not go up again every frame.
+		if (contourSpacing > 0 && !procedural.Enabled())
+		{
+			if (!contours.Loaded())
+			{
+				contours.Load(heightmap);
+				if (erosion.Loaded())
+					contours.Update(0, 0, erosion.Height, erosion.Width, [&](int row, int col) { return erosion.At(row, col); });
+			}
+			GLfloat interval = contours.Interval;
+			contours.SetInterval(CONTOUR_INTERVALS[contourSpacing]);
+			if ((contours.Interval != interval || currentFrame - contoursExtracted >= CONTOUR_REFRESH_SECONDS) && contours.Extract(threadPool))
+			{
+				contours.Upload();
+				contoursExtracted = currentFrame;
+				if (contours.Interval != interval)
+					cout << "Contours every " << contours.Interval << " of the height range: " << contours.First.size() << " lines, "
+						<< contours.Vertices.size() << " points in " << contours.Milliseconds << " ms" << endl;
+			}
+		}
+		// Horizons of the mesh terrain.  Tiles near what the erosion changed are baked again, at
+		//  most every HORIZON_REFRESH_SECONDS.
+		if (horizonShading && !procedural.Enabled())
+		{
+			bool first = !horizon.Loaded();
+			if (first)
+			{
+				horizon.Load(heightmap);
+				if (erosion.Loaded())
+					horizon.Update(0, 0, erosion.Height, erosion.Width, [&](int row, int col) { return erosion.At(row, col); });
+			}
+			if ((first || currentFrame - horizonBaked >= HORIZON_REFRESH_SECONDS) && horizon.Bake(threadPool))
+			{
+				horizon.Upload();
+				horizonBaked = currentFrame;
+				if (first)
+					cout << "Horizons of " << horizon.Width << "x" << horizon.Height << " samples baked in " << horizon.Milliseconds
+						<< " ms with " << threadPool.Size() + 1 << " threads" << endl;
+			}
+		}
+		// Viewshed from the camera, and which boxes are in sight of it.  Grid coordinates and
+		//  elevations of a world position: row, column and 1 - height, up being up.
+		if (viewshedRequested && !procedural.Enabled())
+		{
+			viewshedRequested = false;
+			if (!viewshed.Loaded())
+				viewshed.Load(heightmap);
+			auto gridPoint = [&](glm::vec3 world)
+			{
+				glm::vec3 m = world / 50.0f;
+				return glm::vec3((m.z + 1.0f) * 0.5f * (heightmap.Height - 1), (m.x + 1.0f) * 0.5f * (heightmap.Width - 1), 2.0f + 2.0f * m.y);
+			};
+			auto onGrid = [&](glm::vec3 p) { return p.x >= 0.0f && p.x <= heightmap.Height - 1 && p.y >= 0.0f && p.y <= heightmap.Width - 1; };
+			glm::vec3 eye = gridPoint(camera.Position);
+			if (!onGrid(eye))
+				cout << "Viewshed: the camera is not over the heightmap" << endl;
+			else
+			{
+				viewshed.Compute(threadPool, int(eye.x + 0.5f), int(eye.y + 0.5f), eye.z);
+				viewshed.Upload();
+				viewshedShown = true;
+				vector<SightLine> lines;
+				vector<GLuint> boxes;
+				FOR(i, 10)
+				{
+					int index = sceneStore.Index(boxEntities[i]);
+					if (index < 0)
+						continue;
+					glm::vec3 box = gridPoint(glm::vec3(sceneStore.Models[index][3]));
+					if (onGrid(box))
+					{
+						lines.push_back({ eye.x, eye.y, eye.z, box.x, box.y, box.z });
+						boxes.push_back(i);
+					}
+				}
+				vector<uint8_t> visible;
+				viewshed.LinesOfSight(threadPool, lines, visible);
+				cout << "Viewshed: " << 100.0 * viewshed.VisibleFraction() << "% of the terrain visible, computed in "
+					<< viewshed.Milliseconds << " ms, boxes in sight:";
+				FOR(i, (int)boxes.size())
+					if (visible[i])
+						cout << " " << boxes[i];
+				cout << endl;
+			}
+		}
+		// Edit the scene store: pick along the view, take the nearest box, place or remove one,
+		//  and move the selected box relative to the camera
+		if (pickRequested)
+		{
+			GLfloat distance = 0.0f;
+			selectedBox = sceneStore.Raycast(camera.Position, camera.Front, 100.0f, &distance);
+			if (selectedBox != NO_ENTITY)
+				cout << "Picked box " << SceneStore::Slot(selectedBox) << " at " << distance << endl;
+			else
+				cout << "Nothing picked" << endl;
+		}
+		if (nearestRequested)
+		{
+			GLfloat distance = 0.0f;
+			selectedBox = sceneStore.Nearest(camera.Position, FLT_MAX, &distance);
+			if (selectedBox != NO_ENTITY)
+				cout << "Nearest box " << SceneStore::Slot(selectedBox) << " at " << distance << endl;
+		}
+		if (placeRequested)
+		{
+			selectedBox = sceneStore.Add(camera.Position + camera.Front * 3.0f, glm::vec3(-0.5f), glm::vec3(0.5f), PLACED_MATERIAL);
+			cout << "Placed box " << SceneStore::Slot(selectedBox) << ", " << sceneStore.Size() << " in the scene" << endl;
+		}
+		if (removeRequested && sceneStore.Alive(selectedBox))
+		{
+			sceneStore.Remove(selectedBox);
+			selectedBox = NO_ENTITY;
+		}
+		pickRequested = nearestRequested = placeRequested = removeRequested = false;
+		int selectedIndex = sceneStore.Index(selectedBox);
+		if (selectedIndex >= 0)
+		{
+			glm::vec3 ahead = glm::normalize(glm::vec3(camera.Front.x, 0.0f, camera.Front.z)), move;
+			if (keys[GLFW_KEY_UP])
+				move += ahead;
+			if (keys[GLFW_KEY_DOWN])
+				move -= ahead;
+			if (keys[GLFW_KEY_RIGHT])
+				move += camera.Right;
+			if (keys[GLFW_KEY_LEFT])
+				move -= camera.Right;
+			if (keys[GLFW_KEY_PAGE_UP])
+				move.y += 1.0f;
+			if (keys[GLFW_KEY_PAGE_DOWN])
+				move.y -= 1.0f;
+			if (move != glm::vec3())
+				sceneStore.SetPosition(selectedBox, sceneStore.Positions[selectedIndex] + move * 5.0f * deltaTime);
+		}
+
+		if (shaderCache.Generation != shaderGeneration)
+		{
+			// The variants in use are fetched again when next picked
+			FOR(p, 1 << PERMUTATION_COUNT)
+				shaderVariants[p] = 0;
+			depthProgram = shaderCache.Program("shaders/advanced.vs", "shaders/depth_only.frag");
+			contourProgram = shaderCache.Program("shaders/contour.vs", "shaders/contour.frag");
+			shaderGeneration = shaderCache.Generation;
+		}
+
+		// Pick the render target.  The aspect ratio is the window's, the viewport may be smaller.
+		glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+		framebufferWidth = max(framebufferWidth, 1);
+		framebufferHeight = max(framebufferHeight, 1);
+		GLfloat aspect = (GLfloat)framebufferWidth / (GLfloat)framebufferHeight;
+		glm::vec2 viewport(framebufferWidth, framebufferHeight);
+		bool scaled = dynamicResolution && !batch;
+		if (batch)
+		{
+			const RenderPose& pose = poses[poseIndex];
+			camera = Camera(pose.Position, glm::vec3(0.0f, 1.0f, 0.0f), pose.Yaw, pose.Pitch);
+			camera.Zoom = fov = pose.Zoom;
+			batchOutput.Bind();
+			aspect = (GLfloat)WIDTH / (GLfloat)HEIGHT;
+			viewport = glm::vec2(WIDTH, HEIGHT);
+		}
+		else if (scaled)
+		{
+			dynamicTarget.Begin(framebufferWidth, framebufferHeight);
+			viewport = glm::vec2(dynamicTarget.RenderWidth, dynamicTarget.RenderHeight);
+		}
+		else
+		{
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			glViewport(0, 0, framebufferWidth, framebufferHeight);
+		}
+
+		// Depth convention: reversed-Z clears to 0, the far plane, and keeps greater depths
+		if (reversedZSupported)
+			glClipControl(GL_LOWER_LEFT, reversedZ ? GL_ZERO_TO_ONE : GL_NEGATIVE_ONE_TO_ONE);
+		glClearDepth(reversedZ ? 0.0 : 1.0);
+		glDepthFunc(reversedZ ? GL_GREATER : GL_LESS);
+
 		// Render
 		// Clear the colorbuffer
 		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		fragmentQueries.Begin();
 
 		// Camera/View transformation
 		// Create View Matrix
 		glm::mat4 view;
 		view = camera.GetViewMatrix();
-		// Create Projection Matrix  
+		// Create Projection Matrix.  The CPU culling always uses the conventional one.
+		glm::mat4 cullProjection = glm::perspective(fov, aspect, 0.1f, 100.0f);
 		glm::mat4 projection;
-		projection = glm::perspective(fov, (GLfloat)WIDTH/(GLfloat)HEIGHT, 0.1f, 100.0f);  
-
-
-		// Get the uniform locations for model, view, and project matrix in the shader program
-		GLint modelLoc = glGetUniformLocation(ourShader.Program, "model");
-		GLint viewLoc = glGetUniformLocation(ourShader.Program, "view");
-		GLint projLoc = glGetUniformLocation(ourShader.Program, "projection");
-
-		// Pass the matrice pointers to the shader
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-		glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-
-		// Activate shader
-		ourShader.Use();
-
-		//  Load Textures for the Front of the Skycube
-		// 1.  Activate the texture unit GL_TEXTURE0 so it can be used 
-		//         (and is the one you are currently loading into)
-		glActiveTexture(GL_TEXTURE0);
-		// 2.  Bind the texture3 object to use in the GL_TEXTURE0 texture unit
-		glBindTexture(GL_TEXTURE_2D, texture3);
-		// 3.  Send the texture information to the shader variable 'ourTexture1' in the fragment shader
-		glUniform1i(glGetUniformLocation(ourShader.Program, "ourTexture1"), 0);
-		// 4.  Activate a second texture unit to use another texture at the same time
-		glActiveTexture(GL_TEXTURE1);
-		// 5.  Bind texture3 again to texture unit GL_TEXTURE1.  This is only necessary since the shader
-		//      takes two textures and mixes them together. 
-		glBindTexture(GL_TEXTURE_2D, texture3);
-		// 6.  Send the texture information to the shader variable `ourTexture2'
-		glUniform1i(glGetUniformLocation(ourShader.Program, "ourTexture2"), 1);
-
-
-		// Draw the front side of the skybox
-		// 1. Bind the vertex array 
-		glBindVertexArray(VAO_Front);
-		// 2. Create the Model Matrix
-		glm::mat4 model ;
-		// 4.  Scale the model matrix by 50.0f (f is to make it a float)
-		model = glm::scale(model, glm::vec3(50.0f,50.0f,50.0f));
-		// 6.  Send the matrix pointer of the model matrix to the shader
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-		// 7.  Draw the two triangles consisting of 6 sides.
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		// 8.  Unbind the vertex array
-		glBindVertexArray(0);
-
-
-		//  Load Textures for the Back of the Skycube
-		// 1.  Activate the texture unit GL_TEXTURE0 so it can be used 
-		//         (and is the one you are currently loading into)
-		glActiveTexture(GL_TEXTURE0);
-		// 2.  Bind the texture3 object to use in the GL_TEXTURE0 texture unit
-		glBindTexture(GL_TEXTURE_2D, texture4);
-		// 3.  Send the texture information to the shader variable 'ourTexture1' in the fragment shader
-		glUniform1i(glGetUniformLocation(ourShader.Program, "ourTexture1"), 0);
-		// 4.  Activate a second texture unit to use another texture at the same time
-		glActiveTexture(GL_TEXTURE1);
-		// 5.  Bind texture3 again to texture unit GL_TEXTURE1.  This is only necessary since the shader
-		//      takes two textures and mixes them together. 
-		glBindTexture(GL_TEXTURE_2D, texture4);
-		// 6.  Send the texture information to the shader variable `ourTexture2'
-		glUniform1i(glGetUniformLocation(ourShader.Program, "ourTexture2"), 1);
-
-		// Draw the back side of the skybox
-		// 1. Bind the vertex array 
-		glBindVertexArray(VAO_Back);
-		// 2. Create the Model Matrix
-		glm::mat4 model2 ;
-		// 4.  Scale the model matrix by 50.0f (f is to make it a float)
-		model2 = glm::scale(model2, glm::vec3(50.0f,50.0f,50.0f));
-		// 6.  Send the matrix pointer of the model matrix to the shader
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model2));
-		// 7.  Draw the two triangles consisting of 6 sides.
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		// 8.  Unbind the vertex array
-		glBindVertexArray(0);
-
-
-		//  Load Textures for the Left of the Skycube
-		// 1.  Activate the texture unit GL_TEXTURE0 so it can be used 
-		//         (and is the one you are currently loading into)
-		glActiveTexture(GL_TEXTURE0);
-		// 2.  Bind the texture3 object to use in the GL_TEXTURE0 texture unit
-		glBindTexture(GL_TEXTURE_2D, texture5);
-		// 3.  Send the texture information to the shader variable 'ourTexture1' in the fragment shader
-		glUniform1i(glGetUniformLocation(ourShader.Program, "ourTexture1"), 0);
-		// 4.  Activate a second texture unit to use another texture at the same time
-		glActiveTexture(GL_TEXTURE1);
-		// 5.  Bind texture3 again to texture unit GL_TEXTURE1.  This is only necessary since the shader
-		//      takes two textures and mixes them together. 
-		glBindTexture(GL_TEXTURE_2D, texture5);
-		// 6.  Send the texture information to the shader variable `ourTexture2'
-		glUniform1i(glGetUniformLocation(ourShader.Program, "ourTexture2"), 1);
-
-		// Draw the left side of the skybox
-		// 1. Bind the vertex array 
-		glBindVertexArray(VAO_Left);
-		// 2. Create the Model Matrix
-		glm::mat4 model3 ;
-		// 4.  Scale the model matrix by 50.0f (f is to make it a float)
-		model3 = glm::scale(model3, glm::vec3(50.0f,50.0f,50.0f));
-		// 6.  Send the matrix pointer of the model matrix to the shader
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model3));
-		// 7.  Draw the two triangles consisting of 6 sides.
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		// 8.  Unbind the vertex array
-		glBindVertexArray(0);
-
-
-		//  Load Textures for the Right of the Skycube
-		// 1.  Activate the texture unit GL_TEXTURE0 so it can be used 
-		//         (and is the one you are currently loading into)
-		glActiveTexture(GL_TEXTURE0);
-		// 2.  Bind the texture3 object to use in the GL_TEXTURE0 texture unit
-		glBindTexture(GL_TEXTURE_2D, texture6);
-		// 3.  Send the texture information to the shader variable 'ourTexture1' in the fragment shader
-		glUniform1i(glGetUniformLocation(ourShader.Program, "ourTexture1"), 0);
-		// 4.  Activate a second texture unit to use another texture at the same time
-		glActiveTexture(GL_TEXTURE1);
-		// 5.  Bind texture3 again to texture unit GL_TEXTURE1.  This is only necessary since the shader
-		//      takes two textures and mixes them together. 
-		glBindTexture(GL_TEXTURE_2D, texture6);
-		// 6.  Send the texture information to the shader variable `ourTexture2'
-		glUniform1i(glGetUniformLocation(ourShader.Program, "ourTexture2"), 1);
-
-		// Draw the right side of the skybox
-		// 1. Bind the vertex array 
-		glBindVertexArray(VAO_Right);
-		// 2. Create the Model Matrix
-		glm::mat4 model4 ;
-		// 4.  Scale the model matrix by 50.0f (f is to make it a float)
-		model4 = glm::scale(model4, glm::vec3(50.0f,50.0f,50.0f));
-		// 6.  Send the matrix pointer of the model matrix to the shader
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model4));
-		// 7.  Draw the two triangles consisting of 6 sides.
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		// 8.  Unbind the vertex array
-		glBindVertexArray(0);
-
-
-		//  Load Textures for the Top of the Skycube
-		// 1.  Activate the texture unit GL_TEXTURE0 so it can be used 
-		//         (and is the one you are currently loading into)
-		glActiveTexture(GL_TEXTURE0);
-		// 2.  Bind the texture3 object to use in the GL_TEXTURE0 texture unit
-		glBindTexture(GL_TEXTURE_2D, texture7);
-		// 3.  Send the texture information to the shader variable 'ourTexture1' in the fragment shader
-		glUniform1i(glGetUniformLocation(ourShader.Program, "ourTexture1"), 0);
-		// 4.  Activate a second texture unit to use another texture at the same time
-		glActiveTexture(GL_TEXTURE1);
-		// 5.  Bind texture3 again to texture unit GL_TEXTURE1.  This is only necessary since the shader
-		//      takes two textures and mixes them together. 
-		glBindTexture(GL_TEXTURE_2D, texture7);
-		// 6.  Send the texture information to the shader variable `ourTexture2'
-		glUniform1i(glGetUniformLocation(ourShader.Program, "ourTexture2"), 1);
-
-		// Draw the top side of the skybox
-		// 1. Bind the vertex array 
-		glBindVertexArray(VAO_Top);
-		// 2. Create the Model Matrix
-		glm::mat4 model5 ;
-		// 4.  Scale the model matrix by 50.0f (f is to make it a float)
-		model5 = glm::scale(model5, glm::vec3(50.0f,50.0f,50.0f));
-		// 6.  Send the matrix pointer of the model matrix to the shader
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model5));
-		// 7.  Draw the two triangles consisting of 6 sides.
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		// 8.  Unbind the vertex array
-		glBindVertexArray(0);
-
-		////  Load Textures for the Bottom of the Skycube
-		//// 1.  Activate the texture unit GL_TEXTURE0 so it can be used 
-		////         (and is the one you are currently loading into)
-		//glActiveTexture(GL_TEXTURE0);
-		//// 2.  Bind the texture3 object to use in the GL_TEXTURE0 texture unit
-		//glBindTexture(GL_TEXTURE_2D, texture8);
-		//// 3.  Send the texture information to the shader variable 'ourTexture1' in the fragment shader
-		//glUniform1i(glGetUniformLocation(ourShader.Program, "ourTexture1"), 0);
-		//// 4.  Activate a second texture unit to use another texture at the same time
-		//glActiveTexture(GL_TEXTURE1);
-		//// 5.  Bind texture3 again to texture unit GL_TEXTURE1.  This is only necessary since the shader
-		////      takes two textures and mixes them together. 
-		//glBindTexture(GL_TEXTURE_2D, texture8);
-		//// 6.  Send the texture information to the shader variable `ourTexture2'
-		//glUniform1i(glGetUniformLocation(ourShader.Program, "ourTexture2"), 1);
-
-		//// Draw the bottom side of the skybox
-		//// 1. Bind the vertex array 
-		//glBindVertexArray(VAO_Bottom);
-		//// 2. Create the Model Matrix
-		//glm::mat4 model6 ;
-		//// 4.  Scale the model matrix by 50.0f (f is to make it a float)
-		//model6 = glm::scale(model6, glm::vec3(50.0f,50.0f,50.0f));
-		//// 6.  Send the matrix pointer of the model matrix to the shader
-		//glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model6));
-		//// 7.  Draw the two triangles consisting of 6 sides.
-		//glDrawArrays(GL_TRIANGLES, 0, 6);
-		//// 8.  Unbind the vertex array
-		//glBindVertexArray(0);
-
-		//  Load Textures for the Bottom of the Skycube
-		// 1.  Activate the texture unit GL_TEXTURE0 so it can be used 
-		//         (and is the one you are currently loading into)
-		glActiveTexture(GL_TEXTURE0);
-		// 2.  Bind the texture3 object to use in the GL_TEXTURE0 texture unit
-		glBindTexture(GL_TEXTURE_2D, texture8);
-		// 3.  Send the texture information to the shader variable 'ourTexture1' in the fragment shader
-		glUniform1i(glGetUniformLocation(ourShader.Program, "ourTexture1"), 0);
-		// 4.  Activate a second texture unit to use another texture at the same time
-		glActiveTexture(GL_TEXTURE1);
-		// 5.  Bind texture3 again to texture unit GL_TEXTURE1.  This is only necessary since the shader
-		//      takes two textures and mixes them together. 
-		glBindTexture(GL_TEXTURE_2D, texture8);
-		// 6.  Send the texture information to the shader variable `ourTexture2'
-		glUniform1i(glGetUniformLocation(ourShader.Program, "ourTexture2"), 1);
-		// Draw the height map
-		glBindVertexArray(VAOht);
-
-		glm::mat4 model7 ;
-		// 4.  Scale the model matrix by 50.0f (f is to make it a float)
-		model7 = glm::scale(model7, glm::vec3(50.0f,50.0,50.0f));
-		// 6.  Send the matrix pointer of the model matrix to the shader
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model7));
-
-		glDrawArrays(GL_TRIANGLES, 0, 5*3*2*(ht_height-1)*(ht_width-1));
-		glBindVertexArray(0);
-
-
-		// Bind Textures using texture units
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, texture1);
-		glUniform1i(glGetUniformLocation(ourShader.Program, "ourTexture1"), 0);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, texture2);
-		glUniform1i(glGetUniformLocation(ourShader.Program, "ourTexture2"), 1);
-
-
-		//  Draw each of the Boxes in the center
-		glBindVertexArray(VAO);
-		for (GLuint i = 0; i < 10; i++)
-		{
-			// Calculate the model matrix for each object and pass it to shader before drawing
-			glm::mat4 model, angle;
+		projection = reversedZ ? ReversedPerspective(fov, aspect, 0.1f, 100.0f) : cullProjection;
 
-			// Make the boxes transform in time
-			model = glm::translate(model, boxTranslate);
-			model = glm::translate(model, cubePositions[i]);
-			model = glm::rotate(model,(GLfloat)glfwGetTime() * 0.5f, rotationRate);
-			model = glm::rotate(model,(GLfloat)glfwGetTime() * alpha, glm::vec3(1.0f, 0.0f, 0.0f));
-			model = glm::rotate(model,(GLfloat)glfwGetTime() * beta, glm::vec3(0.0f, 1.0f, 0.0f));
-			model = glm::rotate(model,(GLfloat)glfwGetTime() * gamma, glm::vec3(0.0f, 0.0f, 1.0f));
-			model = glm::scale(model, boxScale);
 
+		// Animate the ten boxes where they were placed, shared by both render paths.  The scene
+		//  store refits its BVH over the boxes that moved when it is queried.
+		FOR(i, 10)
+		{
+			int index = sceneStore.Index(boxEntities[i]);
+			if (index >= 0)
+				sceneStore.SetModel(boxEntities[i], boxModel(sceneStore.Positions[index], batch ? 0.0f : currentFrame));
+		}
 
-			glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+		// The tessellated and ray marched terrain, the contours and the virtual texture feedback draw
+		//  one view only, so with any of them on the camera is drawn alone whatever the layout
+		ViewLayout layout = terrainMode != TERRAIN_MESH || (contourSpacing > 0 && !procedural.Enabled() && contourProgram != 0)
+			|| virtualTexture.Ready() ? VIEWS_SINGLE : viewLayout;
 
-			glDrawArrays(GL_TRIANGLES, 0, 36);
+		if (gpuDriven && gpuDrivenSupported)
+		{
+			// One culling dispatch and one indirect multi draw for the whole scene.  It only has
+			//  the animated boxes, a removed one shrinks to nothing.
+			FOR(i, 10)
+			{
+				int index = sceneStore.Index(boxEntities[i]);
+				gpuScene.SetModel(gpuBoxObjects[i], index >= 0 ? sceneStore.Models[index] : glm::mat4(0.0f));
+			}
+			gpuScene.Draw(view, projection, textureArray, litTerrain, reversedZ);
+		}
+		else
+		{
+			// The views of the frame.  The first one, the camera or its left eye, stands in for the
+			//  camera in the feedback and culling setup.  With several views every draw goes to all
+			//  of them as instances, or each view is drawn in a pass of its own.
+			multiView.Layout(layout, camera.Position, camera.Front, camera.Up, camera.Right, fov, viewport, reversedZ, 0.1f, 100.0f);
+			bool multiple = multiView.Count() > 1;
+			GLuint viewFlags = multiple && multiView.Instanced ? MULTI_VIEW : 0;
+			GLsizei instances = viewFlags ? multiView.Count() : 1;
+			view = multiView.Views[0].View;
+			cullProjection = multiView.Views[0].CullProjection;
+			projection = multiView.Views[0].Projection;
+
+			// Binds the cheapest shader variant able to draw with the two textures, and the textures
+			//  themselves.  View and projection are only uploaded when the program changes.  Returns
+			//  the location of the model matrix in the bound program.
+			GLuint currentProgram = 0;
+			auto bindMaterial = [&](GLuint textureA, GLuint textureB, GLuint flags) -> GLint
+			{
+				GLuint program = shaderVariant(ChoosePermutation(textureA, textureB, flags | viewFlags));
+				if (program != currentProgram)
+				{
+					glUseProgram(program);
+					glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+					glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+					if (viewFlags)
+						multiView.SetUniforms(program);
+					glUniform1i(glGetUniformLocation(program, "ourTexture1"), 0);
+					glUniform1i(glGetUniformLocation(program, "ourTexture2"), 1);
+					glUniform3f(glGetUniformLocation(program, "sunDirection"), 0.4f, 1.0f, 0.3f);
+					currentProgram = program;
+				}
+				glActiveTexture(GL_TEXTURE0);
+				glBindTexture(GL_TEXTURE_2D, textureA);
+				// The single-texture variant has no second sampler to feed
+				if (textureA != textureB)
+				{
+					glActiveTexture(GL_TEXTURE1);
+					glBindTexture(GL_TEXTURE_2D, textureB);
+				}
+				return glGetUniformLocation(program, "model");
+			};
+			// Viewport, depth range and matrices of one view, for the passes drawn a view at a time
+			auto selectView = [&](int v)
+			{
+				multiView.Apply(v);
+				view = multiView.Views[v].View;
+				projection = multiView.Views[v].Projection;
+				currentProgram = 0;
+			};
+
+			glm::mat4 model7 ;
+			// 4.  Scale the model matrix by 50.0f (f is to make it a float)
+			model7 = glm::scale(model7, glm::vec3(50.0f,50.0,50.0f));
+
+			// Culling runs once for all the views, on their conventional projections whatever the
+			//  depth mode, and marks every chunk and box with the views that see it.  The occluder is
+			//  built from the heightmap as loaded, eroded ground could sink behind it, and is only
+			//  rendered from a single view.
+			bool occluding = occlusionCulling && !multiple && !procedural.Enabled() && !erosion.Loaded();
+			if (occluding)
+				occlusion.Render(cullProjection * view);
+
+			// Collect the visible chunks of the mesh terrain and the visible boxes, and draw them
+			//  nearest first so the depth test rejects what they hide before it is shaded
+			orderedDraws.clear();
+			if (terrainMode == TERRAIN_MESH && procedural.Enabled())
+			{
+				FOR(t, (int)procedural.Tiles.size())
+				{
+					const ProceduralTerrain::Tile& tile = procedural.Tiles[t];
+					FOR(c, (int)tile.Chunks.size())
+					{
+						glm::vec3 chunkMin, chunkMax;
+						TransformBounds(tile.Model, tile.Chunks[c].BoundsMin, tile.Chunks[c].BoundsMax, chunkMin, chunkMax);
+						GLuint views = multiView.Mask(chunkMin, chunkMax);
+						if (views)
+							orderedDraws.push_back({ multiView.Distance(views, chunkMin, chunkMax), c, -1, t, views });
+					}
+				}
+			}
+			else if (terrainMode == TERRAIN_MESH)
+			{
+				FOR(c, (int)terrain.Chunks.size())
+				{
+					glm::vec3 chunkMin, chunkMax;
+					TransformBounds(model7, terrain.Chunks[c].BoundsMin, terrain.Chunks[c].BoundsMax, chunkMin, chunkMax);
+					GLuint views = multiView.Mask(chunkMin, chunkMax);
+					if (!views)
+						continue;
+					if (!occluding || !occlusion.IsOccluded(chunkMin, chunkMax))
+						orderedDraws.push_back({ multiView.Distance(views, chunkMin, chunkMax), c, -1, -1, views });
+				}
+			}
+			auto queryStart = chrono::steady_clock::now();
+			sceneStore.QueryFrusta(multiView.Frusta, multiView.Count(), visibleBoxes, visibleViews);
+			sceneQueryMilliseconds += chrono::duration<GLfloat, milli>(chrono::steady_clock::now() - queryStart).count();
+			sceneQueries++;
+			FOR(i, (int)visibleBoxes.size())
+			{
+				int index = visibleBoxes[i];
+				const glm::vec3& boxMin = sceneStore.BoundsMin[index];
+				const glm::vec3& boxMax = sceneStore.BoundsMax[index];
+				if (occluding && occlusion.IsOccluded(boxMin, boxMax))
+					continue;
+				orderedDraws.push_back({ multiView.Distance(visibleViews[i], boxMin, boxMax), -1, index, -1, visibleViews[i] });
+			}
+			if (frontToBack)
+				sort(orderedDraws.begin(), orderedDraws.end(),
+					[](const OrderedDraw& a, const OrderedDraw& b) { return a.Distance < b.Distance; });
+
+			// Feedback for the virtual texture: which pages the visible chunks sample
+			if (virtualTexture.Ready() && terrainMode == TERRAIN_MESH)
+			{
+				GLint feedbackModel = virtualTexture.BeginFeedback((int)viewport.x, (int)viewport.y, view, projection);
+				glUniformMatrix4fv(feedbackModel, 1, GL_FALSE, glm::value_ptr(model7));
+				glBindVertexArray(VAOht);
+				for (const OrderedDraw& draw : orderedDraws)
+				{
+					if (draw.Chunk < 0)
+						continue;
+					const TerrainChunk& chunk = terrain.Chunks[draw.Chunk];
+					glDrawElements(GL_TRIANGLES, chunk.IndexCount, GL_UNSIGNED_INT, (GLvoid*)(sizeof(GLuint) * chunk.FirstIndex));
+				}
+				glBindVertexArray(0);
+				virtualTexture.EndFeedback();
+				currentProgram = 0;
+			}
+
+			// Draws the collected chunks and boxes in order.  The program, vertex array and textures
+			//  only change where the draws switch between terrain and boxes.  Instanced across the
+			//  views each draw tells the vertex stage which views see it, a pass of one view skips
+			//  the draws that view does not see.
+			auto drawOrdered = [&](bool depthOnly, int onlyView)
+			{
+				int bound = -1, boundTile = -2;
+				GLuint boundArray = 0;
+				auto bindArray = [&](GLuint vertexArray)
+				{
+					if (vertexArray != boundArray)
+						glBindVertexArray(vertexArray);
+					boundArray = vertexArray;
+				};
+				bool horizonShown = horizonShading && horizon.Texture != 0;
+				GLuint terrainFlags = (litTerrain ? LIT_TERRAIN : SINGLE_TEXTURE) | (viewshedShown ? VIEWSHED_OVERLAY : 0) |
+					(horizonShown ? HORIZON_SHADING : 0);
+				GLint modelLoc = -1, viewMaskLoc = -1;
+				GLuint boundViews = 0;
+				for (const OrderedDraw& draw : orderedDraws)
+				{
+					if (onlyView >= 0 && !(draw.Views & (1u << onlyView)))
+						continue;
+					// Terrain, or boxes of one material
+					int kind = draw.Chunk >= 0 ? 0 : 1 + int(sceneStore.Materials[draw.Box]);
+					if (kind != bound)
+					{
+						if (depthOnly)
+							modelLoc = glGetUniformLocation(depthProgram, "model");
+						else if (kind == 0)
+						{
+							if (virtualTexture.Ready())
+							{
+								modelLoc = bindMaterial(virtualTexture.Cache(), virtualTexture.Cache(), VIRTUAL_TEXTURE | terrainFlags);
+								virtualTexture.SetUniforms(currentProgram);
+							}
+							else
+								modelLoc = bindMaterial(texture8, texture8, terrainFlags);
+							if (viewshedShown)
+								viewshed.SetUniforms(currentProgram);
+							if (horizonShown)
+								horizon.SetUniforms(currentProgram);
+						}
+						else if (kind == 1 + BOX_MATERIAL)
+							modelLoc = bindMaterial(texture1, texture2, SINGLE_TEXTURE);
+						else
+							modelLoc = bindMaterial(texture2, texture2, SINGLE_TEXTURE);
+						// The terrain binds its vertex array below, the heightmap has its own
+						if (kind > 0)
+							bindArray(geometry.VAO);
+						boundTile = -2;
+						bound = kind;
+						viewMaskLoc = viewFlags ? glGetUniformLocation(currentProgram, "viewMask") : -1;
+						boundViews = 0;
+					}
+					if (viewFlags && draw.Views != boundViews)
+					{
+						glUniform1i(viewMaskLoc, GLint(draw.Views));
+						boundViews = draw.Views;
+					}
+					if (kind == 0)
+					{
+						// Every procedural tile has its own model matrix, all of them share the pool's vertex array
+						if (draw.Tile != boundTile)
+						{
+							bindArray(draw.Tile >= 0 ? geometry.VAO : VAOht);
+							glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(draw.Tile >= 0 ? procedural.Tiles[draw.Tile].Model : model7));
+							boundTile = draw.Tile;
+						}
+						if (draw.Tile >= 0)
+							procedural.DrawChunk(draw.Tile, draw.Chunk, instances);
+						else
+						{
+							const TerrainChunk& chunk = terrain.Chunks[draw.Chunk];
+							glDrawElementsInstanced(GL_TRIANGLES, chunk.IndexCount, GL_UNSIGNED_INT, (GLvoid*)(sizeof(GLuint) * chunk.FirstIndex), instances);
+						}
+					}
+					else
+					{
+						glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(sceneStore.Models[draw.Box]));
+						glDrawArraysInstanced(GL_TRIANGLES, geometry.BaseVertex(boxMesh), 36, instances);
+					}
+				}
+				glBindVertexArray(0);
+			};
+
+			// Several views: all of them in one pass through the viewport array, or one pass each
+			if (viewFlags)
+			{
+				multiView.ApplyAll();
+				drawOrdered(false, -1);
+			}
+			else if (multiple)
+			{
+				FOR(v, multiView.Count())
+				{
+					selectView(v);
+					drawOrdered(false, v);
+				}
+			}
+			// Depth pre-pass: lay down the depth of the chunks and boxes without shading, then
+			//  shade exactly the surfaces that stay visible
+			else if (depthPrePass && depthProgram != 0)
+			{
+				glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+				glUseProgram(depthProgram);
+				glUniformMatrix4fv(glGetUniformLocation(depthProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+				glUniformMatrix4fv(glGetUniformLocation(depthProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+				drawOrdered(true, 0);
+				glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+				glDepthMask(GL_FALSE);
+				glDepthFunc(reversedZ ? GL_GEQUAL : GL_LEQUAL);
+				drawOrdered(false, 0);
+				glDepthMask(GL_TRUE);
+				glDepthFunc(reversedZ ? GL_GREATER : GL_LESS);
+			}
+			else
+				drawOrdered(false, 0);
+			if (terrainMode == TERRAIN_TESSELLATED)
+			{
+				// The tessellation stages cull and refine the patches themselves
+				tessellatedTerrain.Draw(model7, view, projection, viewport, texture8, litTerrain, reversedZ);
+				currentProgram = 0;
+			}
+			else if (terrainMode == TERRAIN_RAYMARCHED)
+			{
+				// Covers the screen and writes the depth of the surface it hits
+				raymarchedTerrain.Draw(model7, view, projection, texture8, litTerrain, reversedZ);
+				currentProgram = 0;
+			}
+
+			// Contour lines, one multi draw over the terrain the depth buffer now holds
+			if (contourSpacing > 0 && !procedural.Enabled() && contourProgram != 0)
+			{
+				glUseProgram(contourProgram);
+				glUniformMatrix4fv(glGetUniformLocation(contourProgram, "model"), 1, GL_FALSE, glm::value_ptr(model7));
+				glUniformMatrix4fv(glGetUniformLocation(contourProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+				glUniformMatrix4fv(glGetUniformLocation(contourProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+				glUniform3f(glGetUniformLocation(contourProgram, "lineColor"), 0.15f, 0.1f, 0.05f);
+				contours.Draw();
+				currentProgram = 0;
+			}
+
+			// Draw the sides of the skybox last, it lies behind everything else.  Every side samples
+			//  one texture, so they all use the single-texture variant.  The bottom side is covered
+			//  by the height map.  Every view sees the sky.
+			GLuint skyTextures[] = { texture3, texture4, texture5, texture6, texture7 };
+			// 1. Bind the vertex array, shared by the sides
+			glBindVertexArray(geometry.VAO);
+			if (viewFlags)
+				multiView.ApplyAll();
+			FOR(v, multiple && !viewFlags ? multiView.Count() : 1)
+			{
+				if (multiple && !viewFlags)
+					selectView(v);
+				FOR(side, 5)
+				{
+					GLint modelLoc = bindMaterial(skyTextures[side], skyTextures[side], SINGLE_TEXTURE);
+					if (viewFlags)
+						glUniform1i(glGetUniformLocation(currentProgram, "viewMask"), GLint(multiView.AllViews()));
+					// 2. Create the Model Matrix
+					glm::mat4 model ;
+					// 3.  Procedural terrain has no end, its sky travels with the camera
+					if (procedural.Enabled())
+						model = glm::translate(model, glm::vec3(camera.Position.x, 0.0f, camera.Position.z));
+					// 4.  Scale the model matrix by 50.0f (f is to make it a float)
+					model = glm::scale(model, glm::vec3(50.0f,50.0f,50.0f));
+					// 6.  Send the matrix pointer of the model matrix to the shader
+					glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+					// 7.  Draw the two triangles consisting of 6 sides.
+					glDrawArraysInstanced(GL_TRIANGLES, geometry.BaseVertex(skyMeshes[side]), 6, instances);
+				}
+			}
+			// 8.  Unbind the vertex array
+			glBindVertexArray(0);
+
+			// Back to the whole render target for the passes after the frame
+			if (multiple)
+			{
+				glViewport(0, 0, (GLsizei)viewport.x, (GLsizei)viewport.y);
+				glDepthRange(0.0, 1.0);
+			}
 		}
-		glBindVertexArray(0);
 
 
-		// Swap the screen buffers
-		glfwSwapBuffers(window);
+		fragmentQueries.End();
+
+		// Scale the frame up to the window
+		if (scaled)
+			dynamicTarget.Present();
+
+		// Swap the screen buffers, or queue the frame of the pose for saving
+		if (batch)
+			batchOutput.Capture(poses[poseIndex++].Output);
+		else
+			glfwSwapBuffers(window);
+		GLfloat frameEnd = glfwGetTime();
+		frameTimeLog.Add(currentFrame, frameEnd - frameStart);
+
+		if (resourceLogRequested)
+		{
+			resourceLogRequested = false;
+			if (Resources().WriteJson(resourceLogPath))
+				cout << "Resources written to " << resourceLogPath << endl;
+		}
+
+		// Report the statistics of the last second
+		reportFrames++;
+		bool occlusionShown = occlusionCulling && !gpuDriven && layout == VIEWS_SINGLE && !procedural.Enabled() && !erosion.Loaded();
+		if (occlusionShown)
+			occludedSum += occlusion.OccludedFraction();
+		if (frameEnd - lastReport >= 1.0f)
+		{
+			cout << reportFrames / (frameEnd - lastReport) << " fps";
+			if (!gpuDriven)
+				cout << ", " << TERRAIN_MODE_NAMES[terrainMode] << " terrain";
+			if (!gpuDriven && layout != VIEWS_SINGLE)
+				cout << ", " << VIEW_LAYOUT_NAMES[layout] << (multiView.Instanced ? " instanced" : " in a pass per view");
+			else if (!gpuDriven && viewLayout != VIEWS_SINGLE)
+				cout << ", " << VIEW_LAYOUT_NAMES[viewLayout] << " off, the terrain mode, contours or virtual texture draw one view";
+			if (occlusionShown)
+				cout << ", occluded " << 100.0f * occludedSum / reportFrames << "% of the objects in the frustum";
+			cout << ", " << fragmentQueries.Average() / 1e6 << (invocationsCounted ? "M fragment shader invocations" : "M samples passed")
+				<< " per frame";
+			if (scaled)
+				cout << ", scale " << dynamicTarget.AverageScale() << ", " << 100.0f * dynamicTarget.BudgetHitRate()
+					<< "% of the frames within " << dynamicTarget.TargetMilliseconds << " ms";
+			if (procedural.Enabled())
+				cout << ", " << procedural.Tiles.size() << " procedural tiles, " << procedural.PendingTiles() << " generating, "
+					<< procedural.SamplesPerSecondPerCore() / 1e6 << "M noise samples/s per core, geometry pool "
+					<< geometry.UsedBytes() / 1048576.0 << " of " << geometry.Bytes() / 1048576.0 << " MB, "
+					<< geometry.Grows << " grows, " << geometry.Compactions << " compactions";
+			if (erosion.Loaded())
+				cout << ", erosion " << erosion.Iterations << " iterations, " << erosion.IterationsPerSecond() << " iterations/s";
+			if (horizonShading && horizon.Loaded())
+				cout << ", horizons last baked " << horizon.TilesBaked << " tiles in " << horizon.Milliseconds << " ms";
+			if (contourSpacing > 0 && contours.Loaded())
+				cout << ", contours " << contours.First.size() << " lines, last " << contours.TilesExtracted << " tiles in "
+					<< contours.Milliseconds << " ms";
+			if (virtualTexture.Ready())
+				cout << ", virtual texture " << 100.0f * virtualTexture.HitRate() << "% hits, "
+					<< virtualTexture.AverageLatencyMilliseconds() << " ms page-in, " << virtualTexture.ResidentPages() << " pages resident";
+			if (sceneQueries > 0)
+				cout << ", " << sceneStore.Size() << " boxes, frusta query " << sceneQueryMilliseconds / sceneQueries << " ms, "
+					<< sceneStore.Builds << " BVH builds";
+			Resources().CpuAllocation(&sceneStore, "scene store", sceneStore.Bytes());
+			ResourceRegistry::Totals gpuMemory = Resources().Gpu(), cpuMemory = Resources().Cpu();
+			cout << ", GPU " << gpuMemory.Bytes / 1048576.0 << " MB in " << gpuMemory.Count << " objects (peak " << gpuMemory.PeakBytes / 1048576.0
+				<< "), CPU " << cpuMemory.Bytes / 1048576.0 << " MB (peak " << cpuMemory.PeakBytes / 1048576.0 << ")";
+			cout << endl;
+			dynamicTarget.ResetStatistics();
+			virtualTexture.ResetStatistics();
+			fragmentQueries.Reset();
+			lastReport = frameEnd;
+			reportFrames = 0;
+			occludedSum = 0.0f;
+			sceneQueryMilliseconds = 0.0f;
+			sceneQueries = 0;
+		}
 	}
+	if (batch)
+	{
+		batchOutput.Finish();
+		GLfloat seconds = glfwGetTime() - batchStart;
+		size_t written = batchOutput.Written.load();
+		cout << "Batch: " << written << " images in " << seconds << " s, "
+			<< written / max(seconds, 1e-3f) << " images/s" << endl;
+	}
+	if (inputLog.Replaying())
+	{
+		GLfloat seconds = glfwGetTime() - replayStart;
+		cout << "Replay: " << inputLog.Frames << " frames in " << seconds << " s, "
+			<< 1000.0f * seconds / max<size_t>(inputLog.Frames, 1) << " ms per frame" << endl;
+	}
+
 	// Properly de-allocate all resources once they've outlived their purpose
-	glDeleteVertexArrays(1, &VAO);
-	glDeleteBuffers(1, &VBO);
-	glDeleteVertexArrays(1, &VAO_Front);
-	glDeleteBuffers(1, &VBO_Front);
-	glDeleteVertexArrays(1, &VAO_Back);
-	glDeleteBuffers(1, &VBO_Back);
-	glDeleteVertexArrays(1, &VAO_Left);
-	glDeleteBuffers(1, &VBO_Left);
-	glDeleteVertexArrays(1, &VAO_Right);
-	glDeleteBuffers(1, &VBO_Right);
-	glDeleteVertexArrays(1, &VAO_Top);
-	glDeleteBuffers(1, &VBO_Top);
-	glDeleteVertexArrays(1, &VAO_Bottom);
-	glDeleteBuffers(1, &VBO_Bottom);
-	glDeleteBuffers(1, &VAOht);
-	glDeleteBuffers(1, &VBOht);
+	GLuint buffers[] = { VBOht, EBOht };
+	GLuint textures[] = { texture1, texture2, texture3, texture4, texture5, texture6, texture7, texture8, textureArray };
+	Resources().Deleted(RESOURCE_VERTEX_ARRAY, VAOht);
+	Resources().Deleted(RESOURCE_BUFFER, 2, buffers);
+	Resources().Deleted(RESOURCE_TEXTURE, 9, textures);
+	glDeleteVertexArrays(1, &VAOht);
+	glDeleteBuffers(2, buffers);
+	glDeleteTextures(9, textures);
+	gpuScene.Release();
+	tessellatedTerrain.Release();
+	raymarchedTerrain.Release();
+	batchOutput.Release();
+	dynamicTarget.Release();
+	fragmentQueries.Release();
+	virtualTexture.Release();
+	procedural.Release();
+	geometry.Release();
+	viewshed.Release();
+	contours.Release();
+	horizon.Release();
+	shaderCache.Release();
+	if (resourceLogAtExit)
+		Resources().WriteJson(resourceLogPath);
+	size_t leaked = Resources().ReportLeaks(cout);
+	if (leaked > 0)
+		cout << leaked << " GL objects were not deleted" << endl;
 
 	// Terminate GLFW, clearing any resources allocated by GLFW.
 	glfwTerminate();
 	return 0;
 }
 
+// Model matrix of a box placed at position, at the given time
+glm::mat4 boxModel(const glm::vec3& position, GLfloat time)
+{
+	glm::mat4 model;
+
+	// Make the boxes transform in time
+	model = glm::translate(model, boxTranslate);
+	model = glm::translate(model, position);
+	model = glm::rotate(model, time * 0.5f, rotationRate);
+	model = glm::rotate(model, time * alpha, glm::vec3(1.0f, 0.0f, 0.0f));
+	model = glm::rotate(model, time * beta, glm::vec3(0.0f, 1.0f, 0.0f));
+	model = glm::rotate(model, time * gamma, glm::vec3(0.0f, 0.0f, 1.0f));
+	model = glm::scale(model, boxScale);
+	return model;
+}
+
+// Renders the scene from the starting camera on the CPU and saves it as a BMP.  Uses the
+//  same meshes, images and matrices as the GL path, for machines without a GPU.
+int renderSoftware(const char* outputPath)
+{
+	Heightmap heightmap;
+	if (!LoadHeightmap(heightmapPath, heightmap))
+		return 1;
+	TerrainMesh terrain = BuildTerrainMesh(heightmap);
+	// A heightmap one sample wide or high makes no triangles
+	if (terrain.Indices.empty())
+	{
+		cout << "ERROR::SOFTWARE::NO_TERRAIN " << heightmapPath << endl;
+		return 1;
+	}
+	vector<Image> images(IMAGE_COUNT);
+	FOR(i, IMAGE_COUNT)
+		LoadImageFile(imagePaths[i], images[i]);
+
+	ThreadPool threadPool;
+	SoftRasterizer raster(threadPool, WIDTH, HEIGHT);
+	auto start = chrono::steady_clock::now();
+
+	glm::mat4 view = camera.GetViewMatrix();
+	glm::mat4 projection = glm::perspective(fov, (GLfloat)WIDTH/(GLfloat)HEIGHT, 0.1f, 100.0f);
+	glm::mat4 model = glm::scale(glm::mat4(), glm::vec3(50.0f, 50.0f, 50.0f));
+	raster.Clear(glm::vec3(0.0f, 0.0f, 0.0f));
+
+	// The skybox without its bottom side, which the height map covers
+	const GLfloat* skyVertices[] = { front_vertices, back_vertices, left_vertices, right_vertices, top_vertices };
+	FOR(side, 5)
+		raster.DrawTriangles(skyVertices[side], 6, NULL, 6, projection * view * model, images[2 + side], images[2 + side]);
+	raster.DrawTriangles(terrain.Vertices.data(), terrain.VertexCount(), terrain.Indices.data(), GLuint(terrain.Indices.size()),
+		projection * view * model, images[7], images[7]);
+	FOR(i, 10)
+		raster.DrawTriangles(vertices, 36, NULL, 36, projection * view * boxModel(cubePositions[i], 0.0f), images[0], images[1]);
+	raster.Flush();
+
+	GLfloat milliseconds = chrono::duration<GLfloat, milli>(chrono::steady_clock::now() - start).count();
+	vector<unsigned char> pixels;
+	raster.ReadPixels(pixels);
+	if (!SOIL_save_image(outputPath, SOIL_SAVE_TYPE_BMP, WIDTH, HEIGHT, 3, pixels.data()))
+	{
+		cout << "ERROR::SOFTWARE::SAVE_FAILED " << outputPath << endl;
+		return 1;
+	}
+	cout << "Rendered " << outputPath << " on the CPU in " << milliseconds << " ms with "
+		<< threadPool.Size() + 1 << " threads" << endl;
+	return 0;
+}
+
+// Erodes a heightmap on the CPU and saves it as a 16 bit PGM, which the preprocessor turns
+//  into a tile archive for the viewer
+int erodeHeightmap(const char* inputPath, int iterations, const char* outputPath)
+{
+	Heightmap heightmap;
+	if (!LoadHeightmap(inputPath, heightmap))
+		return 1;
+	ThreadPool threadPool;
+	Erosion erosion;
+	erosion.Load(heightmap);
+	erosion.Step(threadPool, iterations);
+	if (!erosion.SavePGM(outputPath))
+		return 1;
+	cout << "Eroded " << erosion.Width << "x" << erosion.Height << " samples, " << iterations << " iterations at "
+		<< erosion.IterationsPerSecond() << " iterations/s with " << threadPool.Size() + 1 << " threads" << endl;
+	return 0;
+}
+
+// Writes the terrain of an image or tile archive as a mesh.  An archive is streamed a row of
+//  tiles at a time from the level asked for, or from the coarsest one within the error; an
+//  image is loaded and its level of detail made the same way.
+int exportMesh(const char* inputPath, const char* outputPath, int level, float error)
+{
+	string name(inputPath);
+	MeshExportSource source;
+	Heightmap heightmap;
+	if (name.size() > 4 && name.compare(name.size() - 4, 4, ".hta") == 0)
+	{
+		auto archive = make_shared<TileArchive>();
+		if (!archive->Open(inputPath))
+			return 1;
+		if (error >= 0.0f)
+			level = ArchiveLevelForError(*archive, error);
+		level = min(max(level, 0), int(archive->Header.Levels) - 1);
+		ArchiveExportSource(archive, level, source);
+	}
+	else
+	{
+		if (!LoadHeightmap(inputPath, heightmap))
+			return 1;
+		if (error >= 0.0f)
+			cout << "Export: only tile archives know their error, --error is ignored" << endl;
+		HeightmapExportSource(heightmap, max(level, 0), source);
+	}
+	ThreadPool threadPool;
+	MeshExporter exporter;
+	if (!exporter.Export(threadPool, source, outputPath))
+		return 1;
+	cout << "Exported level " << level << ", " << source.Width << "x" << source.Height << " samples: " << exporter.Vertices << " vertices, "
+		<< exporter.Triangles << " triangles, " << exporter.Bytes / 1e6 << " MB in " << exporter.Seconds << " s ("
+		<< exporter.Vertices / max(exporter.Seconds, 1e-6) / 1e6 << "M vertices/s, " << exporter.Bytes / max(exporter.Seconds, 1e-6) / 1e6
+		<< " MB/s) with " << threadPool.Size() + 1 << " threads, at most " << exporter.PeakBufferBytes / 1e6 << " MB of buffers" << endl;
+	return 0;
+}
 
 #pragma region "User Input"
 // Is called whenever a key is pressed/released via GLFW
@@ -961,6 +1540,68 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 {
 	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
 		glfwSetWindowShouldClose(window, GL_TRUE);
+	// Cycle the terrain shading: flat, sun lit, sun lit with baked occlusion and shadows
+	if (key == GLFW_KEY_F && action == GLFW_PRESS)
+	{
+		if (!litTerrain)
+			litTerrain = true;
+		else if (!horizonShading)
+			horizonShading = true;
+		else
+			litTerrain = horizonShading = false;
+	}
+	// Toggle the GPU driven path when the context supports it
+	if (key == GLFW_KEY_G && action == GLFW_PRESS && gpuDrivenSupported)
+		gpuDriven = !gpuDriven;
+	// Toggle occlusion culling
+	if (key == GLFW_KEY_C && action == GLFW_PRESS)
+		occlusionCulling = !occlusionCulling;
+	// Toggle dynamic resolution
+	if (key == GLFW_KEY_V && action == GLFW_PRESS)
+		dynamicResolution = !dynamicResolution;
+	// Toggle reversed-Z when the context supports it, the depth pre-pass and front-to-back order
+	if (key == GLFW_KEY_Z && action == GLFW_PRESS && reversedZSupported)
+		reversedZ = !reversedZ;
+	if (key == GLFW_KEY_X && action == GLFW_PRESS)
+		depthPrePass = !depthPrePass;
+	if (key == GLFW_KEY_B && action == GLFW_PRESS)
+		frontToBack = !frontToBack;
+	// Toggle erosion of the mesh terrain
+	if (key == GLFW_KEY_H && action == GLFW_PRESS)
+		eroding = !eroding;
+	// Compute the viewshed from the camera, or hide the one shown
+	if (key == GLFW_KEY_N && action == GLFW_PRESS)
+	{
+		if (viewshedShown)
+			viewshedShown = false;
+		else
+			viewshedRequested = true;
+	}
+	// Cycle the spacing of the contour lines, off after the densest
+	if (key == GLFW_KEY_M && action == GLFW_PRESS)
+		contourSpacing = (contourSpacing + 1) % (sizeof(CONTOUR_INTERVALS) / sizeof(CONTOUR_INTERVALS[0]));
+	// Write the resource registry as JSON
+	if (key == GLFW_KEY_Y && action == GLFW_PRESS)
+		resourceLogRequested = true;
+	// Pick, select the nearest, place and remove boxes of the scene store
+	if (key == GLFW_KEY_SPACE && action == GLFW_PRESS)
+		pickRequested = true;
+	if (key == GLFW_KEY_TAB && action == GLFW_PRESS)
+		nearestRequested = true;
+	if (key == GLFW_KEY_ENTER && action == GLFW_PRESS)
+		placeRequested = true;
+	if (key == GLFW_KEY_DELETE && action == GLFW_PRESS)
+		removeRequested = true;
+	// Pick the views drawn: the camera alone, with a minimap, or a stereo pair with the minimap
+	if (key >= GLFW_KEY_1 && key < GLFW_KEY_1 + VIEW_LAYOUT_COUNT && action == GLFW_PRESS)
+		viewLayout = ViewLayout(key - GLFW_KEY_1);
+	// Cycle through the terrain modes the context supports
+	if (key == GLFW_KEY_T && action == GLFW_PRESS)
+	{
+		do
+			terrainMode = TerrainMode((terrainMode + 1) % TERRAIN_MODE_COUNT);
+		while (!terrainModeSupported[terrainMode]);
+	}
 	if (key >= 0 && key < 1024)
 	{
 		if (action == GLFW_PRESS)
@@ -991,7 +1632,7 @@ void do_movement()
 		(
 		"awesomenessity.bmp",
 		SOIL_SAVE_TYPE_BMP,
-		0, 0, WIDTH, HEIGHT
+		0, 0, framebufferWidth, framebufferHeight
 		);
 
 	// Define more keys here
@@ -1062,6 +1703,42 @@ void do_movement()
 		boxTranslate = boxTranslate - glm::vec3(0.0f, 0.0f, 0.01f);
 }
 
+// GLFW input arrives through these. It is written to the log while recording, and only Escape
+//  gets through while a recording replays.
+void live_key_callback(GLFWwindow* window, int key, int scancode, int action, int mode)
+{
+	if (inputLog.Replaying())
+	{
+		if (key == GLFW_KEY_ESCAPE)
+			key_callback(window, key, scancode, action, mode);
+		return;
+	}
+	if (inputLog.Recording())
+		inputLog.Key(key, scancode, action, mode);
+	key_callback(window, key, scancode, action, mode);
+}
+
+// The log keeps floats, so live input is rounded the same way and the replay sees equal values
+void live_mouse_callback(GLFWwindow* window, double xpos, double ypos)
+{
+	if (inputLog.Replaying())
+		return;
+	GLfloat x = GLfloat(xpos), y = GLfloat(ypos);
+	if (inputLog.Recording())
+		inputLog.Cursor(x, y);
+	mouse_callback(window, x, y);
+}
+
+void live_scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
+{
+	if (inputLog.Replaying())
+		return;
+	GLfloat x = GLfloat(xoffset), y = GLfloat(yoffset);
+	if (inputLog.Recording())
+		inputLog.Scroll(x, y);
+	scroll_callback(window, x, y);
+}
+
 bool firstMouse = true;
 void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 {
@@ -0,0 +1,402 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+#include <fstream>
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <limits>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+#include "heightmap.h"
+#include "tile_archive.h"
+#include "thread_pool.h"
+
+// Rows of the grid encoded by one task, the height of an archive tile so a band reads one row of tiles
+const int MESH_EXPORT_BAND = TILE_ARCHIVE_TILE;
+// Size of the exported terrain, the scale the viewer draws the heightmap's model space at
+const float MESH_EXPORT_SCALE = 50.0f;
+
+
+// Normalised heights of a grid, read a band of rows at a time
+struct MeshExportSource
+{
+    int Width, Height;
+    // Fills out with rows [row0, row0 + rows), row major; false when they cannot be read
+    std::function<bool(int row0, int rows, float* out)> ReadRows;
+
+    MeshExportSource() : Width(0), Height(0) {}
+};
+
+// A level of a tile archive, reading only the row of tiles under a band
+inline void ArchiveExportSource(const std::shared_ptr<TileArchive>& archive, int level, MeshExportSource& source)
+{
+    int width = int(archive->LevelWidth(level)), height = int(archive->LevelHeight(level));
+    source.Width = width;
+    source.Height = height;
+    source.ReadRows = [archive, level, width](int row0, int rows, float* out)
+    {
+        const TileArchiveHeader& header = archive->Header;
+        float scale = header.Max > header.Min ? 1.0f / (header.Max - header.Min) : 0.0f;
+        int size = int(header.TileSize);
+        std::vector<float> tile;
+        for (int ty = row0 / size; ty <= (row0 + rows - 1) / size; ty++)
+        {
+            for (uint32_t tx = 0; tx < TileArchiveTiles(width, header.TileSize); tx++)
+            {
+                const TileInfo* info = archive->Find(level, tx, ty);
+                if (!info || !archive->ReadTile(*info, tile))
+                {
+                    std::cout << "ERROR::MESH_EXPORT::TILE_MISSING " << level << " " << tx << " " << ty << std::endl;
+                    return false;
+                }
+                // Tiles share their last row with the next one, either copy will do
+                int first = std::max(row0, ty * size), last = std::min(row0 + rows, ty * size + int(info->Height));
+                for (int row = first; row < last; row++)
+                {
+                    const float* in = &tile[size_t(row - ty * size) * info->Width];
+                    float* dest = out + size_t(row - row0) * width + tx * size;
+                    for (uint32_t j = 0; j < info->Width; j++)
+                        dest[j] = (in[j] - header.Min) * scale;
+                }
+            }
+        }
+        return true;
+    };
+}
+
+// Coarsest level of an archive whose surface stays within error of the full raster, error being
+// a fraction of the height range
+inline int ArchiveLevelForError(const TileArchive& archive, float error)
+{
+    const TileArchiveHeader& header = archive.Header;
+    float range = header.Max > header.Min ? header.Max - header.Min : 1.0f;
+    std::vector<float> worst(header.Levels, 0.0f);
+    for (const TileInfo& info : archive.Index)
+        if (info.Level < header.Levels)
+            worst[info.Level] = std::max(worst[info.Level], info.Error / range);
+    int level = 0;
+    while (level + 1 < int(header.Levels) && worst[level + 1] <= error)
+        level++;
+    return level;
+}
+
+// A heightmap, or a level of detail of it made the way the archive makes its levels: sample j of
+// level n is sample min(j 2^n, size - 1) of the heightmap
+inline void HeightmapExportSource(const Heightmap& heightmap, int level, MeshExportSource& source)
+{
+    source.Width = int(TileArchiveLevelSize(heightmap.Width, level));
+    source.Height = int(TileArchiveLevelSize(heightmap.Height, level));
+    int width = source.Width;
+    source.ReadRows = [heightmap, level, width](int row0, int rows, float* out)
+    {
+        // Whole tiles decode without going through the cache
+        const HeightTiles& tiles = *heightmap.Tiles;
+        std::vector<GLfloat> tile(HEIGHT_TILE_SIZE * HEIGHT_TILE_SIZE);
+        if (level > 0)
+        {
+            // Only the tiles holding samples of the level, each decoded once for the band: the
+            // output rows in one row of tiles, then the columns in one tile of it
+            auto sourceRow = [&](int i) { return std::min((row0 + i) << level, heightmap.Height - 1); };
+            auto sourceCol = [&](int j) { return std::min(j << level, heightmap.Width - 1); };
+            for (int i = 0; i < rows; )
+            {
+                int ty = sourceRow(i) / HEIGHT_TILE_SIZE, lastRow = i;
+                while (lastRow < rows && sourceRow(lastRow) / HEIGHT_TILE_SIZE == ty)
+                    lastRow++;
+                for (int j = 0; j < width; )
+                {
+                    int tx = sourceCol(j) / HEIGHT_TILE_SIZE, lastCol = j;
+                    while (lastCol < width && sourceCol(lastCol) / HEIGHT_TILE_SIZE == tx)
+                        lastCol++;
+                    tiles.DecodeTile(tx, ty, tile.data());
+                    for (int r = i; r < lastRow; r++)
+                    {
+                        const GLfloat* samples = &tile[(sourceRow(r) - ty * HEIGHT_TILE_SIZE) * HEIGHT_TILE_SIZE];
+                        for (int c = j; c < lastCol; c++)
+                            out[size_t(r) * width + c] = samples[sourceCol(c) - tx * HEIGHT_TILE_SIZE];
+                    }
+                    j = lastCol;
+                }
+                i = lastRow;
+            }
+            return true;
+        }
+        for (int ty = row0 / HEIGHT_TILE_SIZE; ty <= (row0 + rows - 1) / HEIGHT_TILE_SIZE; ty++)
+        {
+            for (int tx = 0; tx < tiles.TilesX; tx++)
+            {
+                int tileWidth, tileHeight;
+                tiles.TileSize(tx, ty, tileWidth, tileHeight);
+                tiles.DecodeTile(tx, ty, tile.data());
+                int first = std::max(row0, ty * HEIGHT_TILE_SIZE), last = std::min(row0 + rows, ty * HEIGHT_TILE_SIZE + tileHeight);
+                for (int row = first; row < last; row++)
+                    memcpy(out + size_t(row - row0) * width + tx * HEIGHT_TILE_SIZE,
+                           &tile[(row - ty * HEIGHT_TILE_SIZE) * HEIGHT_TILE_SIZE], tileWidth * sizeof(GLfloat));
+            }
+        }
+        return true;
+    };
+}
+
+
+// Writes a height grid as a triangle mesh, binary glTF (.glb) or binary PLY (.ply) by the
+// extension. Vertices are placed as the viewer draws the heightmap, in world units, and the
+// triangles are the mesh terrain's. A .glb also has texture coordinates over the whole map.
+//
+// Nothing holds the whole mesh. Vertices go out in bands of MESH_EXPORT_BAND rows: a band's
+// heights are read on the calling thread, a group of bands, one for every thread, is encoded on
+// the pool and the group is written in order. The triangles depend on the grid size only and
+// follow the same way. The bounds glTF wants for the positions are only known at the end, so the
+// JSON is written with space for them and rewritten in place.
+class MeshExporter
+{
+public:
+    // Statistics of the last Export
+    uint64_t Vertices, Triangles, Bytes;
+    double Seconds;
+    // Most memory the band buffers held at once
+    size_t PeakBufferBytes;
+
+    MeshExporter() : Vertices(0), Triangles(0), Bytes(0), Seconds(0.0), PeakBufferBytes(0) {}
+
+    bool Export(ThreadPool& pool, const MeshExportSource& source, const std::string& path)
+    {
+        auto start = std::chrono::steady_clock::now();
+        bool glb = endsWith(path, ".glb");
+        if (!glb && !endsWith(path, ".ply"))
+        {
+            std::cout << "ERROR::MESH_EXPORT::UNKNOWN_FORMAT " << path << std::endl;
+            return false;
+        }
+        if (source.Width < 2 || source.Height < 2)
+        {
+            std::cout << "ERROR::MESH_EXPORT::EMPTY_GRID" << std::endl;
+            return false;
+        }
+        this->Width = source.Width;
+        this->Height = source.Height;
+        this->Glb = glb;
+        this->Vertices = uint64_t(this->Width) * this->Height;
+        this->Triangles = uint64_t(this->Width - 1) * (this->Height - 1) * 2;
+        this->PeakBufferBytes = 0;
+        uint64_t vertexBytes = this->Vertices * this->vertexSize();
+        uint64_t triangleBytes = this->Triangles * this->triangleSize();
+        // Indices are 32 bit, and a .glb states its length in 32 bits
+        if (this->Vertices > std::numeric_limits<uint32_t>::max() ||
+            (glb && vertexBytes + triangleBytes + 65536 > std::numeric_limits<uint32_t>::max()))
+        {
+            std::cout << "ERROR::MESH_EXPORT::TOO_LARGE " << this->Width << "x" << this->Height
+                      << (glb ? ", export a coarser level or a .ply" : "") << std::endl;
+            return false;
+        }
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            std::cout << "ERROR::MESH_EXPORT::NOT_WRITTEN " << path << std::endl;
+            return false;
+        }
+        this->Lowest = std::numeric_limits<float>::max();
+        this->Highest = -this->Lowest;
+        std::string json;
+        if (glb)
+        {
+            // Placeholder bounds, the rewrite prints the same number of characters
+            json = this->gltfJson(0.0f, 0.0f);
+            uint32_t header[5] = { 0x46546C67, 2, uint32_t(12 + 8 + json.size() + 8 + vertexBytes + triangleBytes),
+                                   uint32_t(json.size()), 0x4E4F534A };
+            file.write(reinterpret_cast<const char*>(header), sizeof(header));
+            file.write(json.data(), json.size());
+            uint32_t binary[2] = { uint32_t(vertexBytes + triangleBytes), 0x004E4942 };
+            file.write(reinterpret_cast<const char*>(binary), sizeof(binary));
+        }
+        else
+        {
+            std::string header = "ply\nformat binary_little_endian 1.0\ncomment heightmap terrain\n"
+                "element vertex " + std::to_string(this->Vertices) + "\n"
+                "property float x\nproperty float y\nproperty float z\n"
+                "element face " + std::to_string(this->Triangles) + "\n"
+                "property list uchar uint vertex_indices\nend_header\n";
+            file.write(header.data(), header.size());
+        }
+
+        if (!this->writeBands(pool, file, this->Height, [&](int row0, int rows, std::vector<float>& heights)
+                { heights.resize(size_t(rows) * this->Width); return source.ReadRows(row0, rows, heights.data()); },
+                [&](int row0, int rows, const std::vector<float>& heights, std::vector<uint8_t>& bytes, float& lowest, float& highest)
+                { this->encodeVertices(row0, rows, heights, bytes, lowest, highest); }))
+            return false;
+        if (!this->writeBands(pool, file, this->Height - 1, [](int, int, std::vector<float>&) { return true; },
+                [&](int row0, int rows, const std::vector<float>&, std::vector<uint8_t>& bytes, float&, float&)
+                { this->encodeTriangles(row0, rows, bytes); }))
+            return false;
+
+        if (glb)
+        {
+            std::string bounded = this->gltfJson(this->Lowest, this->Highest);
+            file.seekp(20);
+            file.write(bounded.data(), bounded.size());
+            file.seekp(0, std::ios::end);
+        }
+        this->Bytes = uint64_t(file.tellp());
+        file.close();
+        if (file.fail())
+        {
+            std::cout << "ERROR::MESH_EXPORT::NOT_WRITTEN " << path << std::endl;
+            return false;
+        }
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+        this->Seconds = seconds.count();
+        return true;
+    }
+
+private:
+    int Width, Height;
+    bool Glb;
+    // Lowest and highest y of the vertices written so far
+    float Lowest, Highest;
+
+    static bool endsWith(const std::string& name, const char* suffix)
+    {
+        size_t length = strlen(suffix);
+        return name.size() >= length && name.compare(name.size() - length, length, suffix) == 0;
+    }
+
+    // Position and texture coordinate in a .glb, position only in a .ply
+    size_t vertexSize() const
+    {
+        return this->Glb ? 5 * sizeof(float) : 3 * sizeof(float);
+    }
+
+    // Three indices, in a .ply after their count
+    size_t triangleSize() const
+    {
+        return this->Glb ? 3 * sizeof(uint32_t) : 1 + 3 * sizeof(uint32_t);
+    }
+
+    // Reads and encodes the bands of count rows a group at a time and writes them in order
+    template <typename Read, typename Encode>
+    bool writeBands(ThreadPool& pool, std::ofstream& file, int count, Read read, Encode encode)
+    {
+        int bands = (count + MESH_EXPORT_BAND - 1) / MESH_EXPORT_BAND;
+        int group = int(pool.Size()) + 1;
+        std::vector<std::vector<float>> heights(group);
+        std::vector<std::vector<uint8_t>> bytes(group);
+        std::vector<float> lowest(group), highest(group);
+        for (int first = 0; first < bands; first += group)
+        {
+            int inGroup = std::min(group, bands - first);
+            for (int b = 0; b < inGroup; b++)
+            {
+                int row0 = (first + b) * MESH_EXPORT_BAND;
+                if (!read(row0, std::min(MESH_EXPORT_BAND, count - row0), heights[b]))
+                    return false;
+            }
+            pool.ParallelFor(inGroup, [&](int b)
+            {
+                int row0 = (first + b) * MESH_EXPORT_BAND;
+                lowest[b] = std::numeric_limits<float>::max();
+                highest[b] = -lowest[b];
+                encode(row0, std::min(MESH_EXPORT_BAND, count - row0), heights[b], bytes[b], lowest[b], highest[b]);
+            });
+            size_t held = 0;
+            for (int b = 0; b < group; b++)
+                held += heights[b].capacity() * sizeof(float) + bytes[b].capacity();
+            this->PeakBufferBytes = std::max(this->PeakBufferBytes, held);
+            for (int b = 0; b < inGroup; b++)
+            {
+                file.write(reinterpret_cast<const char*>(bytes[b].data()), bytes[b].size());
+                this->Lowest = std::min(this->Lowest, lowest[b]);
+                this->Highest = std::max(this->Highest, highest[b]);
+            }
+            if (!file)
+            {
+                std::cout << "ERROR::MESH_EXPORT::WRITE_FAILED" << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void encodeVertices(int row0, int rows, const std::vector<float>& heights, std::vector<uint8_t>& bytes,
+        float& lowest, float& highest) const
+    {
+        size_t stride = this->vertexSize() / sizeof(float);
+        bytes.resize(size_t(rows) * this->Width * this->vertexSize());
+        for (int i = 0; i < rows; i++)
+        {
+            // As Heightmap::Position places the samples, so the edges land exactly on the bounds
+            float t = float(row0 + i) / float(this->Height - 1);
+            for (int j = 0; j < this->Width; j++)
+            {
+                float vertex[5];
+                vertex[3] = float(j) / float(this->Width - 1);
+                vertex[4] = t;
+                vertex[0] = (vertex[3] * 2.0f - 1.0f) * MESH_EXPORT_SCALE;
+                vertex[1] = (-heights[size_t(i) * this->Width + j] / 2.0f - 0.5f) * MESH_EXPORT_SCALE;
+                vertex[2] = (t * 2.0f - 1.0f) * MESH_EXPORT_SCALE;
+                lowest = std::min(lowest, vertex[1]);
+                highest = std::max(highest, vertex[1]);
+                memcpy(&bytes[(size_t(i) * this->Width + j) * stride * sizeof(float)], vertex, stride * sizeof(float));
+            }
+        }
+    }
+
+    // Two triangles per quad of the rows of quads [row0, row0 + rows), wound as the mesh terrain's
+    void encodeTriangles(int row0, int rows, std::vector<uint8_t>& bytes) const
+    {
+        bytes.resize(size_t(rows) * (this->Width - 1) * 2 * this->triangleSize());
+        uint8_t* out = bytes.data();
+        auto triangle = [&](uint32_t a, uint32_t b, uint32_t c)
+        {
+            uint32_t indices[3] = { a, b, c };
+            if (!this->Glb)
+                *out++ = 3;
+            memcpy(out, indices, sizeof(indices));
+            out += sizeof(indices);
+        };
+        for (int i = row0; i < row0 + rows; i++)
+        {
+            for (int j = 0; j < this->Width - 1; j++)
+            {
+                uint32_t v00 = uint32_t(i) * this->Width + j, v10 = v00 + this->Width;
+                triangle(v00, v10, v10 + 1);
+                triangle(v10 + 1, v00 + 1, v00);
+            }
+        }
+    }
+
+    // The JSON chunk of a .glb, padded to 4 bytes with spaces. Every number of the bounds takes
+    // the same number of characters whatever its value.
+    std::string gltfJson(float lowest, float highest) const
+    {
+        auto number = [](float value)
+        {
+            char text[32];
+            snprintf(text, sizeof(text), "% .8e", value);
+            return std::string(text);
+        };
+        uint64_t vertexBytes = this->Vertices * this->vertexSize(), triangleBytes = this->Triangles * this->triangleSize();
+        std::string json = "{\"asset\":{\"version\":\"2.0\",\"generator\":\"heightmap viewer\"},"
+            "\"scene\":0,\"scenes\":[{\"nodes\":[0]}],\"nodes\":[{\"mesh\":0}],"
+            "\"meshes\":[{\"primitives\":[{\"attributes\":{\"POSITION\":0,\"TEXCOORD_0\":1},\"indices\":2}]}],"
+            "\"buffers\":[{\"byteLength\":" + std::to_string(vertexBytes + triangleBytes) + "}],"
+            "\"bufferViews\":[{\"buffer\":0,\"byteOffset\":0,\"byteLength\":" + std::to_string(vertexBytes) +
+            ",\"byteStride\":20,\"target\":34962},{\"buffer\":0,\"byteOffset\":" + std::to_string(vertexBytes) +
+            ",\"byteLength\":" + std::to_string(triangleBytes) + ",\"target\":34963}],"
+            "\"accessors\":[{\"bufferView\":0,\"byteOffset\":0,\"componentType\":5126,\"count\":" + std::to_string(this->Vertices) +
+            ",\"type\":\"VEC3\",\"min\":[" + number(-MESH_EXPORT_SCALE) + "," + number(lowest) + "," + number(-MESH_EXPORT_SCALE) +
+            "],\"max\":[" + number(MESH_EXPORT_SCALE) + "," + number(highest) + "," + number(MESH_EXPORT_SCALE) + "]},"
+            "{\"bufferView\":0,\"byteOffset\":12,\"componentType\":5126,\"count\":" + std::to_string(this->Vertices) +
+            ",\"type\":\"VEC2\"},{\"bufferView\":1,\"byteOffset\":0,\"componentType\":5125,\"count\":" +
+            std::to_string(this->Triangles * 3) + ",\"type\":\"SCALAR\"}]}";
+        json.append((4 - json.size() % 4) % 4, ' ');
+        return json;
+    }
+};
@@ -0,0 +1,200 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "frustum.h"
+
+// Views a frame can have, the size of the views[] and projections[] arrays of advanced.vs
+const int MAX_VIEWS = 4;
+// Side of the minimap as a share of the render target's height, its margin in pixels, and the
+// half width of the ground it shows around the camera
+const GLfloat MINIMAP_SIZE = 0.3f;
+const GLfloat MINIMAP_MARGIN = 8.0f;
+const GLfloat MINIMAP_EXTENT = 25.0f;
+// Height the minimap looks down from, under the top of the skybox
+const GLfloat MINIMAP_HEIGHT = 45.0f;
+// Distance between the eyes of a stereo pair
+const GLfloat STEREO_SEPARATION = 0.1f;
+
+// Views drawn each frame (picked with the keys 1 to 3)
+enum ViewLayout
+{
+    VIEWS_SINGLE,       // the camera over the whole render target
+    VIEWS_MINIMAP,      // the camera, with a top-down map in a corner
+    VIEWS_STEREO,       // a left and right eye side by side, with the map
+    VIEW_LAYOUT_COUNT
+};
+static const char* const VIEW_LAYOUT_NAMES[] = { "single view", "view with minimap", "stereo pair with minimap" };
+
+struct RenderView
+{
+    glm::mat4 View, Projection;
+    // The conventional projection the CPU culls with, Projection may be its reversed-Z twin
+    glm::mat4 CullProjection;
+    glm::vec3 Eye;
+    // x y width height in pixels of the render target, and the part of the depth range it
+    // writes. A view drawn over another gets the near end of the depth range, so it wins the
+    // depth test wherever they overlap.
+    glm::vec4 Viewport;
+    GLfloat DepthNear, DepthFar;
+};
+
+// Orthographic projection for reversed-Z: the near plane maps to depth 1 and the far plane to 0
+inline glm::mat4 ReversedOrtho(GLfloat left, GLfloat right, GLfloat bottom, GLfloat top, GLfloat zNear, GLfloat zFar)
+{
+    glm::mat4 projection = glm::ortho(left, right, bottom, top, zNear, zFar);
+    projection[2][2] = 1.0f / (zFar - zNear);
+    projection[3][2] = zFar / (zFar - zNear);
+    return projection;
+}
+
+
+// The views of a frame and their frusta. Culling runs once for all of them: Mask gives the views
+// a box is seen from, and draws carry that mask. With viewport arrays and
+// GL_ARB_shader_viewport_layer_array a draw is instanced once per view, and the MULTI_VIEW
+// vertex stage sends instance i through view i into viewport i, dropping the instances whose
+// view is not in the mask. Without them every view is drawn in a pass of its own, skipping the
+// draws it does not see.
+class MultiView
+{
+public:
+    std::vector<RenderView> Views;
+    Frustum Frusta[MAX_VIEWS];
+    // Viewport arrays and gl_ViewportIndex in the vertex stage are available
+    bool Instanced;
+
+    MultiView() : Instanced(false) {}
+
+    void Init()
+    {
+        this->Instanced = (GLEW_VERSION_4_1 || GLEW_ARB_viewport_array) && GLEW_ARB_shader_viewport_layer_array;
+    }
+
+    // Lays out the views over a render target of the given size. The first view is always the
+    // camera's, or its left eye.
+    void Layout(ViewLayout layout, const glm::vec3& position, const glm::vec3& front, const glm::vec3& up,
+                const glm::vec3& right, GLfloat fov, const glm::vec2& size, bool reversedZ, GLfloat zNear, GLfloat zFar)
+    {
+        this->Views.clear();
+        if (layout == VIEWS_STEREO)
+        {
+            glm::vec2 half(std::max(size.x * 0.5f, 1.0f), size.y);
+            this->addPerspective(position - right * (STEREO_SEPARATION * 0.5f), front, up, fov, glm::vec4(0.0f, 0.0f, half.x, half.y), reversedZ, zNear, zFar);
+            this->addPerspective(position + right * (STEREO_SEPARATION * 0.5f), front, up, fov, glm::vec4(half.x, 0.0f, half.x, half.y), reversedZ, zNear, zFar);
+        }
+        else
+            this->addPerspective(position, front, up, fov, glm::vec4(0.0f, 0.0f, size.x, size.y), reversedZ, zNear, zFar);
+
+        if (layout != VIEWS_SINGLE)
+        {
+            // A square in the top right corner, looking straight down with the camera's heading up
+            GLfloat side = std::max(std::floor(size.y * MINIMAP_SIZE), 1.0f);
+            glm::vec3 heading(front.x, 0.0f, front.z);
+            heading = glm::dot(heading, heading) > 1e-6f ? glm::normalize(heading) : glm::vec3(0.0f, 0.0f, -1.0f);
+            RenderView map;
+            map.Eye = glm::vec3(position.x, MINIMAP_HEIGHT, position.z);
+            map.View = glm::lookAt(map.Eye, glm::vec3(position.x, 0.0f, position.z), heading);
+            map.CullProjection = glm::ortho(-MINIMAP_EXTENT, MINIMAP_EXTENT, -MINIMAP_EXTENT, MINIMAP_EXTENT, zNear, zFar + MINIMAP_HEIGHT);
+            map.Projection = reversedZ ? ReversedOrtho(-MINIMAP_EXTENT, MINIMAP_EXTENT, -MINIMAP_EXTENT, MINIMAP_EXTENT, zNear, zFar + MINIMAP_HEIGHT)
+                                       : map.CullProjection;
+            map.Viewport = glm::vec4(std::max(size.x - side - MINIMAP_MARGIN, 0.0f), std::max(size.y - side - MINIMAP_MARGIN, 0.0f), side, side);
+            // The map lies over the first view, a tenth of the depth range in front of it
+            map.DepthNear = reversedZ ? 0.9f : 0.0f;
+            map.DepthFar = reversedZ ? 1.0f : 0.1f;
+            this->Views[0].DepthNear = reversedZ ? 0.0f : 0.1f;
+            this->Views[0].DepthFar = reversedZ ? 0.9f : 1.0f;
+            this->Views.push_back(map);
+        }
+
+        for (size_t v = 0; v < this->Views.size(); v++)
+            this->Frusta[v] = Frustum(this->Views[v].CullProjection * this->Views[v].View);
+    }
+
+    int Count() const
+    {
+        return int(this->Views.size());
+    }
+
+    GLuint AllViews() const
+    {
+        return (1u << this->Views.size()) - 1;
+    }
+
+    // Bit per view whose frustum a world space box intersects
+    GLuint Mask(const glm::vec3& boxMin, const glm::vec3& boxMax) const
+    {
+        GLuint mask = 0;
+        for (size_t v = 0; v < this->Views.size(); v++)
+            if (this->Frusta[v].IntersectsBox(boxMin, boxMax))
+                mask |= 1u << v;
+        return mask;
+    }
+
+    // Distance from a box to the nearest eye of the views in a mask, for ordering the draws
+    GLfloat Distance(GLuint mask, const glm::vec3& boxMin, const glm::vec3& boxMax) const
+    {
+        GLfloat distance = FLT_MAX;
+        for (size_t v = 0; v < this->Views.size(); v++)
+            if (mask & (1u << v))
+                distance = std::min(distance, DistanceToBox(this->Views[v].Eye, boxMin, boxMax));
+        return distance;
+    }
+
+    // Viewport and depth range of one view, for the passes drawn a view at a time
+    void Apply(int view) const
+    {
+        const RenderView& drawn = this->Views[view];
+        glViewport(GLint(drawn.Viewport.x), GLint(drawn.Viewport.y), GLsizei(drawn.Viewport.z), GLsizei(drawn.Viewport.w));
+        glDepthRange(drawn.DepthNear, drawn.DepthFar);
+    }
+
+    // Viewports and depth ranges of all views at their indices of the viewport array
+    void ApplyAll() const
+    {
+        for (size_t v = 0; v < this->Views.size(); v++)
+        {
+            const RenderView& drawn = this->Views[v];
+            glViewportIndexedf(GLuint(v), drawn.Viewport.x, drawn.Viewport.y, drawn.Viewport.z, drawn.Viewport.w);
+            glDepthRangeIndexed(GLuint(v), drawn.DepthNear, drawn.DepthFar);
+        }
+    }
+
+    // Matrices of all views, for a program built with MULTI_VIEW
+    void SetUniforms(GLuint program) const
+    {
+        glm::mat4 views[MAX_VIEWS], projections[MAX_VIEWS];
+        for (size_t v = 0; v < this->Views.size(); v++)
+        {
+            views[v] = this->Views[v].View;
+            projections[v] = this->Views[v].Projection;
+        }
+        glUniformMatrix4fv(glGetUniformLocation(program, "views"), MAX_VIEWS, GL_FALSE, glm::value_ptr(views[0]));
+        glUniformMatrix4fv(glGetUniformLocation(program, "projections"), MAX_VIEWS, GL_FALSE, glm::value_ptr(projections[0]));
+    }
+
+private:
+    void addPerspective(const glm::vec3& eye, const glm::vec3& front, const glm::vec3& up, GLfloat fov,
+                        const glm::vec4& viewport, bool reversedZ, GLfloat zNear, GLfloat zFar)
+    {
+        RenderView view;
+        GLfloat aspect = viewport.z / std::max(viewport.w, 1.0f);
+        view.Eye = eye;
+        view.View = glm::lookAt(eye, eye + front, up);
+        view.CullProjection = glm::perspective(fov, aspect, zNear, zFar);
+        view.Projection = reversedZ ? ReversedPerspective(fov, aspect, zNear, zFar) : view.CullProjection;
+        view.Viewport = viewport;
+        view.DepthNear = 0.0f;
+        view.DepthFar = 1.0f;
+        this->Views.push_back(view);
+    }
+};
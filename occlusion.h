@@ -0,0 +1,293 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "heightmap.h"
+#include "thread_pool.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define OCCLUSION_SSE 1
+#endif
+
+
+// Cells along each side of the coarse occluder mesh
+const int OCCLUSION_GRID = 64;
+// Rows of the depth buffer rasterised by one task
+const int OCCLUSION_BAND = 16;
+
+
+// Coarse occluder in world space
+struct OccluderMesh
+{
+    std::vector<glm::vec3> Vertices;
+    std::vector<GLuint> Indices;
+};
+
+
+// Software occlusion culling with the terrain as occluder. A coarse version of the height map is
+// rasterised into a small CPU depth buffer (SSE, one band of rows per thread), a max-depth pyramid
+// is built on top, and bounding boxes are tested against it before they are submitted.
+//
+// The coarse mesh takes the lowest surface point around each of its vertices, so it always lies
+// on or below the real surface. Seen from above it can only hide what the full terrain hides.
+class OcclusionCuller
+{
+public:
+    // Statistics of the current frame
+    GLuint Tested;
+    GLuint Occluded;
+
+    OcclusionCuller(ThreadPool& pool, int width = 256, int height = 128) : Tested(0), Occluded(0), Pool(pool)
+    {
+        // Whole groups of four pixels per row for the SIMD loop
+        this->Width = (width + 3) & ~3;
+        this->Height = height;
+        int w = this->Width, h = this->Height;
+        for (;;)
+        {
+            this->LevelWidth.push_back(w);
+            this->LevelHeight.push_back(h);
+            this->Levels.push_back(std::vector<float>(size_t(w) * h, 1.0f));
+            if (w == 1 && h == 1)
+                break;
+            w = std::max(1, (w + 1) / 2);
+            h = std::max(1, (h + 1) / 2);
+        }
+    }
+
+    // Builds the conservative occluder mesh of a height map drawn with the given model matrix
+    void SetOccluder(const Heightmap& heightmap, const glm::mat4& model)
+    {
+        this->SetOccluderMesh(BuildOccluder(heightmap, model));
+    }
+
+    // Replaces the occluder with a mesh built by BuildOccluder, e.g. on a worker thread
+    void SetOccluderMesh(OccluderMesh mesh)
+    {
+        this->Vertices.swap(mesh.Vertices);
+        this->Indices.swap(mesh.Indices);
+        this->Screen.resize(this->Vertices.size());
+    }
+
+    // Only touches the CPU, so it may run on any thread
+    static OccluderMesh BuildOccluder(const Heightmap& heightmap, const glm::mat4& model)
+    {
+        OccluderMesh mesh;
+        if (heightmap.Width < 2 || heightmap.Height < 2)
+            return mesh;
+        int cells = std::min(OCCLUSION_GRID, std::min(heightmap.Width, heightmap.Height) - 1);
+        for (int gi = 0; gi <= cells; gi++)
+        {
+            for (int gj = 0; gj <= cells; gj++)
+            {
+                // Samples covered by the cells around this vertex
+                int row = gi * (heightmap.Height - 1) / cells, col = gj * (heightmap.Width - 1) / cells;
+                int row0 = (std::max(gi - 1, 0)) * (heightmap.Height - 1) / cells;
+                int row1 = (std::min(gi + 1, cells)) * (heightmap.Height - 1) / cells;
+                int col0 = (std::max(gj - 1, 0)) * (heightmap.Width - 1) / cells;
+                int col1 = (std::min(gj + 1, cells)) * (heightmap.Width - 1) / cells;
+                // Brighter samples sit lower, the lowest point is the highest sample
+                GLfloat lowest, highest;
+                heightmap.Range(row0, col0, row1, col1, lowest, highest);
+                glm::vec3 position = heightmap.Position(row, col, highest);
+                mesh.Vertices.push_back(glm::vec3(model * glm::vec4(position, 1.0f)));
+            }
+        }
+        for (int gi = 0; gi < cells; gi++)
+        {
+            for (int gj = 0; gj < cells; gj++)
+            {
+                GLuint v00 = gi * (cells + 1) + gj, v10 = v00 + cells + 1;
+                GLuint quad[] = { v00, v10, v10 + 1, v10 + 1, v00 + 1, v00 };
+                mesh.Indices.insert(mesh.Indices.end(), quad, quad + 6);
+            }
+        }
+        return mesh;
+    }
+
+    // Rasterises the occluder for this frame's view and rebuilds the depth pyramid
+    void Render(const glm::mat4& viewProjection)
+    {
+        this->Tested = this->Occluded = 0;
+        this->ViewProjection = viewProjection;
+
+        // 1. Transform to screen space: pixel x, pixel y, depth in [0,1], clip w
+        for (size_t v = 0; v < this->Vertices.size(); v++)
+        {
+            glm::vec4 clip = viewProjection * glm::vec4(this->Vertices[v], 1.0f);
+            if (clip.w > NEAR_W)
+            {
+                GLfloat invW = 1.0f / clip.w;
+                this->Screen[v] = glm::vec4((clip.x * invW * 0.5f + 0.5f) * this->Width,
+                                            (clip.y * invW * 0.5f + 0.5f) * this->Height,
+                                            clip.z * invW * 0.5f + 0.5f, clip.w);
+            }
+            else
+                this->Screen[v] = glm::vec4(0.0f, 0.0f, 0.0f, clip.w);
+        }
+
+        // 2. Clear and rasterise, every task owns a band of rows so no locking is needed
+        int bands = (this->Height + OCCLUSION_BAND - 1) / OCCLUSION_BAND;
+        this->Pool.ParallelFor(bands, [this](int band)
+        {
+            int y0 = band * OCCLUSION_BAND, y1 = std::min(y0 + OCCLUSION_BAND, this->Height);
+            std::fill(this->Levels[0].begin() + size_t(y0) * this->Width, this->Levels[0].begin() + size_t(y1) * this->Width, 1.0f);
+            for (size_t t = 0; t + 2 < this->Indices.size(); t += 3)
+                this->rasterizeTriangle(this->Screen[this->Indices[t]], this->Screen[this->Indices[t + 1]], this->Screen[this->Indices[t + 2]], y0, y1);
+        });
+
+        // 3. Max-depth pyramid, each texel holds the farthest occluder depth below it
+        for (size_t level = 1; level < this->Levels.size(); level++)
+        {
+            const std::vector<float>& src = this->Levels[level - 1];
+            std::vector<float>& dst = this->Levels[level];
+            int sw = this->LevelWidth[level - 1], sh = this->LevelHeight[level - 1];
+            int dw = this->LevelWidth[level], dh = this->LevelHeight[level];
+            for (int y = 0; y < dh; y++)
+            {
+                int sy0 = std::min(2 * y, sh - 1), sy1 = std::min(2 * y + 1, sh - 1);
+                for (int x = 0; x < dw; x++)
+                {
+                    int sx0 = std::min(2 * x, sw - 1), sx1 = std::min(2 * x + 1, sw - 1);
+                    dst[y * dw + x] = std::max(std::max(src[sy0 * sw + sx0], src[sy0 * sw + sx1]),
+                                               std::max(src[sy1 * sw + sx0], src[sy1 * sw + sx1]));
+                }
+            }
+        }
+    }
+
+    // True when a world space box is certainly hidden behind the occluder
+    bool IsOccluded(const glm::vec3& boxMin, const glm::vec3& boxMax)
+    {
+        this->Tested++;
+        GLfloat minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f, nearest = 1.0f;
+        for (int c = 0; c < 8; c++)
+        {
+            glm::vec3 corner((c & 1) ? boxMax.x : boxMin.x, (c & 2) ? boxMax.y : boxMin.y, (c & 4) ? boxMax.z : boxMin.z);
+            glm::vec4 clip = this->ViewProjection * glm::vec4(corner, 1.0f);
+            // Boxes reaching behind the camera are kept
+            if (clip.w <= NEAR_W)
+                return false;
+            GLfloat invW = 1.0f / clip.w;
+            GLfloat x = (clip.x * invW * 0.5f + 0.5f) * this->Width;
+            GLfloat y = (clip.y * invW * 0.5f + 0.5f) * this->Height;
+            minX = std::min(minX, x);
+            maxX = std::max(maxX, x);
+            minY = std::min(minY, y);
+            maxY = std::max(maxY, y);
+            nearest = std::min(nearest, clip.z * invW * 0.5f + 0.5f);
+        }
+        int x0 = std::max(0, int(std::floor(minX))), x1 = std::min(this->Width - 1, int(std::floor(maxX)));
+        int y0 = std::max(0, int(std::floor(minY))), y1 = std::min(this->Height - 1, int(std::floor(maxY)));
+        if (x0 > x1 || y0 > y1 || nearest < 0.0f)
+            return false;
+
+        // Coarsest level where the rectangle spans at most 2x2 texels
+        size_t level = 0;
+        while (level + 1 < this->Levels.size() && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+            level++;
+        GLfloat farthest = 0.0f;
+        for (int y = y0 >> level; y <= (y1 >> level); y++)
+            for (int x = x0 >> level; x <= (x1 >> level); x++)
+                farthest = std::max(farthest, this->Levels[level][y * this->LevelWidth[level] + x]);
+        if (nearest > farthest)
+        {
+            this->Occluded++;
+            return true;
+        }
+        return false;
+    }
+
+    // Share of the tested boxes that were occluded this frame
+    GLfloat OccludedFraction() const
+    {
+        return this->Tested ? GLfloat(this->Occluded) / GLfloat(this->Tested) : 0.0f;
+    }
+
+private:
+    ThreadPool& Pool;
+    int Width, Height;
+    std::vector<std::vector<float>> Levels;
+    std::vector<int> LevelWidth, LevelHeight;
+    std::vector<glm::vec3> Vertices;
+    std::vector<GLuint> Indices;
+    std::vector<glm::vec4> Screen;
+    glm::mat4 ViewProjection;
+
+    static constexpr GLfloat NEAR_W = 1e-3f;
+
+    // Rasterises one triangle into rows [y0,y1), keeping the nearest depth per pixel
+    void rasterizeTriangle(const glm::vec4& v0, const glm::vec4& v1, const glm::vec4& v2, int y0, int y1)
+    {
+        // Triangles crossing the near plane are dropped, which only makes the occluder smaller
+        if (v0.w <= NEAR_W || v1.w <= NEAR_W || v2.w <= NEAR_W)
+            return;
+        int minY = std::max(y0, int(std::floor(std::min(v0.y, std::min(v1.y, v2.y)))));
+        int maxY = std::min(y1 - 1, int(std::ceil(std::max(v0.y, std::max(v1.y, v2.y)))));
+        int minX = std::max(0, int(std::floor(std::min(v0.x, std::min(v1.x, v2.x)))));
+        int maxX = std::min(this->Width - 1, int(std::ceil(std::max(v0.x, std::max(v1.x, v2.x)))));
+        if (minX > maxX || minY > maxY)
+            return;
+
+        // Edge functions E(x,y) = A*x + B*y + C, positive inside for either winding
+        GLfloat area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+        if (std::fabs(area) < 1e-6f)
+            return;
+        GLfloat sign = area > 0.0f ? 1.0f : -1.0f;
+        const glm::vec4* p[3] = { &v0, &v1, &v2 };
+        GLfloat A[3], B[3], C[3];
+        for (int e = 0; e < 3; e++)
+        {
+            const glm::vec4& a = *p[(e + 1) % 3];
+            const glm::vec4& b = *p[(e + 2) % 3];
+            A[e] = sign * (a.y - b.y);
+            B[e] = sign * (b.x - a.x);
+            C[e] = sign * (a.x * b.y - a.y * b.x);
+        }
+        // Depth is affine in screen space: z = ZA*x + ZB*y + ZC
+        GLfloat invArea = 1.0f / std::fabs(area);
+        GLfloat ZA = (A[0] * v0.z + A[1] * v1.z + A[2] * v2.z) * invArea;
+        GLfloat ZB = (B[0] * v0.z + B[1] * v1.z + B[2] * v2.z) * invArea;
+        GLfloat ZC = (C[0] * v0.z + C[1] * v1.z + C[2] * v2.z) * invArea;
+
+        minX &= ~3;
+        for (int y = minY; y <= maxY; y++)
+        {
+            float* row = &this->Levels[0][size_t(y) * this->Width];
+            GLfloat py = y + 0.5f;
+#ifdef OCCLUSION_SSE
+            __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+            __m128 zero = _mm_setzero_ps();
+            for (int x = minX; x <= maxX; x += 4)
+            {
+                __m128 px = _mm_add_ps(_mm_set1_ps(GLfloat(x)), offsets);
+                __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(A[0]), px), _mm_set1_ps(B[0] * py + C[0])), zero);
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(A[1]), px), _mm_set1_ps(B[1] * py + C[1])), zero));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(A[2]), px), _mm_set1_ps(B[2] * py + C[2])), zero));
+                if (_mm_movemask_ps(inside) == 0)
+                    continue;
+                __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ZA), px), _mm_set1_ps(ZB * py + ZC));
+                __m128 old = _mm_loadu_ps(row + x);
+                __m128 nearer = _mm_min_ps(old, z);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+            }
+#else
+            for (int x = minX; x <= maxX; x++)
+            {
+                GLfloat px = x + 0.5f;
+                if (A[0] * px + B[0] * py + C[0] < 0.0f || A[1] * px + B[1] * py + C[1] < 0.0f || A[2] * px + B[2] * py + C[2] < 0.0f)
+                    continue;
+                row[x] = std::min(row[x], ZA * px + ZB * py + ZC);
+            }
+#endif
+        }
+    }
+};
@@ -0,0 +1,414 @@
+// Heightmap preprocessor: cuts a large height raster into the tiled level of detail pyramid the
+// viewer loads from a .hta archive. Needs no GL, build it on its own:
+//
+//   g++ -O2 -std=c++17 -pthread preprocess.cpp -o preprocess
+//
+//   preprocess survey.pgm survey.hta                    8 or 16 bit binary PGM
+//   preprocess survey.pfm survey.hta                    float PFM
+//   preprocess --raw 40000 30000 u16 survey.raw out.hta headerless little endian u8, u16 or f32
+//   --threads N                                         workers besides the main thread
+//
+// The raster is never loaded whole. It is processed in square blocks of TILE_ARCHIVE_TILE << 3
+// samples, one block per task, each reading its own rows from the file and emitting every tile
+// of four levels in it. The coarsest of those levels is written to a temporary raster which the
+// next pass reads the same way, until the top level fits in one tile. A worker holds at most two
+// levels of one block, so memory depends on the thread count and not on the size of the input.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cctype>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+using namespace std;
+
+#include "thread_pool.h"
+#include "tile_archive.h"
+
+// Levels made from one read of a block: the block is TILE_ARCHIVE_TILE << BLOCK_LEVELS samples
+// wide on the first of them and one tile wide on the last
+const int BLOCK_LEVELS = 3;
+
+enum Sample_Type
+{
+	SAMPLE_U8,
+	SAMPLE_U16,
+	SAMPLE_F32
+};
+
+// A raster on disk read a row span at a time. Several threads can read one raster, each through
+// its own stream.
+struct RasterFile
+{
+	string Path;
+	int Width, Height;
+	Sample_Type Type;
+	bool BigEndian;
+	// PFM stores the bottom row first
+	bool BottomUp;
+	uint64_t Offset;
+
+	RasterFile() : Width(0), Height(0), Type(SAMPLE_U8), BigEndian(false), BottomUp(false), Offset(0) {}
+
+	size_t SampleBytes() const
+	{
+		return this->Type == SAMPLE_U8 ? 1 : (this->Type == SAMPLE_U16 ? 2 : 4);
+	}
+
+	// Reads count samples of a row starting at column x
+	bool ReadSpan(ifstream& file, int row, int x, int count, float* out, vector<unsigned char>& bytes) const
+	{
+		size_t size = this->SampleBytes();
+		uint64_t fileRow = uint64_t(this->BottomUp ? this->Height - 1 - row : row);
+		bytes.resize(count * size);
+		file.seekg(streamoff(this->Offset + (fileRow * this->Width + x) * size));
+		if (!file.read(reinterpret_cast<char*>(bytes.data()), bytes.size()))
+			return false;
+		for (int i = 0; i < count; i++)
+		{
+			unsigned char* b = &bytes[i * size];
+			if (this->BigEndian)
+				reverse(b, b + size);
+			if (this->Type == SAMPLE_U8)
+				out[i] = float(b[0]);
+			else if (this->Type == SAMPLE_U16)
+				out[i] = float(uint16_t(b[0] | (b[1] << 8)));
+			else
+				memcpy(&out[i], b, sizeof(float));
+		}
+		return true;
+	}
+};
+
+// Next whitespace separated word of a PGM or PFM header, skipping comments
+static string headerToken(ifstream& file)
+{
+	string token;
+	for (int c = file.get(); c != EOF; c = file.get())
+	{
+		if (c == '#' && token.empty())
+		{
+			while (c != EOF && c != '\n')
+				c = file.get();
+		}
+		else if (isspace(c))
+		{
+			if (!token.empty())
+				break;
+		}
+		else
+			token += char(c);
+	}
+	return token;
+}
+
+// Reads the header of a binary PGM (P5) or PFM (Pf). The single whitespace ending the header
+// has been consumed by headerToken, so the samples start at the stream position.
+static bool openImage(const char* path, RasterFile& raster)
+{
+	ifstream file(path, ios::binary);
+	string magic = headerToken(file);
+	if (magic != "P5" && magic != "Pf")
+	{
+		cout << "ERROR::PREPROCESS::UNSUPPORTED_FORMAT " << path << " (binary PGM or grey PFM)" << endl;
+		return false;
+	}
+	raster.Path = path;
+	raster.Width = atoi(headerToken(file).c_str());
+	raster.Height = atoi(headerToken(file).c_str());
+	if (magic == "P5")
+	{
+		int maxValue = atoi(headerToken(file).c_str());
+		raster.Type = maxValue < 256 ? SAMPLE_U8 : SAMPLE_U16;
+		raster.BigEndian = true;
+	}
+	else
+	{
+		// A negative scale means little endian samples
+		raster.Type = SAMPLE_F32;
+		raster.BigEndian = atof(headerToken(file).c_str()) > 0.0;
+		raster.BottomUp = true;
+	}
+	raster.Offset = uint64_t(file.tellg());
+	return bool(file);
+}
+
+// Everything one pass over a raster needs to know
+struct Pass
+{
+	RasterFile Input;
+	// Archive level of the input raster, and the last local level made from it
+	int BaseLevel, LastLevel;
+	// Raster of the last level, read by the next pass. Empty on the final pass.
+	string NextPath;
+	int NextWidth, NextHeight;
+};
+
+// Range of the source values, gathered on the first pass
+struct ValueRange
+{
+	float Min, Max;
+	mutex Mutex;
+};
+
+// Position of sample i of a finer level between the samples of the coarser level above it:
+// sample k and k + 1 of the coarser level, t of the way. Only the last coarser sample may sit
+// one sample rather than two from the previous one.
+static void coarsePosition(int i, int coarseSize, int fineSize, int& k, float& t)
+{
+	k = min(i / 2, coarseSize - 2);
+	int low = 2 * k, high = min(low + 2, fineSize - 1);
+	t = float(i - low) / float(high - low);
+}
+
+// Largest difference between the finer level and the bilinear surface of a coarser tile, over
+// the finer samples the tile covers
+static float surfaceError(const vector<float>& coarse, int coarseWidth, int coarseHeight,
+						  const vector<float>& fine, int fineWidth, int fineHeight,
+						  int x0, int y0, int tileWidth, int tileHeight)
+{
+	float error = 0.0f;
+	int i1 = min(2 * (y0 + tileHeight - 1), fineHeight - 1);
+	int j1 = min(2 * (x0 + tileWidth - 1), fineWidth - 1);
+	for (int i = 2 * y0; i <= i1; i++)
+	{
+		int ky;
+		float ty;
+		coarsePosition(i, coarseHeight, fineHeight, ky, ty);
+		const float* top = &coarse[size_t(ky) * coarseWidth];
+		const float* bottom = top + coarseWidth;
+		for (int j = 2 * x0; j <= j1; j++)
+		{
+			int kx;
+			float tx;
+			coarsePosition(j, coarseWidth, fineWidth, kx, tx);
+			float upper = top[kx] + (top[kx + 1] - top[kx]) * tx;
+			float lower = bottom[kx] + (bottom[kx + 1] - bottom[kx]) * tx;
+			error = max(error, fabs(fine[size_t(i) * fineWidth + j] - (upper + (lower - upper) * ty)));
+		}
+	}
+	return error;
+}
+
+// Reads one block of the pass raster, emits its tiles on every level of the pass and writes its
+// last level into the raster of the next pass
+static bool processBlock(const Pass& pass, int bx, int by, TileArchiveWriter& writer, ValueRange& range)
+{
+	const int tile = TILE_ARCHIVE_TILE;
+	const int block = tile << BLOCK_LEVELS;
+	int x0 = bx * block, y0 = by * block;
+	int width = min(block + 1, pass.Input.Width - x0);
+	int height = min(block + 1, pass.Input.Height - y0);
+
+	ifstream file(pass.Input.Path, ios::binary);
+	vector<float> fine(size_t(width) * height), coarse, samples;
+	vector<unsigned char> bytes;
+	for (int i = 0; i < height; i++)
+	{
+		if (!pass.Input.ReadSpan(file, y0 + i, x0, width, &fine[size_t(i) * width], bytes))
+		{
+			cout << "ERROR::PREPROCESS::READ_FAILED " << pass.Input.Path << " row " << y0 + i << endl;
+			return false;
+		}
+	}
+	if (pass.BaseLevel == 0)
+	{
+		auto bounds = minmax_element(fine.begin(), fine.end());
+		lock_guard<mutex> lock(range.Mutex);
+		range.Min = min(range.Min, *bounds.first);
+		range.Max = max(range.Max, *bounds.second);
+	}
+
+	int fineWidth = width, fineHeight = height;
+	for (int m = 0; m <= pass.LastLevel; m++)
+	{
+		// This block's part of local level m: sample j of it is sample min(2j, size - 1) of m - 1
+		int levelWidth = width, levelHeight = height;
+		if (m > 0)
+		{
+			levelWidth = min((block >> m) + 1, int(TileArchiveLevelSize(pass.Input.Width, m)) - (x0 >> m));
+			levelHeight = min((block >> m) + 1, int(TileArchiveLevelSize(pass.Input.Height, m)) - (y0 >> m));
+			coarse.resize(size_t(levelWidth) * levelHeight);
+			for (int i = 0; i < levelHeight; i++)
+			{
+				const float* row = &fine[size_t(min(2 * i, fineHeight - 1)) * fineWidth];
+				for (int j = 0; j < levelWidth; j++)
+					coarse[size_t(i) * levelWidth + j] = row[min(2 * j, fineWidth - 1)];
+			}
+		}
+		const vector<float>& level = m > 0 ? coarse : fine;
+
+		// The first level of later passes was the last level of the previous one
+		if (m > 0 || pass.BaseLevel == 0)
+		{
+			for (uint32_t ty = 0; ty < TileArchiveTiles(levelHeight, tile); ty++)
+			{
+				for (uint32_t tx = 0; tx < TileArchiveTiles(levelWidth, tile); tx++)
+				{
+					TileInfo info;
+					memset(&info, 0, sizeof(info));
+					info.Level = pass.BaseLevel + m;
+					info.X = (x0 >> m) / tile + tx;
+					info.Y = (y0 >> m) / tile + ty;
+					info.Width = min(tile + 1, levelWidth - int(tx) * tile);
+					info.Height = min(tile + 1, levelHeight - int(ty) * tile);
+					samples.resize(size_t(info.Width) * info.Height);
+					for (uint32_t i = 0; i < info.Height; i++)
+						memcpy(&samples[size_t(i) * info.Width], &level[size_t(ty * tile + i) * levelWidth + tx * tile], info.Width * sizeof(float));
+					if (m > 0)
+					{
+						info.Error = surfaceError(level, levelWidth, levelHeight, fine, fineWidth, fineHeight,
+												  tx * tile, ty * tile, info.Width, info.Height);
+						for (uint32_t c = 0; c < 4; c++)
+							info.Error = max(info.Error, writer.Error(info.Level - 1, info.X * 2 + c % 2, info.Y * 2 + c / 2));
+					}
+					writer.Add(info, samples.data());
+				}
+			}
+		}
+
+		if (m > 0)
+			fine.swap(coarse);
+		fineWidth = levelWidth;
+		fineHeight = levelHeight;
+	}
+
+	if (pass.NextPath.empty())
+		return true;
+	// The last row and column are shared with the next block, which writes them unless this is
+	// the last block
+	int x1 = fineWidth - (x0 + block < pass.Input.Width - 1 ? 1 : 0);
+	int y1 = fineHeight - (y0 + block < pass.Input.Height - 1 ? 1 : 0);
+	fstream next(pass.NextPath, ios::binary | ios::in | ios::out);
+	for (int i = 0; i < y1; i++)
+	{
+		next.seekp(streamoff((uint64_t((y0 >> pass.LastLevel) + i) * pass.NextWidth + (x0 >> pass.LastLevel)) * sizeof(float)));
+		next.write(reinterpret_cast<const char*>(&fine[size_t(i) * fineWidth]), x1 * sizeof(float));
+	}
+	if (!next)
+	{
+		cout << "ERROR::PREPROCESS::WRITE_FAILED " << pass.NextPath << endl;
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	RasterFile source;
+	unsigned threads = 0;
+	vector<const char*> paths;
+	for (int a = 1; a < argc; a++)
+	{
+		if (strcmp(argv[a], "--raw") == 0 && a + 3 < argc)
+		{
+			source.Width = atoi(argv[++a]);
+			source.Height = atoi(argv[++a]);
+			string type = argv[++a];
+			source.Type = type == "u8" ? SAMPLE_U8 : (type == "u16" ? SAMPLE_U16 : SAMPLE_F32);
+		}
+		else if (strcmp(argv[a], "--threads") == 0 && a + 1 < argc)
+			threads = unsigned(atoi(argv[++a]));
+		else
+			paths.push_back(argv[a]);
+	}
+	if (paths.size() != 2)
+	{
+		cout << "Usage: preprocess [--threads N] [--raw width height u8|u16|f32] input output.hta" << endl;
+		return 1;
+	}
+	if (source.Width > 0)
+		source.Path = paths[0];
+	else if (!openImage(paths[0], source))
+		return 1;
+	if (source.Width < 2 || source.Height < 2)
+	{
+		cout << "ERROR::PREPROCESS::TOO_SMALL " << paths[0] << endl;
+		return 1;
+	}
+
+	// Levels up to the first that fits in one tile
+	int levels = 1;
+	while (TileArchiveLevelSize(source.Width, levels - 1) > uint32_t(TILE_ARCHIVE_TILE + 1) ||
+		   TileArchiveLevelSize(source.Height, levels - 1) > uint32_t(TILE_ARCHIVE_TILE + 1))
+		levels++;
+
+	TileArchiveWriter writer;
+	if (!writer.Open(paths[1], source.Width, source.Height, levels))
+		return 1;
+	ThreadPool pool(threads);
+	ValueRange range;
+	range.Min = numeric_limits<float>::max();
+	range.Max = -numeric_limits<float>::max();
+	auto start = chrono::steady_clock::now();
+
+	Pass pass;
+	pass.Input = source;
+	pass.BaseLevel = 0;
+	for (int passIndex = 0; ; passIndex++)
+	{
+		pass.LastLevel = min(BLOCK_LEVELS, levels - 1 - pass.BaseLevel);
+		pass.NextPath.clear();
+		if (pass.BaseLevel + pass.LastLevel < levels - 1)
+		{
+			pass.NextPath = string(paths[1]) + ".pass" + to_string(passIndex) + ".tmp";
+			pass.NextWidth = int(TileArchiveLevelSize(pass.Input.Width, pass.LastLevel));
+			pass.NextHeight = int(TileArchiveLevelSize(pass.Input.Height, pass.LastLevel));
+			// Sized up front so every block can write its part in place
+			ofstream next(pass.NextPath, ios::binary | ios::trunc);
+			next.seekp(streamoff(uint64_t(pass.NextWidth) * pass.NextHeight * sizeof(float) - 1));
+			next.put(0);
+		}
+
+		int blocksX = int(TileArchiveTiles(pass.Input.Width, TILE_ARCHIVE_TILE << BLOCK_LEVELS));
+		int blocksY = int(TileArchiveTiles(pass.Input.Height, TILE_ARCHIVE_TILE << BLOCK_LEVELS));
+		cout << "Levels " << pass.BaseLevel << "-" << pass.BaseLevel + pass.LastLevel << ": "
+			 << pass.Input.Width << "x" << pass.Input.Height << " in " << blocksX * blocksY << " blocks" << endl;
+		mutex failedMutex;
+		bool failed = false;
+		pool.ParallelFor(blocksX * blocksY, [&](int b)
+		{
+			if (!processBlock(pass, b % blocksX, b / blocksX, writer, range))
+			{
+				lock_guard<mutex> lock(failedMutex);
+				failed = true;
+			}
+		});
+		if (pass.BaseLevel > 0)
+			remove(pass.Input.Path.c_str());
+		if (failed)
+		{
+			if (!pass.NextPath.empty())
+				remove(pass.NextPath.c_str());
+			return 1;
+		}
+		if (pass.NextPath.empty())
+			break;
+
+		RasterFile next;
+		next.Path = pass.NextPath;
+		next.Width = pass.NextWidth;
+		next.Height = pass.NextHeight;
+		next.Type = SAMPLE_F32;
+		pass.Input = next;
+		pass.BaseLevel += pass.LastLevel;
+	}
+
+	if (!writer.Finish(range.Min, range.Max))
+	{
+		cout << "ERROR::PREPROCESS::WRITE_FAILED " << paths[1] << endl;
+		return 1;
+	}
+	chrono::duration<double> seconds = chrono::steady_clock::now() - start;
+	cout << "Wrote " << paths[1] << ": " << levels << " levels, values " << range.Min << " to " << range.Max
+		 << ", " << seconds.count() << " s on " << pool.Size() + 1 << " threads" << endl;
+	return 0;
+}
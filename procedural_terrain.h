@@ -0,0 +1,272 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <unordered_set>
+#include <algorithm>
+#include <cmath>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "heightmap.h"
+#include "terrain.h"
+#include "terrain_noise.h"
+#include "thread_pool.h"
+#include "geometry_pool.h"
+
+// Samples along each side of a tile, the last row and column are shared with the next tile
+const int PROCEDURAL_TILE_SAMPLES = 129;
+// World units along each side of a tile, the size of the heightmap terrain
+const GLfloat PROCEDURAL_TILE_WORLD = 100.0f;
+// Tiles kept in every direction around the camera, and around the point a tile ahead of it
+const int PROCEDURAL_RADIUS = 2;
+// Tiles resident on the GPU, the least recently wanted one is dropped first
+const int PROCEDURAL_CACHE_TILES = 64;
+// Tiles generating at once, and finished tiles uploaded per frame
+const int PROCEDURAL_MAX_PENDING = 8;
+const int PROCEDURAL_UPLOADS_PER_FRAME = 2;
+
+
+// Endless terrain generated from TerrainNoise in square tiles as the camera moves. The tiles
+// around the camera and ahead of where it looks are generated on the thread pool, nearest
+// first. Each one goes through the same path as a loaded heightmap: its heights are stored in
+// a Heightmap and meshed by BuildTerrainMesh, so it has the usual chunks for culling. Finished
+// tiles put their vertices in a GeometryPool on the main thread; the indices are added once and
+// shared because every tile has the same grid, so all tiles draw from the pool's VAO.
+//
+// A tile's sample at column j of tile x is column x * (PROCEDURAL_TILE_SAMPLES - 1) + j of the
+// noise, so neighbouring tiles meet without cracks and a seed always gives the same world.
+class ProceduralTerrain
+{
+public:
+    struct Tile
+    {
+        int X, Z;
+        PoolMesh Mesh;
+        glm::mat4 Model;
+        std::vector<TerrainChunk> Chunks;
+        uint64_t LastWanted;
+    };
+    // Tiles on the GPU, in no particular order
+    std::vector<Tile> Tiles;
+
+    ProceduralTerrain() : Pool(NULL), Geometry(NULL), Frame(0), Samples(0), NoiseSeconds(0.0) {}
+
+    bool Enabled() const
+    {
+        return this->Geometry != NULL;
+    }
+
+    // Starts the terrain of a seed, its tiles go into geometry
+    void Create(ThreadPool& pool, GeometryPool& geometry, uint32_t seed)
+    {
+        this->Pool = &pool;
+        this->Geometry = &geometry;
+        this->Noise = TerrainNoise(seed);
+        this->Finished = std::make_shared<FinishedQueue>();
+        // A flat tile gives the index buffer every tile shares
+        std::vector<uint16_t> flat(PROCEDURAL_TILE_SAMPLES * PROCEDURAL_TILE_SAMPLES, 0);
+        Heightmap heightmap;
+        heightmap.Assign(flat.data(), PROCEDURAL_TILE_SAMPLES, PROCEDURAL_TILE_SAMPLES, 65535);
+        TerrainMesh mesh = BuildTerrainMesh(heightmap);
+        this->SharedIndices = geometry.AddMesh(NULL, 0, mesh.Indices.data(), mesh.Indices.size());
+    }
+
+    // Takes the tiles out of the geometry pool, before the pool is released. Tiles still being
+    // generated finish into a queue nobody reads.
+    void Release()
+    {
+        if (!this->Enabled())
+            return;
+        for (Tile& tile : this->Tiles)
+            this->Geometry->Remove(tile.Mesh);
+        this->Tiles.clear();
+        this->Geometry->Remove(this->SharedIndices);
+        this->Geometry = NULL;
+    }
+
+    // Draws a chunk of a tile, with the pool's VAO bound and the tile's model matrix set, once
+    // per view when instanced across several
+    void DrawChunk(int tile, int chunk, GLsizei instances = 1) const
+    {
+        const TerrainChunk& drawn = this->Tiles[tile].Chunks[chunk];
+        GLuint firstIndex = this->Geometry->FirstIndex(this->SharedIndices) + drawn.FirstIndex;
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, drawn.IndexCount, GL_UNSIGNED_INT, (GLvoid*)(sizeof(GLuint) * firstIndex),
+            instances, this->Geometry->BaseVertex(this->Tiles[tile].Mesh));
+    }
+
+    // Requests the tiles around the camera, uploads finished ones and drops the least recently
+    // wanted tiles over the cache size
+    void Update(const glm::vec3& position, const glm::vec3& front)
+    {
+        if (!this->Enabled())
+            return;
+        this->Frame++;
+
+        // Wanted: a square around the camera's tile and one around the tile a tile ahead of it
+        glm::vec3 level(front.x, 0.0f, front.z);
+        glm::vec3 ahead = glm::length(level) > 1e-3f ? position + glm::normalize(level) * PROCEDURAL_TILE_WORLD : position;
+        std::vector<std::pair<GLfloat, std::pair<int, int>>> wanted;
+        for (const glm::vec3& center : { position, ahead })
+        {
+            int cx = tileOf(center.x), cz = tileOf(center.z);
+            for (int z = cz - PROCEDURAL_RADIUS; z <= cz + PROCEDURAL_RADIUS; z++)
+            {
+                for (int x = cx - PROCEDURAL_RADIUS; x <= cx + PROCEDURAL_RADIUS; x++)
+                {
+                    GLfloat dx = x * PROCEDURAL_TILE_WORLD - position.x, dz = z * PROCEDURAL_TILE_WORLD - position.z;
+                    wanted.push_back(std::make_pair(dx * dx + dz * dz, std::make_pair(x, z)));
+                }
+            }
+        }
+        std::sort(wanted.begin(), wanted.end());
+        wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+        for (const auto& entry : wanted)
+        {
+            int x = entry.second.first, z = entry.second.second;
+            Tile* tile = this->find(x, z);
+            if (tile)
+                tile->LastWanted = this->Frame;
+            else if (!this->Pending.count(key(x, z)) && this->Pending.size() < size_t(PROCEDURAL_MAX_PENDING))
+                this->generate(x, z);
+        }
+
+        std::vector<FinishedTile> finished;
+        {
+            std::lock_guard<std::mutex> lock(this->Finished->Mutex);
+            size_t count = std::min<size_t>(this->Finished->Tiles.size(), PROCEDURAL_UPLOADS_PER_FRAME);
+            finished.assign(std::make_move_iterator(this->Finished->Tiles.begin()), std::make_move_iterator(this->Finished->Tiles.begin() + count));
+            this->Finished->Tiles.erase(this->Finished->Tiles.begin(), this->Finished->Tiles.begin() + count);
+            this->Samples += this->Finished->Samples;
+            this->NoiseSeconds += this->Finished->Seconds;
+            this->Finished->Samples = 0;
+            this->Finished->Seconds = 0.0;
+        }
+        for (FinishedTile& done : finished)
+        {
+            this->Pending.erase(key(done.X, done.Z));
+            this->upload(done);
+        }
+
+        while (this->Tiles.size() > size_t(PROCEDURAL_CACHE_TILES))
+        {
+            auto oldest = std::min_element(this->Tiles.begin(), this->Tiles.end(),
+                [](const Tile& a, const Tile& b) { return a.LastWanted < b.LastWanted; });
+            this->Geometry->Remove(oldest->Mesh);
+            *oldest = this->Tiles.back();
+            this->Tiles.pop_back();
+        }
+    }
+
+    // Noise throughput of the workers: samples per second of one core
+    double SamplesPerSecondPerCore() const
+    {
+        return this->NoiseSeconds > 0.0 ? this->Samples / this->NoiseSeconds : 0.0;
+    }
+
+    size_t PendingTiles() const
+    {
+        return this->Pending.size();
+    }
+
+private:
+    struct FinishedTile
+    {
+        int X, Z;
+        TerrainMesh Mesh;
+    };
+
+    // Filled by the pool, emptied on the main thread, with the time spent on noise. Shared with
+    // the tiles in flight, so it outlives the terrain if they finish late.
+    struct FinishedQueue
+    {
+        std::mutex Mutex;
+        std::vector<FinishedTile> Tiles;
+        size_t Samples;
+        double Seconds;
+        FinishedQueue() : Samples(0), Seconds(0.0) {}
+    };
+
+    ThreadPool* Pool;
+    GeometryPool* Geometry;
+    TerrainNoise Noise;
+    PoolMesh SharedIndices;
+    uint64_t Frame;
+    std::unordered_set<uint64_t> Pending;
+    std::shared_ptr<FinishedQueue> Finished;
+    size_t Samples;
+    double NoiseSeconds;
+
+    static uint64_t key(int x, int z)
+    {
+        return (uint64_t(uint32_t(x)) << 32) | uint32_t(z);
+    }
+
+    // Tile whose square contains a world coordinate, tile 0 spans [-50,50] like the heightmap
+    static int tileOf(GLfloat coordinate)
+    {
+        return int(std::floor(coordinate / PROCEDURAL_TILE_WORLD + 0.5f));
+    }
+
+    Tile* find(int x, int z)
+    {
+        for (Tile& tile : this->Tiles)
+            if (tile.X == x && tile.Z == z)
+                return &tile;
+        return NULL;
+    }
+
+    // Generates and meshes a tile on the pool
+    void generate(int x, int z)
+    {
+        this->Pending.insert(key(x, z));
+        TerrainNoise noise = this->Noise;
+        std::shared_ptr<FinishedQueue> queue = this->Finished;
+        this->Pool->Submit([x, z, noise, queue]
+        {
+            const int n = PROCEDURAL_TILE_SAMPLES;
+            auto start = std::chrono::steady_clock::now();
+            std::vector<float> heights(n * n);
+            for (int i = 0; i < n; i++)
+                noise.Row(x * (n - 1), z * (n - 1) + i, n, &heights[i * n]);
+            std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+
+            std::vector<uint16_t> codes(heights.size());
+            for (size_t i = 0; i < heights.size(); i++)
+                codes[i] = uint16_t(heights[i] * 65535.0f + 0.5f);
+            Heightmap heightmap;
+            heightmap.Assign(codes.data(), n, n, 65535);
+            FinishedTile tile;
+            tile.X = x;
+            tile.Z = z;
+            tile.Mesh = BuildTerrainMesh(heightmap);
+            // Every tile uses the shared index buffer
+            std::vector<GLuint>().swap(tile.Mesh.Indices);
+
+            std::lock_guard<std::mutex> lock(queue->Mutex);
+            queue->Tiles.push_back(std::move(tile));
+            queue->Samples += heights.size();
+            queue->Seconds += seconds.count();
+        });
+    }
+
+    void upload(const FinishedTile& done)
+    {
+        Tile tile;
+        tile.X = done.X;
+        tile.Z = done.Z;
+        tile.LastWanted = this->Frame;
+        tile.Chunks = done.Mesh.Chunks;
+        tile.Model = glm::translate(glm::mat4(), glm::vec3(done.X * PROCEDURAL_TILE_WORLD, 0.0f, done.Z * PROCEDURAL_TILE_WORLD));
+        tile.Model = glm::scale(tile.Model, glm::vec3(PROCEDURAL_TILE_WORLD / 2.0f));
+
+        tile.Mesh = this->Geometry->AddMesh(done.Mesh.Vertices.data(), done.Mesh.VertexCount(), NULL, 0);
+        this->Tiles.push_back(tile);
+    }
+};
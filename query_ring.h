@@ -0,0 +1,91 @@
+#pragma once
+
+// GL Includes
+#include <GL/glew.h>
+
+#include "resource_registry.h"
+
+// Frames a query result may lag behind
+const int QUERY_RING_SIZE = 4;
+
+
+// Counts something on the GPU once per frame, such as fragment shader invocations, without ever
+// waiting: every frame uses the next query of a ring, and a query is only read when its slot
+// comes round again and the result is available.
+class QueryRing
+{
+public:
+    // Results read since the last reset, and how many
+    GLuint64 Sum;
+    GLuint Count;
+
+    QueryRing() : Sum(0), Count(0), Target(0), Next(0)
+    {
+        for (int i = 0; i < QUERY_RING_SIZE; i++)
+        {
+            this->Queries[i] = 0;
+            this->Pending[i] = false;
+        }
+    }
+
+    // Creates the queries, for a target such as GL_SAMPLES_PASSED
+    void Create(GLenum target)
+    {
+        this->Target = target;
+        glGenQueries(QUERY_RING_SIZE, this->Queries);
+        Resources().Created(RESOURCE_QUERY, QUERY_RING_SIZE, this->Queries, "query ring");
+    }
+
+    // Deletes the queries, must run while the context is still current
+    void Release()
+    {
+        if (this->Target == 0)
+            return;
+        Resources().Deleted(RESOURCE_QUERY, QUERY_RING_SIZE, this->Queries);
+        glDeleteQueries(QUERY_RING_SIZE, this->Queries);
+        this->Target = 0;
+    }
+
+    void Begin()
+    {
+        int slot = this->Next;
+        if (this->Pending[slot])
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(this->Queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available)
+            {
+                GLuint64 result = 0;
+                glGetQueryObjectui64v(this->Queries[slot], GL_QUERY_RESULT, &result);
+                this->Sum += result;
+                this->Count++;
+            }
+        }
+        glBeginQuery(this->Target, this->Queries[slot]);
+        this->Pending[slot] = true;
+    }
+
+    void End()
+    {
+        glEndQuery(this->Target);
+        this->Next = (this->Next + 1) % QUERY_RING_SIZE;
+    }
+
+    // Average of the results read since the last reset
+    double Average() const
+    {
+        return this->Count ? double(this->Sum) / this->Count : 0.0;
+    }
+
+    void Reset()
+    {
+        this->Sum = 0;
+        this->Count = 0;
+    }
+
+private:
+    GLenum Target;
+    GLuint Queries[QUERY_RING_SIZE];
+    bool Pending[QUERY_RING_SIZE];
+    int Next;
+};
@@ -0,0 +1,384 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// Free lists per power of two are split into 1 << RANGE_SUBDIVISIONS_LOG2 finer classes
+const int RANGE_SUBDIVISIONS_LOG2 = 4;
+const int RANGE_SUBDIVISIONS = 1 << RANGE_SUBDIVISIONS_LOG2;
+const int RANGE_CLASSES = 64 - RANGE_SUBDIVISIONS_LOG2 + 1;
+
+
+// Hands out ranges of a space of Capacity units, such as the vertices of a buffer, with the
+// two-level segregated fit of TLSF (Masmoudi et al.). Free ranges sit in lists by size class:
+// one class per power of two, each split in 16. Two levels of bitmaps find the smallest
+// non-empty class that fits in constant time, and a freed range merges with free neighbours
+// at once, so there are never two free ranges side by side.
+//
+// The space holds no headers, the ranges are kept in a table, so it can describe GPU memory.
+// An allocation is a handle into the table that stays valid until it is freed, while Compact
+// may move its offset.
+class RangeAllocator
+{
+public:
+    // A range Compact moved, for the owner to copy its contents
+    struct Move
+    {
+        int Handle;
+        size_t From, To, Size;
+    };
+
+    RangeAllocator() : CapacityUnits(0), UsedUnits(0), Allocations(0), Head(-1), Tail(-1), ClassBitmap(0), Unused(-1)
+    {
+        for (int i = 0; i < RANGE_CLASSES; i++)
+            this->SubclassBitmap[i] = 0;
+    }
+
+    // Starts over with one free range of the given capacity
+    void Reset(size_t capacity)
+    {
+        *this = RangeAllocator();
+        if (capacity > 0)
+            this->Tail = this->Head = this->insertFree(this->newRange(0, capacity, -1, -1));
+        this->CapacityUnits = capacity;
+    }
+
+    // Handle of a new range of size units, -1 when no free range is large enough
+    int Allocate(size_t size)
+    {
+        if (size == 0)
+            size = 1;
+        int index = this->findFree(size);
+        if (index < 0)
+            return -1;
+        this->removeFree(index);
+        Range& range = this->Ranges[index];
+        if (range.Size > size)
+        {
+            // The rest stays free, right after the allocation
+            int rest = this->newRange(this->Ranges[index].Offset + size, this->Ranges[index].Size - size, index, this->Ranges[index].Next);
+            Range& split = this->Ranges[index];
+            if (split.Next >= 0)
+                this->Ranges[split.Next].Prev = rest;
+            else
+                this->Tail = rest;
+            split.Next = rest;
+            split.Size = size;
+            this->insertFree(rest);
+        }
+        this->UsedUnits += this->Ranges[index].Size;
+        this->Allocations++;
+        return index;
+    }
+
+    void Free(int handle)
+    {
+        Range& range = this->Ranges[handle];
+        this->UsedUnits -= range.Size;
+        this->Allocations--;
+        int merged = handle;
+        // Absorb a free successor, then let a free predecessor absorb the result
+        int next = range.Next;
+        if (next >= 0 && this->Ranges[next].Free)
+        {
+            this->removeFree(next);
+            this->Ranges[handle].Size += this->Ranges[next].Size;
+            this->unlink(next);
+        }
+        int prev = this->Ranges[handle].Prev;
+        if (prev >= 0 && this->Ranges[prev].Free)
+        {
+            this->removeFree(prev);
+            this->Ranges[prev].Size += this->Ranges[handle].Size;
+            this->unlink(handle);
+            merged = prev;
+        }
+        this->insertFree(merged);
+    }
+
+    size_t Offset(int handle) const
+    {
+        return this->Ranges[handle].Offset;
+    }
+
+    size_t Size(int handle) const
+    {
+        return this->Ranges[handle].Size;
+    }
+
+    // Adds units at the end of the space
+    void Grow(size_t capacity)
+    {
+        if (capacity <= this->CapacityUnits)
+            return;
+        size_t added = capacity - this->CapacityUnits;
+        if (this->Tail >= 0 && this->Ranges[this->Tail].Free)
+        {
+            this->removeFree(this->Tail);
+            this->Ranges[this->Tail].Size += added;
+            this->insertFree(this->Tail);
+        }
+        else
+        {
+            int range = this->newRange(this->CapacityUnits, added, this->Tail, -1);
+            if (this->Tail >= 0)
+                this->Ranges[this->Tail].Next = range;
+            else
+                this->Head = range;
+            this->Tail = range;
+            this->insertFree(range);
+        }
+        this->CapacityUnits = capacity;
+    }
+
+    // Moves every allocation down to close the gaps between them, in order, leaving one free
+    // range at the end. Returns the allocations that moved, lowest first.
+    std::vector<Move> Compact()
+    {
+        std::vector<Move> moves;
+        std::vector<int> live;
+        for (int index = this->Head; index >= 0; index = this->Ranges[index].Next)
+            if (!this->Ranges[index].Free)
+                live.push_back(index);
+        for (int index = this->Head; index >= 0; )
+        {
+            int next = this->Ranges[index].Next;
+            if (this->Ranges[index].Free)
+            {
+                this->removeFree(index);
+                this->release(index);
+            }
+            index = next;
+        }
+        this->Head = this->Tail = -1;
+        size_t offset = 0;
+        for (int index : live)
+        {
+            Range& range = this->Ranges[index];
+            if (range.Offset != offset)
+                moves.push_back({ index, range.Offset, offset, range.Size });
+            range.Offset = offset;
+            range.Prev = this->Tail;
+            range.Next = -1;
+            if (this->Tail >= 0)
+                this->Ranges[this->Tail].Next = index;
+            else
+                this->Head = index;
+            this->Tail = index;
+            offset += range.Size;
+        }
+        size_t capacity = this->CapacityUnits;
+        this->CapacityUnits = offset;
+        this->Grow(capacity);
+        return moves;
+    }
+
+    size_t Capacity() const
+    {
+        return this->CapacityUnits;
+    }
+
+    size_t Used() const
+    {
+        return this->UsedUnits;
+    }
+
+    size_t Count() const
+    {
+        return this->Allocations;
+    }
+
+    // Largest range Allocate can still hand out, from the highest non-empty free list
+    size_t LargestFree() const
+    {
+        if (!this->ClassBitmap)
+            return 0;
+        int level = highestBit(this->ClassBitmap);
+        size_t largest = 0;
+        for (int index = this->FreeLists[level][highestBit(this->SubclassBitmap[level])]; index >= 0; index = this->Ranges[index].NextFree)
+            largest = std::max(largest, this->Ranges[index].Size);
+        return largest;
+    }
+
+    // Share of the free units outside the largest free range, 0 when the free space is in one piece
+    float Fragmentation() const
+    {
+        size_t free = this->CapacityUnits - this->UsedUnits;
+        return free > 0 ? float(free - this->LargestFree()) / float(free) : 0.0f;
+    }
+
+private:
+    struct Range
+    {
+        size_t Offset, Size;
+        // Neighbours in the space, and in the free list of the size class while free
+        int Prev, Next;
+        int PrevFree, NextFree;
+        bool Free;
+    };
+
+    std::vector<Range> Ranges;
+    size_t CapacityUnits, UsedUnits, Allocations;
+    int Head, Tail;
+    // Classes with a free range, and subclasses of each class with one
+    uint64_t ClassBitmap;
+    uint32_t SubclassBitmap[RANGE_CLASSES];
+    int FreeLists[RANGE_CLASSES][RANGE_SUBDIVISIONS];
+    // Table entries no range uses, chained through Next
+    int Unused;
+
+    static int log2(uint64_t size)
+    {
+        int bit = 0;
+        while (size >> (bit + 1))
+            bit++;
+        return bit;
+    }
+
+    static int highestBit(uint64_t bits)
+    {
+        return log2(bits);
+    }
+
+    static int lowestBit(uint64_t bits)
+    {
+        int bit = 0;
+        while (!(bits & 1))
+        {
+            bits >>= 1;
+            bit++;
+        }
+        return bit;
+    }
+
+    // Class and subclass of a size: sizes below 16 get a subclass each, larger ones one of 16
+    // equal steps within their power of two
+    static void sizeClass(size_t size, int& level, int& sublevel)
+    {
+        if (size < size_t(RANGE_SUBDIVISIONS))
+        {
+            level = 0;
+            sublevel = int(size);
+            return;
+        }
+        int bit = log2(size);
+        level = bit - RANGE_SUBDIVISIONS_LOG2 + 1;
+        sublevel = int(size >> (bit - RANGE_SUBDIVISIONS_LOG2)) - RANGE_SUBDIVISIONS;
+    }
+
+    // A free range of at least size units from the smallest class that only holds such ranges.
+    // Failing that, the class of size itself may still hold one that fits.
+    int findFree(size_t size)
+    {
+        // Round up to the next subclass boundary, so any range of the class found is large enough
+        size_t rounded = size;
+        if (size >= size_t(RANGE_SUBDIVISIONS))
+            rounded += (size_t(1) << (log2(size) - RANGE_SUBDIVISIONS_LOG2)) - 1;
+        int level, sublevel;
+        sizeClass(rounded, level, sublevel);
+        uint32_t subclasses = level < RANGE_CLASSES ? this->SubclassBitmap[level] & (~0u << sublevel) : 0;
+        if (!subclasses)
+        {
+            uint64_t classes = level + 1 < RANGE_CLASSES ? this->ClassBitmap & (~uint64_t(0) << (level + 1)) : 0;
+            if (classes)
+            {
+                level = lowestBit(classes);
+                subclasses = this->SubclassBitmap[level];
+            }
+        }
+        if (subclasses)
+            return this->FreeLists[level][lowestBit(subclasses)];
+
+        sizeClass(size, level, sublevel);
+        if (!(this->SubclassBitmap[level] & (1u << sublevel)))
+            return -1;
+        for (int index = this->FreeLists[level][sublevel]; index >= 0; index = this->Ranges[index].NextFree)
+            if (this->Ranges[index].Size >= size)
+                return index;
+        return -1;
+    }
+
+    int insertFree(int index)
+    {
+        Range& range = this->Ranges[index];
+        int level, sublevel;
+        sizeClass(range.Size, level, sublevel);
+        int& head = this->FreeLists[level][sublevel];
+        if (!(this->SubclassBitmap[level] & (1u << sublevel)))
+            head = -1;
+        range.Free = true;
+        range.PrevFree = -1;
+        range.NextFree = head;
+        if (head >= 0)
+            this->Ranges[head].PrevFree = index;
+        head = index;
+        this->SubclassBitmap[level] |= 1u << sublevel;
+        this->ClassBitmap |= uint64_t(1) << level;
+        return index;
+    }
+
+    void removeFree(int index)
+    {
+        Range& range = this->Ranges[index];
+        int level, sublevel;
+        sizeClass(range.Size, level, sublevel);
+        if (range.PrevFree >= 0)
+            this->Ranges[range.PrevFree].NextFree = range.NextFree;
+        else
+            this->FreeLists[level][sublevel] = range.NextFree;
+        if (range.NextFree >= 0)
+            this->Ranges[range.NextFree].PrevFree = range.PrevFree;
+        if (this->FreeLists[level][sublevel] < 0)
+        {
+            this->SubclassBitmap[level] &= ~(1u << sublevel);
+            if (!this->SubclassBitmap[level])
+                this->ClassBitmap &= ~(uint64_t(1) << level);
+        }
+        range.Free = false;
+    }
+
+    int newRange(size_t offset, size_t size, int prev, int next)
+    {
+        int index = this->Unused;
+        if (index >= 0)
+            this->Unused = this->Ranges[index].Next;
+        else
+        {
+            index = int(this->Ranges.size());
+            this->Ranges.push_back(Range());
+        }
+        Range& range = this->Ranges[index];
+        range.Offset = offset;
+        range.Size = size;
+        range.Prev = prev;
+        range.Next = next;
+        range.PrevFree = range.NextFree = -1;
+        range.Free = false;
+        return index;
+    }
+
+    // Takes a range out of the space and returns its table entry for reuse
+    void unlink(int index)
+    {
+        Range& range = this->Ranges[index];
+        if (range.Prev >= 0)
+            this->Ranges[range.Prev].Next = range.Next;
+        else
+            this->Head = range.Next;
+        if (range.Next >= 0)
+            this->Ranges[range.Next].Prev = range.Prev;
+        else
+            this->Tail = range.Prev;
+        this->release(index);
+    }
+
+    void release(int index)
+    {
+        this->Ranges[index].Free = false;
+        this->Ranges[index].Next = this->Unused;
+        this->Unused = index;
+    }
+};
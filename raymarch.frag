@@ -0,0 +1,147 @@
+#version 330 core
+in vec2 NdcPos;
+
+out vec4 color;
+
+uniform mat4 model;
+uniform mat4 inverseModel;
+uniform mat4 viewProjection;
+uniform mat4 inverseViewProjection;
+uniform sampler2D ourTexture1;
+// Height samples, and the highest elevation of every cell with one mip level per 2x2 block
+uniform sampler2D heightMap;
+uniform sampler2D maxElevation;
+uniform int maxLevel;
+// The projection maps near to depth 1 and far to 0, and depth runs from 0 to 1
+uniform bool reversedZ;
+#ifdef LIT_TERRAIN
+uniform mat3 normalMatrix;
+uniform vec3 sunDirection;
+#endif
+
+const int MAX_STEPS = 256;
+// Linear steps and bisections spent on a cell the ray may hit
+const int CELL_STEPS = 4;
+const int REFINE_STEPS = 6;
+
+vec2 samples;
+
+// The ray is marched in grid space: x and z count samples and y is the elevation 1 - h, so a
+// cell of the finest level is one unit wide and the terrain spans [0,1] in y
+vec3 toGrid(vec4 world)
+{
+    vec4 position = inverseModel * (world / world.w);
+    return vec3((position.x + 1.0) * 0.5 * (samples.x - 1.0), (position.y + 1.0) * 2.0, (position.z + 1.0) * 0.5 * (samples.y - 1.0));
+}
+
+float elevation(vec2 grid)
+{
+    return 1.0 - texture(heightMap, (grid + 0.5) / samples).r;
+}
+
+void main()
+{
+    samples = vec2(textureSize(heightMap, 0));
+
+    // The ray from the near to the far plane, t in [0,1]
+    vec2 depthRange = reversedZ ? vec2(1.0, 0.0) : vec2(-1.0, 1.0);
+    vec3 origin = toGrid(inverseViewProjection * vec4(NdcPos, depthRange.x, 1.0));
+    vec3 dir = toGrid(inverseViewProjection * vec4(NdcPos, depthRange.y, 1.0)) - origin;
+    vec3 safeDir = mix(vec3(1e-8), dir, greaterThan(abs(dir), vec3(1e-8)));
+    vec3 invDir = 1.0 / safeDir;
+
+    // Clip against the box of the terrain
+    vec3 boxMax = vec3(samples.x - 1.0, 1.0, samples.y - 1.0);
+    vec3 t0 = -origin * invDir, t1 = (boxMax - origin) * invDir;
+    vec3 tNear = min(t0, t1), tFar = max(t0, t1);
+    float t = max(max(tNear.x, tNear.y), max(tNear.z, 0.0));
+    float tLeave = min(min(tFar.x, tFar.y), min(tFar.z, 1.0));
+    if (t >= tLeave)
+        discard;
+    // Pushes t past a cell border so the next step lands in the neighbour
+    float nudge = 1e-3 / max(length(dir.xz), 1e-6);
+
+    // Walk the max-elevation quadtree: go down where the ray dips below a cell's highest point,
+    // skip the cell and go up a level where it stays above
+    int level = maxLevel;
+    bool hit = false;
+    for (int i = 0; i < MAX_STEPS && t < tLeave && !hit; i++)
+    {
+        vec3 p = origin + dir * t;
+        float size = float(1 << level);
+        ivec2 levelSize = textureSize(maxElevation, level);
+        ivec2 cell = clamp(ivec2(floor(p.xz / size)), ivec2(0), levelSize - 1);
+
+        // Where the ray leaves the cell. The last cell of an odd level reaches the border.
+        vec2 low = vec2(cell) * size, high = low + size;
+        if (cell.x == levelSize.x - 1)
+            high.x = boxMax.x;
+        if (cell.y == levelSize.y - 1)
+            high.y = boxMax.z;
+        vec2 exits = (mix(low, high, greaterThan(dir.xz, vec2(0.0))) - origin.xz) * invDir.xz;
+        float tExit = min(min(exits.x, exits.y), tLeave);
+
+        if (min(p.y, origin.y + dir.y * tExit) > texelFetch(maxElevation, cell, level).r)
+        {
+            t = tExit + nudge;
+            level = min(level + 1, maxLevel);
+            continue;
+        }
+        if (level > 0)
+        {
+            level--;
+            continue;
+        }
+
+        // A finest cell: step along the bilinear surface and bisect the first crossing
+        float previous = t;
+        for (int s = 0; s <= CELL_STEPS && !hit; s++)
+        {
+            float ts = mix(t, tExit, float(s) / float(CELL_STEPS));
+            vec3 q = origin + dir * ts;
+            if (q.y <= elevation(q.xz))
+            {
+                float above = previous, below = ts;
+                for (int r = 0; r < REFINE_STEPS; r++)
+                {
+                    float middle = 0.5 * (above + below);
+                    vec3 m = origin + dir * middle;
+                    if (m.y <= elevation(m.xz))
+                        below = middle;
+                    else
+                        above = middle;
+                }
+                t = below;
+                hit = true;
+            }
+            previous = ts;
+        }
+        if (!hit)
+        {
+            t = tExit + nudge;
+            level = min(level + 1, maxLevel);
+        }
+    }
+    if (!hit)
+        discard;
+
+    // Same mapping as the mesh: x and z span [-1,1] and brighter samples sit lower
+    vec2 grid = (origin + dir * t).xz;
+    vec2 uv = grid / (samples - 1.0);
+    vec3 position = vec3(uv.x * 2.0 - 1.0, elevation(grid) / 2.0 - 1.0, uv.y * 2.0 - 1.0);
+    vec4 clip = viewProjection * (model * vec4(position, 1.0));
+    // glClipControl's 0..1 depth is written as it is
+    gl_FragDepth = reversedZ ? clip.z / clip.w : clip.z / clip.w * 0.5 + 0.5;
+
+    color = texture(ourTexture1, vec2(uv.x, 1.0 - uv.y));
+#ifdef LIT_TERRAIN
+    // Central differences over two samples; one sample is 2 / (samples - 1) wide in model space
+    // and one unit of elevation is 0.5 high
+    float dx = elevation(grid + vec2(1.0, 0.0)) - elevation(grid - vec2(1.0, 0.0));
+    float dz = elevation(grid + vec2(0.0, 1.0)) - elevation(grid - vec2(0.0, 1.0));
+    vec2 slope = vec2(dx, dz) * 0.5 / (4.0 / (samples - 1.0));
+    vec3 normal = normalize(normalMatrix * vec3(-slope.x, 1.0, -slope.y));
+    float diffuse = max(dot(normal, normalize(sunDirection)), 0.0);
+    color.rgb *= 0.35 + 0.65 * diffuse;
+#endif
+}
@@ -0,0 +1,10 @@
+#version 330 core
+
+out vec2 NdcPos;
+
+void main()
+{
+    // One triangle covering the screen: (-1,-1), (3,-1), (-1,3)
+    NdcPos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
+    gl_Position = vec4(NdcPos, 0.0, 1.0);
+}
@@ -0,0 +1,207 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <algorithm>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "heightmap.h"
+#include "shader_cache.h"
+#include "resource_registry.h"
+
+
+// CPU side inputs of the ray marched terrain. Only touches the CPU, so it may be built on any thread.
+struct RaymarchData
+{
+    int Width, Height;
+    // The height samples, uploaded as they are into a float texture
+    std::vector<GLfloat> Samples;
+    // Highest surface point of every cell between four samples, then of 2x2 blocks of the level
+    // below. Elevation is 1 - sample, so the top of the terrain is 1.
+    std::vector<std::vector<GLfloat>> Levels;
+    std::vector<int> LevelWidth, LevelHeight;
+
+    RaymarchData() : Width(0), Height(0) {}
+};
+
+
+// Terrain drawn as one full-screen triangle. The fragment shader ray marches the height texture,
+// skipping empty space with a max-elevation mip chain, and writes gl_FragDepth so the skybox and
+// the boxes still composite with it. No mesh at all is needed, memory only depends on the textures.
+class RaymarchedTerrain
+{
+public:
+    RaymarchedTerrain() : VAO(0), HeightTexture(0), MaxTexture(0), Levels(0), Shaders(NULL), ShaderGeneration(0)
+    {
+        this->Programs[0] = this->Programs[1] = 0;
+    }
+
+    // Deletes the GL objects, must run while the context is still current
+    void Release()
+    {
+        if (this->VAO == 0)
+            return;
+        GLuint textures[] = { this->HeightTexture, this->MaxTexture };
+        Resources().Deleted(RESOURCE_VERTEX_ARRAY, this->VAO);
+        Resources().Deleted(RESOURCE_TEXTURE, 2, textures);
+        glDeleteVertexArrays(1, &this->VAO);
+        glDeleteTextures(2, textures);
+        this->VAO = 0;
+    }
+
+    static RaymarchData Build(const Heightmap& heightmap)
+    {
+        RaymarchData data;
+        if (heightmap.Width < 2 || heightmap.Height < 2)
+            return data;
+        data.Width = heightmap.Width;
+        data.Height = heightmap.Height;
+        heightmap.Decode(data.Samples);
+        auto at = [&](int i, int j) { return data.Samples[size_t(i) * data.Width + j]; };
+
+        // Level 0: one texel per cell, the bilinear surface never rises above its highest corner
+        int w = heightmap.Width - 1, h = heightmap.Height - 1;
+        std::vector<GLfloat> cells(size_t(w) * h);
+        for (int i = 0; i < h; i++)
+        {
+            for (int j = 0; j < w; j++)
+            {
+                GLfloat lowest = std::min(std::min(at(i, j), at(i, j + 1)), std::min(at(i + 1, j), at(i + 1, j + 1)));
+                cells[i * w + j] = 1.0f - lowest;
+            }
+        }
+        data.Levels.push_back(cells);
+        data.LevelWidth.push_back(w);
+        data.LevelHeight.push_back(h);
+
+        // Coarser levels follow the GL mip sizes (halved, rounded down). On odd sizes the last
+        // texel also covers the row or column left over, the shader knows it reaches the border.
+        while (w > 1 || h > 1)
+        {
+            const std::vector<GLfloat>& fine = data.Levels.back();
+            int nw = std::max(1, w / 2), nh = std::max(1, h / 2);
+            std::vector<GLfloat> coarse(size_t(nw) * nh, 0.0f);
+            for (int i = 0; i < h; i++)
+            {
+                int ci = std::min(i / 2, nh - 1);
+                for (int j = 0; j < w; j++)
+                {
+                    GLfloat& target = coarse[ci * nw + std::min(j / 2, nw - 1)];
+                    target = std::max(target, fine[i * w + j]);
+                }
+            }
+            data.Levels.push_back(coarse);
+            data.LevelWidth.push_back(nw);
+            data.LevelHeight.push_back(nh);
+            w = nw;
+            h = nh;
+        }
+        return data;
+    }
+
+    // Creates the textures, replacing any previous ones
+    void Upload(const RaymarchData& data, ShaderCache& shaderCache)
+    {
+        this->Release();
+        this->Shaders = &shaderCache;
+        this->ShaderGeneration = shaderCache.Generation;
+        this->Programs[0] = this->program(SINGLE_TEXTURE);
+        this->Programs[1] = this->program(LIT_TERRAIN);
+        this->Levels = GLint(data.Levels.size());
+        if (this->Levels == 0)
+            return;
+
+        // The full-screen triangle comes from gl_VertexID, but core contexts still need a VAO
+        glGenVertexArrays(1, &this->VAO);
+        Resources().Created(RESOURCE_VERTEX_ARRAY, this->VAO, "raymarch");
+
+        glGenTextures(1, &this->HeightTexture);
+        glBindTexture(GL_TEXTURE_2D, this->HeightTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, data.Width, data.Height, 0, GL_RED, GL_FLOAT, data.Samples.data());
+        Resources().Created(RESOURCE_TEXTURE, this->HeightTexture, "raymarch heights", TextureBytes(data.Width, data.Height, 4));
+
+        glGenTextures(1, &this->MaxTexture);
+        glBindTexture(GL_TEXTURE_2D, this->MaxTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, this->Levels - 1);
+        size_t maxBytes = 0;
+        for (GLint level = 0; level < this->Levels; level++)
+        {
+            glTexImage2D(GL_TEXTURE_2D, level, GL_R32F, data.LevelWidth[level], data.LevelHeight[level], 0,
+                         GL_RED, GL_FLOAT, data.Levels[level].data());
+            maxBytes += TextureBytes(data.LevelWidth[level], data.LevelHeight[level], 4);
+        }
+        Resources().Created(RESOURCE_TEXTURE, this->MaxTexture, "raymarch maxima", maxBytes);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // Draws the terrain with the given surface texture. reversedZ tells that projection comes from
+    // ReversedPerspective and depth is written for glClipControl's 0..1 range.
+    void Draw(const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection, GLuint texture, bool litTerrain,
+              bool reversedZ = false)
+    {
+        if (this->VAO == 0)
+            return;
+        // Pick up programs rebuilt by a shader reload
+        if (this->Shaders->Generation != this->ShaderGeneration)
+        {
+            this->ShaderGeneration = this->Shaders->Generation;
+            this->Programs[0] = this->program(SINGLE_TEXTURE);
+            this->Programs[1] = this->program(LIT_TERRAIN);
+        }
+        GLuint program = this->Programs[litTerrain ? 1 : 0];
+        if (program == 0)
+            return;
+
+        glm::mat4 viewProjection = projection * view;
+        glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+        glUseProgram(program);
+        glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(model));
+        glUniformMatrix4fv(glGetUniformLocation(program, "inverseModel"), 1, GL_FALSE, glm::value_ptr(glm::inverse(model)));
+        glUniformMatrix4fv(glGetUniformLocation(program, "viewProjection"), 1, GL_FALSE, glm::value_ptr(viewProjection));
+        glUniformMatrix4fv(glGetUniformLocation(program, "inverseViewProjection"), 1, GL_FALSE, glm::value_ptr(glm::inverse(viewProjection)));
+        glUniformMatrix3fv(glGetUniformLocation(program, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+        glUniform1i(glGetUniformLocation(program, "maxLevel"), this->Levels - 1);
+        glUniform1i(glGetUniformLocation(program, "reversedZ"), reversedZ);
+        glUniform1i(glGetUniformLocation(program, "ourTexture1"), 0);
+        glUniform1i(glGetUniformLocation(program, "heightMap"), 1);
+        glUniform1i(glGetUniformLocation(program, "maxElevation"), 2);
+        glUniform3f(glGetUniformLocation(program, "sunDirection"), 0.4f, 1.0f, 0.3f);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, this->HeightTexture);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, this->MaxTexture);
+
+        glBindVertexArray(this->VAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+private:
+    GLuint VAO;
+    GLuint HeightTexture, MaxTexture;
+    GLint Levels;
+    ShaderCache* Shaders;
+    GLuint ShaderGeneration;
+    // Unlit and lit variants
+    GLuint Programs[2];
+
+    GLuint program(GLuint permutation)
+    {
+        return this->Shaders->Program("shaders/raymarch.vs", "shaders/raymarch.frag", permutation);
+    }
+};
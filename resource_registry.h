@@ -0,0 +1,273 @@
+#pragma once
+
+// Std. Includes
+#include <string>
+#include <map>
+#include <mutex>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+
+// GL Includes
+#include <GL/glew.h>
+
+// What a registered resource is. Everything before RESOURCE_CPU lives on the GPU.
+enum ResourceKind
+{
+    RESOURCE_BUFFER,
+    RESOURCE_VERTEX_ARRAY,
+    RESOURCE_TEXTURE,
+    RESOURCE_RENDERBUFFER,
+    RESOURCE_FRAMEBUFFER,
+    RESOURCE_QUERY,
+    RESOURCE_PROGRAM,
+    RESOURCE_CPU,
+    RESOURCE_KIND_COUNT
+};
+const char* const RESOURCE_KIND_NAMES[] = { "buffer", "vertex array", "texture", "renderbuffer", "framebuffer", "query", "program", "cpu" };
+
+// Bytes of a 2D texture or of every layer of an array, with its mipmap chain when it has one
+inline size_t TextureBytes(int width, int height, int bytesPerTexel, bool mipmapped = false, int layers = 1)
+{
+    size_t bytes = size_t(width) * height * bytesPerTexel * layers;
+    while (mipmapped && (width > 1 || height > 1))
+    {
+        width = std::max(width / 2, 1);
+        height = std::max(height / 2, 1);
+        bytes += size_t(width) * height * bytesPerTexel * layers;
+    }
+    return bytes;
+}
+
+
+// Every GL object and large CPU allocation of the viewer, with its size, so the memory a scene
+// uses can be read off at any time. Owners record their objects where they create, size and
+// delete them; the registry keeps live and peak totals per kind and can list what is still alive.
+// GL objects are keyed by kind and name, CPU allocations by their owner and a label.
+//
+// Owners keep releasing their objects explicitly while the context is current rather than in
+// destructors, so the registry only watches; a shutdown report of what is still registered
+// catches what they forgot.
+class ResourceRegistry
+{
+public:
+    struct Totals
+    {
+        size_t Count, Bytes, PeakBytes;
+        Totals() : Count(0), Bytes(0), PeakBytes(0) {}
+    };
+
+    // Records count GL objects of a kind, each of the given size
+    void Created(ResourceKind kind, GLsizei count, const GLuint* ids, const std::string& label, size_t bytes = 0)
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        for (GLsizei i = 0; i < count; i++)
+        {
+            if (ids[i] == 0)
+                continue;
+            Entry& entry = this->Entries[key(kind, ids[i])];
+            this->remove(entry);
+            entry.Label = label;
+            this->add(entry, kind, bytes);
+        }
+    }
+
+    void Created(ResourceKind kind, GLuint id, const std::string& label, size_t bytes = 0)
+    {
+        this->Created(kind, 1, &id, label, bytes);
+    }
+
+    // New size of a registered object, after glBufferData, glTexImage2D and the like
+    void Resized(ResourceKind kind, GLuint id, size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        auto found = this->Entries.find(key(kind, id));
+        if (found == this->Entries.end())
+            return;
+        this->remove(found->second);
+        this->add(found->second, kind, bytes);
+    }
+
+    // Forgets objects that are about to be deleted; names that were never registered are ignored
+    void Deleted(ResourceKind kind, GLsizei count, const GLuint* ids)
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        for (GLsizei i = 0; i < count; i++)
+        {
+            auto found = this->Entries.find(key(kind, ids[i]));
+            if (found == this->Entries.end())
+                continue;
+            this->remove(found->second);
+            this->Entries.erase(found);
+        }
+    }
+
+    void Deleted(ResourceKind kind, GLuint id)
+    {
+        this->Deleted(kind, 1, &id);
+    }
+
+    // Sets the bytes a CPU allocation of an owner holds; 0 forgets it
+    void CpuAllocation(const void* owner, const std::string& label, size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        auto found = this->CpuEntries.find(std::make_pair(owner, label));
+        if (found != this->CpuEntries.end())
+        {
+            this->remove(found->second);
+            this->CpuEntries.erase(found);
+        }
+        if (bytes == 0)
+            return;
+        Entry& entry = this->CpuEntries[std::make_pair(owner, label)];
+        entry.Label = label;
+        this->add(entry, RESOURCE_CPU, bytes);
+    }
+
+    Totals Kind(ResourceKind kind) const
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        return this->Kinds[kind];
+    }
+
+    // Live and peak bytes of the GPU kinds together, and of the CPU
+    Totals Gpu() const
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        return this->GpuTotals;
+    }
+
+    Totals Cpu() const
+    {
+        return this->Kind(RESOURCE_CPU);
+    }
+
+    // Everything registered, with the totals, as JSON
+    void WriteJson(std::ostream& out) const
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        out << "{\n  \"gpu\": ";
+        writeTotals(out, this->GpuTotals);
+        out << ",\n  \"kinds\": {";
+        for (int kind = 0; kind < RESOURCE_KIND_COUNT; kind++)
+        {
+            out << (kind ? "," : "") << "\n    \"" << RESOURCE_KIND_NAMES[kind] << "\": ";
+            writeTotals(out, this->Kinds[kind]);
+        }
+        out << "\n  },\n  \"resources\": [";
+        bool first = true;
+        for (const auto& entry : this->Entries)
+        {
+            out << (first ? "" : ",") << "\n    { \"kind\": \"" << RESOURCE_KIND_NAMES[entry.first >> 32] << "\", \"id\": "
+                << (entry.first & 0xFFFFFFFFu) << ", \"label\": \"" << escape(entry.second.Label) << "\", \"bytes\": " << entry.second.Bytes << " }";
+            first = false;
+        }
+        for (const auto& entry : this->CpuEntries)
+        {
+            out << (first ? "" : ",") << "\n    { \"kind\": \"cpu\", \"label\": \"" << escape(entry.second.Label)
+                << "\", \"bytes\": " << entry.second.Bytes << " }";
+            first = false;
+        }
+        out << "\n  ]\n}\n";
+    }
+
+    bool WriteJson(const std::string& path) const
+    {
+        std::ofstream file(path.c_str());
+        if (!file)
+        {
+            std::cout << "ERROR::RESOURCES::FILE_NOT_WRITTEN " << path << std::endl;
+            return false;
+        }
+        this->WriteJson(file);
+        return bool(file);
+    }
+
+    // Lists the GL objects still registered, meant for after every owner released its objects.
+    // Returns how many there are.
+    size_t ReportLeaks(std::ostream& out) const
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        for (const auto& entry : this->Entries)
+            out << "ERROR::RESOURCES::LEAKED " << RESOURCE_KIND_NAMES[entry.first >> 32] << " " << (entry.first & 0xFFFFFFFFu)
+                << " (" << entry.second.Label << "), " << entry.second.Bytes << " bytes" << std::endl;
+        return this->Entries.size();
+    }
+
+private:
+    struct Entry
+    {
+        std::string Label;
+        ResourceKind Kind;
+        size_t Bytes;
+        Entry() : Kind(RESOURCE_KIND_COUNT), Bytes(0) {}
+    };
+
+    mutable std::mutex Mutex;
+    std::map<uint64_t, Entry> Entries;
+    std::map<std::pair<const void*, std::string>, Entry> CpuEntries;
+    Totals Kinds[RESOURCE_KIND_COUNT];
+    Totals GpuTotals;
+
+    static uint64_t key(ResourceKind kind, GLuint id)
+    {
+        return (uint64_t(kind) << 32) | id;
+    }
+
+    void add(Entry& entry, ResourceKind kind, size_t bytes)
+    {
+        entry.Kind = kind;
+        entry.Bytes = bytes;
+        grow(this->Kinds[kind], 1, bytes);
+        if (kind != RESOURCE_CPU)
+            grow(this->GpuTotals, 1, bytes);
+    }
+
+    // Takes a registered entry off the totals, does nothing for a new one
+    void remove(const Entry& entry)
+    {
+        if (entry.Kind == RESOURCE_KIND_COUNT)
+            return;
+        shrink(this->Kinds[entry.Kind], entry.Bytes);
+        if (entry.Kind != RESOURCE_CPU)
+            shrink(this->GpuTotals, entry.Bytes);
+    }
+
+    static void grow(Totals& totals, size_t count, size_t bytes)
+    {
+        totals.Count += count;
+        totals.Bytes += bytes;
+        totals.PeakBytes = std::max(totals.PeakBytes, totals.Bytes);
+    }
+
+    static void shrink(Totals& totals, size_t bytes)
+    {
+        totals.Count--;
+        totals.Bytes -= bytes;
+    }
+
+    static void writeTotals(std::ostream& out, const Totals& totals)
+    {
+        out << "{ \"count\": " << totals.Count << ", \"bytes\": " << totals.Bytes << ", \"peakBytes\": " << totals.PeakBytes << " }";
+    }
+
+    static std::string escape(const std::string& text)
+    {
+        std::string escaped;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    }
+};
+
+// The registry every module records into
+inline ResourceRegistry& Resources()
+{
+    static ResourceRegistry registry;
+    return registry;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+
+// The static geometry of the scene, shared by the GL and the software renderers
+
+// Vertices for front side of skycube
+//      3D Coordinates      Texture Coordinates
+//    x       y      z     s     t  
+const GLfloat front_vertices[] = {
+	-1.0f, -1.0f, -1.0f,  1.0f, 0.0f,
+	1.0f, -1.0f, -1.0f,  0.0f, 0.0f,
+	1.0f,  1.0f, -1.0f,  0.0f, 1.0f,
+	1.0f,  1.0f, -1.0f,  0.0f, 1.0f,
+	-1.0f,  1.0f, -1.0f,  1.0f, 1.0f,
+	-1.0f, -1.0f, -1.0f,  1.0f, 0.0f
+};	// finished
+
+// Vertices for back side of skycube
+//      3D Coordinates      Texture Coordinates
+//    x       y      z     s     t  
+const GLfloat back_vertices[] = {
+	-1.0f, -1.0f, 1.0f,  0.0f, 0.0f,
+	1.0f, -1.0f, 1.0f,  1.0f, 0.0f,
+	1.0f,  1.0f, 1.0f,  1.0f, 1.0f,
+	-1.0f,  -1.0f, 1.0f,  0.0f, 0.0f,
+	-1.0f,  1.0f, 1.0f,  0.0f, 1.0f,
+	1.0f, 1.0f, 1.0f,  1.0f, 1.0f
+};	// finished
+
+// Vertices for right side of skycube
+//      3D Coordinates      Texture Coordinates
+//    x       y      z     s     t  
+const GLfloat right_vertices[] = {
+	1.0f, 1.0f, -1.0f,  1.0f, 1.0f,
+	1.0f, -1.0f, -1.0f,  1.0f, 0.0f,
+	1.0f,  1.0f, 1.0f,  0.0f, 1.0f,
+	1.0f,  -1.0f, -1.0f,  1.0f, 0.0f,
+	1.0f,  -1.0f, 1.0f,  0.0f, 0.0f,
+	1.0f, 1.0f, 1.0f,  0.0f, 1.0f
+};	// finished
+
+// Vertices for left side of skycube
+//      3D Coordinates      Texture Coordinates
+//    x       y      z     s     t  
+const GLfloat left_vertices[] = {
+	-1.0f, 1.0f, -1.0f,  0.0f, 1.0f,
+	-1.0f, -1.0f, -1.0f,  0.0f, 0.0f,
+	-1.0f,  -1.0f, 1.0f,  1.0f, 0.0f,
+	-1.0f,  1.0f, -1.0f,  0.0f, 1.0f,
+	-1.0f,  1.0f, 1.0f,  1.0f, 1.0f,
+	-1.0f, -1.0f, 1.0f,  1.0f, 0.0f
+};	// finished
+
+// Vertices for bottom side of skycube
+//      3D Coordinates      Texture Coordinates
+//    x       y      z     s     t  
+const GLfloat bottom_vertices[] = {
+	-1.0f, -1.0f, -1.0f,  1.0f, 0.0f,	// left bot back
+	1.0f, -1.0f, -1.0f,  1.0f, 1.0f,	// right bot back
+	-1.0f,  -1.0f, 1.0f,  0.0f, 0.0f,	// left bot front
+	-1.0f,  -1.0f, 1.0f,  0.0f, 0.0f,	// left bot front
+	1.0f,  -1.0f, 1.0f,  0.0f, 1.0f,	// right bot front
+	1.0f, -1.0f, -1.0f,  1.0f, 1.0f		// right bot back
+};	// not finished
+
+// Vertices for top side of skycube
+//      3D Coordinates      Texture Coordinates
+//    x       y      z     s     t  
+const GLfloat top_vertices[] = {
+	-1.0f, 1.0f, -1.0f,  1.0f, 1.0f,
+	-1.0f, 1.0f, 1.0f,  0.0f, 1.0f,
+	1.0f,  1.0f, -1.0f,  1.0f, 0.0f,
+	1.0f,  1.0f, -1.0f,  1.0f, 0.0f,
+	1.0f,  1.0f, 1.0f,  0.0f, 0.0f,
+	-1.0f, 1.0f, 1.0f,  0.0f, 1.0f
+};	// finished
+
+
+// Set up vertex data for boxes in the center
+const GLfloat vertices[] = {
+	-0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
+	0.5f, -0.5f, -0.5f,  1.0f, 0.0f,
+	0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+	0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+	-0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
+	-0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
+
+	-0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
+	0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
+	0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
+	0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
+	-0.5f,  0.5f,  0.5f,  0.0f, 1.0f,
+	-0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
+
+	-0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+	-0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+	-0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+	-0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+	-0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
+	-0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+
+	0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+	0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+	0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+	0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+	0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
+	0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+
+	-0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+	0.5f, -0.5f, -0.5f,  1.0f, 1.0f,
+	0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
+	0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
+	-0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
+	-0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+
+	-0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
+	0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+	0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+	0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+	-0.5f,  0.5f,  0.5f,  0.0f, 0.0f,
+	-0.5f,  0.5f, -0.5f,  0.0f, 1.0f
+};
+
+// Initial Translation Coordinates for each of the Boxes
+const glm::vec3 cubePositions[] = {
+	glm::vec3( 0.0f,  0.0f,  0.0f),
+	glm::vec3( 2.0f,  5.0f, -15.0f),
+	glm::vec3(-1.5f, -2.2f, -2.5f),
+	glm::vec3(-3.8f, -2.0f, -12.3f),
+	glm::vec3( 2.4f, -0.4f, -3.5f),
+	glm::vec3(-1.7f,  3.0f, -7.5f),
+	glm::vec3( 1.3f, -2.0f, -2.5f),
+	glm::vec3( 1.5f,  2.0f, -2.5f),
+	glm::vec3( 1.5f,  0.2f, -1.5f),
+	glm::vec3(-1.3f,  1.0f, -1.5f)
+};
+
+// The images of the scene, in the order of the textures and of the texture array layers
+const char* const imagePaths[] = {
+	"textures/container.jpg",	// boxes
+	"textures/psulogo.png",
+	"skybox/front.jpg",
+	"skybox/back.jpg",
+	"skybox/left.jpg",
+	"skybox/right.jpg",
+	"skybox/top.jpg",
+	"skybox/bottom.jpg"
+};
+const int IMAGE_COUNT = sizeof(imagePaths) / sizeof(imagePaths[0]);
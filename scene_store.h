@@ -0,0 +1,806 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cfloat>
+#include <cstdint>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "frustum.h"
+
+// Handle of an object in a SceneStore: its slot in the low bits, the slot's generation above
+typedef uint32_t Entity;
+const Entity NO_ENTITY = 0xFFFFFFFFu;
+const int SCENE_SLOT_BITS = 24;
+// Objects a BVH leaf holds at most when it is built, and bins tried per axis for a split
+const int SCENE_LEAF_OBJECTS = 4;
+const int SCENE_BVH_BINS = 12;
+// Depth below which nodes stay leaves however many objects they hold, bounding the traversal stacks
+const int SCENE_BVH_DEPTH = 48;
+// Rebuild once refitting made the BVH this much more costly to traverse than when it was built
+const float SCENE_REBUILD_COST = 1.5f;
+// Added objects are tested one by one until there are more than this many, or a 64th of the scene
+const size_t SCENE_PENDING_OBJECTS = 64;
+
+
+// Objects of the scene in structure of arrays: where each was placed, its model matrix, its
+// bounds in model space and in the world, and its material. The arrays are packed, removing an
+// object moves the last one into its place, so an index is only good until the next Remove.
+// Entities are what stays stable: a slot that outlives the object's index, with a generation
+// that tells a removed object from the next one in the same slot.
+//
+// A bounding volume hierarchy over the world bounds answers ray picks, frustum queries and
+// nearest object lookups. It is built top-down with binned SAH. Moved objects only refit the
+// bounds of their leaves and the nodes above them, added objects wait in a short list that the
+// queries test one by one, and the hierarchy is built again once the list grows or refitting
+// made it costly to traverse. Queries bring the hierarchy up to date first.
+class SceneStore
+{
+public:
+    std::vector<glm::vec3> Positions;
+    std::vector<glm::mat4> Models;
+    std::vector<glm::vec3> LocalMin, LocalMax;
+    std::vector<glm::vec3> BoundsMin, BoundsMax;
+    std::vector<GLuint> Materials;
+    // Entity of each index
+    std::vector<Entity> Owners;
+    // Times the hierarchy was built, and how long the last build took
+    GLuint Builds;
+    GLfloat BuildMilliseconds;
+
+    SceneStore() : Builds(0), BuildMilliseconds(0.0f), FreeSlot(-1), BuildCost(0.0f), Changes(0) {}
+
+    // A new object at a position, its model matrix a translation there until SetModel
+    Entity Add(const glm::vec3& position, const glm::vec3& localMin, const glm::vec3& localMax, GLuint material)
+    {
+        int slot = this->FreeSlot;
+        if (slot >= 0)
+            this->FreeSlot = this->Slots[slot];
+        else
+        {
+            slot = int(this->Slots.size());
+            this->Slots.push_back(-1);
+            this->Generations.push_back(0);
+        }
+        int index = int(this->Models.size());
+        this->Slots[slot] = index;
+        Entity entity = (Entity(this->Generations[slot]) << SCENE_SLOT_BITS) | Entity(slot);
+
+        glm::mat4 model;
+        model[3] = glm::vec4(position, 1.0f);
+        this->Positions.push_back(position);
+        this->Models.push_back(model);
+        this->LocalMin.push_back(localMin);
+        this->LocalMax.push_back(localMax);
+        this->BoundsMin.push_back(position + localMin);
+        this->BoundsMax.push_back(position + localMax);
+        this->Materials.push_back(material);
+        this->Owners.push_back(entity);
+        this->Leaves.push_back(-1);
+        this->Pending.push_back(index);
+        return entity;
+    }
+
+    void Remove(Entity entity)
+    {
+        int index = this->Index(entity);
+        if (index < 0)
+            return;
+        this->unlink(index);
+        int last = int(this->Models.size()) - 1;
+        if (index != last)
+        {
+            // The last object takes the freed index, in its leaf or the pending list as well
+            this->relink(last, index);
+            this->Positions[index] = this->Positions[last];
+            this->Models[index] = this->Models[last];
+            this->LocalMin[index] = this->LocalMin[last];
+            this->LocalMax[index] = this->LocalMax[last];
+            this->BoundsMin[index] = this->BoundsMin[last];
+            this->BoundsMax[index] = this->BoundsMax[last];
+            this->Materials[index] = this->Materials[last];
+            this->Owners[index] = this->Owners[last];
+            this->Leaves[index] = this->Leaves[last];
+            this->Slots[slot(this->Owners[index])] = index;
+        }
+        this->Positions.pop_back();
+        this->Models.pop_back();
+        this->LocalMin.pop_back();
+        this->LocalMax.pop_back();
+        this->BoundsMin.pop_back();
+        this->BoundsMax.pop_back();
+        this->Materials.pop_back();
+        this->Owners.pop_back();
+        this->Leaves.pop_back();
+
+        int freed = slot(entity);
+        this->Generations[freed]++;
+        this->Slots[freed] = this->FreeSlot;
+        this->FreeSlot = freed;
+    }
+
+    bool Alive(Entity entity) const
+    {
+        return this->Index(entity) >= 0;
+    }
+
+    // Index of an object in the arrays, -1 once it was removed
+    int Index(Entity entity) const
+    {
+        if (entity == NO_ENTITY)
+            return -1;
+        int s = slot(entity);
+        if (s >= int(this->Slots.size()) || this->Generations[s] != uint8_t(entity >> SCENE_SLOT_BITS))
+            return -1;
+        return this->Slots[s];
+    }
+
+    size_t Size() const
+    {
+        return this->Models.size();
+    }
+
+    // Bytes of the arrays and of the hierarchy
+    size_t Bytes() const
+    {
+        size_t objects = this->Models.capacity();
+        return objects * (sizeof(glm::mat4) + 5 * sizeof(glm::vec3) + sizeof(GLuint) + sizeof(Entity) + 2 * sizeof(int))
+            + this->Nodes.capacity() * (sizeof(Node) + 1) + this->Slots.capacity() * (sizeof(int) + 1)
+            + (this->Pending.capacity() + this->Dirty.capacity()) * sizeof(int);
+    }
+
+    // Slot number of an entity, for printing
+    static int Slot(Entity entity)
+    {
+        return slot(entity);
+    }
+
+    // New model matrix of an object; the world bounds follow
+    void SetModel(Entity entity, const glm::mat4& model)
+    {
+        int index = this->Index(entity);
+        if (index < 0)
+            return;
+        this->Models[index] = model;
+        TransformBounds(model, this->LocalMin[index], this->LocalMax[index], this->BoundsMin[index], this->BoundsMax[index]);
+        this->moved(index);
+    }
+
+    // Places an object elsewhere, moving its model matrix by the same amount
+    void SetPosition(Entity entity, const glm::vec3& position)
+    {
+        int index = this->Index(entity);
+        if (index < 0)
+            return;
+        glm::vec3 offset = position - this->Positions[index];
+        this->Positions[index] = position;
+        this->Models[index][3] += glm::vec4(offset, 0.0f);
+        this->BoundsMin[index] += offset;
+        this->BoundsMax[index] += offset;
+        this->moved(index);
+    }
+
+    void SetMaterial(Entity entity, GLuint material)
+    {
+        int index = this->Index(entity);
+        if (index >= 0)
+            this->Materials[index] = material;
+    }
+
+    // Brings the hierarchy up to date with the objects, the queries call it themselves
+    void Refit()
+    {
+        size_t count = this->Models.size();
+        if (this->Nodes.empty() ? count > 0 : this->Pending.size() > std::max(SCENE_PENDING_OBJECTS, count / 64))
+        {
+            this->build();
+            return;
+        }
+        if (this->Dirty.empty())
+            return;
+        // Many moved leaves are cheaper to refit in one sweep, which also measures the cost
+        if (this->Dirty.size() > this->Nodes.size() / 16 || this->Changes > count / 4)
+        {
+            for (int node : this->Dirty)
+                this->NodeDirty[node] = 0;
+            this->Dirty.clear();
+            for (int node = int(this->Nodes.size()) - 1; node >= 0; node--)
+                this->fit(node);
+            this->Changes = 0;
+            if (this->cost() > SCENE_REBUILD_COST * this->BuildCost)
+                this->build();
+            return;
+        }
+        // Otherwise walk up from each moved leaf, until a node keeps its bounds
+        for (int leaf : this->Dirty)
+        {
+            this->NodeDirty[leaf] = 0;
+            this->fit(leaf);
+            for (int node = this->Nodes[leaf].Parent; node >= 0; node = this->Nodes[node].Parent)
+            {
+                glm::vec3 boundsMin = this->Nodes[node].Min, boundsMax = this->Nodes[node].Max;
+                this->fit(node);
+                if (this->Nodes[node].Min == boundsMin && this->Nodes[node].Max == boundsMax)
+                    break;
+            }
+        }
+        this->Dirty.clear();
+    }
+
+    // Nearest object a ray hits, NO_ENTITY for none. Objects are hit in their model space
+    // bounds, not just the world box around them; distance is along the direction given.
+    Entity Raycast(const glm::vec3& origin, const glm::vec3& direction, GLfloat maxDistance = FLT_MAX, GLfloat* distance = NULL)
+    {
+        this->Refit();
+        glm::vec3 inverse = 1.0f / direction;
+        GLfloat nearest = maxDistance;
+        int hit = -1;
+        auto test = [&](int index)
+        {
+            GLfloat t;
+            if (rayBox(origin, inverse, this->BoundsMin[index], this->BoundsMax[index], nearest, t) && this->rayObject(index, origin, direction, nearest, t))
+            {
+                nearest = t;
+                hit = index;
+            }
+        };
+        for (int index : this->Pending)
+            test(index);
+        if (!this->Nodes.empty())
+        {
+            int stack[SCENE_BVH_DEPTH + 2];
+            int top = 0;
+            stack[top++] = 0;
+            while (top > 0)
+            {
+                const Node& node = this->Nodes[stack[--top]];
+                GLfloat t;
+                if (node.Left < 0 && node.Count == 0)
+                    continue;
+                if (!rayBox(origin, inverse, node.Min, node.Max, nearest, t))
+                    continue;
+                if (node.Left < 0)
+                {
+                    for (int i = node.First; i < node.First + node.Count; i++)
+                        test(this->Items[i]);
+                    continue;
+                }
+                // The nearer child goes on top
+                GLfloat tLeft, tRight;
+                bool left = rayBox(origin, inverse, this->Nodes[node.Left].Min, this->Nodes[node.Left].Max, nearest, tLeft);
+                bool right = rayBox(origin, inverse, this->Nodes[node.Left + 1].Min, this->Nodes[node.Left + 1].Max, nearest, tRight);
+                if (left && right && tLeft < tRight)
+                {
+                    stack[top++] = node.Left + 1;
+                    stack[top++] = node.Left;
+                }
+                else
+                {
+                    if (left)
+                        stack[top++] = node.Left;
+                    if (right)
+                        stack[top++] = node.Left + 1;
+                }
+            }
+        }
+        if (hit < 0)
+            return NO_ENTITY;
+        if (distance)
+            *distance = nearest;
+        return this->Owners[hit];
+    }
+
+    // Indices of the objects whose world bounds intersect a frustum. Nodes found completely
+    // inside some planes skip them further down, nodes completely inside add everything below.
+    void QueryFrustum(const Frustum& frustum, std::vector<int>& indices)
+    {
+        this->Refit();
+        indices.clear();
+        for (int index : this->Pending)
+            if (frustum.IntersectsBox(this->BoundsMin[index], this->BoundsMax[index]))
+                indices.push_back(index);
+        if (this->Nodes.empty())
+            return;
+        // Node and the planes it still has to be tested against
+        std::pair<int, int> stack[SCENE_BVH_DEPTH + 2];
+        int top = 0;
+        stack[top++] = std::make_pair(0, 0x3F);
+        while (top > 0)
+        {
+            std::pair<int, int> entry = stack[--top];
+            const Node& node = this->Nodes[entry.first];
+            int planes = classify(frustum, node.Min, node.Max, entry.second);
+            if (planes < 0)
+                continue;
+            if (planes == 0)
+                this->collect(entry.first, indices);
+            else if (node.Left < 0)
+            {
+                for (int i = node.First; i < node.First + node.Count; i++)
+                    if (classify(frustum, this->BoundsMin[this->Items[i]], this->BoundsMax[this->Items[i]], planes) >= 0)
+                        indices.push_back(this->Items[i]);
+            }
+            else
+            {
+                stack[top++] = std::make_pair(node.Left + 1, planes);
+                stack[top++] = std::make_pair(node.Left, planes);
+            }
+        }
+    }
+
+    // Objects intersecting any of up to five frusta, in one traversal for all of them. masks
+    // gets a bit per frustum the object intersects, in the order of indices. A node drops the
+    // frusta it lies outside of, and keeps six plane bits per frustum like QueryFrustum does;
+    // the frusta it lies completely inside stop being tested below it.
+    void QueryFrusta(const Frustum* frusta, int count, std::vector<int>& indices, std::vector<uint32_t>& masks)
+    {
+        this->Refit();
+        indices.clear();
+        masks.clear();
+        // Frusta partly inside, completely inside, and the planes left to test of each partly inside one
+        struct Entry
+        {
+            int Node;
+            uint32_t Partial, Inside, Planes;
+        };
+        auto test = [&](const glm::vec3& boxMin, const glm::vec3& boxMax, Entry& entry)
+        {
+            uint32_t partial = entry.Partial, planes = 0;
+            entry.Partial = 0;
+            for (int v = 0; v < count; v++)
+            {
+                if (!(partial & (1u << v)))
+                    continue;
+                int crossed = classify(frusta[v], boxMin, boxMax, (entry.Planes >> (6 * v)) & 0x3F);
+                if (crossed == 0)
+                    entry.Inside |= 1u << v;
+                else if (crossed > 0)
+                {
+                    entry.Partial |= 1u << v;
+                    planes |= uint32_t(crossed) << (6 * v);
+                }
+            }
+            entry.Planes = planes;
+        };
+        Entry all = { 0, (1u << count) - 1, 0, 0 };
+        for (int v = 0; v < count; v++)
+            all.Planes |= 0x3Fu << (6 * v);
+        for (int index : this->Pending)
+        {
+            Entry entry = all;
+            test(this->BoundsMin[index], this->BoundsMax[index], entry);
+            if (entry.Partial | entry.Inside)
+            {
+                indices.push_back(index);
+                masks.push_back(entry.Partial | entry.Inside);
+            }
+        }
+        if (this->Nodes.empty())
+            return;
+        Entry stack[SCENE_BVH_DEPTH + 2];
+        int top = 0;
+        stack[top++] = all;
+        while (top > 0)
+        {
+            Entry entry = stack[--top];
+            const Node& node = this->Nodes[entry.Node];
+            test(node.Min, node.Max, entry);
+            if (!entry.Partial)
+            {
+                if (entry.Inside)
+                {
+                    this->collect(entry.Node, indices);
+                    masks.resize(indices.size(), entry.Inside);
+                }
+            }
+            else if (node.Left < 0)
+            {
+                for (int i = node.First; i < node.First + node.Count; i++)
+                {
+                    Entry item = entry;
+                    test(this->BoundsMin[this->Items[i]], this->BoundsMax[this->Items[i]], item);
+                    if (item.Partial | item.Inside)
+                    {
+                        indices.push_back(this->Items[i]);
+                        masks.push_back(item.Partial | item.Inside);
+                    }
+                }
+            }
+            else
+            {
+                Entry child = entry;
+                child.Node = node.Left + 1;
+                stack[top++] = child;
+                child.Node = node.Left;
+                stack[top++] = child;
+            }
+        }
+    }
+
+    // Object whose world bounds are closest to a point, within maxDistance; NO_ENTITY for none
+    Entity Nearest(const glm::vec3& point, GLfloat maxDistance = FLT_MAX, GLfloat* distance = NULL)
+    {
+        this->Refit();
+        GLfloat best = maxDistance == FLT_MAX ? FLT_MAX : maxDistance * maxDistance;
+        int found = -1;
+        auto test = [&](int index)
+        {
+            GLfloat d = distanceSquared(point, this->BoundsMin[index], this->BoundsMax[index]);
+            if (d < best)
+            {
+                best = d;
+                found = index;
+            }
+        };
+        for (int index : this->Pending)
+            test(index);
+        if (!this->Nodes.empty())
+        {
+            std::pair<int, GLfloat> stack[SCENE_BVH_DEPTH + 2];
+            int top = 0;
+            stack[top++] = std::make_pair(0, distanceSquared(point, this->Nodes[0].Min, this->Nodes[0].Max));
+            while (top > 0)
+            {
+                std::pair<int, GLfloat> entry = stack[--top];
+                if (entry.second >= best)
+                    continue;
+                const Node& node = this->Nodes[entry.first];
+                if (node.Left < 0)
+                {
+                    for (int i = node.First; i < node.First + node.Count; i++)
+                        test(this->Items[i]);
+                    continue;
+                }
+                // The nearer child goes on top
+                GLfloat dLeft = distanceSquared(point, this->Nodes[node.Left].Min, this->Nodes[node.Left].Max);
+                GLfloat dRight = distanceSquared(point, this->Nodes[node.Left + 1].Min, this->Nodes[node.Left + 1].Max);
+                if (dLeft < dRight)
+                {
+                    stack[top++] = std::make_pair(node.Left + 1, dRight);
+                    stack[top++] = std::make_pair(node.Left, dLeft);
+                }
+                else
+                {
+                    stack[top++] = std::make_pair(node.Left, dLeft);
+                    stack[top++] = std::make_pair(node.Left + 1, dRight);
+                }
+            }
+        }
+        if (found < 0)
+            return NO_ENTITY;
+        if (distance)
+            *distance = std::sqrt(best);
+        return this->Owners[found];
+    }
+
+private:
+    // A leaf holds Count objects from First in Items, an inner node its two children at Left
+    // and Left + 1. Children always come after their parent.
+    struct Node
+    {
+        glm::vec3 Min, Max;
+        int Left, First, Count, Parent;
+    };
+
+    std::vector<Node> Nodes;
+    std::vector<int> Items;
+    // Per index: the leaf holding the object, -1 while it waits in Pending
+    std::vector<int> Leaves;
+    std::vector<int> Pending;
+    // Leaves whose objects moved since the last refit, flagged per node so each is listed once
+    std::vector<int> Dirty;
+    std::vector<uint8_t> NodeDirty;
+    // Per slot: the index of its object, or the next free slot
+    std::vector<int> Slots;
+    std::vector<uint8_t> Generations;
+    int FreeSlot;
+    // Traversal cost when the hierarchy was built, and objects moved or removed since the last sweep
+    GLfloat BuildCost;
+    size_t Changes;
+
+    static int slot(Entity entity)
+    {
+        return int(entity & ((1u << SCENE_SLOT_BITS) - 1));
+    }
+
+    void moved(int index)
+    {
+        int leaf = this->Leaves[index];
+        if (leaf < 0)
+            return;
+        if (!this->NodeDirty[leaf])
+        {
+            this->NodeDirty[leaf] = 1;
+            this->Dirty.push_back(leaf);
+        }
+        this->Changes++;
+    }
+
+    // Takes an object out of its leaf or the pending list
+    void unlink(int index)
+    {
+        int leaf = this->Leaves[index];
+        if (leaf < 0)
+        {
+            std::vector<int>::iterator found = std::find(this->Pending.begin(), this->Pending.end(), index);
+            *found = this->Pending.back();
+            this->Pending.pop_back();
+            return;
+        }
+        Node& node = this->Nodes[leaf];
+        int* first = &this->Items[node.First];
+        std::swap(*std::find(first, first + node.Count, index), first[node.Count - 1]);
+        node.Count--;
+        this->moved(index);
+    }
+
+    // Points the leaf or pending entry of an object at its new index
+    void relink(int from, int to)
+    {
+        int leaf = this->Leaves[from];
+        if (leaf < 0)
+        {
+            *std::find(this->Pending.begin(), this->Pending.end(), from) = to;
+            return;
+        }
+        int* first = &this->Items[this->Nodes[leaf].First];
+        *std::find(first, first + this->Nodes[leaf].Count, from) = to;
+    }
+
+    // Bounds of a node from its objects or children. An empty leaf gets inverted bounds: the frustum
+    // and distance tests reject them, but the ray test's slab swap turns them into a huge box, so
+    // Raycast skips empty leaves itself.
+    void fit(int index)
+    {
+        Node& node = this->Nodes[index];
+        if (node.Left >= 0)
+        {
+            node.Min = glm::min(this->Nodes[node.Left].Min, this->Nodes[node.Left + 1].Min);
+            node.Max = glm::max(this->Nodes[node.Left].Max, this->Nodes[node.Left + 1].Max);
+            return;
+        }
+        node.Min = glm::vec3(FLT_MAX);
+        node.Max = glm::vec3(-FLT_MAX);
+        for (int i = node.First; i < node.First + node.Count; i++)
+        {
+            node.Min = glm::min(node.Min, this->BoundsMin[this->Items[i]]);
+            node.Max = glm::max(node.Max, this->BoundsMax[this->Items[i]]);
+        }
+    }
+
+    // Appends every object below a node
+    void collect(int index, std::vector<int>& indices) const
+    {
+        int stack[SCENE_BVH_DEPTH + 2];
+        int top = 0;
+        stack[top++] = index;
+        while (top > 0)
+        {
+            const Node& node = this->Nodes[stack[--top]];
+            if (node.Left < 0)
+                indices.insert(indices.end(), this->Items.begin() + node.First, this->Items.begin() + node.First + node.Count);
+            else
+            {
+                stack[top++] = node.Left + 1;
+                stack[top++] = node.Left;
+            }
+        }
+    }
+
+    static GLfloat area(const glm::vec3& boxMin, const glm::vec3& boxMax)
+    {
+        glm::vec3 size = boxMax - boxMin;
+        if (size.x < 0.0f || size.y < 0.0f || size.z < 0.0f)
+            return 0.0f;
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+
+    // Expected cost of a query by the surface area heuristic: inner nodes count as one visit,
+    // leaves as one per object, each weighted by its area relative to the root's
+    GLfloat cost() const
+    {
+        GLfloat total = 0.0f;
+        for (const Node& node : this->Nodes)
+            total += area(node.Min, node.Max) * (node.Left < 0 ? GLfloat(node.Count) : 1.0f);
+        GLfloat root = area(this->Nodes[0].Min, this->Nodes[0].Max);
+        return root > 0.0f ? total / root : 0.0f;
+    }
+
+    // Builds the hierarchy over every object from the top down, splitting where SAH is lowest
+    void build()
+    {
+        auto start = std::chrono::steady_clock::now();
+        int count = int(this->Models.size());
+        this->Nodes.clear();
+        this->Items.resize(count);
+        for (int i = 0; i < count; i++)
+            this->Items[i] = i;
+        this->Leaves.assign(count, -1);
+        this->Pending.clear();
+        this->Dirty.clear();
+        this->Changes = 0;
+        std::vector<glm::vec3> centers(count);
+        for (int i = 0; i < count; i++)
+            centers[i] = (this->BoundsMin[i] + this->BoundsMax[i]) * 0.5f;
+
+        if (count > 0)
+        {
+            Node root = { glm::vec3(0.0f), glm::vec3(0.0f), -1, 0, count, -1 };
+            this->Nodes.push_back(root);
+            // Nodes to split, with their depth
+            std::vector<std::pair<int, int> > stack(1, std::make_pair(0, 0));
+            while (!stack.empty())
+            {
+                int index = stack.back().first, depth = stack.back().second;
+                stack.pop_back();
+                this->fit(index);
+                int first = this->Nodes[index].First, objects = this->Nodes[index].Count;
+                int left = depth < SCENE_BVH_DEPTH ? this->split(index, centers) : 0;
+                if (left == 0)
+                {
+                    for (int i = first; i < first + objects; i++)
+                        this->Leaves[this->Items[i]] = index;
+                    continue;
+                }
+                int child = int(this->Nodes.size());
+                Node leftNode = { glm::vec3(0.0f), glm::vec3(0.0f), -1, first, left, index };
+                Node rightNode = { glm::vec3(0.0f), glm::vec3(0.0f), -1, first + left, objects - left, index };
+                this->Nodes.push_back(leftNode);
+                this->Nodes.push_back(rightNode);
+                this->Nodes[index].Left = child;
+                this->Nodes[index].Count = 0;
+                stack.push_back(std::make_pair(child + 1, depth + 1));
+                stack.push_back(std::make_pair(child, depth + 1));
+            }
+            // Bounds of the inner nodes, now that the leaves have theirs
+            for (int node = int(this->Nodes.size()) - 1; node >= 0; node--)
+                if (this->Nodes[node].Left >= 0)
+                    this->fit(node);
+        }
+        this->NodeDirty.assign(this->Nodes.size(), 0);
+        this->BuildCost = this->Nodes.empty() ? 0.0f : this->cost();
+        this->Builds++;
+        this->BuildMilliseconds = std::chrono::duration<GLfloat, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Sorts the objects of a node into two halves and returns how many go left, 0 to keep the
+    // node a leaf. Centers are binned along each axis and the cheapest boundary wins; a node
+    // whose centers coincide is halved.
+    int split(int index, const std::vector<glm::vec3>& centers)
+    {
+        const Node& node = this->Nodes[index];
+        int first = node.First, objects = node.Count;
+        if (objects <= SCENE_LEAF_OBJECTS)
+            return 0;
+        glm::vec3 centerMin(FLT_MAX), centerMax(-FLT_MAX);
+        for (int i = first; i < first + objects; i++)
+        {
+            centerMin = glm::min(centerMin, centers[this->Items[i]]);
+            centerMax = glm::max(centerMax, centers[this->Items[i]]);
+        }
+
+        GLfloat bestCost = FLT_MAX;
+        int bestAxis = -1, bestBin = 0;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            GLfloat extent = centerMax[axis] - centerMin[axis];
+            if (extent <= 0.0f)
+                continue;
+            GLfloat scale = SCENE_BVH_BINS / extent;
+            int binCount[SCENE_BVH_BINS] = {};
+            glm::vec3 binMin[SCENE_BVH_BINS], binMax[SCENE_BVH_BINS];
+            for (int b = 0; b < SCENE_BVH_BINS; b++)
+            {
+                binMin[b] = glm::vec3(FLT_MAX);
+                binMax[b] = glm::vec3(-FLT_MAX);
+            }
+            for (int i = first; i < first + objects; i++)
+            {
+                int item = this->Items[i];
+                int b = std::min(int((centers[item][axis] - centerMin[axis]) * scale), SCENE_BVH_BINS - 1);
+                binCount[b]++;
+                binMin[b] = glm::min(binMin[b], this->BoundsMin[item]);
+                binMax[b] = glm::max(binMax[b], this->BoundsMax[item]);
+            }
+            // Areas and counts left of each boundary, then swept in from the right
+            GLfloat leftArea[SCENE_BVH_BINS];
+            int leftCount[SCENE_BVH_BINS];
+            glm::vec3 sweepMin(FLT_MAX), sweepMax(-FLT_MAX);
+            int sweepCount = 0;
+            for (int b = 0; b < SCENE_BVH_BINS - 1; b++)
+            {
+                sweepMin = glm::min(sweepMin, binMin[b]);
+                sweepMax = glm::max(sweepMax, binMax[b]);
+                sweepCount += binCount[b];
+                leftArea[b] = area(sweepMin, sweepMax);
+                leftCount[b] = sweepCount;
+            }
+            sweepMin = glm::vec3(FLT_MAX);
+            sweepMax = glm::vec3(-FLT_MAX);
+            sweepCount = 0;
+            for (int b = SCENE_BVH_BINS - 1; b > 0; b--)
+            {
+                sweepMin = glm::min(sweepMin, binMin[b]);
+                sweepMax = glm::max(sweepMax, binMax[b]);
+                sweepCount += binCount[b];
+                if (leftCount[b - 1] == 0 || sweepCount == 0)
+                    continue;
+                GLfloat splitCost = leftArea[b - 1] * leftCount[b - 1] + area(sweepMin, sweepMax) * sweepCount;
+                if (splitCost < bestCost)
+                {
+                    bestCost = splitCost;
+                    bestAxis = axis;
+                    bestBin = b - 1;
+                }
+            }
+        }
+
+        int* items = &this->Items[first];
+        if (bestAxis < 0)
+            return objects / 2;
+        // Splitting must pay for the visit of the extra node
+        GLfloat leafCost = area(node.Min, node.Max) * objects;
+        if (bestCost + area(node.Min, node.Max) >= leafCost && objects <= 4 * SCENE_LEAF_OBJECTS)
+            return 0;
+        GLfloat scale = SCENE_BVH_BINS / (centerMax[bestAxis] - centerMin[bestAxis]);
+        int* middle = std::partition(items, items + objects, [&](int item)
+        {
+            return std::min(int((centers[item][bestAxis] - centerMin[bestAxis]) * scale), SCENE_BVH_BINS - 1) <= bestBin;
+        });
+        return int(middle - items);
+    }
+
+    // Classifies a box against the planes of a mask: -1 outside one of them, otherwise the mask
+    // of the planes the box still crosses, 0 when it is inside all of them
+    static int classify(const Frustum& frustum, const glm::vec3& boxMin, const glm::vec3& boxMax, int mask)
+    {
+        int crossed = 0;
+        for (int p = 0; p < 6; p++)
+        {
+            if (!(mask & (1 << p)))
+                continue;
+            const glm::vec4& plane = frustum.Planes[p];
+            // Corners furthest along the normal and against it
+            glm::vec3 outer(plane.x >= 0.0f ? boxMax.x : boxMin.x, plane.y >= 0.0f ? boxMax.y : boxMin.y, plane.z >= 0.0f ? boxMax.z : boxMin.z);
+            if (glm::dot(glm::vec3(plane), outer) + plane.w < 0.0f)
+                return -1;
+            glm::vec3 inner(plane.x >= 0.0f ? boxMin.x : boxMax.x, plane.y >= 0.0f ? boxMin.y : boxMax.y, plane.z >= 0.0f ? boxMin.z : boxMax.z);
+            if (glm::dot(glm::vec3(plane), inner) + plane.w < 0.0f)
+                crossed |= 1 << p;
+        }
+        return crossed;
+    }
+
+    // Slab test of a ray against a box, hit when it enters the box before maxDistance. t is
+    // where it enters, 0 from inside.
+    static bool rayBox(const glm::vec3& origin, const glm::vec3& inverse, const glm::vec3& boxMin, const glm::vec3& boxMax, GLfloat maxDistance, GLfloat& t)
+    {
+        glm::vec3 t0 = (boxMin - origin) * inverse, t1 = (boxMax - origin) * inverse;
+        glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+        GLfloat enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        GLfloat exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+        t = enter;
+        return enter <= exit && enter < maxDistance;
+    }
+
+    // The ray against an object's bounds in model space, where they are a box again
+    bool rayObject(int index, const glm::vec3& origin, const glm::vec3& direction, GLfloat maxDistance, GLfloat& t) const
+    {
+        glm::mat4 toModel = glm::inverse(this->Models[index]);
+        glm::vec3 localOrigin = glm::vec3(toModel * glm::vec4(origin, 1.0f));
+        glm::vec3 localDirection = glm::vec3(toModel * glm::vec4(direction, 0.0f));
+        return rayBox(localOrigin, 1.0f / localDirection, this->LocalMin[index], this->LocalMax[index], maxDistance, t);
+    }
+
+    static GLfloat distanceSquared(const glm::vec3& point, const glm::vec3& boxMin, const glm::vec3& boxMax)
+    {
+        glm::vec3 outside = glm::max(glm::max(boxMin - point, point - boxMax), glm::vec3(0.0f));
+        return glm::dot(outside, outside);
+    }
+};
@@ -0,0 +1,403 @@
+#pragma once
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <filesystem>
+#include <cstdint>
+#include <cstdio>
+
+// GL Includes
+#include <GL/glew.h>
+
+#include "resource_registry.h"
+
+
+// Compile-time features a program variant can be specialised with. Every set bit becomes a
+// "#define NAME" injected right after the #version line of each stage, so a single source file
+// yields several programs that only pay for what they use.
+enum Shader_Permutation {
+    SINGLE_TEXTURE    = 0,        // one texture fetch, no blending (skybox and terrain)
+    TWO_TEXTURE_BLEND = 1 << 0,   // two texture fetches mixed together (boxes)
+    LIT_TERRAIN       = 1 << 1,   // derivative based normal with a directional sun light
+    VIRTUAL_TEXTURE   = 1 << 2,   // ourTexture1 is a page cache, looked up through a page table
+    VIEWSHED_OVERLAY  = 1 << 3,   // tints the terrain by a mask of what an observer can see
+    HORIZON_SHADING   = 1 << 4,   // ambient occlusion and sun shadows from baked horizon angles
+    MULTI_VIEW        = 1 << 5    // instance i of a draw is seen from view i, into viewport i
+};
+
+// Names of the defines for each permutation bit, in bit order
+static const char* const PERMUTATION_DEFINES[] = {
+    "TWO_TEXTURE_BLEND",
+    "LIT_TERRAIN",
+    "VIRTUAL_TEXTURE",
+    "VIEWSHED_OVERLAY",
+    "HORIZON_SHADING",
+    "MULTI_VIEW"
+};
+const GLuint PERMUTATION_COUNT = sizeof(PERMUTATION_DEFINES) / sizeof(PERMUTATION_DEFINES[0]);
+
+// Picks the cheapest variant able to draw with the given textures. Binding the same texture to
+// both samplers and mixing it with itself is the single-texture case with an extra fetch.
+inline GLuint ChoosePermutation(GLuint texture1, GLuint texture2, GLuint extraFlags = 0)
+{
+    GLuint permutation = extraFlags;
+    if (texture1 != texture2)
+        permutation |= TWO_TEXTURE_BLEND;
+    return permutation;
+}
+
+
+// One source file attached to a program
+struct ShaderStage
+{
+    GLenum Type;
+    std::string Path;
+};
+
+// A program the driver is still compiling and linking
+struct PendingProgram
+{
+    std::string Name;
+    GLuint Program;
+    std::vector<GLuint> Shaders;   // empty when the program came from the binary cache
+    std::vector<std::string> Paths;
+    std::string CachePath;
+
+    PendingProgram() : Program(0) {}
+};
+
+
+// Builds program variants from source files and keeps them in a persistent program binary cache.
+// Linked programs are stored with glGetProgramBinary under a key made from the driver strings, the
+// sources and the permutation, so a warm start loads the binaries instead of compiling anything.
+// When the driver changes or a source file is edited, the key changes and the variant is rebuilt.
+class ShaderCache
+{
+public:
+    // Statistics of the current session
+    GLuint LoadedFromCache;
+    GLuint Compiled;
+    // Bumped whenever a reload replaces a program, so users can refresh the ids they hold
+    GLuint Generation;
+
+    ShaderCache(const std::string& cacheDir = "shadercache") : LoadedFromCache(0), Compiled(0), Generation(0)
+    {
+        this->CacheDir = cacheDir;
+        // Program binaries are core since 4.1; some 3.3 drivers still expose the extension
+        this->BinariesSupported = GLEW_ARB_get_program_binary != 0;
+        if (this->BinariesSupported)
+        {
+            GLint formats = 0;
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+            this->BinariesSupported = formats > 0;
+        }
+        if (this->BinariesSupported)
+        {
+            std::error_code error;
+            std::filesystem::create_directories(this->CacheDir, error);
+        }
+        // Let the driver compile on its own threads, so reloads can be polled instead of waited on
+        this->ParallelCompile = GLEW_ARB_parallel_shader_compile != 0;
+        if (this->ParallelCompile)
+            glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+        // Everything the driver could change its binary format for
+        this->DriverKey = this->glString(GL_VENDOR) + "|" + this->glString(GL_RENDERER) + "|" +
+                          this->glString(GL_VERSION) + "|" + this->glString(GL_SHADING_LANGUAGE_VERSION);
+    }
+
+    // Deletes every program, must run while the context is still current
+    void Release()
+    {
+        for (auto& entry : this->Programs)
+        {
+            Resources().Deleted(RESOURCE_PROGRAM, entry.second);
+            glDeleteProgram(entry.second);
+        }
+        this->Programs.clear();
+    }
+
+    // Returns the vertex/fragment program for the given permutation, building it on first use
+    GLuint Program(const std::string& vertexPath, const std::string& fragmentPath, GLuint permutation = SINGLE_TEXTURE)
+    {
+        return this->Program({ { GL_VERTEX_SHADER, vertexPath }, { GL_FRAGMENT_SHADER, fragmentPath } }, permutation);
+    }
+
+    // Returns the program linked from an arbitrary list of stages, building it on first use
+    GLuint Program(const std::vector<ShaderStage>& stages, GLuint permutation = SINGLE_TEXTURE)
+    {
+        std::string name = this->programName(stages, permutation);
+        auto found = this->Programs.find(name);
+        if (found != this->Programs.end())
+            return found->second;
+
+        PendingProgram pending;
+        GLuint program = 0;
+        if (this->startBuild(stages, permutation, pending))
+            program = this->finishBuild(pending);
+        this->Programs[name] = program;
+        Resources().Created(RESOURCE_PROGRAM, program, name);
+        return program;
+    }
+
+    // Starts rebuilding every program that uses the given source file from its current sources
+    std::vector<PendingProgram> BeginReload(const std::string& path)
+    {
+        std::vector<PendingProgram> pending;
+        for (auto& entry : this->Stages)
+        {
+            const std::vector<ShaderStage>& stages = entry.second.first;
+            bool usesPath = false;
+            for (const ShaderStage& stage : stages)
+                usesPath = usesPath || stage.Path == path;
+            PendingProgram program;
+            if (usesPath && this->startBuild(stages, entry.second.second, program))
+                pending.push_back(program);
+        }
+        return pending;
+    }
+
+    // Returns false while the driver is still busy with a reload. Once it is done, a program that
+    // linked replaces the old one and a broken one is dropped, so the old program stays in use.
+    bool FinishReload(PendingProgram& pending)
+    {
+        if (this->ParallelCompile && pending.Program != 0)
+        {
+            GLint done = GL_TRUE;
+            glGetProgramiv(pending.Program, GL_COMPLETION_STATUS_ARB, &done);
+            if (!done)
+                return false;
+        }
+        GLuint program = this->finishBuild(pending);
+        if (program != 0)
+        {
+            GLuint& current = this->Programs[pending.Name];
+            if (current != 0)
+            {
+                Resources().Deleted(RESOURCE_PROGRAM, current);
+                glDeleteProgram(current);
+            }
+            current = program;
+            Resources().Created(RESOURCE_PROGRAM, program, pending.Name);
+            this->Generation++;
+        }
+        return true;
+    }
+
+private:
+    std::string CacheDir;
+    std::string DriverKey;
+    bool BinariesSupported;
+    bool ParallelCompile;
+    std::map<std::string, GLuint> Programs;
+    // Stages and permutation of every program, by name, for reloads
+    std::map<std::string, std::pair<std::vector<ShaderStage>, GLuint>> Stages;
+
+    std::string programName(const std::vector<ShaderStage>& stages, GLuint permutation)
+    {
+        std::string name = std::to_string(permutation);
+        for (const ShaderStage& stage : stages)
+            name += "|" + stage.Path;
+        return name;
+    }
+
+    // Reads, specialises and compiles the stages and starts linking them. Compile errors are only
+    // queried in finishBuild, so a driver with parallel compilation is never waited on here.
+    bool startBuild(const std::vector<ShaderStage>& stages, GLuint permutation, PendingProgram& pending)
+    {
+        pending.Name = this->programName(stages, permutation);
+        this->Stages[pending.Name] = std::make_pair(stages, permutation);
+
+        // Read every stage and specialise it with the permutation defines
+        std::vector<std::string> sources;
+        std::string keyText = this->DriverKey;
+        for (const ShaderStage& stage : stages)
+        {
+            std::string source;
+            if (!this->readFile(stage.Path, source))
+            {
+                std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ " << stage.Path << std::endl;
+                return false;
+            }
+            sources.push_back(this->specialise(source, permutation));
+            keyText += "|" + std::to_string(stage.Type) + "|" + sources.back();
+        }
+        pending.CachePath = this->CacheDir + "/" + this->hashString(keyText) + ".bin";
+
+        // Warm start: hand the stored binary straight to the driver
+        if (this->BinariesSupported)
+        {
+            pending.Program = this->loadBinary(pending.CachePath);
+            if (pending.Program != 0)
+            {
+                this->LoadedFromCache++;
+                return true;
+            }
+        }
+
+        // Cold start: compile and link, the result is stored for the next launch once it is done
+        pending.Program = glCreateProgram();
+        for (size_t i = 0; i < stages.size(); i++)
+        {
+            GLuint shader = glCreateShader(stages[i].Type);
+            const GLchar* code = sources[i].c_str();
+            glShaderSource(shader, 1, &code, NULL);
+            glCompileShader(shader);
+            glAttachShader(pending.Program, shader);
+            pending.Shaders.push_back(shader);
+            pending.Paths.push_back(stages[i].Path);
+        }
+        if (this->BinariesSupported)
+            glProgramParameteri(pending.Program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(pending.Program);
+        return true;
+    }
+
+    // Checks the result of startBuild, returns the program or 0 when it failed
+    GLuint finishBuild(PendingProgram& pending)
+    {
+        GLuint program = pending.Program;
+        if (pending.Shaders.empty())
+            return program;
+        bool success = this->checkLink(program);
+        for (size_t i = 0; i < pending.Shaders.size(); i++)
+        {
+            if (!success)
+                this->checkCompile(pending.Shaders[i], pending.Paths[i]);
+            glDetachShader(program, pending.Shaders[i]);
+            glDeleteShader(pending.Shaders[i]);
+        }
+        pending.Shaders.clear();
+        if (!success)
+        {
+            glDeleteProgram(program);
+            return 0;
+        }
+        this->Compiled++;
+        if (this->BinariesSupported)
+            this->storeBinary(program, pending.CachePath);
+        return program;
+    }
+
+    // Inserts the permutation defines after the #version line, which must stay first
+    std::string specialise(const std::string& source, GLuint permutation)
+    {
+        std::string defines;
+        for (GLuint bit = 0; bit < PERMUTATION_COUNT; bit++)
+            if (permutation & (1u << bit))
+                defines += std::string("#define ") + PERMUTATION_DEFINES[bit] + "\n";
+        if (defines.empty())
+            return source;
+        size_t versionEnd = 0;
+        if (source.compare(0, 8, "#version") == 0)
+        {
+            versionEnd = source.find('\n');
+            versionEnd = versionEnd == std::string::npos ? source.size() : versionEnd + 1;
+        }
+        return source.substr(0, versionEnd) + defines + source.substr(versionEnd);
+    }
+
+    void checkCompile(GLuint shader, const std::string& path)
+    {
+        GLint success;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+        if (!success)
+        {
+            GLchar infoLog[1024];
+            glGetShaderInfoLog(shader, 1024, NULL, infoLog);
+            std::cout << "ERROR::SHADER::COMPILATION_FAILED " << path << "\n" << infoLog << std::endl;
+        }
+    }
+
+    bool checkLink(GLuint program)
+    {
+        GLint success;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            GLchar infoLog[1024];
+            glGetProgramInfoLog(program, 1024, NULL, infoLog);
+            std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+        }
+        return success != 0;
+    }
+
+    // Cache file layout: magic, binary format, binary length, binary bytes
+    GLuint loadBinary(const std::string& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return 0;
+        uint32_t header[3];
+        if (!file.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != CACHE_MAGIC)
+            return 0;
+        std::vector<char> binary(header[2]);
+        if (!file.read(binary.data(), binary.size()))
+            return 0;
+
+        GLuint program = glCreateProgram();
+        glProgramBinary(program, (GLenum)header[1], binary.data(), (GLsizei)binary.size());
+        GLint success;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            // Stale or rejected binary (driver update with the same version string), rebuild it
+            glDeleteProgram(program);
+            std::remove(path.c_str());
+            return 0;
+        }
+        return program;
+    }
+
+    void storeBinary(GLuint program, const std::string& path)
+    {
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(program, length, NULL, &format, binary.data());
+        uint32_t header[3] = { CACHE_MAGIC, (uint32_t)format, (uint32_t)length };
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        file.write(binary.data(), binary.size());
+    }
+
+    bool readFile(const std::string& path, std::string& contents)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return false;
+        std::stringstream stream;
+        stream << file.rdbuf();
+        contents = stream.str();
+        return true;
+    }
+
+    std::string glString(GLenum name)
+    {
+        const GLubyte* value = glGetString(name);
+        return value ? std::string(reinterpret_cast<const char*>(value)) : std::string();
+    }
+
+    // 64-bit FNV-1a, printed as hex for the cache file name
+    std::string hashString(const std::string& text)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c : text)
+        {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        char name[17];
+        std::snprintf(name, sizeof(name), "%016llx", (unsigned long long)hash);
+        return name;
+    }
+
+    static const uint32_t CACHE_MAGIC = 0x43534d48; // "HMSC"
+};
@@ -0,0 +1,355 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "texture.h"
+#include "thread_pool.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define SOFT_RASTER_SSE 1
+#endif
+
+
+// Pixels along each side of a tile, every tile is rasterised by one task
+const int SOFT_TILE = 64;
+// Triangles set up and binned by one task
+const int SOFT_BATCH = 16384;
+
+
+// CPU renderer for machines without a GPU. Draws textured triangle lists the way advanced.vs and
+// advanced.frag do: depth tested, perspective correct texture coordinates, bilinear clamped
+// sampling and an optional second texture blended in.
+//
+// Draw calls transform their vertices, clip against the near plane and sort the triangles into
+// screen tiles on the thread pool. Flush then rasterises the tiles in parallel with SSE, four
+// pixels at a time. A tile keeps the submission order, so results do not depend on the threads.
+class SoftRasterizer
+{
+public:
+    int Width, Height;
+
+    SoftRasterizer(ThreadPool& pool, int width, int height) : Width(width), Height(height), Pool(pool)
+    {
+        this->TilesX = (width + SOFT_TILE - 1) / SOFT_TILE;
+        this->TilesY = (height + SOFT_TILE - 1) / SOFT_TILE;
+        // Rows are padded to whole tiles so four-pixel steps never leave their tile
+        this->Stride = this->TilesX * SOFT_TILE;
+        this->Color.resize(size_t(this->Stride) * this->TilesY * SOFT_TILE);
+        this->Depth.resize(this->Color.size());
+    }
+
+    // Clears the framebuffer and drops anything queued
+    void Clear(const glm::vec3& color)
+    {
+        std::fill(this->Color.begin(), this->Color.end(), pack(color * 255.0f));
+        std::fill(this->Depth.begin(), this->Depth.end(), 1.0f);
+        this->Batches.clear();
+        this->Materials.clear();
+    }
+
+    // Queues a triangle list of x y z s t vertices, indexed unless indices is NULL. textureB is
+    // blended over textureA when it is a different image. The images must stay alive until Flush.
+    void DrawTriangles(const GLfloat* vertices, GLuint vertexCount, const GLuint* indices, GLuint count,
+                       const glm::mat4& mvp, const Image& textureA, const Image& textureB, GLfloat blend = 0.2f)
+    {
+        // 1. Transform every vertex once
+        std::vector<ClipVertex> clip(vertexCount);
+        const int VERTEX_BLOCK = 4096;
+        this->Pool.ParallelFor(int((vertexCount + VERTEX_BLOCK - 1) / VERTEX_BLOCK), [&](int block)
+        {
+            GLuint end = std::min(vertexCount, GLuint(block + 1) * VERTEX_BLOCK);
+            for (GLuint v = GLuint(block) * VERTEX_BLOCK; v < end; v++)
+            {
+                const GLfloat* source = vertices + v * 5;
+                clip[v].Position = mvp * glm::vec4(source[0], source[1], source[2], 1.0f);
+                // Flipped like advanced.vs
+                clip[v].TexCoord = glm::vec2(source[3], 1.0f - source[4]);
+            }
+        });
+
+        // 2. Clip, set up and bin the triangles, one batch per task
+        Material material = { &textureA, &textureB, blend };
+        GLuint materialIndex = GLuint(this->Materials.size());
+        this->Materials.push_back(material);
+        GLuint triangles = count / 3;
+        int batches = int((triangles + SOFT_BATCH - 1) / SOFT_BATCH);
+        size_t firstBatch = this->Batches.size();
+        this->Batches.resize(firstBatch + batches);
+        this->Pool.ParallelFor(batches, [&](int b)
+        {
+            Batch& batch = this->Batches[firstBatch + b];
+            batch.Bins.assign(this->TilesX * this->TilesY, std::vector<GLuint>());
+            GLuint end = std::min(triangles, GLuint(b + 1) * SOFT_BATCH);
+            for (GLuint t = GLuint(b) * SOFT_BATCH; t < end; t++)
+            {
+                ClipVertex corners[3];
+                for (int c = 0; c < 3; c++)
+                    corners[c] = clip[indices ? indices[t * 3 + c] : t * 3 + c];
+                this->clipAndBin(corners, materialIndex, batch);
+            }
+        });
+    }
+
+    // Rasterises everything queued since the last Clear or Flush
+    void Flush()
+    {
+        this->Pool.ParallelFor(this->TilesX * this->TilesY, [&](int tile)
+        {
+            int x0 = (tile % this->TilesX) * SOFT_TILE, y0 = (tile / this->TilesX) * SOFT_TILE;
+            for (const Batch& batch : this->Batches)
+                for (GLuint index : batch.Bins[tile])
+                    this->rasterizeTriangle(batch.Triangles[index], x0, y0);
+        });
+        this->Batches.clear();
+        this->Materials.clear();
+    }
+
+    // The framebuffer as tightly packed RGB rows, top row first, as SOIL_save_image expects
+    void ReadPixels(std::vector<unsigned char>& rgb) const
+    {
+        rgb.resize(size_t(this->Width) * this->Height * 3);
+        for (int y = 0; y < this->Height; y++)
+        {
+            for (int x = 0; x < this->Width; x++)
+            {
+                uint32_t color = this->Color[size_t(y) * this->Stride + x];
+                unsigned char* pixel = &rgb[(size_t(y) * this->Width + x) * 3];
+                pixel[0] = color & 0xff;
+                pixel[1] = (color >> 8) & 0xff;
+                pixel[2] = (color >> 16) & 0xff;
+            }
+        }
+    }
+
+private:
+    struct ClipVertex
+    {
+        glm::vec4 Position;
+        glm::vec2 TexCoord;
+    };
+
+    struct Material
+    {
+        const Image* TextureA;
+        const Image* TextureB;
+        GLfloat Blend;
+    };
+
+    // A set up triangle. Every quantity is a plane over the screen: q = Q[0]*x + Q[1]*y + Q[2].
+    // Edges are positive inside. Depth is affine in screen space, texture coordinates are
+    // interpolated divided by w and recovered per pixel.
+    struct Triangle
+    {
+        GLfloat A[3], B[3], C[3];
+        GLfloat Z[3], InvW[3], U[3], V[3];
+        int MinX, MinY, MaxX, MaxY;
+        GLuint Material;
+    };
+
+    struct Batch
+    {
+        std::vector<Triangle> Triangles;
+        // Triangles overlapping every tile, in submission order
+        std::vector<std::vector<GLuint>> Bins;
+    };
+
+    ThreadPool& Pool;
+    int TilesX, TilesY, Stride;
+    std::vector<uint32_t> Color;
+    std::vector<GLfloat> Depth;
+    std::vector<Material> Materials;
+    std::vector<Batch> Batches;
+
+    static uint32_t pack(const glm::vec3& color)
+    {
+        uint32_t r = uint32_t(std::min(std::max(color.x, 0.0f), 255.0f));
+        uint32_t g = uint32_t(std::min(std::max(color.y, 0.0f), 255.0f));
+        uint32_t b = uint32_t(std::min(std::max(color.z, 0.0f), 255.0f));
+        return r | (g << 8) | (b << 16);
+    }
+
+    // Bilinear fetch with clamped edges, like the GL textures of the scene
+    static glm::vec3 sample(const Image& image, GLfloat u, GLfloat v)
+    {
+        if (image.Pixels.empty())
+            return glm::vec3(0.0f);
+        GLfloat x = u * image.Width - 0.5f, y = v * image.Height - 0.5f;
+        GLfloat fx = std::floor(x), fy = std::floor(y);
+        int x0 = std::min(std::max(int(fx), 0), image.Width - 1), x1 = std::min(std::max(int(fx) + 1, 0), image.Width - 1);
+        int y0 = std::min(std::max(int(fy), 0), image.Height - 1), y1 = std::min(std::max(int(fy) + 1, 0), image.Height - 1);
+        GLfloat tx = x - fx, ty = y - fy;
+        auto texel = [&](int px, int py)
+        {
+            const unsigned char* p = &image.Pixels[(size_t(py) * image.Width + px) * 3];
+            return glm::vec3(p[0], p[1], p[2]);
+        };
+        glm::vec3 top = glm::mix(texel(x0, y0), texel(x1, y0), tx);
+        glm::vec3 bottom = glm::mix(texel(x0, y1), texel(x1, y1), tx);
+        return glm::mix(top, bottom, ty);
+    }
+
+    // Clips against the near plane (z >= -w), which leaves one or two triangles
+    void clipAndBin(const ClipVertex* corners, GLuint material, Batch& batch)
+    {
+        ClipVertex polygon[4];
+        int count = 0;
+        for (int c = 0; c < 3; c++)
+        {
+            const ClipVertex& a = corners[c];
+            const ClipVertex& b = corners[(c + 1) % 3];
+            GLfloat da = a.Position.z + a.Position.w, db = b.Position.z + b.Position.w;
+            if (da >= 0.0f)
+                polygon[count++] = a;
+            if ((da >= 0.0f) != (db >= 0.0f))
+            {
+                GLfloat t = da / (da - db);
+                polygon[count].Position = glm::mix(a.Position, b.Position, t);
+                polygon[count].TexCoord = glm::mix(a.TexCoord, b.TexCoord, t);
+                count++;
+            }
+        }
+        for (int c = 2; c < count; c++)
+            this->setupAndBin(polygon[0], polygon[c - 1], polygon[c], material, batch);
+    }
+
+    void setupAndBin(const ClipVertex& c0, const ClipVertex& c1, const ClipVertex& c2, GLuint material, Batch& batch)
+    {
+        // Screen space: pixel x, pixel y with row 0 at the top, depth in [0,1], 1/w
+        const ClipVertex* clip[3] = { &c0, &c1, &c2 };
+        glm::vec4 v[3];
+        for (int c = 0; c < 3; c++)
+        {
+            GLfloat invW = 1.0f / clip[c]->Position.w;
+            v[c] = glm::vec4((clip[c]->Position.x * invW * 0.5f + 0.5f) * this->Width,
+                             (0.5f - clip[c]->Position.y * invW * 0.5f) * this->Height,
+                             clip[c]->Position.z * invW * 0.5f + 0.5f, invW);
+        }
+        GLfloat area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[1].y - v[0].y) * (v[2].x - v[0].x);
+        if (std::fabs(area) < 1e-8f)
+            return;
+
+        Triangle triangle;
+        triangle.MinX = std::max(0, int(std::floor(std::min(v[0].x, std::min(v[1].x, v[2].x)))));
+        triangle.MaxX = std::min(this->Width - 1, int(std::ceil(std::max(v[0].x, std::max(v[1].x, v[2].x)))));
+        triangle.MinY = std::max(0, int(std::floor(std::min(v[0].y, std::min(v[1].y, v[2].y)))));
+        triangle.MaxY = std::min(this->Height - 1, int(std::ceil(std::max(v[0].y, std::max(v[1].y, v[2].y)))));
+        if (triangle.MinX > triangle.MaxX || triangle.MinY > triangle.MaxY)
+            return;
+        triangle.Material = material;
+
+        // Edge e lies opposite vertex e, so it doubles as that vertex's barycentric weight
+        GLfloat sign = area > 0.0f ? 1.0f : -1.0f;
+        for (int e = 0; e < 3; e++)
+        {
+            const glm::vec4& a = v[(e + 1) % 3];
+            const glm::vec4& b = v[(e + 2) % 3];
+            triangle.A[e] = sign * (a.y - b.y);
+            triangle.B[e] = sign * (b.x - a.x);
+            triangle.C[e] = sign * (a.x * b.y - a.y * b.x);
+        }
+        GLfloat invArea = 1.0f / std::fabs(area);
+        GLfloat z[3], invW[3], u[3], vv[3];
+        for (int c = 0; c < 3; c++)
+        {
+            z[c] = v[c].z;
+            invW[c] = v[c].w;
+            u[c] = clip[c]->TexCoord.x * v[c].w;
+            vv[c] = clip[c]->TexCoord.y * v[c].w;
+        }
+        planeOf(triangle, z, invArea, triangle.Z);
+        planeOf(triangle, invW, invArea, triangle.InvW);
+        planeOf(triangle, u, invArea, triangle.U);
+        planeOf(triangle, vv, invArea, triangle.V);
+
+        GLuint index = GLuint(batch.Triangles.size());
+        batch.Triangles.push_back(triangle);
+        for (int ty = triangle.MinY / SOFT_TILE; ty <= triangle.MaxY / SOFT_TILE; ty++)
+            for (int tx = triangle.MinX / SOFT_TILE; tx <= triangle.MaxX / SOFT_TILE; tx++)
+                batch.Bins[ty * this->TilesX + tx].push_back(index);
+    }
+
+    static void planeOf(const Triangle& triangle, const GLfloat* values, GLfloat invArea, GLfloat* plane)
+    {
+        plane[0] = (triangle.A[0] * values[0] + triangle.A[1] * values[1] + triangle.A[2] * values[2]) * invArea;
+        plane[1] = (triangle.B[0] * values[0] + triangle.B[1] * values[1] + triangle.B[2] * values[2]) * invArea;
+        plane[2] = (triangle.C[0] * values[0] + triangle.C[1] * values[1] + triangle.C[2] * values[2]) * invArea;
+    }
+
+    uint32_t shade(const Material& material, GLfloat u, GLfloat v) const
+    {
+        glm::vec3 color = sample(*material.TextureA, u, v);
+        if (material.TextureB != material.TextureA)
+            color = glm::mix(color, sample(*material.TextureB, u, v), material.Blend);
+        return pack(color);
+    }
+
+    // Rasterises the part of a triangle inside the tile starting at (tileX, tileY)
+    void rasterizeTriangle(const Triangle& t, int tileX, int tileY)
+    {
+        int minX = std::max(t.MinX, tileX) & ~3, maxX = std::min(t.MaxX, tileX + SOFT_TILE - 1);
+        int minY = std::max(t.MinY, tileY), maxY = std::min(t.MaxY, tileY + SOFT_TILE - 1);
+        const Material& material = this->Materials[t.Material];
+        for (int y = minY; y <= maxY; y++)
+        {
+            uint32_t* colorRow = &this->Color[size_t(y) * this->Stride];
+            GLfloat* depthRow = &this->Depth[size_t(y) * this->Stride];
+            GLfloat py = y + 0.5f;
+#ifdef SOFT_RASTER_SSE
+            __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+            __m128 zero = _mm_setzero_ps();
+            for (int x = minX; x <= maxX; x += 4)
+            {
+                __m128 px = _mm_add_ps(_mm_set1_ps(GLfloat(x)), offsets);
+                __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.A[0]), px), _mm_set1_ps(t.B[0] * py + t.C[0])), zero);
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.A[1]), px), _mm_set1_ps(t.B[1] * py + t.C[1])), zero));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.A[2]), px), _mm_set1_ps(t.B[2] * py + t.C[2])), zero));
+                if (_mm_movemask_ps(inside) == 0)
+                    continue;
+                __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.Z[0]), px), _mm_set1_ps(t.Z[1] * py + t.Z[2]));
+                __m128 old = _mm_loadu_ps(depthRow + x);
+                __m128 pass = _mm_and_ps(inside, _mm_cmplt_ps(z, old));
+                int mask = _mm_movemask_ps(pass);
+                if (mask == 0)
+                    continue;
+                _mm_storeu_ps(depthRow + x, _mm_or_ps(_mm_and_ps(pass, z), _mm_andnot_ps(pass, old)));
+
+                // Perspective correct texture coordinates for the lanes that passed
+                __m128 invW = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.InvW[0]), px), _mm_set1_ps(t.InvW[1] * py + t.InvW[2]));
+                __m128 w = _mm_div_ps(_mm_set1_ps(1.0f), invW);
+                __m128 u = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.U[0]), px), _mm_set1_ps(t.U[1] * py + t.U[2])), w);
+                __m128 v = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.V[0]), px), _mm_set1_ps(t.V[1] * py + t.V[2])), w);
+                alignas(16) GLfloat us[4], vs[4];
+                _mm_store_ps(us, u);
+                _mm_store_ps(vs, v);
+                for (int lane = 0; lane < 4; lane++)
+                    if (mask & (1 << lane))
+                        colorRow[x + lane] = this->shade(material, us[lane], vs[lane]);
+            }
+#else
+            for (int x = minX; x <= maxX; x++)
+            {
+                GLfloat px = x + 0.5f;
+                if (t.A[0] * px + t.B[0] * py + t.C[0] < 0.0f || t.A[1] * px + t.B[1] * py + t.C[1] < 0.0f ||
+                    t.A[2] * px + t.B[2] * py + t.C[2] < 0.0f)
+                    continue;
+                GLfloat z = t.Z[0] * px + t.Z[1] * py + t.Z[2];
+                if (z >= depthRow[x])
+                    continue;
+                depthRow[x] = z;
+                GLfloat w = 1.0f / (t.InvW[0] * px + t.InvW[1] * py + t.InvW[2]);
+                colorRow[x] = this->shade(material, (t.U[0] * px + t.U[1] * py + t.U[2]) * w,
+                                          (t.V[0] * px + t.V[1] * py + t.V[2]) * w);
+            }
+#endif
+        }
+    }
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+// Std. Includes
+#include <cstddef>
+#include <algorithm>
+
+// GL Includes
+#include <GL/glew.h>
+
+#include "resource_registry.h"
+
+
+// A GL buffer filled a slice at a time over several frames, so a large upload never stalls one
+// frame. Slices go through GL_COPY_WRITE_BUFFER, which leaves the bindings of any VAO untouched.
+class StagedBuffer
+{
+public:
+    GLuint Buffer;
+
+    StagedBuffer() : Buffer(0), Data(NULL), Size(0), Uploaded(0) {}
+
+    // Creates the buffer storage, registered under label. The data is read by later Steps and
+    // must stay alive until Done.
+    void Begin(const void* data, size_t size, GLenum usage = GL_STATIC_DRAW, const char* label = "staged buffer")
+    {
+        this->Data = static_cast<const char*>(data);
+        this->Size = size;
+        this->Uploaded = 0;
+        glGenBuffers(1, &this->Buffer);
+        Resources().Created(RESOURCE_BUFFER, this->Buffer, label, size);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, this->Buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, usage);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    // Uploads at most budget bytes and takes them off the budget. Returns true once complete.
+    bool Step(size_t& budget)
+    {
+        size_t slice = std::min(budget, this->Size - this->Uploaded);
+        if (slice > 0)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, this->Buffer);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, this->Uploaded, slice, this->Data + this->Uploaded);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            this->Uploaded += slice;
+            budget -= slice;
+        }
+        return this->Done();
+    }
+
+    bool Done() const
+    {
+        return this->Uploaded == this->Size;
+    }
+
+private:
+    const char* Data;
+    size_t Size;
+    size_t Uploaded;
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <algorithm>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "heightmap.h"
+
+
+// Quads along each side of a terrain chunk
+const int TERRAIN_CHUNK_SIZE = 64;
+
+// A square block of the terrain that is culled and drawn as one index range
+struct TerrainChunk
+{
+    GLuint FirstIndex;
+    GLuint IndexCount;
+    // Model space bounds
+    glm::vec3 BoundsMin;
+    glm::vec3 BoundsMax;
+};
+
+// Indexed mesh of a height map. Every sample is stored once and the index buffer is grouped by
+// chunk, so any set of chunks can be drawn straight out of the same buffers.
+struct TerrainMesh
+{
+    std::vector<GLfloat> Vertices;   // x y z s t per height sample
+    std::vector<GLuint> Indices;     // two triangles per quad
+    std::vector<TerrainChunk> Chunks;
+
+    GLuint VertexCount() const
+    {
+        return GLuint(this->Vertices.size() / 5);
+    }
+};
+
+// Builds the chunked terrain mesh. Triangles keep the winding of the original per-quad mesh.
+inline TerrainMesh BuildTerrainMesh(const Heightmap& heightmap, int chunkSize = TERRAIN_CHUNK_SIZE)
+{
+    TerrainMesh mesh;
+    // Vertices are filled in a decoded tile of the heightmap at a time, bypassing its cache
+    mesh.Vertices.resize(size_t(heightmap.Width) * heightmap.Height * 5);
+    const HeightTiles& tiles = *heightmap.Tiles;
+    std::vector<GLfloat> tile(HEIGHT_TILE_SIZE * HEIGHT_TILE_SIZE);
+    for (int ty = 0; ty < tiles.TilesY; ty++)
+    {
+        for (int tx = 0; tx < tiles.TilesX; tx++)
+        {
+            int tileWidth, tileHeight;
+            tiles.TileSize(tx, ty, tileWidth, tileHeight);
+            tiles.DecodeTile(tx, ty, tile.data());
+            for (int i = 0; i < tileHeight; i++)
+            {
+                for (int j = 0; j < tileWidth; j++)
+                {
+                    int row = ty * HEIGHT_TILE_SIZE + i, col = tx * HEIGHT_TILE_SIZE + j;
+                    glm::vec3 position = heightmap.Position(row, col, tile[i * HEIGHT_TILE_SIZE + j]);
+                    glm::vec2 coords = heightmap.TexCoord(row, col);
+                    GLfloat* vertex = &mesh.Vertices[(size_t(row) * heightmap.Width + col) * 5];
+                    vertex[0] = position.x;
+                    vertex[1] = position.y;
+                    vertex[2] = position.z;
+                    vertex[3] = coords.x;
+                    vertex[4] = coords.y;
+                }
+            }
+        }
+    }
+    auto vertexAt = [&](int row, int col)
+    {
+        const GLfloat* vertex = &mesh.Vertices[(size_t(row) * heightmap.Width + col) * 5];
+        return glm::vec3(vertex[0], vertex[1], vertex[2]);
+    };
+
+    mesh.Indices.reserve(size_t(heightmap.Width - 1) * (heightmap.Height - 1) * 6);
+    for (int row0 = 0; row0 < heightmap.Height - 1; row0 += chunkSize)
+    {
+        for (int col0 = 0; col0 < heightmap.Width - 1; col0 += chunkSize)
+        {
+            int row1 = std::min(row0 + chunkSize, heightmap.Height - 1);
+            int col1 = std::min(col0 + chunkSize, heightmap.Width - 1);
+            TerrainChunk chunk;
+            chunk.FirstIndex = GLuint(mesh.Indices.size());
+            chunk.BoundsMin = chunk.BoundsMax = vertexAt(row0, col0);
+            for (int i = row0; i < row1; i++)
+            {
+                for (int j = col0; j < col1; j++)
+                {
+                    GLuint v00 = i * heightmap.Width + j;
+                    GLuint v10 = v00 + heightmap.Width;
+                    // Triangle1
+                    mesh.Indices.push_back(v00);
+                    mesh.Indices.push_back(v10);
+                    mesh.Indices.push_back(v10 + 1);
+                    // Triangle2
+                    mesh.Indices.push_back(v10 + 1);
+                    mesh.Indices.push_back(v00 + 1);
+                    mesh.Indices.push_back(v00);
+                }
+            }
+            for (int i = row0; i <= row1; i++)
+            {
+                for (int j = col0; j <= col1; j++)
+                {
+                    chunk.BoundsMin = glm::min(chunk.BoundsMin, vertexAt(i, j));
+                    chunk.BoundsMax = glm::max(chunk.BoundsMax, vertexAt(i, j));
+                }
+            }
+            chunk.IndexCount = GLuint(mesh.Indices.size()) - chunk.FirstIndex;
+            mesh.Chunks.push_back(chunk);
+        }
+    }
+    return mesh;
+}
@@ -0,0 +1,10 @@
+#version 400 core
+layout (location = 0) in vec2 position;
+
+out vec2 ControlPos;
+
+void main()
+{
+    // Patch corners in model space x z, the height comes in the evaluation stage
+    ControlPos = position;
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+// Std. Includes
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define TERRAIN_NOISE_SSE 1
+#endif
+
+// Octaves of the height and of the warp applied to its coordinates
+const int TERRAIN_NOISE_OCTAVES = 6;
+const int TERRAIN_NOISE_WARP_OCTAVES = 3;
+
+
+// Heights for procedural terrain: fractal Brownian motion of gradient noise, on coordinates
+// warped by two more fBm fields so ridges bend and valleys meander. Samples are addressed by
+// integer column and row, so two tiles that share an edge compute exactly the same values
+// there, and the output depends on nothing but the seed.
+//
+// Four samples are computed at once, in SSE2 registers when the compiler has them and in
+// plain arrays otherwise. Both run the same operations in the same order.
+class TerrainNoise
+{
+public:
+    uint32_t Seed;
+    // Noise coordinates per sample: the largest features span about 1 / Frequency samples
+    float Frequency;
+    // How far the warp moves coordinates, in noise units
+    float Warp;
+
+    explicit TerrainNoise(uint32_t seed = 1) : Seed(seed), Frequency(1.0f / 384.0f), Warp(1.2f) {}
+
+    // Heights in [0,1] of count samples of a row, from column onwards
+    void Row(int column, int row, int count, float* out) const
+    {
+        for (int j = 0; j < count; j += 4)
+        {
+            float x[4], heights[4];
+            for (int k = 0; k < 4; k++)
+                x[k] = float(column + j + k) * this->Frequency;
+            store(heights, this->height(load(x), set(float(row) * this->Frequency)));
+            memcpy(out + j, heights, std::min(4, count - j) * sizeof(float));
+        }
+    }
+
+private:
+#ifdef TERRAIN_NOISE_SSE
+    typedef __m128 Float4;
+    typedef __m128i Int4;
+
+    static Float4 load(const float* v) { return _mm_loadu_ps(v); }
+    static void store(float* v, Float4 a) { _mm_storeu_ps(v, a); }
+    static Float4 set(float v) { return _mm_set1_ps(v); }
+    static Int4 seti(int32_t v) { return _mm_set1_epi32(v); }
+    static Float4 add(Float4 a, Float4 b) { return _mm_add_ps(a, b); }
+    static Float4 sub(Float4 a, Float4 b) { return _mm_sub_ps(a, b); }
+    static Float4 mul(Float4 a, Float4 b) { return _mm_mul_ps(a, b); }
+    static Float4 clamp01(Float4 a) { return _mm_min_ps(_mm_max_ps(a, _mm_setzero_ps()), _mm_set1_ps(1.0f)); }
+    static Int4 addi(Int4 a, Int4 b) { return _mm_add_epi32(a, b); }
+    static Int4 xori(Int4 a, Int4 b) { return _mm_xor_si128(a, b); }
+    static Int4 shr(Int4 a, int bits) { return _mm_srli_epi32(a, bits); }
+    static Float4 tofloat(Int4 a) { return _mm_cvtepi32_ps(a); }
+
+    // Low 32 bits of the products, SSE2 only multiplies the even lanes at a time
+    static Int4 mullo(Int4 a, Int4 b)
+    {
+        __m128i even = _mm_mul_epu32(a, b);
+        __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+        return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+    }
+
+    static Int4 floori(Float4 a)
+    {
+        __m128i truncated = _mm_cvttps_epi32(a);
+        // Truncation rounds negative values up, the comparison mask is -1 where it did
+        return _mm_add_epi32(truncated, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(truncated), a)));
+    }
+
+    // Negates the lanes whose given bit of h is set
+    static Float4 negateBy(Float4 a, Int4 h, int bit)
+    {
+        return _mm_xor_ps(a, _mm_castsi128_ps(_mm_slli_epi32(_mm_srli_epi32(h, bit), 31)));
+    }
+#else
+    struct Float4 { float V[4]; };
+    struct Int4 { uint32_t V[4]; };
+
+#define TERRAIN_NOISE_LANES(result, expression) for (int k = 0; k < 4; k++) result.V[k] = expression; return result
+    static Float4 load(const float* v) { Float4 r; TERRAIN_NOISE_LANES(r, v[k]); }
+    static void store(float* v, Float4 a) { memcpy(v, a.V, sizeof(a.V)); }
+    static Float4 set(float v) { Float4 r; TERRAIN_NOISE_LANES(r, v); }
+    static Int4 seti(int32_t v) { Int4 r; TERRAIN_NOISE_LANES(r, uint32_t(v)); }
+    static Float4 add(Float4 a, Float4 b) { Float4 r; TERRAIN_NOISE_LANES(r, a.V[k] + b.V[k]); }
+    static Float4 sub(Float4 a, Float4 b) { Float4 r; TERRAIN_NOISE_LANES(r, a.V[k] - b.V[k]); }
+    static Float4 mul(Float4 a, Float4 b) { Float4 r; TERRAIN_NOISE_LANES(r, a.V[k] * b.V[k]); }
+    static Float4 clamp01(Float4 a) { Float4 r; TERRAIN_NOISE_LANES(r, std::min(std::max(a.V[k], 0.0f), 1.0f)); }
+    static Int4 addi(Int4 a, Int4 b) { Int4 r; TERRAIN_NOISE_LANES(r, a.V[k] + b.V[k]); }
+    static Int4 xori(Int4 a, Int4 b) { Int4 r; TERRAIN_NOISE_LANES(r, a.V[k] ^ b.V[k]); }
+    static Int4 shr(Int4 a, int bits) { Int4 r; TERRAIN_NOISE_LANES(r, a.V[k] >> bits); }
+    static Float4 tofloat(Int4 a) { Float4 r; TERRAIN_NOISE_LANES(r, float(int32_t(a.V[k]))); }
+    static Int4 mullo(Int4 a, Int4 b) { Int4 r; TERRAIN_NOISE_LANES(r, a.V[k] * b.V[k]); }
+    static Int4 floori(Float4 a)
+    {
+        Int4 r;
+        for (int k = 0; k < 4; k++)
+        {
+            int32_t truncated = int32_t(a.V[k]);
+            r.V[k] = uint32_t(truncated - (float(truncated) > a.V[k] ? 1 : 0));
+        }
+        return r;
+    }
+    static Float4 negateBy(Float4 a, Int4 h, int bit)
+    {
+        Float4 r;
+        for (int k = 0; k < 4; k++)
+            r.V[k] = (h.V[k] >> bit) & 1 ? -a.V[k] : a.V[k];
+        return r;
+    }
+#undef TERRAIN_NOISE_LANES
+#endif
+
+    // Hash of a lattice point, any change of a coordinate or the seed changes every bit
+    static Int4 hash(Int4 x, Int4 y, Int4 seed)
+    {
+        Int4 h = xori(seed, mullo(x, seti(0x27d4eb2d)));
+        h = xori(h, mullo(y, seti(0x165667b1)));
+        h = xori(h, shr(h, 15));
+        h = mullo(h, seti(0x2c1b3c6d));
+        return xori(h, shr(h, 12));
+    }
+
+    // Dot product of the offset with one of the four diagonal gradients picked by the hash
+    static Float4 gradient(Int4 h, Float4 x, Float4 y)
+    {
+        return add(negateBy(x, h, 0), negateBy(y, h, 1));
+    }
+
+    static Float4 fade(Float4 t)
+    {
+        // t^3 (t (6t - 15) + 10)
+        Float4 inner = add(mul(t, sub(mul(t, set(6.0f)), set(15.0f))), set(10.0f));
+        return mul(mul(mul(t, t), t), inner);
+    }
+
+    // Gradient noise, roughly in [-1,1]
+    static Float4 noise(Float4 x, Float4 y, Int4 seed)
+    {
+        Int4 ix = floori(x), iy = floori(y);
+        Float4 fx = sub(x, tofloat(ix)), fy = sub(y, tofloat(iy));
+        Int4 ix1 = addi(ix, seti(1)), iy1 = addi(iy, seti(1));
+        Float4 fx1 = sub(fx, set(1.0f)), fy1 = sub(fy, set(1.0f));
+        Float4 n00 = gradient(hash(ix, iy, seed), fx, fy);
+        Float4 n10 = gradient(hash(ix1, iy, seed), fx1, fy);
+        Float4 n01 = gradient(hash(ix, iy1, seed), fx, fy1);
+        Float4 n11 = gradient(hash(ix1, iy1, seed), fx1, fy1);
+        Float4 u = fade(fx), v = fade(fy);
+        Float4 bottom = add(n00, mul(u, sub(n10, n00)));
+        Float4 top = add(n01, mul(u, sub(n11, n01)));
+        return add(bottom, mul(v, sub(top, bottom)));
+    }
+
+    // Octaves of noise at doubling frequencies and halving amplitudes, each with its own seed
+    Float4 fbm(Float4 x, Float4 y, int octaves, uint32_t seed) const
+    {
+        Float4 sum = set(0.0f);
+        float amplitude = 0.5f;
+        for (int o = 0; o < octaves; o++)
+        {
+            sum = add(sum, mul(set(amplitude), noise(x, y, seti(int32_t(seed + o * 0x9e3779b9u)))));
+            x = add(x, x);
+            y = add(y, y);
+            amplitude *= 0.5f;
+        }
+        return sum;
+    }
+
+    Float4 height(Float4 x, Float4 y) const
+    {
+        Float4 warpX = fbm(x, y, TERRAIN_NOISE_WARP_OCTAVES, this->Seed ^ 0x68bc21ebu);
+        Float4 warpY = fbm(x, y, TERRAIN_NOISE_WARP_OCTAVES, this->Seed ^ 0x02e5be93u);
+        x = add(x, mul(set(this->Warp), warpX));
+        y = add(y, mul(set(this->Warp), warpY));
+        return clamp01(add(set(0.5f), mul(set(0.9f), fbm(x, y, TERRAIN_NOISE_OCTAVES, this->Seed))));
+    }
+};
@@ -0,0 +1,239 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "heightmap.h"
+#include "frustum.h"
+#include "shader_cache.h"
+#include "resource_registry.h"
+
+// Patches along each side of the terrain
+const int TESSELLATION_PATCHES = 64;
+// Target length of a tessellated edge on screen, in pixels
+const GLfloat TESSELLATION_EDGE_PIXELS = 8.0f;
+
+
+// CPU side inputs of the tessellated terrain. Only touches the CPU, so it may be built on any thread.
+struct TessellationData
+{
+    int Width, Height;
+    // The height samples, uploaded as they are into a float texture
+    std::vector<GLfloat> Samples;
+    // Per patch: standard deviation, lowest and highest sample
+    int Patches;
+    std::vector<glm::vec3> PatchStats;
+
+    TessellationData() : Width(0), Height(0), Patches(0) {}
+};
+
+
+// Terrain drawn from a coarse grid of GL_PATCHES. The tessellation control shader picks every edge
+// factor from the edge's projected length and the height variance of the patches next to it, and
+// the evaluation shader displaces the generated vertices from a height texture. Patches outside the
+// frustum get a factor of 0 and are dropped. Needs GL 4.0.
+//
+// Only the patch grid and two textures live on the GPU, so no full resolution mesh is needed.
+class TessellatedTerrain
+{
+public:
+    TessellatedTerrain() : VAO(0), VBO(0), EBO(0), HeightTexture(0), StatsTexture(0), PatchCount(0),
+                           Shaders(NULL), ShaderGeneration(0)
+    {
+        this->Programs[0] = this->Programs[1] = 0;
+    }
+
+    // Deletes the GL objects, must run while the context is still current
+    void Release()
+    {
+        if (this->VAO == 0)
+            return;
+        GLuint buffers[] = { this->VBO, this->EBO };
+        GLuint textures[] = { this->HeightTexture, this->StatsTexture };
+        Resources().Deleted(RESOURCE_VERTEX_ARRAY, this->VAO);
+        Resources().Deleted(RESOURCE_BUFFER, 2, buffers);
+        Resources().Deleted(RESOURCE_TEXTURE, 2, textures);
+        glDeleteVertexArrays(1, &this->VAO);
+        glDeleteBuffers(2, buffers);
+        glDeleteTextures(2, textures);
+        this->VAO = 0;
+    }
+
+    static TessellationData Build(const Heightmap& heightmap)
+    {
+        TessellationData data;
+        if (heightmap.Width < 2 || heightmap.Height < 2)
+            return data;
+        data.Width = heightmap.Width;
+        data.Height = heightmap.Height;
+        heightmap.Decode(data.Samples);
+        data.Patches = std::min(TESSELLATION_PATCHES, std::min(heightmap.Width, heightmap.Height) - 1);
+        data.PatchStats.resize(data.Patches * data.Patches);
+        for (int pi = 0; pi < data.Patches; pi++)
+        {
+            int row0 = pi * (heightmap.Height - 1) / data.Patches, row1 = (pi + 1) * (heightmap.Height - 1) / data.Patches;
+            for (int pj = 0; pj < data.Patches; pj++)
+            {
+                int col0 = pj * (heightmap.Width - 1) / data.Patches, col1 = (pj + 1) * (heightmap.Width - 1) / data.Patches;
+                GLfloat lowest = 1.0f, highest = 0.0f;
+                double sum = 0.0, sumSquares = 0.0;
+                for (int i = row0; i <= row1; i++)
+                {
+                    for (int j = col0; j <= col1; j++)
+                    {
+                        GLfloat h = data.Samples[size_t(i) * data.Width + j];
+                        lowest = std::min(lowest, h);
+                        highest = std::max(highest, h);
+                        sum += h;
+                        sumSquares += double(h) * h;
+                    }
+                }
+                double count = double(row1 - row0 + 1) * (col1 - col0 + 1);
+                double mean = sum / count;
+                GLfloat deviation = GLfloat(std::sqrt(std::max(0.0, sumSquares / count - mean * mean)));
+                data.PatchStats[pi * data.Patches + pj] = glm::vec3(deviation, lowest, highest);
+            }
+        }
+        return data;
+    }
+
+    // Creates the patch grid and the textures, replacing any previous ones
+    void Upload(const TessellationData& data, ShaderCache& shaderCache)
+    {
+        this->Release();
+        this->Shaders = &shaderCache;
+        this->ShaderGeneration = shaderCache.Generation;
+        this->Programs[0] = this->program(SINGLE_TEXTURE);
+        this->Programs[1] = this->program(LIT_TERRAIN);
+        this->PatchCount = data.Patches;
+        if (data.Patches == 0)
+            return;
+
+        // Grid corners in model space x z, the patch edges follow the sample rows and columns
+        std::vector<GLfloat> corners;
+        for (int pi = 0; pi <= data.Patches; pi++)
+        {
+            for (int pj = 0; pj <= data.Patches; pj++)
+            {
+                int row = pi * (data.Height - 1) / data.Patches, col = pj * (data.Width - 1) / data.Patches;
+                corners.push_back(GLfloat(col) / GLfloat(data.Width - 1) * 2.0f - 1.0f);
+                corners.push_back(GLfloat(row) / GLfloat(data.Height - 1) * 2.0f - 1.0f);
+            }
+        }
+        // Four corners per patch, row major so the control shader finds its patch from gl_PrimitiveID
+        std::vector<GLuint> indices;
+        for (int pi = 0; pi < data.Patches; pi++)
+        {
+            for (int pj = 0; pj < data.Patches; pj++)
+            {
+                GLuint v00 = pi * (data.Patches + 1) + pj, v10 = v00 + data.Patches + 1;
+                GLuint patch[] = { v00, v00 + 1, v10 + 1, v10 };
+                indices.insert(indices.end(), patch, patch + 4);
+            }
+        }
+
+        glGenVertexArrays(1, &this->VAO);
+        glGenBuffers(1, &this->VBO);
+        glGenBuffers(1, &this->EBO);
+        Resources().Created(RESOURCE_VERTEX_ARRAY, this->VAO, "tessellation patches");
+        Resources().Created(RESOURCE_BUFFER, this->VBO, "tessellation corners", sizeof(GLfloat) * corners.size());
+        Resources().Created(RESOURCE_BUFFER, this->EBO, "tessellation indices", sizeof(GLuint) * indices.size());
+        glBindVertexArray(this->VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * corners.size(), corners.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indices.size(), indices.data(), GL_STATIC_DRAW);
+        // Position attribute, x and z only
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), (GLvoid*)0);
+        glEnableVertexAttribArray(0);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glGenTextures(1, &this->HeightTexture);
+        glBindTexture(GL_TEXTURE_2D, this->HeightTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, data.Width, data.Height, 0, GL_RED, GL_FLOAT, data.Samples.data());
+        Resources().Created(RESOURCE_TEXTURE, this->HeightTexture, "tessellation heights", TextureBytes(data.Width, data.Height, 4));
+
+        glGenTextures(1, &this->StatsTexture);
+        glBindTexture(GL_TEXTURE_2D, this->StatsTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, data.Patches, data.Patches, 0, GL_RGB, GL_FLOAT, data.PatchStats.data());
+        Resources().Created(RESOURCE_TEXTURE, this->StatsTexture, "tessellation patch stats", TextureBytes(data.Patches, data.Patches, 12));
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // Draws the terrain with the given surface texture. viewport is the framebuffer size in pixels,
+    // reversedZ tells that projection comes from ReversedPerspective.
+    void Draw(const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection,
+              const glm::vec2& viewport, GLuint texture, bool litTerrain, bool reversedZ = false)
+    {
+        if (this->VAO == 0)
+            return;
+        // Pick up programs rebuilt by a shader reload
+        if (this->Shaders->Generation != this->ShaderGeneration)
+        {
+            this->ShaderGeneration = this->Shaders->Generation;
+            this->Programs[0] = this->program(SINGLE_TEXTURE);
+            this->Programs[1] = this->program(LIT_TERRAIN);
+        }
+        GLuint program = this->Programs[litTerrain ? 1 : 0];
+        if (program == 0)
+            return;
+
+        Frustum frustum(projection * view, reversedZ);
+        glUseProgram(program);
+        glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(model));
+        glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        glUniform4fv(glGetUniformLocation(program, "frustumPlanes"), 6, glm::value_ptr(frustum.Planes[0]));
+        glUniform2f(glGetUniformLocation(program, "viewportSize"), viewport.x, viewport.y);
+        glUniform1f(glGetUniformLocation(program, "edgePixels"), TESSELLATION_EDGE_PIXELS);
+        glUniform1i(glGetUniformLocation(program, "ourTexture1"), 0);
+        glUniform1i(glGetUniformLocation(program, "heightMap"), 1);
+        glUniform1i(glGetUniformLocation(program, "patchStats"), 2);
+        glUniform3f(glGetUniformLocation(program, "sunDirection"), 0.4f, 1.0f, 0.3f);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, this->HeightTexture);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, this->StatsTexture);
+
+        glBindVertexArray(this->VAO);
+        glPatchParameteri(GL_PATCH_VERTICES, 4);
+        glDrawElements(GL_PATCHES, this->PatchCount * this->PatchCount * 4, GL_UNSIGNED_INT, (GLvoid*)0);
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+private:
+    GLuint VAO, VBO, EBO;
+    GLuint HeightTexture, StatsTexture;
+    int PatchCount;
+    ShaderCache* Shaders;
+    GLuint ShaderGeneration;
+    // Unlit and lit variants
+    GLuint Programs[2];
+
+    // The fragment stage is shared with the mesh terrain
+    GLuint program(GLuint permutation)
+    {
+        return this->Shaders->Program({ { GL_VERTEX_SHADER, "shaders/terrain.vs" },
+                                        { GL_TESS_CONTROL_SHADER, "shaders/terrain.tcs" },
+                                        { GL_TESS_EVALUATION_SHADER, "shaders/terrain.tes" },
+                                        { GL_FRAGMENT_SHADER, "shaders/advanced.frag" } }, permutation);
+    }
+};
@@ -0,0 +1,152 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+// GL Includes
+#include <GL/glew.h>
+
+// Other Libs
+#include <SOIL.h>
+
+#include "resource_registry.h"
+
+
+// Decoded 8 bit image kept on the CPU, rows stored top to bottom as loaded by SOIL
+struct Image
+{
+    int Width;
+    int Height;
+    int Channels;
+    std::vector<unsigned char> Pixels;
+
+    Image() : Width(0), Height(0), Channels(0) {}
+};
+
+// Loads an image file, forcing RGB like every texture of the scene
+inline bool LoadImageFile(const char* path, Image& image)
+{
+    unsigned char* data = SOIL_load_image(path, &image.Width, &image.Height, 0, SOIL_LOAD_RGB);
+    if (!data)
+    {
+        std::cout << "ERROR::TEXTURE::LOAD_FAILED " << path << std::endl;
+        image = Image();
+        return false;
+    }
+    image.Channels = 3;
+    image.Pixels.assign(data, data + size_t(image.Width) * image.Height * 3);
+    SOIL_free_image_data(data);
+    return true;
+}
+
+// Bilinear resample of an image to a new size
+inline Image ResampleImage(const Image& image, int width, int height)
+{
+    Image result;
+    result.Width = width;
+    result.Height = height;
+    result.Channels = image.Channels;
+    result.Pixels.resize(size_t(width) * height * image.Channels);
+    if (image.Width == width && image.Height == height)
+    {
+        result.Pixels = image.Pixels;
+        return result;
+    }
+    for (int y = 0; y < height; y++)
+    {
+        float sy = std::max(0.0f, (y + 0.5f) * image.Height / height - 0.5f);
+        int y0 = std::min(int(sy), image.Height - 1);
+        int y1 = std::min(y0 + 1, image.Height - 1);
+        float fy = sy - y0;
+        for (int x = 0; x < width; x++)
+        {
+            float sx = std::max(0.0f, (x + 0.5f) * image.Width / width - 0.5f);
+            int x0 = std::min(int(sx), image.Width - 1);
+            int x1 = std::min(x0 + 1, image.Width - 1);
+            float fx = sx - x0;
+            for (int c = 0; c < image.Channels; c++)
+            {
+                float p00 = image.Pixels[(size_t(y0) * image.Width + x0) * image.Channels + c];
+                float p01 = image.Pixels[(size_t(y0) * image.Width + x1) * image.Channels + c];
+                float p10 = image.Pixels[(size_t(y1) * image.Width + x0) * image.Channels + c];
+                float p11 = image.Pixels[(size_t(y1) * image.Width + x1) * image.Channels + c];
+                float top = p00 + (p01 - p00) * fx;
+                float bottom = p10 + (p11 - p10) * fx;
+                result.Pixels[(size_t(y) * width + x) * image.Channels + c] = (unsigned char)(top + (bottom - top) * fy + 0.5f);
+            }
+        }
+    }
+    return result;
+}
+
+// Sets the clamp/linear parameters every texture of the scene uses
+inline void SetTextureParameters(GLenum target)
+{
+    // Set our texture parameters
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);	// Set texture wrapping to GL_CLAMP_TO_EDGE
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    // Set texture filtering
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+// Creates a 2D texture from an RGB image and generates its mipmaps
+inline GLuint CreateTexture2D(const Image& image)
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    SetTextureParameters(GL_TEXTURE_2D);
+    // RGB rows are not 4 byte aligned for every width
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image.Width, image.Height, 0, GL_RGB, GL_UNSIGNED_BYTE, image.Pixels.data());
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    Resources().Created(RESOURCE_TEXTURE, texture, "image", TextureBytes(image.Width, image.Height, 4, true));
+    return texture;
+}
+
+// Packs RGB images into the layers of a 2D texture array. Layers must share one size, so every
+// image is resampled to the largest width and height among them (capped at maxSize).
+inline GLuint CreateTextureArray(const std::vector<const Image*>& images, int maxSize = 2048)
+{
+    int width = 1, height = 1;
+    for (const Image* image : images)
+    {
+        width = std::max(width, image->Width);
+        height = std::max(height, image->Height);
+    }
+    width = std::min(width, maxSize);
+    height = std::min(height, maxSize);
+    int levels = 1;
+    while ((std::max(width, height) >> levels) > 0)
+        levels++;
+
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    SetTextureParameters(GL_TEXTURE_2D_ARRAY);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGB8, width, height, GLsizei(images.size()));
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (size_t layer = 0; layer < images.size(); layer++)
+    {
+        Image resampled = ResampleImage(*images[layer], width, height);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, GLint(layer), width, height, 1, GL_RGB, GL_UNSIGNED_BYTE, resampled.Pixels.data());
+    }
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    Resources().Created(RESOURCE_TEXTURE, texture, "image array", TextureBytes(width, height, 4, true, int(images.size())));
+    return texture;
+}
+
+// Replaces one layer of a texture array with an image already resampled to the layer size
+inline void UpdateTextureArrayLayer(GLuint texture, GLint layer, const Image& image)
+{
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, image.Width, image.Height, 1, GL_RGB, GL_UNSIGNED_BYTE, image.Pixels.data());
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <algorithm>
+#include <memory>
+
+
+// A fixed set of worker threads shared by the CPU side systems of the viewer
+class ThreadPool
+{
+public:
+    // Uses every core but one, the calling thread takes part in ParallelFor
+    explicit ThreadPool(unsigned threads = 0) : Stopping(false)
+    {
+        if (threads == 0)
+        {
+            // hardware_concurrency may not know and return 0, one worker then
+            unsigned cores = std::thread::hardware_concurrency();
+            threads = cores > 1 ? cores - 1 : 1;
+        }
+        for (unsigned i = 0; i < threads; i++)
+            this->Workers.emplace_back([this] { this->workerLoop(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->Mutex);
+            this->Stopping = true;
+        }
+        this->Wake.notify_all();
+        for (std::thread& worker : this->Workers)
+            worker.join();
+    }
+
+    // Number of worker threads, not counting the caller
+    unsigned Size() const
+    {
+        return unsigned(this->Workers.size());
+    }
+
+    // Queues a task to run on a worker
+    void Submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->Mutex);
+            this->Tasks.push_back(std::move(task));
+        }
+        this->Wake.notify_one();
+    }
+
+    // Runs body(i) for every i in [0,count) on the workers and the calling thread, and returns
+    // once all of them are done. Indices are handed out one at a time, so uneven items balance.
+    void ParallelFor(int count, const std::function<void(int)>& body)
+    {
+        if (count <= 0)
+            return;
+        struct Job
+        {
+            std::atomic<int> Next;
+            std::atomic<int> Done;
+        };
+        auto job = std::make_shared<Job>();
+        job->Next = 0;
+        job->Done = 0;
+        auto run = [job, count, &body]
+        {
+            for (int i = job->Next++; i < count; i = job->Next++)
+            {
+                body(i);
+                job->Done++;
+            }
+        };
+        int helpers = std::min<int>(count - 1, int(this->Workers.size()));
+        for (int h = 0; h < helpers; h++)
+            this->Submit(run);
+        run();
+        // Items still running on workers; they never wait on the caller so spinning is safe
+        while (job->Done.load() < count)
+            std::this_thread::yield();
+    }
+
+private:
+    std::vector<std::thread> Workers;
+    std::deque<std::function<void()>> Tasks;
+    std::mutex Mutex;
+    std::condition_variable Wake;
+    bool Stopping;
+
+    void workerLoop()
+    {
+        for (;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(this->Mutex);
+                this->Wake.wait(lock, [this] { return this->Stopping || !this->Tasks.empty(); });
+                if (this->Stopping && this->Tasks.empty())
+                    return;
+                task = std::move(this->Tasks.front());
+                this->Tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
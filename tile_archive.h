@@ -0,0 +1,250 @@
+#pragma once
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+// Samples along the side of a tile, not counting the row and column shared with the next tile
+const int TILE_ARCHIVE_TILE = 256;
+
+
+// A tile archive holds a height raster as a pyramid of tiles. Level 0 is the full raster, every
+// level above keeps every other sample of the one below, so tile corners line up across levels.
+// Tiles are TILE_ARCHIVE_TILE + 1 samples square, sharing their last row and column with their
+// neighbours, and smaller along the right and bottom edges. Each tile is stored as 16 bit steps
+// between its own lowest and highest sample.
+//
+// File: header, tiles in any order, then the index of every tile at IndexOffset.
+struct TileArchiveHeader
+{
+    char Magic[4];
+    uint32_t Version;
+    uint32_t Width, Height;
+    uint32_t TileSize, Levels;
+    // Range of the source values, the viewer rescales it to [0,1]
+    float Min, Max;
+    uint64_t IndexOffset;
+    uint32_t TileCount, Reserved;
+};
+
+struct TileInfo
+{
+    uint32_t Level, X, Y;
+    uint32_t Width, Height;
+    float Min, Max;
+    // Largest height difference between the samples of the level below and this tile's
+    // surface, or any of its descendants'. 0 on level 0.
+    float Error;
+    uint64_t Offset;
+};
+
+// Order of the index: by level, then row, then column
+inline bool TileOrder(const TileInfo& a, const TileInfo& b)
+{
+    return a.Level != b.Level ? a.Level < b.Level : (a.Y != b.Y ? a.Y < b.Y : a.X < b.X);
+}
+
+inline uint64_t TileKey(uint32_t level, uint32_t x, uint32_t y)
+{
+    return (uint64_t(level) << 48) | (uint64_t(y) << 24) | x;
+}
+
+// Size of a level of the pyramid. Level n + 1 has sample j at sample min(2j, size - 1) of level n.
+inline uint32_t TileArchiveLevelSize(uint32_t size, int level)
+{
+    for (int l = 0; l < level; l++)
+        size = size <= 1 ? 1 : size / 2 + 1;
+    return size;
+}
+
+// Tiles along one side of a level
+inline uint32_t TileArchiveTiles(uint32_t size, uint32_t tileSize)
+{
+    return size <= 1 ? 1 : (size - 2) / tileSize + 1;
+}
+
+
+// Writes an archive. Tiles may be added from several threads at once.
+class TileArchiveWriter
+{
+public:
+    bool Open(const std::string& path, uint32_t width, uint32_t height, uint32_t levels)
+    {
+        this->File.open(path, std::ios::binary | std::ios::trunc);
+        if (!this->File)
+        {
+            std::cout << "ERROR::TILE_ARCHIVE::NOT_WRITTEN " << path << std::endl;
+            return false;
+        }
+        memset(&this->Header, 0, sizeof(this->Header));
+        memcpy(this->Header.Magic, "HMTA", 4);
+        this->Header.Version = 1;
+        this->Header.Width = width;
+        this->Header.Height = height;
+        this->Header.TileSize = TILE_ARCHIVE_TILE;
+        this->Header.Levels = levels;
+        this->File.write(reinterpret_cast<const char*>(&this->Header), sizeof(this->Header));
+        this->End = sizeof(this->Header);
+        return true;
+    }
+
+    // Quantises and appends one tile of width x height samples
+    void Add(TileInfo info, const float* samples)
+    {
+        size_t count = size_t(info.Width) * info.Height;
+        float lowest = samples[0], highest = samples[0];
+        for (size_t i = 1; i < count; i++)
+        {
+            lowest = std::min(lowest, samples[i]);
+            highest = std::max(highest, samples[i]);
+        }
+        info.Min = lowest;
+        info.Max = highest;
+        float step = highest > lowest ? 65535.0f / (highest - lowest) : 0.0f;
+        std::vector<uint16_t> quantised(count);
+        for (size_t i = 0; i < count; i++)
+            quantised[i] = uint16_t((samples[i] - lowest) * step + 0.5f);
+
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        info.Offset = this->End;
+        this->File.write(reinterpret_cast<const char*>(quantised.data()), count * sizeof(uint16_t));
+        this->End += count * sizeof(uint16_t);
+        this->Index.push_back(info);
+        this->Errors[TileKey(info.Level, info.X, info.Y)] = info.Error;
+    }
+
+    // Error of a tile already added, for its parent. 0 when it is missing.
+    float Error(uint32_t level, uint32_t x, uint32_t y)
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        auto it = this->Errors.find(TileKey(level, x, y));
+        return it == this->Errors.end() ? 0.0f : it->second;
+    }
+
+    // Writes the index and completes the header with the range of the source values, which is
+    // only known once every tile has been read
+    bool Finish(float minValue, float maxValue)
+    {
+        this->Header.Min = minValue;
+        this->Header.Max = maxValue;
+        std::sort(this->Index.begin(), this->Index.end(), TileOrder);
+        this->Header.IndexOffset = this->End;
+        this->Header.TileCount = uint32_t(this->Index.size());
+        this->File.write(reinterpret_cast<const char*>(this->Index.data()), this->Index.size() * sizeof(TileInfo));
+        this->File.seekp(0);
+        this->File.write(reinterpret_cast<const char*>(&this->Header), sizeof(this->Header));
+        this->File.close();
+        return !this->File.fail();
+    }
+
+private:
+    std::ofstream File;
+    TileArchiveHeader Header;
+    uint64_t End;
+    std::vector<TileInfo> Index;
+    std::unordered_map<uint64_t, float> Errors;
+    std::mutex Mutex;
+};
+
+
+// Reads an archive written by the preprocessor
+class TileArchive
+{
+public:
+    TileArchiveHeader Header;
+    // Sorted by level, then row, then column
+    std::vector<TileInfo> Index;
+
+    bool Open(const std::string& path)
+    {
+        this->File.open(path, std::ios::binary);
+        if (!this->File || !this->File.read(reinterpret_cast<char*>(&this->Header), sizeof(this->Header)) ||
+            memcmp(this->Header.Magic, "HMTA", 4) != 0 || this->Header.Version != 1)
+        {
+            std::cout << "ERROR::TILE_ARCHIVE::NOT_AN_ARCHIVE " << path << std::endl;
+            return false;
+        }
+        this->Index.resize(this->Header.TileCount);
+        this->File.seekg(std::streamoff(this->Header.IndexOffset));
+        if (!this->File.read(reinterpret_cast<char*>(this->Index.data()), this->Index.size() * sizeof(TileInfo)))
+        {
+            std::cout << "ERROR::TILE_ARCHIVE::INDEX_NOT_READ " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    uint32_t LevelWidth(int level) const
+    {
+        return TileArchiveLevelSize(this->Header.Width, level);
+    }
+
+    uint32_t LevelHeight(int level) const
+    {
+        return TileArchiveLevelSize(this->Header.Height, level);
+    }
+
+    const TileInfo* Find(uint32_t level, uint32_t x, uint32_t y) const
+    {
+        TileInfo key;
+        key.Level = level;
+        key.X = x;
+        key.Y = y;
+        auto it = std::lower_bound(this->Index.begin(), this->Index.end(), key, TileOrder);
+        return it != this->Index.end() && it->Level == level && it->X == x && it->Y == y ? &*it : NULL;
+    }
+
+    // Decodes one tile into source units
+    bool ReadTile(const TileInfo& info, std::vector<float>& samples)
+    {
+        size_t count = size_t(info.Width) * info.Height;
+        std::vector<uint16_t> quantised(count);
+        this->File.clear();
+        this->File.seekg(std::streamoff(info.Offset));
+        if (!this->File.read(reinterpret_cast<char*>(quantised.data()), count * sizeof(uint16_t)))
+            return false;
+        float step = (info.Max - info.Min) / 65535.0f;
+        samples.resize(count);
+        for (size_t i = 0; i < count; i++)
+            samples[i] = info.Min + quantised[i] * step;
+        return true;
+    }
+
+    // Assembles a whole level, rescaled to [0,1] over the source range
+    bool ReadLevel(int level, std::vector<float>& samples, int& width, int& height)
+    {
+        width = int(this->LevelWidth(level));
+        height = int(this->LevelHeight(level));
+        samples.assign(size_t(width) * height, 0.0f);
+        float scale = this->Header.Max > this->Header.Min ? 1.0f / (this->Header.Max - this->Header.Min) : 0.0f;
+        std::vector<float> tile;
+        for (uint32_t ty = 0; ty < TileArchiveTiles(height, this->Header.TileSize); ty++)
+        {
+            for (uint32_t tx = 0; tx < TileArchiveTiles(width, this->Header.TileSize); tx++)
+            {
+                const TileInfo* info = this->Find(level, tx, ty);
+                if (!info || !this->ReadTile(*info, tile))
+                {
+                    std::cout << "ERROR::TILE_ARCHIVE::TILE_MISSING " << level << " " << tx << " " << ty << std::endl;
+                    return false;
+                }
+                for (uint32_t i = 0; i < info->Height; i++)
+                    for (uint32_t j = 0; j < info->Width; j++)
+                        samples[size_t(ty * this->Header.TileSize + i) * width + tx * this->Header.TileSize + j] =
+                            (tile[size_t(i) * info->Width + j] - this->Header.Min) * scale;
+            }
+        }
+        return true;
+    }
+
+private:
+    std::ifstream File;
+};
@@ -0,0 +1,38 @@
+#version 330 core
+
+in vec2 TexCoord;
+
+out vec4 color;
+
+// Scene rendered into the lower left part of this texture
+uniform sampler2D scene;
+// Fraction of the texture holding the scene
+uniform vec2 renderedArea;
+// Strength of the sharpening, 0 is a plain bilinear upscale
+uniform float sharpness;
+
+vec3 fetch(vec2 uv, vec2 texel)
+{
+    // Stay inside the rendered area, the rest of the texture holds older frames
+    return texture(scene, clamp(uv, 0.5 * texel, renderedArea - 0.5 * texel)).rgb;
+}
+
+void main()
+{
+    vec2 texel = 1.0 / vec2(textureSize(scene, 0));
+    vec2 uv = TexCoord * renderedArea;
+    vec3 center = fetch(uv, texel);
+    if (sharpness > 0.0)
+    {
+        vec3 north = fetch(uv + vec2(0.0, texel.y), texel);
+        vec3 south = fetch(uv - vec2(0.0, texel.y), texel);
+        vec3 east = fetch(uv + vec2(texel.x, 0.0), texel);
+        vec3 west = fetch(uv - vec2(texel.x, 0.0), texel);
+        // Unsharp mask, clamped to the neighbourhood so edges do not ring
+        vec3 sharpened = center + (center - 0.25 * (north + south + east + west)) * sharpness;
+        vec3 lowest = min(center, min(min(north, south), min(east, west)));
+        vec3 highest = max(center, max(max(north, south), max(east, west)));
+        center = clamp(sharpened, lowest, highest);
+    }
+    color = vec4(center, 1.0);
+}
@@ -0,0 +1,285 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// GL Includes
+#include <GL/glew.h>
+
+#include "heightmap.h"
+#include "thread_pool.h"
+#include "resource_registry.h"
+
+// Padding of the rows of the transposed mask
+const int VIEWSHED_PAD = 64;
+// Lines of sight handed to one worker at a time
+const int VIEWSHED_LINE_BATCH = 256;
+
+// A line between two points over the heightmap grid, at elevations in the units of Viewshed
+struct SightLine
+{
+    GLfloat Row0, Col0, Elevation0;
+    GLfloat Row1, Col1, Elevation1;
+};
+
+
+// Which cells of the heightmap can be seen from an observer, and whether pairs of points can
+// see each other. Elevations are 1 - height, so up is up; scaling them all alike changes no
+// line of sight.
+//
+// The viewshed is swept outwards from the observer one ring of cells at a time (XDraw, Franklin
+// and Ray). The horizon a cell needs to clear is interpolated between the two cells of the ring
+// inside it that its line of sight passes between, so every cell costs a few operations instead
+// of a ray. The grid splits into eight octants that depend on nothing outside themselves, swept
+// in parallel. Octants whose rings are columns read a transposed copy of the ground so every
+// ring is a contiguous run of memory, and their results are transposed back at the end.
+class Viewshed
+{
+public:
+    int Width, Height;
+    // 255 where the terrain can be seen from the last observer, 0 elsewhere, row major
+    std::vector<uint8_t> Mask;
+    // Time taken by the last Compute
+    double Milliseconds;
+    // Mask texture for the terrain overlay, 0 until uploaded
+    GLuint Texture;
+
+    Viewshed() : Width(0), Height(0), Milliseconds(0.0), Texture(0) {}
+
+    bool Loaded() const
+    {
+        return this->Width > 0;
+    }
+
+    void Load(const Heightmap& heightmap)
+    {
+        this->Width = heightmap.Width;
+        this->Height = heightmap.Height;
+        heightmap.Decode(this->Ground);
+        for (float& sample : this->Ground)
+            sample = 1.0f - sample;
+        this->GroundT.resize(this->Ground.size());
+        transpose(this->Ground.data(), this->GroundT.data(), this->Height, this->Width);
+        this->Mask.assign(this->Ground.size(), 0);
+        this->MaskT.assign(size_t(this->Width) * (this->Height + VIEWSHED_PAD), 0);
+        Resources().CpuAllocation(this, "viewshed grids", (this->Ground.size() + this->GroundT.size()) * sizeof(float) +
+            this->Mask.size() + this->MaskT.size());
+    }
+
+    // Frees the grids and the texture
+    void Clear()
+    {
+        std::vector<float>().swap(this->Ground);
+        std::vector<float>().swap(this->GroundT);
+        std::vector<uint8_t>().swap(this->Mask);
+        std::vector<uint8_t>().swap(this->MaskT);
+        this->Width = this->Height = 0;
+        Resources().CpuAllocation(this, "viewshed grids", 0);
+        this->Release();
+    }
+
+    GLfloat Elevation(int row, int col) const
+    {
+        return this->Ground[size_t(row) * this->Width + col];
+    }
+
+    // Fills Mask with the cells seen from an eye at the given elevation above a cell; an eye
+    // below the ground is lifted onto it
+    void Compute(ThreadPool& pool, int row, int col, GLfloat eye)
+    {
+        auto start = std::chrono::steady_clock::now();
+        eye = std::max(eye, this->Elevation(row, col));
+        // Octants 0-3 sweep rows outwards, 4-7 sweep columns in the transposed grids
+        pool.ParallelFor(8, [&](int octant)
+        {
+            bool columns = octant >= 4;
+            int out = octant & 1 ? -1 : 1, side = octant & 2 ? -1 : 1;
+            if (columns)
+                this->sweep(this->GroundT.data(), this->MaskT.data(), this->Width, this->Height, this->Height + VIEWSHED_PAD, col, row, eye, out, side);
+            else
+                this->sweep(this->Ground.data(), this->Mask.data(), this->Height, this->Width, this->Width, row, col, eye, out, side);
+        });
+        // Copy back the cells the column octants own, those at least as far across as down, in
+        // 64 x 64 blocks that stay in the cache
+        int bands = (this->Height + 63) / 64;
+        size_t stride = this->Height + VIEWSHED_PAD;
+        pool.ParallelFor(bands, [&](int band)
+        {
+            int r0 = band * 64, r1 = std::min(r0 + 64, this->Height);
+            for (int c0 = 0; c0 < this->Width; c0 += 64)
+            {
+                int c1 = std::min(c0 + 64, this->Width);
+                for (int r = r0; r < r1; r++)
+                {
+                    int down = std::abs(r - row);
+                    uint8_t* maskRow = &this->Mask[size_t(r) * this->Width];
+                    const uint8_t* transposed = &this->MaskT[r];
+                    for (int c = c0; c < c1; c++)
+                        if (std::abs(c - col) >= down)
+                            maskRow[c] = transposed[c * stride];
+                }
+            }
+        });
+        this->Mask[size_t(row) * this->Width + col] = 255;
+        std::chrono::duration<double, std::milli> milliseconds = std::chrono::steady_clock::now() - start;
+        this->Milliseconds = milliseconds.count();
+    }
+
+    // Share of the cells in the last viewshed
+    double VisibleFraction() const
+    {
+        size_t seen = 0;
+        for (uint8_t cell : this->Mask)
+            seen += cell != 0;
+        return this->Mask.empty() ? 0.0 : double(seen) / this->Mask.size();
+    }
+
+    // Whether each line clears the ground between its ends, batches of lines run on the pool.
+    // The ground is interpolated between cells at steps of a cell along the line; ends off the
+    // grid are clamped onto it.
+    void LinesOfSight(ThreadPool& pool, const std::vector<SightLine>& lines, std::vector<uint8_t>& visible) const
+    {
+        visible.resize(lines.size());
+        int batches = int((lines.size() + VIEWSHED_LINE_BATCH - 1) / VIEWSHED_LINE_BATCH);
+        pool.ParallelFor(batches, [&](int batch)
+        {
+            size_t end = std::min(lines.size(), size_t(batch + 1) * VIEWSHED_LINE_BATCH);
+            for (size_t i = size_t(batch) * VIEWSHED_LINE_BATCH; i < end; i++)
+                visible[i] = this->lineOfSight(lines[i]) ? 1 : 0;
+        });
+    }
+
+    // Uploads Mask into Texture, for the VIEWSHED_OVERLAY shader variant
+    void Upload()
+    {
+        if (!this->Texture)
+        {
+            glGenTextures(1, &this->Texture);
+            Resources().Created(RESOURCE_TEXTURE, this->Texture, "viewshed mask");
+        }
+        glBindTexture(GL_TEXTURE_2D, this->Texture);
+        // Rows of an odd width are not 4 byte aligned
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, this->Width, this->Height, 0, GL_RED, GL_UNSIGNED_BYTE, this->Mask.data());
+        Resources().Resized(RESOURCE_TEXTURE, this->Texture, this->Mask.size());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // Binds the mask to texture unit 3 of a program built with VIEWSHED_OVERLAY
+    void SetUniforms(GLuint program) const
+    {
+        glUniform1i(glGetUniformLocation(program, "viewshedMask"), 3);
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_2D, this->Texture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // Deletes the texture, must run while the context is still current
+    void Release()
+    {
+        if (this->Texture)
+        {
+            Resources().Deleted(RESOURCE_TEXTURE, this->Texture);
+            glDeleteTextures(1, &this->Texture);
+        }
+        this->Texture = 0;
+    }
+
+private:
+    std::vector<float> Ground, GroundT;
+    // Mask of the column octants, transposed, with rows padded so a column of it is not a
+    // power of two stride apart
+    std::vector<uint8_t> MaskT;
+
+    static void transpose(const float* in, float* out, int rows, int cols)
+    {
+        for (int r0 = 0; r0 < rows; r0 += 64)
+            for (int c0 = 0; c0 < cols; c0 += 64)
+                for (int r = r0; r < std::min(r0 + 64, rows); r++)
+                    for (int c = c0; c < std::min(c0 + 64, cols); c++)
+                        out[size_t(c) * rows + r] = in[size_t(r) * cols + c];
+    }
+
+    // Sweeps one octant of a row major grid: rings are the rows at distance k from the observer
+    // in direction out, cells are at distance j = 0..k across it in direction side. The horizon
+    // of ring k - 1 is all a ring needs. The axis is written by the side going right only; the
+    // diagonals the row octants write are overwritten by the column octants' afterwards.
+    void sweep(const float* ground, uint8_t* mask, int rings, int across, size_t maskStride, int ring0, int cell0,
+        float eye, int out, int side)
+    {
+        int lastRing = out > 0 ? rings - 1 - ring0 : ring0;
+        int lastCell = side > 0 ? across - 1 - cell0 : cell0;
+        std::vector<float> previous(size_t(std::min(lastRing, lastCell)) + 2), current(previous.size());
+        for (int k = 1; k <= lastRing; k++)
+        {
+            const float* groundRow = ground + size_t(ring0 + out * k) * across + cell0;
+            uint8_t* maskRow = mask + (ring0 + out * k) * maskStride + cell0;
+            int cells = std::min(k, lastCell);
+            if (k == 1)
+            {
+                // Next to the observer nothing is in the way
+                for (int j = 0; j <= cells; j++)
+                {
+                    current[j] = groundRow[side * j];
+                    if (j > 0 || side > 0)
+                        maskRow[side * j] = 255;
+                }
+                previous.swap(current);
+                continue;
+            }
+            // On the axis the line of sight runs straight through cell 0 of every ring
+            float outward = float(k) / float(k - 1);
+            float sight = eye + (previous[0] - eye) * outward;
+            current[0] = std::max(groundRow[0], sight);
+            if (side > 0)
+                maskRow[0] = groundRow[0] >= sight ? 255 : 0;
+            // Elsewhere it crosses ring k - 1 at j - j / k, between cells j - 1 and j, nearer
+            // j - 1 the further across it is
+            float step = 1.0f / float(k);
+            for (int j = 1; j <= cells; j++)
+            {
+                float horizon = previous[j - 1] + float(k - j) * step * (previous[j] - previous[j - 1]);
+                float seen = eye + (horizon - eye) * outward;
+                float height = groundRow[side * j];
+                current[j] = std::max(height, seen);
+                maskRow[side * j] = height >= seen ? 255 : 0;
+            }
+            previous.swap(current);
+        }
+    }
+
+    float groundAt(float row, float col) const
+    {
+        row = std::min(std::max(row, 0.0f), float(this->Height - 1));
+        col = std::min(std::max(col, 0.0f), float(this->Width - 1));
+        int r0 = std::min(int(row), this->Height - 2), c0 = std::min(int(col), this->Width - 2);
+        float fr = row - r0, fc = col - c0;
+        const float* g = &this->Ground[size_t(r0) * this->Width + c0];
+        float top = g[0] + fc * (g[1] - g[0]);
+        float bottom = g[this->Width] + fc * (g[this->Width + 1] - g[this->Width]);
+        return top + fr * (bottom - top);
+    }
+
+    bool lineOfSight(const SightLine& line) const
+    {
+        float dr = line.Row1 - line.Row0, dc = line.Col1 - line.Col0;
+        int steps = int(std::ceil(std::max(std::abs(dr), std::abs(dc))));
+        for (int i = 1; i < steps; i++)
+        {
+            float t = float(i) / float(steps);
+            float sight = line.Elevation0 + t * (line.Elevation1 - line.Elevation0);
+            if (this->groundAt(line.Row0 + t * dr, line.Col0 + t * dc) > sight)
+                return false;
+        }
+        return true;
+    }
+};
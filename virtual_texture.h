@@ -0,0 +1,719 @@
+#pragma once
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// Other Libs
+#include <SOIL.h>
+
+#include "thread_pool.h"
+#include "shader_cache.h"
+#include "resource_registry.h"
+
+// Texels of imagery in a page, and the border copied from the neighbours so bilinear filtering
+// never reads across into another page of the cache
+const int VT_PAGE_CONTENT = 120;
+const int VT_PAGE_BORDER = 4;
+const int VT_PAGE_SIZE = VT_PAGE_CONTENT + 2 * VT_PAGE_BORDER;
+const size_t VT_PAGE_BYTES = size_t(VT_PAGE_SIZE) * VT_PAGE_SIZE * 3;
+// Pages along each side of the physical cache: 16x16 pages of 128x128 RGBA8 take 16 MB
+const int VT_CACHE_PAGES = 16;
+// The feedback pass renders at this fraction of the frame on each axis
+const int VT_FEEDBACK_DIVISOR = 8;
+// Feedback frames being read back at once
+const int VT_FEEDBACK_FRAMES = 3;
+// Page reads in flight, and pages copied into the cache per frame
+const int VT_MAX_LOADS = 64;
+const int VT_UPLOADS_PER_FRAME = 16;
+
+
+// Page file: a header, then the pages of every mip level, finest first, each level row major.
+// Level 0 spans Pages x Pages pages, a power of two, of which only those touching the image are
+// stored. Pages are RGB, VT_PAGE_SIZE square with the border included, rows in image order.
+struct PageFileHeader
+{
+    char Magic[4];
+    uint32_t Version;
+    uint32_t Width, Height;
+    uint32_t Pages, Levels;
+};
+
+// Where every page of a page file lives
+struct PageFileLayout
+{
+    int Width, Height, Pages, Levels;
+    std::vector<int> LevelWidth, LevelHeight;
+    // Stored pages of each level, and the index of the level's first page in the file
+    std::vector<int> PagesX, PagesY;
+    std::vector<uint64_t> FirstPage;
+
+    PageFileLayout() : Width(0), Height(0), Pages(0), Levels(0) {}
+
+    void Compute(int width, int height)
+    {
+        this->Width = width;
+        this->Height = height;
+        int needed = (std::max(width, height) + VT_PAGE_CONTENT - 1) / VT_PAGE_CONTENT;
+        this->Pages = 1;
+        this->Levels = 1;
+        while (this->Pages < needed)
+        {
+            this->Pages *= 2;
+            this->Levels++;
+        }
+        uint64_t first = 0;
+        int w = width, h = height;
+        for (int level = 0; level < this->Levels; level++)
+        {
+            this->LevelWidth.push_back(w);
+            this->LevelHeight.push_back(h);
+            this->PagesX.push_back((w + VT_PAGE_CONTENT - 1) / VT_PAGE_CONTENT);
+            this->PagesY.push_back((h + VT_PAGE_CONTENT - 1) / VT_PAGE_CONTENT);
+            this->FirstPage.push_back(first);
+            first += uint64_t(this->PagesX.back()) * this->PagesY.back();
+            w = std::max(1, (w + 1) / 2);
+            h = std::max(1, (h + 1) / 2);
+        }
+    }
+
+    bool Stored(int level, int x, int y) const
+    {
+        return level >= 0 && level < this->Levels && x >= 0 && y >= 0 && x < this->PagesX[level] && y < this->PagesY[level];
+    }
+
+    uint64_t Offset(int level, int x, int y) const
+    {
+        return sizeof(PageFileHeader) + (this->FirstPage[level] + uint64_t(y) * this->PagesX[level] + x) * VT_PAGE_BYTES;
+    }
+};
+
+
+// Terrain imagery far larger than any texture, streamed in pages. Every frame a small feedback
+// pass records which page and mip level each pixel of the terrain needs. Missing pages are read
+// from the page file on the thread pool and copied into a fixed physical cache texture, evicting
+// the least recently seen. A page table texture, with one mip level per page level, sends every
+// virtual page to its cache slot, or to the closest coarser page that is resident. The coarsest
+// page is always resident, so every lookup finds something to show.
+//
+// GPU memory is the cache plus a page table of 4 bytes per level 0 page, whatever the imagery size.
+class VirtualTexture
+{
+public:
+    VirtualTexture() : Pool(NULL), Shaders(NULL), ShaderGeneration(0), FeedbackProgram(0), CacheTexture(0), PageTable(0),
+                       FeedbackFBO(0), FeedbackColor(0), FeedbackDepth(0), FeedbackWidth(0), FeedbackHeight(0), NextFeedback(0),
+                       Frame(1), Dirty(false), Requests(0), Hits(0), Loads(0), LatencySum(0.0)
+    {
+        for (int i = 0; i < VT_FEEDBACK_FRAMES; i++)
+        {
+            this->FeedbackBuffers[i] = 0;
+            this->FeedbackFences[i] = 0;
+        }
+        this->SavedFramebuffer = 0;
+        std::fill(this->SavedViewport, this->SavedViewport + 4, 0);
+    }
+
+    // Cuts an image into a page file with all its mip levels. The image is loaded whole, so this
+    // runs offline, once per image.
+    static bool Bake(const char* imagePath, const char* pagePath)
+    {
+        int width, height, channels;
+        unsigned char* pixels = SOIL_load_image(imagePath, &width, &height, &channels, SOIL_LOAD_RGB);
+        if (!pixels)
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::IMAGE_NOT_LOADED " << imagePath << std::endl;
+            return false;
+        }
+        std::vector<unsigned char> image(pixels, pixels + size_t(width) * height * 3);
+        SOIL_free_image_data(pixels);
+
+        std::ofstream file(pagePath, std::ios::binary);
+        if (!file)
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::PAGE_FILE_NOT_WRITTEN " << pagePath << std::endl;
+            return false;
+        }
+        PageFileLayout layout;
+        layout.Compute(width, height);
+        PageFileHeader header = { { 'H', 'M', 'V', 'T' }, 1, uint32_t(width), uint32_t(height), uint32_t(layout.Pages), uint32_t(layout.Levels) };
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        std::vector<unsigned char> page(VT_PAGE_BYTES);
+        for (int level = 0; level < layout.Levels; level++)
+        {
+            int w = layout.LevelWidth[level], h = layout.LevelHeight[level];
+            for (int py = 0; py < layout.PagesY[level]; py++)
+            {
+                for (int px = 0; px < layout.PagesX[level]; px++)
+                {
+                    // Texels outside the image repeat its edge
+                    for (int i = 0; i < VT_PAGE_SIZE; i++)
+                    {
+                        int y = std::min(std::max(py * VT_PAGE_CONTENT - VT_PAGE_BORDER + i, 0), h - 1);
+                        for (int j = 0; j < VT_PAGE_SIZE; j++)
+                        {
+                            int x = std::min(std::max(px * VT_PAGE_CONTENT - VT_PAGE_BORDER + j, 0), w - 1);
+                            memcpy(&page[(size_t(i) * VT_PAGE_SIZE + j) * 3], &image[(size_t(y) * w + x) * 3], 3);
+                        }
+                    }
+                    file.write(reinterpret_cast<const char*>(page.data()), page.size());
+                }
+            }
+
+            // Next level: average 2x2 blocks, the last row or column repeats on odd sizes
+            if (level + 1 < layout.Levels)
+            {
+                int nw = layout.LevelWidth[level + 1], nh = layout.LevelHeight[level + 1];
+                std::vector<unsigned char> coarse(size_t(nw) * nh * 3);
+                for (int y = 0; y < nh; y++)
+                {
+                    int y0 = std::min(2 * y, h - 1), y1 = std::min(2 * y + 1, h - 1);
+                    for (int x = 0; x < nw; x++)
+                    {
+                        int x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+                        for (int c = 0; c < 3; c++)
+                        {
+                            int sum = image[(size_t(y0) * w + x0) * 3 + c] + image[(size_t(y0) * w + x1) * 3 + c] +
+                                      image[(size_t(y1) * w + x0) * 3 + c] + image[(size_t(y1) * w + x1) * 3 + c];
+                            coarse[(size_t(y) * nw + x) * 3 + c] = (unsigned char)((sum + 2) / 4);
+                        }
+                    }
+                }
+                image.swap(coarse);
+            }
+        }
+        if (!file)
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::PAGE_FILE_NOT_WRITTEN " << pagePath << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Opens a page file and creates the cache and the page table, needs a current GL 3.3 context
+    bool Open(const std::string& pagePath, ThreadPool& pool, ShaderCache& shaderCache)
+    {
+        std::ifstream file(pagePath, std::ios::binary);
+        PageFileHeader header;
+        if (!file || !file.read(reinterpret_cast<char*>(&header), sizeof(header)) || memcmp(header.Magic, "HMVT", 4) != 0 ||
+            header.Version != 1 || header.Width == 0 || header.Height == 0)
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::NOT_A_PAGE_FILE " << pagePath << std::endl;
+            return false;
+        }
+        this->Path = pagePath;
+        this->Layout.Compute(int(header.Width), int(header.Height));
+        this->Pool = &pool;
+        this->Shaders = &shaderCache;
+        this->ShaderGeneration = shaderCache.Generation;
+        this->FeedbackProgram = shaderCache.Program("shaders/advanced.vs", "shaders/vt_feedback.frag");
+        this->Loader = std::make_shared<LoadQueue>();
+
+        int cacheTexels = VT_CACHE_PAGES * VT_PAGE_SIZE;
+        glGenTextures(1, &this->CacheTexture);
+        glBindTexture(GL_TEXTURE_2D, this->CacheTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, cacheTexels, cacheTexels, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        Resources().Created(RESOURCE_TEXTURE, this->CacheTexture, "virtual texture cache", TextureBytes(cacheTexels, cacheTexels, 4));
+
+        glGenTextures(1, &this->PageTable);
+        glBindTexture(GL_TEXTURE_2D, this->PageTable);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, this->Layout.Levels - 1);
+        for (int level = 0; level < this->Layout.Levels; level++)
+        {
+            int n = this->Layout.Pages >> level;
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, n, n, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            this->Resident.push_back(std::vector<int16_t>(size_t(n) * n, -1));
+            this->Entries.push_back(std::vector<unsigned char>(size_t(n) * n * 4, 0));
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        Resources().Created(RESOURCE_TEXTURE, this->PageTable, "virtual texture page table", TextureBytes(this->Layout.Pages, this->Layout.Pages, 4, true));
+        this->Slots.assign(VT_CACHE_PAGES * VT_CACHE_PAGES, CacheSlot());
+
+        glGenBuffers(VT_FEEDBACK_FRAMES, this->FeedbackBuffers);
+        Resources().Created(RESOURCE_BUFFER, VT_FEEDBACK_FRAMES, this->FeedbackBuffers, "virtual texture feedback readback");
+
+        // The single page of the coarsest level is read now and never evicted
+        LoadedPage root;
+        root.Key = pageKey(this->Layout.Levels - 1, 0, 0);
+        root.Pixels.resize(VT_PAGE_BYTES);
+        file.seekg(std::streamoff(this->Layout.Offset(this->Layout.Levels - 1, 0, 0)));
+        if (!file.read(reinterpret_cast<char*>(root.Pixels.data()), VT_PAGE_BYTES))
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::PAGE_NOT_READ " << pagePath << std::endl;
+            this->Release();
+            return false;
+        }
+        this->PendingSince[root.Key] = Clock::now();
+        this->upload(root);
+        this->Slots[0].Pinned = true;
+        this->LatencySum = 0.0;
+        this->Loads = 0;
+        this->updatePageTable();
+        return true;
+    }
+
+    bool Ready() const
+    {
+        return this->CacheTexture != 0;
+    }
+
+    GLuint Cache() const
+    {
+        return this->CacheTexture;
+    }
+
+    // Deletes the GL objects, must run while the context is still current. Reads still running
+    // on the pool finish into a queue nobody collects.
+    void Release()
+    {
+        if (this->CacheTexture == 0)
+            return;
+        Resources().Deleted(RESOURCE_TEXTURE, this->CacheTexture);
+        Resources().Deleted(RESOURCE_TEXTURE, this->PageTable);
+        glDeleteTextures(1, &this->CacheTexture);
+        glDeleteTextures(1, &this->PageTable);
+        this->releaseFeedbackTarget();
+        for (int i = 0; i < VT_FEEDBACK_FRAMES; i++)
+            if (this->FeedbackFences[i])
+                glDeleteSync(this->FeedbackFences[i]);
+        Resources().Deleted(RESOURCE_BUFFER, VT_FEEDBACK_FRAMES, this->FeedbackBuffers);
+        glDeleteBuffers(VT_FEEDBACK_FRAMES, this->FeedbackBuffers);
+        this->CacheTexture = 0;
+    }
+
+    // Starts the feedback pass for a frame of the given size and returns the location of the model
+    // matrix. The caller draws the virtually textured geometry, then calls EndFeedback.
+    GLint BeginFeedback(int frameWidth, int frameHeight, const glm::mat4& view, const glm::mat4& projection)
+    {
+        // Pick up a program rebuilt by a shader reload
+        if (this->Shaders->Generation != this->ShaderGeneration)
+        {
+            this->ShaderGeneration = this->Shaders->Generation;
+            this->FeedbackProgram = this->Shaders->Program("shaders/advanced.vs", "shaders/vt_feedback.frag");
+        }
+        int width = std::max(1, frameWidth / VT_FEEDBACK_DIVISOR), height = std::max(1, frameHeight / VT_FEEDBACK_DIVISOR);
+        if (width != this->FeedbackWidth || height != this->FeedbackHeight)
+            this->createFeedbackTarget(width, height);
+
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &this->SavedFramebuffer);
+        glGetIntegerv(GL_VIEWPORT, this->SavedViewport);
+        glBindFramebuffer(GL_FRAMEBUFFER, this->FeedbackFBO);
+        glViewport(0, 0, width, height);
+        // Alpha 0 marks pixels that need no page
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glUseProgram(this->FeedbackProgram);
+        glUniformMatrix4fv(glGetUniformLocation(this->FeedbackProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(this->FeedbackProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        // Derivatives are VT_FEEDBACK_DIVISOR times larger than in the frame
+        glUniform1f(glGetUniformLocation(this->FeedbackProgram, "lodBias"), -std::log2(GLfloat(VT_FEEDBACK_DIVISOR)));
+        this->setLayoutUniforms(this->FeedbackProgram);
+        return glGetUniformLocation(this->FeedbackProgram, "model");
+    }
+
+    // Starts reading the feedback back and restores the previous framebuffer
+    void EndFeedback()
+    {
+        int slot = this->NextFeedback;
+        // Still not collected: drop it, a newer one is about to take its place
+        if (this->FeedbackFences[slot])
+        {
+            glDeleteSync(this->FeedbackFences[slot]);
+            this->FeedbackFences[slot] = 0;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, this->FeedbackBuffers[slot]);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, this->FeedbackWidth, this->FeedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        this->FeedbackFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        this->NextFeedback = (slot + 1) % VT_FEEDBACK_FRAMES;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, GLuint(this->SavedFramebuffer));
+        glViewport(this->SavedViewport[0], this->SavedViewport[1], this->SavedViewport[2], this->SavedViewport[3]);
+    }
+
+    // Once per frame: reads the feedback the GPU has finished, starts the missing pages loading,
+    // copies loaded pages into the cache and refreshes the page table
+    void Update()
+    {
+        if (!this->Ready())
+            return;
+        this->Frame++;
+        for (int i = 0; i < VT_FEEDBACK_FRAMES; i++)
+        {
+            int slot = (this->NextFeedback + i) % VT_FEEDBACK_FRAMES;
+            if (this->FeedbackFences[slot] &&
+                glClientWaitSync(this->FeedbackFences[slot], 0, 0) != GL_TIMEOUT_EXPIRED)
+            {
+                glDeleteSync(this->FeedbackFences[slot]);
+                this->FeedbackFences[slot] = 0;
+                this->readFeedback(slot);
+            }
+        }
+
+        std::vector<LoadedPage> loaded;
+        {
+            std::lock_guard<std::mutex> lock(this->Loader->Mutex);
+            size_t count = std::min<size_t>(this->Loader->Done.size(), VT_UPLOADS_PER_FRAME);
+            loaded.assign(std::make_move_iterator(this->Loader->Done.begin()), std::make_move_iterator(this->Loader->Done.begin() + count));
+            this->Loader->Done.erase(this->Loader->Done.begin(), this->Loader->Done.begin() + count);
+        }
+        for (LoadedPage& page : loaded)
+            this->upload(page);
+        if (this->Dirty)
+            this->updatePageTable();
+    }
+
+    // Sets the uniforms of a program drawn with the VIRTUAL_TEXTURE permutation and binds the page
+    // table. The cache itself is bound as ourTexture1.
+    void SetUniforms(GLuint program)
+    {
+        this->setLayoutUniforms(program);
+        glUniform1i(glGetUniformLocation(program, "pageTable"), 2);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, this->PageTable);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // Statistics since the last reset: share of the pages seen in the feedback that were resident,
+    // and the average time from a page's first request to its upload
+    GLfloat HitRate() const
+    {
+        return this->Requests ? GLfloat(this->Hits) / this->Requests : 1.0f;
+    }
+
+    GLfloat AverageLatencyMilliseconds() const
+    {
+        return this->Loads ? GLfloat(this->LatencySum / this->Loads) : 0.0f;
+    }
+
+    size_t ResidentPages() const
+    {
+        size_t count = 0;
+        for (const CacheSlot& slot : this->Slots)
+            if (slot.Level >= 0)
+                count++;
+        return count;
+    }
+
+    void ResetStatistics()
+    {
+        this->Requests = 0;
+        this->Hits = 0;
+        this->Loads = 0;
+        this->LatencySum = 0.0;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct CacheSlot
+    {
+        int Level, X, Y;
+        uint64_t LastUsed;
+        bool Pinned;
+        CacheSlot() : Level(-1), X(0), Y(0), LastUsed(0), Pinned(false) {}
+    };
+
+    struct LoadedPage
+    {
+        uint64_t Key;
+        std::vector<unsigned char> Pixels;
+    };
+
+    // Filled by the pool, emptied on the main thread. Shared with the reads in flight, so it
+    // outlives the texture if they finish late.
+    struct LoadQueue
+    {
+        std::mutex Mutex;
+        std::vector<LoadedPage> Done;
+    };
+
+    std::string Path;
+    PageFileLayout Layout;
+    ThreadPool* Pool;
+    ShaderCache* Shaders;
+    GLuint ShaderGeneration;
+    GLuint FeedbackProgram;
+    GLuint CacheTexture, PageTable;
+    GLuint FeedbackFBO, FeedbackColor, FeedbackDepth;
+    int FeedbackWidth, FeedbackHeight;
+    GLuint FeedbackBuffers[VT_FEEDBACK_FRAMES];
+    GLsync FeedbackFences[VT_FEEDBACK_FRAMES];
+    int NextFeedback;
+    GLint SavedFramebuffer;
+    GLint SavedViewport[4];
+    // Per level: cache slot of every page or -1, and the page table texels
+    std::vector<std::vector<int16_t>> Resident;
+    std::vector<std::vector<unsigned char>> Entries;
+    std::vector<CacheSlot> Slots;
+    std::shared_ptr<LoadQueue> Loader;
+    // Pages being read, with the time they were first requested
+    std::unordered_map<uint64_t, Clock::time_point> PendingSince;
+    uint64_t Frame;
+    bool Dirty;
+    size_t Requests, Hits, Loads;
+    double LatencySum;
+
+    static uint64_t pageKey(int level, int x, int y)
+    {
+        return (uint64_t(level) << 48) | (uint64_t(y) << 24) | uint64_t(x);
+    }
+
+    static void splitKey(uint64_t key, int& level, int& x, int& y)
+    {
+        level = int(key >> 48);
+        y = int((key >> 24) & 0xFFFFFF);
+        x = int(key & 0xFFFFFF);
+    }
+
+    void setLayoutUniforms(GLuint program)
+    {
+        glUniform1f(glGetUniformLocation(program, "virtualPages"), GLfloat(this->Layout.Pages));
+        glUniform1i(glGetUniformLocation(program, "pageLevels"), this->Layout.Levels);
+        glUniform2f(glGetUniformLocation(program, "imageArea"),
+                    GLfloat(this->Layout.Width) / (this->Layout.Pages * VT_PAGE_CONTENT),
+                    GLfloat(this->Layout.Height) / (this->Layout.Pages * VT_PAGE_CONTENT));
+        glUniform4f(glGetUniformLocation(program, "pageLayout"), GLfloat(VT_PAGE_CONTENT), GLfloat(VT_PAGE_BORDER),
+                    GLfloat(VT_PAGE_SIZE), GLfloat(VT_CACHE_PAGES * VT_PAGE_SIZE));
+    }
+
+    void releaseFeedbackTarget()
+    {
+        if (this->FeedbackFBO == 0)
+            return;
+        Resources().Deleted(RESOURCE_FRAMEBUFFER, this->FeedbackFBO);
+        Resources().Deleted(RESOURCE_RENDERBUFFER, this->FeedbackColor);
+        Resources().Deleted(RESOURCE_RENDERBUFFER, this->FeedbackDepth);
+        glDeleteFramebuffers(1, &this->FeedbackFBO);
+        glDeleteRenderbuffers(1, &this->FeedbackColor);
+        glDeleteRenderbuffers(1, &this->FeedbackDepth);
+        this->FeedbackFBO = 0;
+    }
+
+    void createFeedbackTarget(int width, int height)
+    {
+        this->releaseFeedbackTarget();
+        // Readbacks of the old size are dropped
+        for (int i = 0; i < VT_FEEDBACK_FRAMES; i++)
+        {
+            if (this->FeedbackFences[i])
+                glDeleteSync(this->FeedbackFences[i]);
+            this->FeedbackFences[i] = 0;
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, this->FeedbackBuffers[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, size_t(width) * height * 4, NULL, GL_STREAM_READ);
+            Resources().Resized(RESOURCE_BUFFER, this->FeedbackBuffers[i], size_t(width) * height * 4);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        this->FeedbackWidth = width;
+        this->FeedbackHeight = height;
+        glGenFramebuffers(1, &this->FeedbackFBO);
+        glGenRenderbuffers(1, &this->FeedbackColor);
+        glGenRenderbuffers(1, &this->FeedbackDepth);
+        Resources().Created(RESOURCE_FRAMEBUFFER, this->FeedbackFBO, "virtual texture feedback");
+        Resources().Created(RESOURCE_RENDERBUFFER, this->FeedbackColor, "virtual texture feedback color", size_t(width) * height * 4);
+        Resources().Created(RESOURCE_RENDERBUFFER, this->FeedbackDepth, "virtual texture feedback depth", size_t(width) * height * 4);
+        glBindRenderbuffer(GL_RENDERBUFFER, this->FeedbackColor);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, this->FeedbackDepth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, this->FeedbackFBO);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, this->FeedbackColor);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, this->FeedbackDepth);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::VIRTUAL_TEXTURE::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Turns one feedback frame into page requests
+    void readFeedback(int slot)
+    {
+        size_t texels = size_t(this->FeedbackWidth) * this->FeedbackHeight;
+        std::vector<uint64_t> keys;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, this->FeedbackBuffers[slot]);
+        const unsigned char* mapped = static_cast<const unsigned char*>(
+            glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, texels * 4, GL_MAP_READ_BIT));
+        if (mapped)
+        {
+            // r, g: low bits of the page x and y, b: their high bits, a: level + 1
+            for (size_t t = 0; t < texels; t++)
+            {
+                const unsigned char* texel = mapped + t * 4;
+                if (texel[3] == 0)
+                    continue;
+                int x = texel[0] | ((texel[2] & 0x0F) << 8), y = texel[1] | ((texel[2] >> 4) << 8);
+                keys.push_back(pageKey(texel[3] - 1, x, y));
+            }
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+        // Missing pages and their missing ancestors, loaded coarsest first so the closest
+        // fallback arrives soonest
+        std::vector<uint64_t> missing;
+        for (uint64_t key : keys)
+        {
+            int level, x, y;
+            splitKey(key, level, x, y);
+            if (!this->Layout.Stored(level, x, y))
+                continue;
+            this->Requests++;
+            int16_t cacheSlot = this->Resident[level][size_t(y) * (this->Layout.Pages >> level) + x];
+            if (cacheSlot >= 0)
+            {
+                this->Hits++;
+                this->Slots[cacheSlot].LastUsed = this->Frame;
+                continue;
+            }
+            for (; level < this->Layout.Levels; level++, x /= 2, y /= 2)
+            {
+                cacheSlot = this->Resident[level][size_t(y) * (this->Layout.Pages >> level) + x];
+                if (cacheSlot >= 0)
+                {
+                    this->Slots[cacheSlot].LastUsed = this->Frame;
+                    break;
+                }
+                missing.push_back(pageKey(level, x, y));
+            }
+        }
+        std::sort(missing.begin(), missing.end(), [](uint64_t a, uint64_t b) { return a > b; });
+        missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+        for (uint64_t key : missing)
+        {
+            if (this->PendingSince.size() >= size_t(VT_MAX_LOADS))
+                break;
+            if (this->PendingSince.count(key))
+                continue;
+            this->PendingSince[key] = Clock::now();
+            this->load(key);
+        }
+    }
+
+    // Reads a page on the pool
+    void load(uint64_t key)
+    {
+        int level, x, y;
+        splitKey(key, level, x, y);
+        std::string path = this->Path;
+        uint64_t offset = this->Layout.Offset(level, x, y);
+        std::shared_ptr<LoadQueue> queue = this->Loader;
+        this->Pool->Submit([path, offset, key, queue]
+        {
+            LoadedPage page;
+            page.Key = key;
+            page.Pixels.resize(VT_PAGE_BYTES);
+            std::ifstream file(path, std::ios::binary);
+            file.seekg(std::streamoff(offset));
+            if (!file.read(reinterpret_cast<char*>(page.Pixels.data()), VT_PAGE_BYTES))
+                page.Pixels.clear();
+            std::lock_guard<std::mutex> lock(queue->Mutex);
+            queue->Done.push_back(std::move(page));
+        });
+    }
+
+    // Copies a loaded page into the least recently used slot not seen this frame
+    void upload(const LoadedPage& page)
+    {
+        auto pending = this->PendingSince.find(page.Key);
+        if (pending == this->PendingSince.end())
+            return;
+        Clock::time_point requested = pending->second;
+        this->PendingSince.erase(pending);
+        if (page.Pixels.empty())
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::PAGE_NOT_READ " << this->Path << std::endl;
+            return;
+        }
+
+        int victim = -1;
+        for (int s = 0; s < int(this->Slots.size()); s++)
+        {
+            const CacheSlot& slot = this->Slots[s];
+            if (slot.Level < 0)
+            {
+                victim = s;
+                break;
+            }
+            if (!slot.Pinned && slot.LastUsed < this->Frame && (victim < 0 || slot.LastUsed < this->Slots[victim].LastUsed))
+                victim = s;
+        }
+        // Every slot is in use this frame, the page is requested again later
+        if (victim < 0)
+            return;
+
+        CacheSlot& slot = this->Slots[victim];
+        if (slot.Level >= 0)
+            this->Resident[slot.Level][size_t(slot.Y) * (this->Layout.Pages >> slot.Level) + slot.X] = -1;
+        splitKey(page.Key, slot.Level, slot.X, slot.Y);
+        slot.LastUsed = this->Frame;
+        this->Resident[slot.Level][size_t(slot.Y) * (this->Layout.Pages >> slot.Level) + slot.X] = int16_t(victim);
+        this->Dirty = true;
+
+        glBindTexture(GL_TEXTURE_2D, this->CacheTexture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, (victim % VT_CACHE_PAGES) * VT_PAGE_SIZE, (victim / VT_CACHE_PAGES) * VT_PAGE_SIZE,
+                        VT_PAGE_SIZE, VT_PAGE_SIZE, GL_RGB, GL_UNSIGNED_BYTE, page.Pixels.data());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        this->Loads++;
+        this->LatencySum += std::chrono::duration<double, std::milli>(Clock::now() - requested).count();
+    }
+
+    // Every page table texel: its own slot when resident, else the entry of its parent. The
+    // coarsest level is always resident.
+    void updatePageTable()
+    {
+        glBindTexture(GL_TEXTURE_2D, this->PageTable);
+        for (int level = this->Layout.Levels - 1; level >= 0; level--)
+        {
+            int n = this->Layout.Pages >> level;
+            std::vector<unsigned char>& entries = this->Entries[level];
+            for (int y = 0; y < n; y++)
+            {
+                for (int x = 0; x < n; x++)
+                {
+                    unsigned char* entry = &entries[(size_t(y) * n + x) * 4];
+                    int16_t slot = this->Resident[level][size_t(y) * n + x];
+                    if (slot >= 0)
+                    {
+                        entry[0] = (unsigned char)(slot % VT_CACHE_PAGES);
+                        entry[1] = (unsigned char)(slot / VT_CACHE_PAGES);
+                        entry[2] = (unsigned char)level;
+                        entry[3] = 255;
+                    }
+                    else if (level + 1 < this->Layout.Levels)
+                        memcpy(entry, &this->Entries[level + 1][(size_t(y / 2) * (n / 2) + x / 2) * 4], 4);
+                }
+            }
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, n, n, GL_RGBA, GL_UNSIGNED_BYTE, entries.data());
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        this->Dirty = false;
+    }
+};
@@ -0,0 +1,25 @@
+#version 330 core
+in vec2 TexCoord;
+
+out vec4 color;
+
+// Same layout uniforms as the VIRTUAL_TEXTURE permutation of advanced.frag
+uniform float virtualPages;
+uniform int pageLevels;
+uniform vec2 imageArea;
+uniform vec4 pageLayout;
+// Corrects the level for the feedback pass rendering at a lower resolution than the frame
+uniform float lodBias;
+
+// Writes the page and level this pixel samples: the low bits of x and y in red and green, their
+// high bits in blue, and level + 1 in alpha
+void main()
+{
+    vec2 virtualUv = TexCoord * imageArea;
+    vec2 texels = virtualUv * virtualPages * pageLayout.x;
+    float lod = 0.5 * log2(max(dot(dFdx(texels), dFdx(texels)), dot(dFdy(texels), dFdy(texels)))) + lodBias;
+    int level = clamp(int(floor(lod)), 0, pageLevels - 1);
+    int pages = int(virtualPages) >> level;
+    ivec2 page = min(ivec2(virtualUv * float(pages)), ivec2(pages - 1));
+    color = vec4(float(page.x & 255), float(page.y & 255), float((page.x >> 8) | ((page.y >> 8) << 4)), float(level + 1)) / 255.0;
+}